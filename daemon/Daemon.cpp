@@ -22,6 +22,7 @@
 #include "DotNetControl.h"
 #include "ClientContext.h"
 #include "Crypto.h"
+#include "CryptoWorker.h"
 #include "UPnP.h"
 #include "Timestamp.h"
 #include "util.h"
@@ -132,7 +133,9 @@ namespace dotnet
 			LogPrint(eLogDebug, "FS: data directory: ", datadir);
 
 			bool precomputation; dotnet::config::GetOption("precomputation.elgamal", precomputation);
-			dotnet::crypto::InitCrypto (precomputation);
+			std::string chacha20poly1305; dotnet::config::GetOption("crypto.chacha20poly1305", chacha20poly1305);
+
+			dotnet::crypto::InitCrypto (precomputation, chacha20poly1305 == "builtin");
 
 			int netID; dotnet::config::GetOption("netid", netID);
 			dotnet::context.SetNetID (netID);
@@ -301,6 +304,15 @@ namespace dotnet
 				d.m_NTPSync->Start ();
 			}
 
+			bool elgamalpool; dotnet::config::GetOption("precomputation.elgamalpool", elgamalpool);
+			if (elgamalpool)
+				dotnet::crypto::StartElGamalPool ();
+
+			uint16_t cryptothreads; dotnet::config::GetOption("limits.cryptothreads", cryptothreads);
+			dotnet::worker::cryptoExecutor.Start (cryptothreads);
+			if (!dotnet::config::IsDefault("limits.ntcpthreads"))
+				LogPrint(eLogWarning, "Daemon: limits.ntcpthreads is deprecated and ignored, use limits.cryptothreads");
+
 			bool ntcp; dotnet::config::GetOption("ntcp", ntcp);
 			bool ssu; dotnet::config::GetOption("ssu", ssu);
 			LogPrint(eLogInfo, "Daemon: starting Transports");
@@ -314,6 +326,7 @@ namespace dotnet
 			{
 				LogPrint(eLogError, "Daemon: failed to start Transports");
 				/** shut down netdb right away */
+				dotnet::worker::cryptoExecutor.Stop ();
 				dotnet::transport::transports.Stop();
 				dotnet::data::netdb.Stop();
 				return false;
@@ -369,6 +382,7 @@ namespace dotnet
 			dotnet::client::context.Stop();
 			LogPrint(eLogInfo, "Daemon: stopping Tunnels");
 			dotnet::tunnel::tunnels.Stop();
+			dotnet::crypto::StopElGamalPool ();
 
 			if (d.UPnP) 
 			{
@@ -382,6 +396,7 @@ namespace dotnet
 				d.m_NTPSync = nullptr;
 			}
 
+			dotnet::worker::cryptoExecutor.Stop (); // runs jobs left, they still might use transports
 			LogPrint(eLogInfo, "Daemon: stopping Transports");
 			dotnet::transport::transports.Stop();
 			LogPrint(eLogInfo, "Daemon: stopping NetDB");
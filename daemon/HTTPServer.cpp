@@ -8,6 +8,8 @@
 #include <boost/algorithm/string.hpp>
 
 #include "Base.h"
+#include "Crypto.h"
+#include "CryptoWorker.h"
 #include "FS.h"
 #include "Log.h"
 #include "Config.h"
@@ -115,6 +117,8 @@ namespace http {
 
 	static void ShowTraffic (std::stringstream& s, uint64_t bytes)
 	{
+		auto flags = s.flags ();
+		auto precision = s.precision ();
 		s << std::fixed << std::setprecision(2);
 		auto numKBytes = (double) bytes / 1024;
 		if (numKBytes < 1024)
@@ -123,6 +127,15 @@ namespace http {
 			s << numKBytes / 1024 << " MiB";
 		else
 			s << numKBytes / 1024 / 1024 << " GiB";
+		s.flags (flags);
+		s.precision (precision);
+	}
+
+	static void ShowLatency (std::stringstream& s, int microseconds)
+	{
+		std::stringstream tmp; // keep page's formatting
+		tmp << std::fixed << std::setprecision(2) << microseconds / 1000.0 << " ms latency";
+		s << tmp.str ();
 	}
 
 	static void ShowTunnelDetails (std::stringstream& s, enum dotnet::tunnel::TunnelState eState, bool explr, int bytes)
@@ -306,7 +319,28 @@ namespace http {
 		size_t transitTunnelCount = dotnet::tunnel::tunnels.CountTransitTunnels();
 
 		s << "<b>Client Tunnels:</b> " << std::to_string(clientTunnelCount) << " ";
-		s << "<b>Transit Tunnels:</b> " << std::to_string(transitTunnelCount) << "<br>\r\n<br>\r\n";
+		s << "<b>Transit Tunnels:</b> " << std::to_string(transitTunnelCount) << "<br>\r\n";
+		s << "<b>Build requests:</b> " << dotnet::tunnel::tunnels.GetBuildRequestQueueSize () << " queued, ";
+		ShowLatency (s, dotnet::tunnel::tunnels.GetBuildRequestLatency ());
+		s << "<br>\r\n";
+		auto& cryptoExecutor = dotnet::worker::cryptoExecutor;
+		if (cryptoExecutor.IsRunning ())
+		{
+			s << "<b>Crypto workers:</b> " << cryptoExecutor.GetNumWorkers () << ", " << cryptoExecutor.GetQueueSize () << " queued, ";
+			ShowLatency (s, cryptoExecutor.GetLatency ());
+			s << "<br>\r\n";
+		}
+		auto ntcp2Server = dotnet::transport::transports.GetNTCP2Server ();
+		if (ntcp2Server)
+			s << "<b>NTCP2 threads:</b> " << ntcp2Server->GetNumThreads () << "<br>\r\n";
+		auto ssuServer = dotnet::transport::transports.GetSSUServer ();
+		if (ssuServer)
+			s << "<b>SSU threads:</b> " << ssuServer->GetNumThreads () << "<br>\r\n";
+
+		auto poolStats = dotnet::GetDNNPMessagePoolStats ();
+		s << "<b>Message pool:</b> " << poolStats.hits << " hits, " << poolStats.misses << " misses, ";
+		ShowTraffic (s, poolStats.bytesHeld);
+		s << " held<br>\r\n<br>\r\n";
 
         if(outputFormat==OutputFormatEnum::forWebConsole) {
             s << "<table><caption>Services</caption><tr><th>Service</th><th>State</th></tr>\r\n";
@@ -318,6 +352,10 @@ namespace http {
             bool dotnetcontrol; dotnet::config::GetOption("dotnetcontrol.enabled", dotnetcontrol);
             s << "<tr><td>" << "DotNetControl"		<< "</td><td><div class='" << ((dotnetcontrol) 									? "enabled" : "disabled") << "'></div></td></tr>\r\n";
             s << "</table>\r\n";
+            s << "<table><caption>Crypto</caption><tr><th>Primitive</th><th>Implementation</th></tr>\r\n";
+            for (const auto& it: dotnet::crypto::GetCryptoKernels ())
+                s << "<tr><td>" << it.first << "</td><td>" << it.second << "</td></tr>\r\n";
+            s << "</table>\r\n";
         }
 	}
 
@@ -1,5 +1,6 @@
+#include <inttypes.h>
 #include "CPU.h"
-#if defined(__x86_64__) || defined(__i386__)
+#ifdef X86_DISPATCH
 #include <cpuid.h>
 #endif
 #include "Log.h"
@@ -10,6 +11,21 @@
 #ifndef bit_AVX
 #define bit_AVX (1 << 28)
 #endif
+#ifndef bit_OSXSAVE
+#define bit_OSXSAVE (1 << 27)
+#endif
+#ifndef bit_AVX2
+#define bit_AVX2 (1 << 5)
+#endif
+#ifndef bit_AVX512F
+#define bit_AVX512F (1 << 16)
+#endif
+#ifndef bit_VAES
+#define bit_VAES (1 << 9)
+#endif
+#ifndef bit_SHA
+#define bit_SHA (1 << 29)
+#endif
 
 
 namespace dotnet
@@ -18,38 +34,73 @@ namespace cpu
 {
 	bool aesni = false;
 	bool avx = false;
+	bool avx2 = false;
+	bool avx512 = false;
+	bool vaes = false;
+	bool sha = false;
 
-	void Detect()
+#ifdef X86_DISPATCH
+	static uint64_t GetXCR0 ()
 	{
-#if defined(__AES__) || defined(__AVX__)
+		uint32_t eax, edx;
+		__asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((uint64_t)edx << 32) | eax;
+	}
+#endif
 
-#if defined(__x86_64__) || defined(__i386__)
+	void Detect()
+	{
+#ifdef X86_DISPATCH
 		int info[4];
 		__cpuid(0, info[0], info[1], info[2], info[3]);
-		if (info[0] >= 0x00000001) {
+		int maxLeaf = info[0];
+		if (maxLeaf >= 0x00000001) {
 			__cpuid(0x00000001, info[0], info[1], info[2], info[3]);
-#ifdef __AES__
 			aesni = info[2] & bit_AES;  // AESNI
-#endif  // __AES__
-#ifdef __AVX__
-			avx = info[2] & bit_AVX;  // AVX
-#endif  // __AVX__
+			// wide registers are usable only if OS saves them
+			bool ymm = false, zmm = false;
+			if (info[2] & bit_OSXSAVE)
+			{
+				uint64_t xcr0 = GetXCR0 ();
+				ymm = (xcr0 & 0x06) == 0x06; // xmm and ymm
+				zmm = ymm && (xcr0 & 0xE0) == 0xE0; // opmask and zmm
+			}
+			avx = ymm && (info[2] & bit_AVX);  // AVX
+			if (maxLeaf >= 0x00000007)
+			{
+				__cpuid_count(0x00000007, 0, info[0], info[1], info[2], info[3]);
+				avx2 = avx && (info[1] & bit_AVX2);
+				avx512 = zmm && (info[1] & bit_AVX512F);
+				vaes = avx2 && (info[2] & bit_VAES);
+				sha = info[1] & bit_SHA;
+			}
 		}
-#endif  // defined(__x86_64__) || defined(__i386__)
+#endif  // X86_DISPATCH
 
-#ifdef __AES__
 		if(aesni)
 		{
 			LogPrint(eLogInfo, "AESNI enabled");
 		}
-#endif  // __AES__
-#ifdef __AVX__
 		if(avx)
 		{
 			LogPrint(eLogInfo, "AVX enabled");
 		}
-#endif  // __AVX__
-#endif  // defined(__AES__) || defined(__AVX__)
+		if(avx2)
+		{
+			LogPrint(eLogInfo, "AVX2 enabled");
+		}
+		if(avx512)
+		{
+			LogPrint(eLogInfo, "AVX-512 enabled");
+		}
+		if(vaes)
+		{
+			LogPrint(eLogInfo, "VAES enabled");
+		}
+		if(sha)
+		{
+			LogPrint(eLogInfo, "SHA-NI enabled");
+		}
 	}
 }
 }
@@ -1,12 +1,22 @@
 #ifndef LIBDOTNET_CPU_H
 #define LIBDOTNET_CPU_H
 
+// x86 kernels are always built, whatever -m flags are, and Detect() tells which of them can run
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define X86_DISPATCH
+#endif
+
 namespace dotnet
 {
 namespace cpu
 {
   extern bool aesni;
   extern bool avx;
+  extern bool avx2;
+  extern bool avx512; // AVX-512F
+  extern bool vaes; // with avx2, 512 bit with avx512
+  extern bool sha; // SHA-NI
 
   void Detect();
 }
@@ -12,7 +12,11 @@
 #include "DotNetEndian.h"
 #include "ChaCha20.h"
 
-#if !OPENSSL_AEAD_CHACHA20_POLY1305 
+#if defined(X86_DISPATCH) && defined(__x86_64__)
+#define CHACHA20_SIMD // SSE2 is always there, AVX2 if detected
+#include <immintrin.h>
+#endif
+
 namespace dotnet
 {
 namespace crypto
@@ -81,6 +85,129 @@ void block (Chacha20State &input, int rounds)
 
 }
 
+#ifdef CHACHA20_SIMD
+// 4 or 8 blocks at once, vector i holds word i of every block
+
+#define CHACHA20_ROTL_SSE2(x, n) _mm_or_si128 (_mm_slli_epi32 (x, n), _mm_srli_epi32 (x, 32 - n))
+#define CHACHA20_QR_SSE2(a, b, c, d) \
+	a = _mm_add_epi32 (a, b); d = CHACHA20_ROTL_SSE2 (_mm_xor_si128 (d, a), 16); \
+	c = _mm_add_epi32 (c, d); b = CHACHA20_ROTL_SSE2 (_mm_xor_si128 (b, c), 12); \
+	a = _mm_add_epi32 (a, b); d = CHACHA20_ROTL_SSE2 (_mm_xor_si128 (d, a), 8); \
+	c = _mm_add_epi32 (c, d); b = CHACHA20_ROTL_SSE2 (_mm_xor_si128 (b, c), 7);
+// words 4j..4j+3 of 4 blocks to rows, xor with buf
+#define CHACHA20_XOR4_SSE2(j, a, b, c, d) \
+	{ \
+		__m128i t0 = _mm_unpacklo_epi32 (a, b), t1 = _mm_unpacklo_epi32 (c, d); \
+		__m128i t2 = _mm_unpackhi_epi32 (a, b), t3 = _mm_unpackhi_epi32 (c, d); \
+		__m128i * p = (__m128i *)buf + j; \
+		_mm_storeu_si128 (p, _mm_xor_si128 (_mm_loadu_si128 (p), _mm_unpacklo_epi64 (t0, t1))); \
+		_mm_storeu_si128 (p + 4, _mm_xor_si128 (_mm_loadu_si128 (p + 4), _mm_unpackhi_epi64 (t0, t1))); \
+		_mm_storeu_si128 (p + 8, _mm_xor_si128 (_mm_loadu_si128 (p + 8), _mm_unpacklo_epi64 (t2, t3))); \
+		_mm_storeu_si128 (p + 12, _mm_xor_si128 (_mm_loadu_si128 (p + 12), _mm_unpackhi_epi64 (t2, t3))); \
+	}
+
+__attribute__((target("sse2")))
+static void Chacha20XorBlocksSSE2 (Chacha20State& state, uint8_t * buf) // 4 blocks
+{
+	const uint32_t * s = state.data;
+	__m128i x0 = _mm_set1_epi32 (s[0]), x1 = _mm_set1_epi32 (s[1]), x2 = _mm_set1_epi32 (s[2]), x3 = _mm_set1_epi32 (s[3]),
+		x4 = _mm_set1_epi32 (s[4]), x5 = _mm_set1_epi32 (s[5]), x6 = _mm_set1_epi32 (s[6]), x7 = _mm_set1_epi32 (s[7]),
+		x8 = _mm_set1_epi32 (s[8]), x9 = _mm_set1_epi32 (s[9]), x10 = _mm_set1_epi32 (s[10]), x11 = _mm_set1_epi32 (s[11]),
+		x12 = _mm_add_epi32 (_mm_set1_epi32 (s[12]), _mm_set_epi32 (3, 2, 1, 0)),
+		x13 = _mm_set1_epi32 (s[13]), x14 = _mm_set1_epi32 (s[14]), x15 = _mm_set1_epi32 (s[15]);
+	const __m128i counters = x12;
+	for (int i = 0; i < rounds; i += 2)
+	{
+		CHACHA20_QR_SSE2 (x0, x4, x8, x12)
+		CHACHA20_QR_SSE2 (x1, x5, x9, x13)
+		CHACHA20_QR_SSE2 (x2, x6, x10, x14)
+		CHACHA20_QR_SSE2 (x3, x7, x11, x15)
+		CHACHA20_QR_SSE2 (x0, x5, x10, x15)
+		CHACHA20_QR_SSE2 (x1, x6, x11, x12)
+		CHACHA20_QR_SSE2 (x2, x7, x8, x13)
+		CHACHA20_QR_SSE2 (x3, x4, x9, x14)
+	}
+	x0 = _mm_add_epi32 (x0, _mm_set1_epi32 (s[0])); x1 = _mm_add_epi32 (x1, _mm_set1_epi32 (s[1]));
+	x2 = _mm_add_epi32 (x2, _mm_set1_epi32 (s[2])); x3 = _mm_add_epi32 (x3, _mm_set1_epi32 (s[3]));
+	x4 = _mm_add_epi32 (x4, _mm_set1_epi32 (s[4])); x5 = _mm_add_epi32 (x5, _mm_set1_epi32 (s[5]));
+	x6 = _mm_add_epi32 (x6, _mm_set1_epi32 (s[6])); x7 = _mm_add_epi32 (x7, _mm_set1_epi32 (s[7]));
+	x8 = _mm_add_epi32 (x8, _mm_set1_epi32 (s[8])); x9 = _mm_add_epi32 (x9, _mm_set1_epi32 (s[9]));
+	x10 = _mm_add_epi32 (x10, _mm_set1_epi32 (s[10])); x11 = _mm_add_epi32 (x11, _mm_set1_epi32 (s[11]));
+	x12 = _mm_add_epi32 (x12, counters); x13 = _mm_add_epi32 (x13, _mm_set1_epi32 (s[13]));
+	x14 = _mm_add_epi32 (x14, _mm_set1_epi32 (s[14])); x15 = _mm_add_epi32 (x15, _mm_set1_epi32 (s[15]));
+	CHACHA20_XOR4_SSE2 (0, x0, x1, x2, x3)
+	CHACHA20_XOR4_SSE2 (1, x4, x5, x6, x7)
+	CHACHA20_XOR4_SSE2 (2, x8, x9, x10, x11)
+	CHACHA20_XOR4_SSE2 (3, x12, x13, x14, x15)
+	state.data[12] += 4;
+}
+
+#define CHACHA20_ROTL_AVX2(x, n) _mm256_or_si256 (_mm256_slli_epi32 (x, n), _mm256_srli_epi32 (x, 32 - n))
+#define CHACHA20_QR_AVX2(a, b, c, d) \
+	a = _mm256_add_epi32 (a, b); d = _mm256_shuffle_epi8 (_mm256_xor_si256 (d, a), rot16); \
+	c = _mm256_add_epi32 (c, d); b = CHACHA20_ROTL_AVX2 (_mm256_xor_si256 (b, c), 12); \
+	a = _mm256_add_epi32 (a, b); d = _mm256_shuffle_epi8 (_mm256_xor_si256 (d, a), rot8); \
+	c = _mm256_add_epi32 (c, d); b = CHACHA20_ROTL_AVX2 (_mm256_xor_si256 (b, c), 7);
+// words 4j..4j+3 of blocks 0-3 in low lanes and of blocks 4-7 in high lanes
+#define CHACHA20_TRANSPOSE4_AVX2(a, b, c, d) \
+	{ \
+		__m256i t0 = _mm256_unpacklo_epi32 (a, b), t1 = _mm256_unpacklo_epi32 (c, d); \
+		__m256i t2 = _mm256_unpackhi_epi32 (a, b), t3 = _mm256_unpackhi_epi32 (c, d); \
+		a = _mm256_unpacklo_epi64 (t0, t1); b = _mm256_unpackhi_epi64 (t0, t1); \
+		c = _mm256_unpacklo_epi64 (t2, t3); d = _mm256_unpackhi_epi64 (t2, t3); \
+	}
+// 32 bytes of block k, and of block k+4 at p + 8
+#define CHACHA20_XOR2_AVX2(p, lo, hi) \
+	_mm256_storeu_si256 (p, _mm256_xor_si256 (_mm256_loadu_si256 (p), _mm256_permute2x128_si256 (lo, hi, 0x20))); \
+	_mm256_storeu_si256 (p + 8, _mm256_xor_si256 (_mm256_loadu_si256 (p + 8), _mm256_permute2x128_si256 (lo, hi, 0x31)));
+
+__attribute__((target("avx2")))
+static void Chacha20XorBlocksAVX2 (Chacha20State& state, uint8_t * buf) // 8 blocks
+{
+	const uint32_t * s = state.data;
+	const __m256i rot16 = _mm256_set_epi8 (13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	const __m256i rot8 = _mm256_set_epi8 (14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+		14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+	__m256i x0 = _mm256_set1_epi32 (s[0]), x1 = _mm256_set1_epi32 (s[1]), x2 = _mm256_set1_epi32 (s[2]), x3 = _mm256_set1_epi32 (s[3]),
+		x4 = _mm256_set1_epi32 (s[4]), x5 = _mm256_set1_epi32 (s[5]), x6 = _mm256_set1_epi32 (s[6]), x7 = _mm256_set1_epi32 (s[7]),
+		x8 = _mm256_set1_epi32 (s[8]), x9 = _mm256_set1_epi32 (s[9]), x10 = _mm256_set1_epi32 (s[10]), x11 = _mm256_set1_epi32 (s[11]),
+		x12 = _mm256_add_epi32 (_mm256_set1_epi32 (s[12]), _mm256_set_epi32 (7, 6, 5, 4, 3, 2, 1, 0)),
+		x13 = _mm256_set1_epi32 (s[13]), x14 = _mm256_set1_epi32 (s[14]), x15 = _mm256_set1_epi32 (s[15]);
+	const __m256i counters = x12;
+	for (int i = 0; i < rounds; i += 2)
+	{
+		CHACHA20_QR_AVX2 (x0, x4, x8, x12)
+		CHACHA20_QR_AVX2 (x1, x5, x9, x13)
+		CHACHA20_QR_AVX2 (x2, x6, x10, x14)
+		CHACHA20_QR_AVX2 (x3, x7, x11, x15)
+		CHACHA20_QR_AVX2 (x0, x5, x10, x15)
+		CHACHA20_QR_AVX2 (x1, x6, x11, x12)
+		CHACHA20_QR_AVX2 (x2, x7, x8, x13)
+		CHACHA20_QR_AVX2 (x3, x4, x9, x14)
+	}
+	x0 = _mm256_add_epi32 (x0, _mm256_set1_epi32 (s[0])); x1 = _mm256_add_epi32 (x1, _mm256_set1_epi32 (s[1]));
+	x2 = _mm256_add_epi32 (x2, _mm256_set1_epi32 (s[2])); x3 = _mm256_add_epi32 (x3, _mm256_set1_epi32 (s[3]));
+	x4 = _mm256_add_epi32 (x4, _mm256_set1_epi32 (s[4])); x5 = _mm256_add_epi32 (x5, _mm256_set1_epi32 (s[5]));
+	x6 = _mm256_add_epi32 (x6, _mm256_set1_epi32 (s[6])); x7 = _mm256_add_epi32 (x7, _mm256_set1_epi32 (s[7]));
+	x8 = _mm256_add_epi32 (x8, _mm256_set1_epi32 (s[8])); x9 = _mm256_add_epi32 (x9, _mm256_set1_epi32 (s[9]));
+	x10 = _mm256_add_epi32 (x10, _mm256_set1_epi32 (s[10])); x11 = _mm256_add_epi32 (x11, _mm256_set1_epi32 (s[11]));
+	x12 = _mm256_add_epi32 (x12, counters); x13 = _mm256_add_epi32 (x13, _mm256_set1_epi32 (s[13]));
+	x14 = _mm256_add_epi32 (x14, _mm256_set1_epi32 (s[14])); x15 = _mm256_add_epi32 (x15, _mm256_set1_epi32 (s[15]));
+	CHACHA20_TRANSPOSE4_AVX2 (x0, x1, x2, x3)
+	CHACHA20_TRANSPOSE4_AVX2 (x4, x5, x6, x7)
+	CHACHA20_TRANSPOSE4_AVX2 (x8, x9, x10, x11)
+	CHACHA20_TRANSPOSE4_AVX2 (x12, x13, x14, x15)
+	// now xk, x(k+4), x(k+8), x(k+12) are rows of blocks k and k+4
+	__m256i * p = (__m256i *)buf;
+	CHACHA20_XOR2_AVX2 (p, x0, x4) CHACHA20_XOR2_AVX2 (p + 1, x8, x12)
+	CHACHA20_XOR2_AVX2 (p + 2, x1, x5) CHACHA20_XOR2_AVX2 (p + 3, x9, x13)
+	CHACHA20_XOR2_AVX2 (p + 4, x2, x6) CHACHA20_XOR2_AVX2 (p + 5, x10, x14)
+	CHACHA20_XOR2_AVX2 (p + 6, x3, x7) CHACHA20_XOR2_AVX2 (p + 7, x11, x15)
+	state.data[12] += 8;
+}
+#endif
+
 void Chacha20Init (Chacha20State& state, const uint8_t * nonce, const uint8_t * key, uint32_t counter)
 {
 	state.data[0] = 0x61707865;
@@ -115,6 +242,13 @@ void Chacha20Encrypt (Chacha20State& state, uint8_t * buf, size_t sz)
 		state.offset += s;
 		if (state.offset >= chacha::blocksize) state.offset = 0;	
 	}
+#ifdef CHACHA20_SIMD
+	if (dotnet::cpu::avx2)
+		for (; sz >= 8*chacha::blocksize; buf += 8*chacha::blocksize, sz -= 8*chacha::blocksize)
+			Chacha20XorBlocksAVX2 (state, buf);
+	for (; sz >= 4*chacha::blocksize; buf += 4*chacha::blocksize, sz -= 4*chacha::blocksize)
+		Chacha20XorBlocksSSE2 (state, buf);
+#endif
 	for (size_t i = 0; i < sz; i += chacha::blocksize) 
 	{
 	    chacha::block(state, chacha::rounds);
@@ -134,5 +268,3 @@ void Chacha20Encrypt (Chacha20State& state, uint8_t * buf, size_t sz)
 
 }
 }
-#endif
-
@@ -16,7 +16,6 @@
 #include <string.h>
 #include "Crypto.h"
 
-#if !OPENSSL_AEAD_CHACHA20_POLY1305
 namespace dotnet
 {
 namespace crypto
@@ -67,6 +66,5 @@ namespace chacha
 }
 } 
 }
-#endif
 
 #endif
@@ -75,7 +75,11 @@ namespace config {
 			("limits.transittunnels", value<uint16_t>()->default_value(2500), "Maximum active transit sessions (default:2500)")
 			("limits.ntcpsoft", value<uint16_t>()->default_value(0),          "Threshold to start probabilistic backoff with ntcp sessions (default: use system limit)")
 			("limits.ntcphard", value<uint16_t>()->default_value(0),          "Maximum number of ntcp sessions (default: use system limit)")
-			("limits.ntcpthreads", value<uint16_t>()->default_value(1),       "Maximum number of threads used by NTCP DH worker (default: 1)")
+			("limits.ntcpthreads", value<uint16_t>()->default_value(1),       "Deprecated and ignored, NTCP DH runs on crypto workers, see limits.cryptothreads")
+			("limits.ntcp2threads", value<uint16_t>()->default_value(1),      "Number of threads handling NTCP2 sessions (0 - one per CPU core, default: 1)")
+			("limits.ssuthreads", value<uint16_t>()->default_value(1),        "Number of threads handling SSU v4 sessions, Linux only (0 - one per CPU core, default: 1)")
+			("limits.tunnelthreads", value<uint16_t>()->default_value(1),     "Number of threads handling tunnel data messages (default: 1)")
+			("limits.cryptothreads", value<uint16_t>()->default_value(1),     "Number of shared crypto worker threads (0 - crypto runs in caller's thread, default: 1)")
 		;
 
 		options_description httpserver("HTTP Server options");
@@ -169,13 +173,13 @@ namespace config {
 
 		options_description precomputation("Precomputation options");
 		precomputation.add_options()
-			("precomputation.elgamal",
-#if defined(__x86_64__)
-				value<bool>()->default_value(false),
-#else
-				value<bool>()->default_value(true),
-#endif
-				"Enable or disable elgamal precomputation table")
+			("precomputation.elgamal", value<bool>()->default_value(true), "Enable or disable elgamal precomputation table")
+			("precomputation.elgamalpool", value<bool>()->default_value(true), "Precompute ElGamal exponents in background thread")
+		;
+
+		options_description crypto("Crypto options");
+		crypto.add_options()
+			("crypto.chacha20poly1305", value<std::string>()->default_value("openssl"), "ChaCha20-Poly1305 implementation: openssl, builtin (default: openssl)")
 		;
 
 		options_description reseed("Reseed options");
@@ -246,6 +250,7 @@ namespace config {
 		persist.add_options()
 			("persist.profiles", value<bool>()->default_value(true), "Persist peer profiles (default: true)")
 			("persist.addressbook", value<bool>()->default_value(true), "Persist full addresses (default: true)")
+			("persist.netdbstore", value<std::string>()->default_value("files"), "Store RouterInfos in 'files' or 'single' mapped file (default: files)")
 		;
 
 		m_OptionsDesc
@@ -260,6 +265,7 @@ namespace config {
 			.add(dotnetcontrol)
 			.add(upnp)
 			.add(precomputation)
+			.add(crypto)
 			.add(reseed)
 			.add(addressbook)
 			.add(trust)
@@ -2,8 +2,21 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <openssl/dh.h>
+#include "CPU.h"
+#ifdef X86_DISPATCH
+#include <wmmintrin.h>
+#endif
+#if defined(X86_DISPATCH) && defined(__x86_64__) && \
+	((defined(__clang__) && __clang_major__ >= 6) || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 8))
+#define WIDE_AES // VAES kernels are built with target attribute and selected at runtime
+#include <immintrin.h>
+#endif
 #include <openssl/md5.h>
 #include <openssl/crypto.h>
 #include "TunnelBase.h"
@@ -11,11 +24,10 @@
 #if OPENSSL_HKDF
 #include <openssl/kdf.h>
 #endif
-#if !OPENSSL_AEAD_CHACHA20_POLY1305
 #include "ChaCha20.h"
 #include "Poly1305.h"
-#endif
 #include "Crypto.h"
+#include "SHA256.h"
 #include "Ed25519.h"
 #include "DotNetEndian.h"
 #include "Log.h"
@@ -159,77 +171,253 @@ namespace crypto
 	#define elgp GetCryptoConstants ().elgp
 	#define elgg GetCryptoConstants ().elgg
 
+	// fixed-base table: g^(j*2^(w*i)) in Montgomery form for every w-bit window i of exponent and j = 1..2^w-1
+#if defined(__x86_64__)
+	const int ELGG_TABLE_WINDOW_BITS = 4; // 512 windows of 15 for full exponent, 2M
+	const int ELGG_TABLE_NUM_BYTES = ELGAMAL_FULL_EXPONENT_NUM_BYTES;
+#else
+	const int ELGG_TABLE_WINDOW_BITS = 8; // 29 windows of 255 for short exponent
+	const int ELGG_TABLE_NUM_BYTES = ELGAMAL_SHORT_EXPONENT_NUM_BYTES;
+#endif
+	const int ELGG_TABLE_WINDOW_SIZE = (1 << ELGG_TABLE_WINDOW_BITS) - 1;
+	const int ELGG_TABLE_NUM_WINDOWS = ELGG_TABLE_NUM_BYTES*8/ELGG_TABLE_WINDOW_BITS;
+
 	static BN_MONT_CTX * g_MontCtx = nullptr;
-	static void PrecalculateElggTable (BIGNUM * table[][255], int len) // table is len's array of array of 255 bignums
+	static BIGNUM ** g_ElggTable = nullptr; // ELGG_TABLE_NUM_WINDOWS*ELGG_TABLE_WINDOW_SIZE
+
+	static void PrecalculateElggTable ()
 	{
-		if (len <= 0) return;
 		BN_CTX * ctx = BN_CTX_new ();
 		g_MontCtx = BN_MONT_CTX_new ();
 		BN_MONT_CTX_set (g_MontCtx, elgp, ctx);
-		auto montCtx = BN_MONT_CTX_new ();
-		BN_MONT_CTX_copy (montCtx, g_MontCtx);
-		for (int i = 0; i < len; i++)
+		g_ElggTable = new BIGNUM * [ELGG_TABLE_NUM_WINDOWS*ELGG_TABLE_WINDOW_SIZE];
+		for (int i = 0; i < ELGG_TABLE_NUM_WINDOWS; i++)
 		{
-			table[i][0] = BN_new ();
+			auto window = g_ElggTable + i*ELGG_TABLE_WINDOW_SIZE;
+			window[0] = BN_new ();
 			if (!i)
-				BN_to_montgomery (table[0][0], elgg, montCtx, ctx);
-			else
-				BN_mod_mul_montgomery (table[i][0], table[i-1][254], table[i-1][0], montCtx, ctx);
-			for (int j = 1; j < 255; j++)
+				BN_to_montgomery (window[0], elgg, g_MontCtx, ctx);
+			else // g^(2^(w*i)) = g^((2^w-1)*2^(w*(i-1)))*g^(2^(w*(i-1)))
+				BN_mod_mul_montgomery (window[0], window[-1], window[-ELGG_TABLE_WINDOW_SIZE], g_MontCtx, ctx);
+			for (int j = 1; j < ELGG_TABLE_WINDOW_SIZE; j++)
 			{
-				table[i][j] = BN_new ();
-				BN_mod_mul_montgomery (table[i][j], table[i][j-1], table[i][0], montCtx, ctx);
+				window[j] = BN_new ();
+				BN_mod_mul_montgomery (window[j], window[j-1], window[0], g_MontCtx, ctx);
 			}
 		}
-		BN_MONT_CTX_free (montCtx);
 		BN_CTX_free (ctx);
 	}
 
-	static void DestroyElggTable (BIGNUM * table[][255], int len)
+	static void DestroyElggTable ()
 	{
-		for (int i = 0; i < len; i++)
-			for (int j = 0; j < 255; j++)
-			{
-				BN_free (table[i][j]);
-				table[i][j] = nullptr;
-			}
-		BN_MONT_CTX_free (g_MontCtx);
+		for (int i = 0; i < ELGG_TABLE_NUM_WINDOWS*ELGG_TABLE_WINDOW_SIZE; i++)
+			BN_free (g_ElggTable[i]);
+		delete[] g_ElggTable; g_ElggTable = nullptr;
+		BN_MONT_CTX_free (g_MontCtx); g_MontCtx = nullptr;
 	}
 
-	static BIGNUM * ElggPow (const uint8_t * exp, int len, BIGNUM * table[][255], BN_CTX * ctx)
-	// exp is in Big Endian
+	static BIGNUM * ElggTablePow (const BIGNUM * exp, BN_CTX * ctx)
 	{
-		if (len <= 0) return nullptr;
-		auto montCtx = BN_MONT_CTX_new ();
-		BN_MONT_CTX_copy (montCtx, g_MontCtx);
+		uint8_t buf[ELGG_TABLE_NUM_BYTES]; // big endian
+		if (BN_num_bytes (exp) > ELGG_TABLE_NUM_BYTES) return nullptr;
+		bn2buf (exp, buf, ELGG_TABLE_NUM_BYTES);
 		BIGNUM * res = nullptr;
-		for (int i = 0; i < len; i++)
+		for (int i = 0; i < ELGG_TABLE_NUM_WINDOWS; i++)
 		{
+			int bit = i*ELGG_TABLE_WINDOW_BITS;
+			int d = (buf[ELGG_TABLE_NUM_BYTES - 1 - bit/8] >> (bit & 7)) & ELGG_TABLE_WINDOW_SIZE;
+			if (!d) continue;
+			auto t = g_ElggTable[i*ELGG_TABLE_WINDOW_SIZE + d - 1];
 			if (res)
-			{
-				if (exp[i])
-					BN_mod_mul_montgomery (res, res, table[len-1-i][exp[i]-1], montCtx, ctx);
-			}
-			else if (exp[i])
-				res = BN_dup (table[len-i-1][exp[i]-1]);
+				BN_mod_mul_montgomery (res, res, t, g_MontCtx, ctx);
+			else
+				res = BN_dup (t);
 		}
 		if (res)
-			BN_from_montgomery (res, res, montCtx, ctx);
-		BN_MONT_CTX_free (montCtx);
+			BN_from_montgomery (res, res, g_MontCtx, ctx);
+		else
+			res = BN_dup (BN_value_one ());
 		return res;
 	}
 
-	static BIGNUM * ElggPow (const BIGNUM * exp, BIGNUM * table[][255], BN_CTX * ctx)
+	static BIGNUM * ElggPow (const BIGNUM * exp, BN_CTX * ctx)
+	// g^exp mod p, from table if precalculated
 	{
-		auto len = BN_num_bytes (exp);
-		uint8_t * buf = new uint8_t[len];
-		BN_bn2bin (exp, buf);
-		auto ret = ElggPow (buf, len, table, ctx);
-		delete[] buf;
-		return ret;
+		if (g_ElggTable)
+		{
+			auto res = ElggTablePow (exp, ctx);
+			if (res) return res;
+		}
+		BIGNUM * res = BN_new ();
+		BN_mod_exp (res, elgg, exp, elgp, ctx);
+		return res;
 	}
 
-	static BIGNUM * (* g_ElggTable)[255] = nullptr;
+	static void GenerateElGamalExponent (BIGNUM * k)
+	{
+#if defined(__x86_64__)
+		BN_rand (k, ELGAMAL_FULL_EXPONENT_NUM_BITS, -1, 1); // full exponent for x64
+#else
+		BN_rand (k, ELGAMAL_SHORT_EXPONENT_NUM_BITS, -1, 1); // short exponent of 226 bits
+#endif
+	}
+
+	// pool of ready (k, g^k) pairs refilled by background thread ahead of consumption
+	const size_t ELGAMAL_POOL_MIN_SIZE = 16;
+	const size_t ELGAMAL_POOL_MAX_SIZE = 1024; // 512K
+	const int ELGAMAL_POOL_LOOKAHEAD = 5; // in seconds of consumption
+	const int ELGAMAL_POOL_UPDATE_INTERVAL = 1; // in seconds
+
+	class ElGamalPool
+	{
+		struct Pair
+		{
+			uint8_t k[256], a[256]; // a = g^k, big endian
+		};
+
+		public:
+
+			ElGamalPool (): m_IsRunning (false), m_Thread (nullptr),
+				m_TargetSize (ELGAMAL_POOL_MIN_SIZE), m_Rate (0), m_NumConsumed (0), m_NumMissed (0) {};
+			~ElGamalPool () { Stop (); };
+
+			void Start ();
+			void Stop ();
+			bool Get (BIGNUM * k, BIGNUM * a); // false if empty
+
+		private:
+
+			void Run ();
+			void UpdateTargetSize ();
+
+		private:
+
+			bool m_IsRunning;
+			std::thread * m_Thread;
+			std::mutex m_Mutex;
+			std::condition_variable m_NewPairsNeeded;
+			std::vector<Pair> m_Pairs;
+			size_t m_TargetSize;
+			double m_Rate; // pairs per second
+			uint64_t m_NumConsumed, m_NumMissed;
+	};
+
+	void ElGamalPool::Start ()
+	{
+		if (m_IsRunning) return;
+		m_IsRunning = true;
+		m_Pairs.reserve (ELGAMAL_POOL_MAX_SIZE);
+		m_Thread = new std::thread (std::bind (&ElGamalPool::Run, this));
+	}
+
+	void ElGamalPool::Stop ()
+	{
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			if (!m_IsRunning) return;
+			m_IsRunning = false;
+		}
+		m_NewPairsNeeded.notify_one ();
+		if (m_Thread)
+		{
+			m_Thread->join ();
+			delete m_Thread;
+			m_Thread = nullptr;
+		}
+		LogPrint (eLogDebug, "Crypto: ElGamal pool served ", m_NumConsumed - m_NumMissed, " of ", m_NumConsumed, " exponents");
+		m_Pairs.clear ();
+	}
+
+	bool ElGamalPool::Get (BIGNUM * k, BIGNUM * a)
+	{
+		Pair pair;
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			if (!m_IsRunning) return false;
+			m_NumConsumed++;
+			if (m_Pairs.empty ())
+			{
+				m_NumMissed++;
+				m_NewPairsNeeded.notify_one ();
+				return false;
+			}
+			pair = m_Pairs.back ();
+			memset (&m_Pairs.back (), 0, sizeof (Pair)); // don't keep k after use
+			m_Pairs.pop_back ();
+			if (m_Pairs.size () < m_TargetSize/2)
+				m_NewPairsNeeded.notify_one ();
+		}
+		BN_bin2bn (pair.k, 256, k);
+		BN_bin2bn (pair.a, 256, a);
+		memset (pair.k, 0, 256);
+		return true;
+	}
+
+	void ElGamalPool::Run ()
+	{
+		BN_CTX * ctx = BN_CTX_new ();
+		BIGNUM * k = BN_new ();
+		auto lastUpdate = std::chrono::steady_clock::now ();
+		uint64_t lastConsumed = 0;
+		std::unique_lock<std::mutex> l(m_Mutex);
+		while (m_IsRunning)
+		{
+			if (m_Pairs.size () < m_TargetSize)
+			{
+				l.unlock ();
+				Pair pair;
+				GenerateElGamalExponent (k);
+				auto a = ElggPow (k, ctx);
+				bn2buf (k, pair.k, 256);
+				bn2buf (a, pair.a, 256);
+				BN_free (a);
+				l.lock ();
+				m_Pairs.push_back (pair);
+			}
+			else
+				m_NewPairsNeeded.wait_for (l, std::chrono::seconds (ELGAMAL_POOL_UPDATE_INTERVAL),
+					[this]() { return !m_IsRunning || m_Pairs.size () < m_TargetSize/2; });
+			auto now = std::chrono::steady_clock::now ();
+			auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastUpdate).count ();
+			if (interval >= ELGAMAL_POOL_UPDATE_INTERVAL*1000)
+			{
+				// exponential moving average of consumption rate
+				double rate = (m_NumConsumed - lastConsumed)*1000.0/interval;
+				m_Rate = m_Rate ? (m_Rate*3 + rate)/4 : rate;
+				UpdateTargetSize ();
+				lastConsumed = m_NumConsumed;
+				lastUpdate = now;
+			}
+		}
+		l.unlock ();
+		BN_clear_free (k);
+		BN_CTX_free (ctx);
+	}
+
+	void ElGamalPool::UpdateTargetSize ()
+	{
+		size_t size = m_Rate*ELGAMAL_POOL_LOOKAHEAD;
+		if (size < ELGAMAL_POOL_MIN_SIZE) size = ELGAMAL_POOL_MIN_SIZE;
+		if (size > ELGAMAL_POOL_MAX_SIZE) size = ELGAMAL_POOL_MAX_SIZE;
+		m_TargetSize = size;
+		if (m_Pairs.size () > m_TargetSize) // shrink after burst
+		{
+			memset (m_Pairs.data () + m_TargetSize, 0, (m_Pairs.size () - m_TargetSize)*sizeof (Pair));
+			m_Pairs.resize (m_TargetSize);
+		}
+	}
+
+	static ElGamalPool g_ElGamalPool;
+
+	static BIGNUM * GenerateElggPair (BIGNUM * k, BN_CTX * ctx)
+	// random k and returns g^k, from pool if possible
+	{
+		BIGNUM * a = BN_new ();
+		if (g_ElGamalPool.Get (k, a)) return a;
+		BN_free (a);
+		GenerateElGamalExponent (k);
+		return ElggPow (k, ctx);
+	}
 
 // DH
 
@@ -259,7 +447,7 @@ namespace crypto
 			BN_rand (priv_key, ELGAMAL_FULL_EXPONENT_NUM_BITS, 0, 1);
 #endif
 			auto ctx = BN_CTX_new ();
-			pub_key = ElggPow (priv_key, g_ElggTable, ctx);
+			pub_key = ElggPow (priv_key, ctx);
 			DH_set0_key (m_DH, pub_key, priv_key);
 			BN_CTX_free (ctx);
 		}
@@ -367,21 +555,8 @@ namespace crypto
 		BIGNUM * y = BN_CTX_get (ctx);
 		BIGNUM * b1 = BN_CTX_get (ctx);
 		BIGNUM * b = BN_CTX_get (ctx);
-		// select random k
-#if defined(__x86_64__)
-		BN_rand (k, ELGAMAL_FULL_EXPONENT_NUM_BITS, -1, 1); // full exponent for x64
-#else
-		BN_rand (k, ELGAMAL_SHORT_EXPONENT_NUM_BITS, -1, 1); // short exponent of 226 bits
-#endif
-		// calculate a
-		BIGNUM * a;
-		if (g_ElggTable)
-			a = ElggPow (k, g_ElggTable, ctx);
-		else
-		{
-			a = BN_new ();
-			BN_mod_exp (a, elgg, k, elgp, ctx);
-		}
+		// select random k and calculate a
+		BIGNUM * a = GenerateElggPair (k, ctx);
 
 		// restore y from key
 		BN_bin2bn (key, 256, y);
@@ -602,7 +777,7 @@ namespace crypto
 	{
 		uint64_t buf[256];
 		uint64_t hash[12]; // 96 bytes
-#ifdef __AVX__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::avx)
 		{
 			__asm__
@@ -659,7 +834,7 @@ namespace crypto
 	}
 
 // AES
-#ifdef __AES__
+#ifdef X86_DISPATCH
         #ifdef ARM64AES
                 void init_aesenc(void){
 			// TODO: Implementation
@@ -691,7 +866,7 @@ namespace crypto
 		"movaps	%%xmm3, "#round1"(%[sched]) \n"
 #endif
 
-#ifdef __AES__
+#ifdef X86_DISPATCH
 	void ECBCryptoAESNI::ExpandKey (const AESKey& key)
 	{
 		__asm__
@@ -732,7 +907,7 @@ namespace crypto
 #endif
 
 
-#ifdef __AES__
+#ifdef X86_DISPATCH
 	#define EncryptAES256(sched) \
 		"pxor (%["#sched"]), %%xmm0 \n" \
 		"aesenc	16(%["#sched"]), %%xmm0 \n" \
@@ -753,7 +928,7 @@ namespace crypto
 
 	void ECBEncryption::Encrypt (const ChipherBlock * in, ChipherBlock * out)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			__asm__
@@ -771,7 +946,7 @@ namespace crypto
 		}
 	}
 
-#ifdef __AES__
+#ifdef X86_DISPATCH
 	#define DecryptAES256(sched) \
 		"pxor 224(%["#sched"]), %%xmm0 \n" \
 		"aesdec	208(%["#sched"]), %%xmm0 \n" \
@@ -792,7 +967,7 @@ namespace crypto
 
 	void ECBDecryption::Decrypt (const ChipherBlock * in, ChipherBlock * out)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			__asm__
@@ -810,7 +985,7 @@ namespace crypto
 		}
 	}
 
-#ifdef __AES__
+#ifdef X86_DISPATCH
 	#define CallAESIMC(offset) \
 		"movaps "#offset"(%[shed]), %%xmm0 \n"	\
 		"aesimc %%xmm0, %%xmm0 \n" \
@@ -819,7 +994,7 @@ namespace crypto
 
 	void ECBEncryption::SetKey (const AESKey& key)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			ExpandKey (key);
@@ -833,7 +1008,7 @@ namespace crypto
 
 	void ECBDecryption::SetKey (const AESKey& key)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			ExpandKey (key); // expand encryption key first
@@ -866,7 +1041,7 @@ namespace crypto
 
 	void CBCEncryption::Encrypt (int numBlocks, const ChipherBlock * in, ChipherBlock * out)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			__asm__
@@ -911,7 +1086,7 @@ namespace crypto
 
 	void CBCEncryption::Encrypt (const uint8_t * in, uint8_t * out)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			__asm__
@@ -933,9 +1108,109 @@ namespace crypto
 			Encrypt (1, (const ChipherBlock *)in, (ChipherBlock *)out);
 	}
 
+#ifdef WIDE_AES
+	// CBC decryption of 8 blocks at a time in 4 ymm registers, previous ciphertext is taken from registers
+	// rather than from memory, so in and out might be the same. Returns number of blocks processed
+	__attribute__((target("vaes,avx2")))
+	static int CBCDecryptVAES256 (const uint8_t * sched, int numBlocks, const ChipherBlock * in, ChipherBlock * out, uint8_t * iv)
+	{
+		if (numBlocks < 8) return 0;
+		__m256i keys[15];
+		for (int r = 0; r < 15; r++)
+			keys[r] = _mm256_broadcastsi128_si256 (_mm_load_si128 ((const __m128i *)sched + r));
+		__m256i prev = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *)iv)); // high block is IV
+		int i = 0;
+		for (; i + 8 <= numBlocks; i += 8)
+		{
+			__m256i c0 = _mm256_loadu_si256 ((const __m256i *)(in + i)),
+				c1 = _mm256_loadu_si256 ((const __m256i *)(in + i + 2)),
+				c2 = _mm256_loadu_si256 ((const __m256i *)(in + i + 4)),
+				c3 = _mm256_loadu_si256 ((const __m256i *)(in + i + 6));
+			__m256i s0 = _mm256_xor_si256 (c0, keys[14]), s1 = _mm256_xor_si256 (c1, keys[14]),
+				s2 = _mm256_xor_si256 (c2, keys[14]), s3 = _mm256_xor_si256 (c3, keys[14]);
+			for (int r = 13; r > 0; r--)
+			{
+				s0 = _mm256_aesdec_epi128 (s0, keys[r]); s1 = _mm256_aesdec_epi128 (s1, keys[r]);
+				s2 = _mm256_aesdec_epi128 (s2, keys[r]); s3 = _mm256_aesdec_epi128 (s3, keys[r]);
+			}
+			s0 = _mm256_aesdeclast_epi128 (s0, keys[0]); s1 = _mm256_aesdeclast_epi128 (s1, keys[0]);
+			s2 = _mm256_aesdeclast_epi128 (s2, keys[0]); s3 = _mm256_aesdeclast_epi128 (s3, keys[0]);
+			// high block of previous register and low block of current one
+			s0 = _mm256_xor_si256 (s0, _mm256_permute2x128_si256 (prev, c0, 0x21));
+			s1 = _mm256_xor_si256 (s1, _mm256_permute2x128_si256 (c0, c1, 0x21));
+			s2 = _mm256_xor_si256 (s2, _mm256_permute2x128_si256 (c1, c2, 0x21));
+			s3 = _mm256_xor_si256 (s3, _mm256_permute2x128_si256 (c2, c3, 0x21));
+			_mm256_storeu_si256 ((__m256i *)(out + i), s0);
+			_mm256_storeu_si256 ((__m256i *)(out + i + 2), s1);
+			_mm256_storeu_si256 ((__m256i *)(out + i + 4), s2);
+			_mm256_storeu_si256 ((__m256i *)(out + i + 6), s3);
+			prev = c3;
+		}
+		_mm_storeu_si128 ((__m128i *)iv, _mm256_extracti128_si256 (prev, 1));
+		_mm256_zeroupper ();
+		return i;
+	}
+
+	// same with 16 blocks in 4 zmm registers, 8 blocks of the rest go to ymm
+	__attribute__((target("vaes,avx512f")))
+	static int CBCDecryptVAES512 (const uint8_t * sched, int numBlocks, const ChipherBlock * in, ChipherBlock * out, uint8_t * iv)
+	{
+		if (numBlocks < 16) return CBCDecryptVAES256 (sched, numBlocks, in, out, iv);
+		__m512i keys[15];
+		for (int r = 0; r < 15; r++)
+			keys[r] = _mm512_broadcast_i32x4 (_mm_load_si128 ((const __m128i *)sched + r));
+		__m512i prev = _mm512_broadcast_i32x4 (_mm_loadu_si128 ((const __m128i *)iv)); // last block is IV
+		int i = 0;
+		for (; i + 16 <= numBlocks; i += 16)
+		{
+			__m512i c0 = _mm512_loadu_si512 ((const __m512i *)(in + i)),
+				c1 = _mm512_loadu_si512 ((const __m512i *)(in + i + 4)),
+				c2 = _mm512_loadu_si512 ((const __m512i *)(in + i + 8)),
+				c3 = _mm512_loadu_si512 ((const __m512i *)(in + i + 12));
+			__m512i s0 = _mm512_xor_si512 (c0, keys[14]), s1 = _mm512_xor_si512 (c1, keys[14]),
+				s2 = _mm512_xor_si512 (c2, keys[14]), s3 = _mm512_xor_si512 (c3, keys[14]);
+			for (int r = 13; r > 0; r--)
+			{
+				s0 = _mm512_aesdec_epi128 (s0, keys[r]); s1 = _mm512_aesdec_epi128 (s1, keys[r]);
+				s2 = _mm512_aesdec_epi128 (s2, keys[r]); s3 = _mm512_aesdec_epi128 (s3, keys[r]);
+			}
+			s0 = _mm512_aesdeclast_epi128 (s0, keys[0]); s1 = _mm512_aesdeclast_epi128 (s1, keys[0]);
+			s2 = _mm512_aesdeclast_epi128 (s2, keys[0]); s3 = _mm512_aesdeclast_epi128 (s3, keys[0]);
+			// shift ciphertext by one block to get previous blocks
+			s0 = _mm512_xor_si512 (s0, _mm512_alignr_epi64 (c0, prev, 6));
+			s1 = _mm512_xor_si512 (s1, _mm512_alignr_epi64 (c1, c0, 6));
+			s2 = _mm512_xor_si512 (s2, _mm512_alignr_epi64 (c2, c1, 6));
+			s3 = _mm512_xor_si512 (s3, _mm512_alignr_epi64 (c3, c2, 6));
+			_mm512_storeu_si512 ((__m512i *)(out + i), s0);
+			_mm512_storeu_si512 ((__m512i *)(out + i + 4), s1);
+			_mm512_storeu_si512 ((__m512i *)(out + i + 8), s2);
+			_mm512_storeu_si512 ((__m512i *)(out + i + 12), s3);
+			prev = c3;
+		}
+		_mm_storeu_si128 ((__m128i *)iv, _mm512_extracti32x4_epi32 (prev, 3));
+		_mm256_zeroupper ();
+		return i + CBCDecryptVAES256 (sched, numBlocks - i, in + i, out + i, iv);
+	}
+#endif
+
+	typedef int (* CBCDecryptWide)(const uint8_t * sched, int numBlocks, const ChipherBlock * in, ChipherBlock * out, uint8_t * iv);
+	static CBCDecryptWide g_CBCDecryptWide = nullptr; // set by SelectCryptoKernels
+
+	static inline bool HasWideAES ()
+	{
+		return g_CBCDecryptWide;
+	}
+
 	void CBCDecryption::Decrypt (int numBlocks, const ChipherBlock * in, ChipherBlock * out)
 	{
-#ifdef __AES__
+		if (HasWideAES ())
+		{
+			// wide kernels leave the rest for xmm
+			int num = g_CBCDecryptWide (m_ECBDecryption.GetKeySchedule (), numBlocks, in, out, m_IV);
+			if (num == numBlocks) return;
+			numBlocks -= num; in += num; out += num;
+		}
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			__asm__
@@ -981,7 +1256,7 @@ namespace crypto
 
 	void CBCDecryption::Decrypt (const uint8_t * in, uint8_t * out)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			__asm__
@@ -1005,7 +1280,7 @@ namespace crypto
 
 	void TunnelEncryption::Encrypt (const uint8_t * in, uint8_t * out)
 	{
-#ifdef __AES__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::aesni)
 		{
 			__asm__
@@ -1046,8 +1321,8 @@ namespace crypto
 
 	void TunnelDecryption::Decrypt (const uint8_t * in, uint8_t * out)
 	{
-#ifdef __AES__
-		if(dotnet::cpu::aesni)
+#ifdef X86_DISPATCH
+		if(dotnet::cpu::aesni && !HasWideAES ()) // otherwise data goes to wide CBC-decrypt below
 		{
 			__asm__
 				(
@@ -1086,39 +1361,175 @@ namespace crypto
 		}
 	}
 
+#ifdef X86_DISPATCH
+#if defined(__x86_64__)
+	const int TUNNEL_CRYPTO_INTERLEAVE = 8; // 8 blocks in flight hide aesenc latency, 16 xmm registers
+#else
+	const int TUNNEL_CRYPTO_INTERLEAVE = 4; // 8 xmm registers only
+#endif
+
+	// unrolled by recursion rather than by loop to keep N blocks in registers even with -Os
+	template<int N>
+	struct AESNIxN
+	{
+		static inline __attribute__((always_inline, target("aes"))) void Load (__m128i * s, const uint8_t * const * in, size_t offset)
+		{
+			AESNIxN<N - 1>::Load (s, in, offset);
+			s[N - 1] = _mm_loadu_si128 ((const __m128i *)(in[N - 1] + offset));
+		}
+
+		static inline __attribute__((always_inline, target("aes"))) void Store (const __m128i * s, uint8_t * const * out, size_t offset)
+		{
+			AESNIxN<N - 1>::Store (s, out, offset);
+			_mm_storeu_si128 ((__m128i *)(out[N - 1] + offset), s[N - 1]);
+		}
+
+		static inline __attribute__((always_inline, target("aes"))) void Copy (__m128i * s, const __m128i * x)
+		{
+			AESNIxN<N - 1>::Copy (s, x);
+			s[N - 1] = x[N - 1];
+		}
+
+		static inline __attribute__((always_inline, target("aes"))) void Xor (__m128i * s, const __m128i * x)
+		{
+			AESNIxN<N - 1>::Xor (s, x);
+			s[N - 1] = _mm_xor_si128 (s[N - 1], x[N - 1]);
+		}
+
+		static inline __attribute__((always_inline, target("aes"))) void Round (__m128i * s, __m128i key)
+		{
+			AESNIxN<N - 1>::Round (s, key);
+			s[N - 1] = _mm_aesenc_si128 (s[N - 1], key);
+		}
+
+		static inline __attribute__((always_inline, target("aes"))) void LastRound (__m128i * s, __m128i key)
+		{
+			AESNIxN<N - 1>::LastRound (s, key);
+			s[N - 1] = _mm_aesenclast_si128 (s[N - 1], key);
+		}
+
+		static inline __attribute__((always_inline, target("aes"))) void Encrypt (const __m128i * sched, __m128i * s)
+		{
+			AESNIxN<N>::Whiten (s, sched[0]);
+			for (int r = 1; r < 14; r++)
+				AESNIxN<N>::Round (s, sched[r]);
+			AESNIxN<N>::LastRound (s, sched[14]);
+		}
+
+		static inline __attribute__((always_inline, target("aes"))) void Whiten (__m128i * s, __m128i key)
+		{
+			AESNIxN<N - 1>::Whiten (s, key);
+			s[N - 1] = _mm_xor_si128 (s[N - 1], key);
+		}
+	};
+
+	template<>
+	struct AESNIxN<0>
+	{
+		static inline void Load (__m128i *, const uint8_t * const *, size_t) {}
+		static inline void Store (const __m128i *, uint8_t * const *, size_t) {}
+		static inline void Copy (__m128i *, const __m128i *) {}
+		static inline void Xor (__m128i *, const __m128i *) {}
+		static inline void Round (__m128i *, __m128i) {}
+		static inline void LastRound (__m128i *, __m128i) {}
+		static inline void Whiten (__m128i *, __m128i) {}
+	};
+
+	// CBC encryption is serial within a message, so the same block of N messages goes through AES together
+	template<int N>
+	__attribute__((target("aes")))
+	static void TunnelEncryptAESNI (const uint8_t * ivSched, const uint8_t * layerSched, const uint8_t * const * in, uint8_t * const * out)
+	{
+		__m128i s[N], iv[N];
+		AESNIxN<N>::Load (s, in, 0);
+		AESNIxN<N>::Encrypt ((const __m128i *)ivSched, s);
+		AESNIxN<N>::Copy (iv, s);
+		AESNIxN<N>::Encrypt ((const __m128i *)ivSched, s); // double IV encryption
+		AESNIxN<N>::Store (s, out, 0);
+		for (size_t offset = 16; offset < 1024; offset += 16)
+		{
+			AESNIxN<N>::Load (s, in, offset);
+			AESNIxN<N>::Xor (s, iv);
+			AESNIxN<N>::Encrypt ((const __m128i *)layerSched, s);
+			AESNIxN<N>::Store (s, out, offset);
+			AESNIxN<N>::Copy (iv, s);
+		}
+	}
+#endif
+
+	void TunnelEncryption::Encrypt (int num, const uint8_t * const * in, uint8_t * const * out)
+	{
+		int i = 0;
+#ifdef X86_DISPATCH
+		if(dotnet::cpu::aesni)
+		{
+			auto ivSched = m_IVEncryption.GetKeySchedule (), layerSched = m_LayerEncryption.ECB().GetKeySchedule ();
+			for (; i + TUNNEL_CRYPTO_INTERLEAVE <= num; i += TUNNEL_CRYPTO_INTERLEAVE)
+				TunnelEncryptAESNI<TUNNEL_CRYPTO_INTERLEAVE> (ivSched, layerSched, in + i, out + i);
+			if (TUNNEL_CRYPTO_INTERLEAVE > 4 && i + 4 <= num)
+			{
+				TunnelEncryptAESNI<4> (ivSched, layerSched, in + i, out + i);
+				i += 4;
+			}
+			if (i + 2 <= num)
+			{
+				TunnelEncryptAESNI<2> (ivSched, layerSched, in + i, out + i);
+				i += 2;
+			}
+		}
+#endif
+		for (; i < num; i++)
+			Encrypt (in[i], out[i]);
+	}
+
+	void TunnelDecryption::Decrypt (int num, const uint8_t * const * in, uint8_t * const * out)
+	{
+		// CBC decryption of 63 blocks is parallel within a message already
+		for (int i = 0; i < num; i++)
+			Decrypt (in[i], out[i]);
+	}
+
 // AEAD/ChaCha20/Poly1305
 
+#if OPENSSL_AEAD_CHACHA20_POLY1305
+	static bool g_BuiltinChaCha20Poly1305 = false; // crypto.chacha20poly1305=builtin, set by InitCrypto
+#endif
+
 	bool AEADChaCha20Poly1305 (const uint8_t * msg, size_t msgLen, const uint8_t * ad, size_t adLen, const uint8_t * key, const uint8_t * nonce, uint8_t * buf, size_t len, bool encrypt)
 	{
 		if (len < msgLen) return false;
 		if (encrypt && len < msgLen + 16) return false;
 		bool ret = true;
 #if OPENSSL_AEAD_CHACHA20_POLY1305
-		int outlen = 0;
-		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
-		if (encrypt)
-		{
-			EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), 0, 0, 0);
-			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, 0);
-			EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce);
-			EVP_EncryptUpdate(ctx, NULL, &outlen, ad, adLen);
-			EVP_EncryptUpdate(ctx, buf, &outlen, msg, msgLen);
-			EVP_EncryptFinal_ex(ctx, buf, &outlen);
-			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, buf + msgLen);
-		}
-		else
+		if (!g_BuiltinChaCha20Poly1305)
 		{
-			EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), 0, 0, 0);
-			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, 0);
-			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, 16, (uint8_t *)(msg + msgLen));
-			EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce);
-			EVP_DecryptUpdate(ctx, NULL, &outlen, ad, adLen);
-			EVP_DecryptUpdate(ctx, buf, &outlen, msg, msgLen);
-			ret = EVP_DecryptFinal_ex(ctx, buf + outlen, &outlen) > 0;
-		}
+			int outlen = 0;
+			EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
+			if (encrypt)
+			{
+				EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), 0, 0, 0);
+				EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, 0);
+				EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce);
+				EVP_EncryptUpdate(ctx, NULL, &outlen, ad, adLen);
+				EVP_EncryptUpdate(ctx, buf, &outlen, msg, msgLen);
+				EVP_EncryptFinal_ex(ctx, buf, &outlen);
+				EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, buf + msgLen);
+			}
+			else
+			{
+				EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), 0, 0, 0);
+				EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, 0);
+				EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, 16, (uint8_t *)(msg + msgLen));
+				EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce);
+				EVP_DecryptUpdate(ctx, NULL, &outlen, ad, adLen);
+				EVP_DecryptUpdate(ctx, buf, &outlen, msg, msgLen);
+				ret = EVP_DecryptFinal_ex(ctx, buf + outlen, &outlen) > 0;
+			}
 
-		EVP_CIPHER_CTX_free (ctx);
-#else		
+			EVP_CIPHER_CTX_free (ctx);
+			return ret;
+		}
+#endif
 		chacha::Chacha20State state;
 		// generate one time poly key
 		chacha::Chacha20Init (state, nonce, key, 0);	
@@ -1175,9 +1586,8 @@ namespace crypto
 			uint64_t tag[4];
 			// calculate Poly1305 tag
 			polyHash.Finish (tag);	
-			if (memcmp (tag, msg + msgLen, 16)) ret = false; // compare with provided
+			if (CRYPTO_memcmp (tag, msg + msgLen, 16)) ret = false; // compare with provided, constant time
 		}
-#endif
 		return ret;
 	}
 
@@ -1185,17 +1595,21 @@ namespace crypto
 	{
 		if (bufs.empty ()) return;
 #if OPENSSL_AEAD_CHACHA20_POLY1305
-		int outlen = 0;
-		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
-		EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), 0, 0, 0);
-		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, 0);
-		EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce);
-		for (const auto& it: bufs)	
-			EVP_EncryptUpdate(ctx, it.first, &outlen, it.first, it.second);
-		EVP_EncryptFinal_ex(ctx, NULL, &outlen);
-		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, mac);
-		EVP_CIPHER_CTX_free (ctx);
-#else		
+		if (!g_BuiltinChaCha20Poly1305)
+		{
+			int outlen = 0;
+			EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
+			EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), 0, 0, 0);
+			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, 0);
+			EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce);
+			for (const auto& it: bufs)
+				EVP_EncryptUpdate(ctx, it.first, &outlen, it.first, it.second);
+			EVP_EncryptFinal_ex(ctx, NULL, &outlen);
+			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, mac);
+			EVP_CIPHER_CTX_free (ctx);
+			return;
+		}
+#endif
 		chacha::Chacha20State state;
 		// generate one time poly key
 		chacha::Chacha20Init (state, nonce, key, 0);	
@@ -1228,26 +1642,28 @@ namespace crypto
 		polyHash.Update (padding, 16);	
 		// MAC
 		polyHash.Finish ((uint64_t *)mac);	
-#endif		
 	}
 
 	void ChaCha20 (const uint8_t * msg, size_t msgLen, const uint8_t * key, const uint8_t * nonce, uint8_t * out)
 	{
 #if OPENSSL_AEAD_CHACHA20_POLY1305
-		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
-		uint32_t iv[4];
-		iv[0] = htole32 (1); memcpy (iv + 1, nonce, 12); // counter | nonce
-		EVP_EncryptInit_ex(ctx, EVP_chacha20 (), NULL, key, (const uint8_t *)iv);
-		int outlen = 0;
-		EVP_EncryptUpdate(ctx, out, &outlen, msg, msgLen);
-		EVP_EncryptFinal_ex(ctx, NULL, &outlen);
-		EVP_CIPHER_CTX_free (ctx);
-#else
+		if (!g_BuiltinChaCha20Poly1305)
+		{
+			EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
+			uint32_t iv[4];
+			iv[0] = htole32 (1); memcpy (iv + 1, nonce, 12); // counter | nonce
+			EVP_EncryptInit_ex(ctx, EVP_chacha20 (), NULL, key, (const uint8_t *)iv);
+			int outlen = 0;
+			EVP_EncryptUpdate(ctx, out, &outlen, msg, msgLen);
+			EVP_EncryptFinal_ex(ctx, NULL, &outlen);
+			EVP_CIPHER_CTX_free (ctx);
+			return;
+		}
+#endif
 		chacha::Chacha20State state;
 		chacha::Chacha20Init (state, nonce, key, 1);	
 		if (out != msg) memcpy (out, msg, msgLen);
 		chacha::Chacha20Encrypt (state, out, msgLen);
-#endif
 	}
 
 	void HKDF (const uint8_t * salt, const uint8_t * key, size_t keyLen, const std::string& info, uint8_t * out)
@@ -1288,10 +1704,67 @@ namespace crypto
 		}
 	}*/
 
-	
-	void InitCrypto (bool precomputation)
+	static std::vector<std::pair<std::string, std::string> > g_CryptoKernels;
+
+	static void SelectCryptoKernels (bool builtinChaCha20Poly1305)
+	{
+		g_CryptoKernels.clear ();
+		std::string aes = "OpenSSL", tunnelEncrypt = "OpenSSL", cbcDecrypt = "OpenSSL", avx = "generic";
+		g_CBCDecryptWide = nullptr;
+#ifdef X86_DISPATCH
+		if (dotnet::cpu::aesni)
+		{
+			aes = "AES-NI";
+			tunnelEncrypt = "AES-NI, " + std::to_string (TUNNEL_CRYPTO_INTERLEAVE) + " messages interleaved";
+			cbcDecrypt = "AES-NI";
+#ifdef WIDE_AES
+			if (dotnet::cpu::vaes)
+			{
+				g_CBCDecryptWide = dotnet::cpu::avx512 ? CBCDecryptVAES512 : CBCDecryptVAES256;
+				cbcDecrypt = dotnet::cpu::avx512 ? "VAES-512" : "VAES-256";
+			}
+#endif
+		}
+		if (dotnet::cpu::avx) avx = "AVX";
+#endif
+		g_CryptoKernels.emplace_back ("AES", aes);
+		g_CryptoKernels.emplace_back ("Tunnel encryption", tunnelEncrypt);
+		g_CryptoKernels.emplace_back ("CBC decryption", cbcDecrypt);
+		g_CryptoKernels.emplace_back ("HMAC-MD5 and XOR metric", avx);
+		g_CryptoKernels.emplace_back ("SHA-256", dotnet::cpu::sha ? "OpenSSL, SHA-NI" : "OpenSSL"); // OpenSSL selects SHA-NI itself
+		g_CryptoKernels.emplace_back ("SHA-256 batch", GetSHA256BatchImplementation ());
+#if defined(X86_DISPATCH) && defined(__x86_64__)
+		std::string chacha20 = dotnet::cpu::avx2 ? "AVX2, 8 blocks" : "SSE2, 4 blocks";
+#else
+		std::string chacha20 = "generic";
+#endif
+		std::string poly1305 = GetPoly1305Implementation ();
+#if OPENSSL_AEAD_CHACHA20_POLY1305
+		// EVP unless configured otherwise, so the same build runs the same code on every start
+		g_BuiltinChaCha20Poly1305 = builtinChaCha20Poly1305;
+		if (!builtinChaCha20Poly1305)
+		{
+			chacha20 = "OpenSSL, builtin " + chacha20 + " not selected";
+			poly1305 = "OpenSSL, builtin " + poly1305 + " not selected";
+		}
+#else
+		(void)builtinChaCha20Poly1305; // no EVP, own kernels always
+#endif
+		g_CryptoKernels.emplace_back ("ChaCha20", chacha20);
+		g_CryptoKernels.emplace_back ("Poly1305", poly1305);
+		for (const auto& it: g_CryptoKernels)
+			LogPrint (eLogInfo, "Crypto: ", it.first, ": ", it.second);
+	}
+
+	const std::vector<std::pair<std::string, std::string> >& GetCryptoKernels ()
 	{
-		dotnet::cpu::Detect ();	
+		return g_CryptoKernels;
+	}
+
+	void InitCrypto (bool precomputation, bool builtinChaCha20Poly1305)
+	{
+		dotnet::cpu::Detect ();
+		SelectCryptoKernels (builtinChaCha20Poly1305);
 #if LEGACY_OPENSSL
 		SSL_library_init ();
 #endif
@@ -1300,30 +1773,24 @@ namespace crypto
 			m_OpenSSLMutexes.emplace_back (new std::mutex);
 		CRYPTO_set_locking_callback (OpensslLockingCallback);*/
 		if (precomputation)
-		{
-#if defined(__x86_64__)
-			g_ElggTable = new BIGNUM * [ELGAMAL_FULL_EXPONENT_NUM_BYTES][255];
-			PrecalculateElggTable (g_ElggTable, ELGAMAL_FULL_EXPONENT_NUM_BYTES);
-#else
-			g_ElggTable = new BIGNUM * [ELGAMAL_SHORT_EXPONENT_NUM_BYTES][255];
-			PrecalculateElggTable (g_ElggTable, ELGAMAL_SHORT_EXPONENT_NUM_BYTES);
-#endif
-		}
+			PrecalculateElggTable ();
+	}
+
+	void StartElGamalPool ()
+	{
+		g_ElGamalPool.Start ();
+	}
+
+	void StopElGamalPool ()
+	{
+		g_ElGamalPool.Stop ();
 	}
 
 	void TerminateCrypto ()
 	{
+		g_ElGamalPool.Stop ();
 		if (g_ElggTable)
-		{
-			DestroyElggTable (g_ElggTable,
-#if defined(__x86_64__)
-				ELGAMAL_FULL_EXPONENT_NUM_BYTES
-#else
-				ELGAMAL_SHORT_EXPONENT_NUM_BYTES
-#endif
-			);
-			delete[] g_ElggTable; g_ElggTable = nullptr;
-		}
+			DestroyElggTable ();
 /*		CRYPTO_set_locking_callback (nullptr);
 		m_OpenSSLMutexes.clear ();*/
 	}
@@ -155,7 +155,7 @@ namespace crypto
 	};
 
 
-#ifdef __AES__
+#ifdef X86_DISPATCH
 	#ifdef ARM64AES
 		void init_aesenc(void) __attribute__((constructor));
 	#endif
@@ -175,7 +175,7 @@ namespace crypto
 	};
 #endif
 
-#ifdef __AES__
+#ifdef X86_DISPATCH
 	class ECBEncryption: public ECBCryptoAESNI
 #else
 	class ECBEncryption
@@ -191,7 +191,7 @@ namespace crypto
 		AES_KEY m_Key;
 	};
 
-#ifdef __AES__
+#ifdef X86_DISPATCH
 	class ECBDecryption: public ECBCryptoAESNI
 #else
 	class ECBDecryption
@@ -261,6 +261,7 @@ namespace crypto
 			}
 
 			void Encrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)
+			void Encrypt (int num, const uint8_t * const * in, uint8_t * const * out); // num messages, interleaved
 
 		private:
 
@@ -279,6 +280,7 @@ namespace crypto
 			}
 
 			void Decrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)
+			void Decrypt (int num, const uint8_t * const * in, uint8_t * const * out); // num messages, interleaved
 
 		private:
 
@@ -299,8 +301,11 @@ namespace crypto
 	void HKDF (const uint8_t * salt, const uint8_t * key, size_t keyLen, const std::string& info, uint8_t * out); // salt - 32, out - 64, info <= 32 
 
 // init and terminate
-	void InitCrypto (bool precomputation);
+	void InitCrypto (bool precomputation, bool builtinChaCha20Poly1305 = false); // own ChaCha20/Poly1305 kernels instead of EVP
 	void TerminateCrypto ();
+	void StartElGamalPool (); // background thread precomputing (k, g^k) for ElGamalEncrypt
+	void StopElGamalPool ();
+	const std::vector<std::pair<std::string, std::string> >& GetCryptoKernels (); // primitive and implementation selected by InitCrypto
 }
 }
 
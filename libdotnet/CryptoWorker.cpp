@@ -0,0 +1,185 @@
+#include <chrono>
+#include "Log.h"
+#include "CryptoWorker.h"
+
+namespace dotnet
+{
+namespace worker
+{
+	static thread_local int t_WorkerIndex = -1; // in executor running current thread
+	static thread_local BN_CTX * t_BNCtx = nullptr;
+
+	static uint64_t GetMicroseconds ()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+	}
+
+	CryptoExecutor::CryptoExecutor (): m_IsRunning (false), m_NumQueued (0), m_NextQueue (0), m_Latency (0)
+	{
+	}
+
+	CryptoExecutor::~CryptoExecutor ()
+	{
+		Stop ();
+	}
+
+	void CryptoExecutor::Start (int numWorkers)
+	{
+		if (m_IsRunning || numWorkers <= 0) return;
+		if (m_Workers.empty ())
+			// created once and kept until destruction, Submit reads m_Workers without lock
+			for (int i = 0; i < numWorkers; i++)
+				m_Workers.emplace_back (new Worker);
+		else if ((int)m_Workers.size () != numWorkers)
+			LogPrint (eLogWarning, "CryptoExecutor: can't change number of workers from ", m_Workers.size (), " to ", numWorkers, " on restart");
+		m_IsRunning = true;
+		for (size_t i = 0; i < m_Workers.size (); i++)
+			m_Workers[i]->thread = new std::thread (std::bind (&CryptoExecutor::Run, this, i));
+		LogPrint (eLogInfo, "CryptoExecutor: started ", m_Workers.size (), " workers");
+	}
+
+	void CryptoExecutor::Stop ()
+	{
+		{
+			std::unique_lock<std::mutex> l(m_SleepMutex);
+			if (!m_IsRunning) return;
+			// under every queue's lock, so Submit either fails or its job is queued before workers drain
+			std::vector<std::unique_lock<std::mutex> > locks;
+			for (auto& it: m_Workers)
+				locks.emplace_back (it->mutex);
+			m_IsRunning = false;
+		}
+		m_HasJobs.notify_all ();
+		for (auto& it: m_Workers)
+		{
+			it->thread->join ();
+			delete it->thread;
+			it->thread = nullptr;
+		}
+	}
+
+	int CryptoExecutor::SelectQueue ()
+	{
+		// own queue for jobs submitted by worker, round robin otherwise
+		if (t_WorkerIndex >= 0 && t_WorkerIndex < (int)m_Workers.size ())
+			return t_WorkerIndex;
+		return m_NextQueue++ % m_Workers.size ();
+	}
+
+	bool CryptoExecutor::Submit (Job job)
+	{
+		if (!m_IsRunning) return false;
+		auto& worker = m_Workers[SelectQueue ()];
+		{
+			std::unique_lock<std::mutex> l(worker->mutex);
+			if (!m_IsRunning) return false; // Stop sets it under this lock
+			worker->jobs.push_back ({ std::move (job), GetMicroseconds () });
+			m_NumQueued++; // under the same lock as pop, so it never goes below zero
+		}
+		Wake (1);
+		return true;
+	}
+
+	bool CryptoExecutor::Submit (std::vector<Job>& jobs)
+	{
+		if (!m_IsRunning) return false;
+		if (jobs.empty ()) return true;
+		auto& worker = m_Workers[SelectQueue ()];
+		auto ts = GetMicroseconds ();
+		{
+			std::unique_lock<std::mutex> l(worker->mutex);
+			if (!m_IsRunning) return false;
+			for (auto& it: jobs)
+				worker->jobs.push_back ({ std::move (it), ts });
+			m_NumQueued += jobs.size ();
+		}
+		Wake (jobs.size ());
+		jobs.clear ();
+		return true;
+	}
+
+	void CryptoExecutor::Wake (size_t num)
+	{
+		// sleeping worker checks m_NumQueued under m_SleepMutex, so notification can't be lost
+		{
+			std::unique_lock<std::mutex> l(m_SleepMutex);
+		}
+		if (num > 1)
+			m_HasJobs.notify_all ();
+		else
+			m_HasJobs.notify_one ();
+	}
+
+	bool CryptoExecutor::GetJob (int index, QueuedJob& job)
+	{
+		size_t num = m_Workers.size ();
+		for (size_t i = 0; i < num; i++)
+		{
+			auto& worker = m_Workers[(index + i) % num];
+			std::unique_lock<std::mutex> l(worker->mutex);
+			if (!worker->jobs.empty ())
+			{
+				if (!i)
+				{
+					job = std::move (worker->jobs.front ());
+					worker->jobs.pop_front ();
+				}
+				else
+				{
+					job = std::move (worker->jobs.back ());
+					worker->jobs.pop_back ();
+				}
+				m_NumQueued--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void CryptoExecutor::Run (int index)
+	{
+		t_WorkerIndex = index;
+		t_BNCtx = BN_CTX_new ();
+		while (m_IsRunning)
+		{
+			QueuedJob job;
+			if (GetJob (index, job))
+				Execute (job);
+			else
+			{
+				std::unique_lock<std::mutex> l(m_SleepMutex);
+				m_HasJobs.wait (l, [this]() { return !m_IsRunning || m_NumQueued > 0; });
+			}
+		}
+		// jobs accepted before Stop are run, callers count on their results
+		QueuedJob job;
+		while (GetJob (index, job))
+			Execute (job);
+		BN_CTX_free (t_BNCtx);
+		t_BNCtx = nullptr;
+		t_WorkerIndex = -1;
+	}
+
+	void CryptoExecutor::Execute (QueuedJob& job)
+	{
+		try
+		{
+			job.job ();
+		}
+		catch (std::exception& ex)
+		{
+			LogPrint (eLogError, "CryptoExecutor: job exception: ", ex.what ());
+		}
+		int latency = GetMicroseconds () - job.submitTime;
+		m_Latency = (m_Latency*7 + latency)/8;
+	}
+
+	BN_CTX * CryptoExecutor::GetBNCtx ()
+	{
+		return t_BNCtx;
+	}
+
+	CryptoExecutor cryptoExecutor;
+}
+}
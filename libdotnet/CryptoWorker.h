@@ -7,72 +7,87 @@
 #include <thread>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <openssl/bn.h>
 
 namespace dotnet
 {
 namespace worker
 {
+	/** process-wide executor for expensive crypto, one queue per worker, idle workers steal */
+	class CryptoExecutor
+	{
+		public:
+
+			typedef std::function<void(void)> Job;
+
+			CryptoExecutor ();
+			~CryptoExecutor ();
+
+			void Start (int numWorkers); // number of workers is kept from first start
+			void Stop ();
+			bool IsRunning () const { return m_IsRunning; };
+			int GetNumWorkers () const { return m_IsRunning ? m_Workers.size () : 0; };
+
+			bool Submit (Job job); // false if not running, caller should run job itself
+			bool Submit (std::vector<Job>& jobs); // whole batch to one queue, moved out if submitted
+
+			size_t GetQueueSize () const { return m_NumQueued; };
+			int GetLatency () const { return m_Latency; }; // from submission to completion, in microseconds
+
+			static BN_CTX * GetBNCtx (); // of current worker, nullptr for other threads
+
+		private:
+
+			struct QueuedJob
+			{
+				Job job;
+				uint64_t submitTime; // in microseconds
+			};
+
+			struct Worker
+			{
+				std::mutex mutex;
+				std::deque<QueuedJob> jobs; // own from front, steal from back
+				std::thread * thread = nullptr;
+			};
+
+			void Run (int index);
+			bool GetJob (int index, QueuedJob& job);
+			void Execute (QueuedJob& job);
+			int SelectQueue ();
+			void Wake (size_t num);
+
+		private:
+
+			std::atomic<bool> m_IsRunning;
+			std::vector<std::unique_ptr<Worker> > m_Workers; // never shrinks, filled before m_IsRunning is set
+			std::atomic<size_t> m_NumQueued;
+			std::atomic<unsigned int> m_NextQueue;
+			std::atomic<int> m_Latency;
+			std::mutex m_SleepMutex;
+			std::condition_variable m_HasJobs;
+	};
+
+	extern CryptoExecutor cryptoExecutor;
+
 	template<typename Caller>
-	struct ThreadPool
+	struct ThreadPool // result of job is posted to caller's io_service
 	{
 		typedef std::function<void(void)> ResultFunc;
 		typedef std::function<ResultFunc(void)> WorkFunc;
 		typedef std::pair<std::shared_ptr<Caller>, WorkFunc> Job;
-		typedef std::mutex mtx_t;
-		typedef std::unique_lock<mtx_t> lock_t;
-		typedef std::condition_variable cond_t;
-		ThreadPool(int workers)
-		{
-			stop = false;
-			if(workers > 0)
-			{
-				while(workers--)
-				{
-					threads.emplace_back([this] {
-							for (;;)
-							{
-								Job job;
-								{
-									lock_t lock(this->queue_mutex);
-									this->condition.wait(
-										lock, [this] { return this->stop || !this->jobs.empty(); });
-									if (this->stop && this->jobs.empty()) return;
-									job = std::move(this->jobs.front());
-									this->jobs.pop_front();
-								}
-								ResultFunc result = job.second();
-								job.first->GetService().post(result);
-							}
-					});
-				}
-			}
-		};
 
 		void Offer(const Job & job)
 		{
+			auto f = [job]()
 			{
-				lock_t lock(queue_mutex);
-				if (stop) return;
-				jobs.emplace_back(job);
-			}
-			condition.notify_one();
-		}
-
-		~ThreadPool()
-		{
-			{
-				lock_t lock(queue_mutex);
-				stop = true;
-			}
-			condition.notify_all();
-			for(auto &t: threads) t.join();
+				ResultFunc result = job.second();
+				job.first->GetService().post(result);
+			};
+			if (!cryptoExecutor.Submit (f)) f ();
 		}
-
-		std::vector<std::thread> threads;
-		std::deque<Job> jobs;
-		mtx_t queue_mutex;
-		cond_t condition;
-		bool stop;
 	};
 }
 }
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <atomic>
+#include <mutex>
 #include "Base.h"
 #include "Log.h"
 #include "Crypto.h"
@@ -17,21 +18,213 @@ using namespace dotnet::transport;
 
 namespace dotnet
 {
+	const size_t DNNP_TUNNEL_MESSAGE_SIZE = dotnet::tunnel::TUNNEL_DATA_MSG_SIZE + DNNP_HEADER_SIZE + 34; // reserved for alignment and NTCP 16 + 6 + 12
+
+	enum DNNPMessageSizeClass
+	{
+		eDNNPMessageSizeClassTunnel = 0,
+		eDNNPMessageSizeClassShort,
+		eDNNPMessageSizeClassFull,
+		eNumDNNPMessageSizeClasses
+	};
+
+	// block must fit shared_ptr's control block along with the message
+	static const size_t DNNP_MESSAGE_POOL_BLOCK_SIZES[eNumDNNPMessageSizeClasses] =
+	{
+		(sizeof (DNNPMessageBuffer<DNNP_TUNNEL_MESSAGE_SIZE>) + 64 + 63) & ~(size_t)63,
+		(sizeof (DNNPMessageBuffer<DNNP_MAX_SHORT_MESSAGE_SIZE>) + 64 + 63) & ~(size_t)63,
+		(sizeof (DNNPMessageBuffer<DNNP_MAX_MESSAGE_SIZE>) + 64 + 63) & ~(size_t)63
+	};
+
+	struct DNNPMessagePoolBlock
+	{
+		DNNPMessagePoolBlock * next;
+	};
+
+	struct DNNPMessageSharedPool
+	{
+		std::mutex mutex;
+		DNNPMessagePoolBlock * head = nullptr;
+		size_t num = 0;
+	};
+
+	static std::atomic<uint64_t> g_DNNPMessagePoolHits (0), g_DNNPMessagePoolMisses (0);
+	static std::atomic<size_t> g_DNNPMessagePoolBytesHeld (0);
+
+	static DNNPMessageSharedPool * GetDNNPMessageSharedPools ()
+	{
+		// never destroyed, messages might be released from static destructors
+		static DNNPMessageSharedPool * pools = new DNNPMessageSharedPool[eNumDNNPMessageSizeClasses];
+		return pools;
+	}
+
+	// POD, remains accessible until thread's exit
+	struct DNNPMessageThreadCache
+	{
+		DNNPMessagePoolBlock * head;
+		size_t num;
+	};
+	static thread_local DNNPMessageThreadCache t_DNNPMessageThreadCaches[eNumDNNPMessageSizeClasses];
+	static thread_local bool t_IsDNNPMessageThreadCacheDisabled = false;
+
+	static void MoveDNNPMessageBlocksToSharedPool (int sizeClass, size_t numToMove)
+	{
+		auto& cache = t_DNNPMessageThreadCaches[sizeClass];
+		auto& pool = GetDNNPMessageSharedPools ()[sizeClass];
+		DNNPMessagePoolBlock * surplus = nullptr;
+		{
+			std::unique_lock<std::mutex> l(pool.mutex);
+			while (numToMove > 0 && cache.head)
+			{
+				auto block = cache.head;
+				cache.head = block->next; cache.num--;
+				if ((pool.num + 1)*DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass] <= DNNP_MESSAGE_POOL_MAX_BYTES)
+				{
+					block->next = pool.head; pool.head = block;
+					pool.num++;
+				}
+				else
+				{
+					block->next = surplus; surplus = block;
+				}
+				numToMove--;
+			}
+		}
+		while (surplus)
+		{
+			auto block = surplus;
+			surplus = block->next;
+			g_DNNPMessagePoolBytesHeld -= DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass];
+			::operator delete (block);
+		}
+	}
+
+	struct DNNPMessageThreadCacheReleaser
+	{
+		~DNNPMessageThreadCacheReleaser ()
+		{
+			t_IsDNNPMessageThreadCacheDisabled = true;
+			for (int i = 0; i < eNumDNNPMessageSizeClasses; i++)
+				MoveDNNPMessageBlocksToSharedPool (i, t_DNNPMessageThreadCaches[i].num);
+		}
+	};
+	static thread_local DNNPMessageThreadCacheReleaser t_DNNPMessageThreadCacheReleaser;
+
+	static void * AcquireDNNPMessageBlock (int sizeClass, size_t size)
+	{
+		if (size > DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass])
+			return ::operator new (size); // should not happen
+		if (!t_IsDNNPMessageThreadCacheDisabled)
+		{
+			(void)t_DNNPMessageThreadCacheReleaser; // make sure it's constructed for this thread
+			auto& cache = t_DNNPMessageThreadCaches[sizeClass];
+			if (!cache.head)
+			{
+				// refill half of the cache from shared pool at once
+				auto& pool = GetDNNPMessageSharedPools ()[sizeClass];
+				std::unique_lock<std::mutex> l(pool.mutex);
+				while (pool.head && cache.num < DNNP_MESSAGE_POOL_THREAD_CACHE_SIZE/2)
+				{
+					auto block = pool.head;
+					pool.head = block->next; pool.num--;
+					block->next = cache.head; cache.head = block;
+					cache.num++;
+				}
+			}
+			if (cache.head)
+			{
+				auto block = cache.head;
+				cache.head = block->next; cache.num--;
+				g_DNNPMessagePoolHits++;
+				g_DNNPMessagePoolBytesHeld -= DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass];
+				return block;
+			}
+		}
+		g_DNNPMessagePoolMisses++;
+		return ::operator new (DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass]);
+	}
+
+	static void ReleaseDNNPMessageBlock (int sizeClass, void * p, size_t size)
+	{
+		if (!p) return;
+		if (size > DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass])
+		{
+			::operator delete (p);
+			return;
+		}
+		g_DNNPMessagePoolBytesHeld += DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass];
+		auto block = static_cast<DNNPMessagePoolBlock *>(p);
+		if (t_IsDNNPMessageThreadCacheDisabled)
+		{
+			// thread is exiting, return directly to shared pool
+			auto& pool = GetDNNPMessageSharedPools ()[sizeClass];
+			{
+				std::unique_lock<std::mutex> l(pool.mutex);
+				if ((pool.num + 1)*DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass] <= DNNP_MESSAGE_POOL_MAX_BYTES)
+				{
+					block->next = pool.head; pool.head = block;
+					pool.num++;
+					return;
+				}
+			}
+			g_DNNPMessagePoolBytesHeld -= DNNP_MESSAGE_POOL_BLOCK_SIZES[sizeClass];
+			::operator delete (p);
+			return;
+		}
+		(void)t_DNNPMessageThreadCacheReleaser;
+		auto& cache = t_DNNPMessageThreadCaches[sizeClass];
+		block->next = cache.head; cache.head = block;
+		cache.num++;
+		if (cache.num > DNNP_MESSAGE_POOL_THREAD_CACHE_SIZE)
+			// messages are often released by another thread than created them
+			MoveDNNPMessageBlocksToSharedPool (sizeClass, DNNP_MESSAGE_POOL_THREAD_CACHE_SIZE/2);
+	}
+
+	template<typename T, int sizeClass>
+	struct DNNPMessageAllocator
+	{
+		typedef T value_type;
+		template<typename U> struct rebind { typedef DNNPMessageAllocator<U, sizeClass> other; };
+
+		DNNPMessageAllocator () {};
+		template<typename U> DNNPMessageAllocator (const DNNPMessageAllocator<U, sizeClass>&) {}
+
+		T * allocate (size_t n) { return static_cast<T *>(AcquireDNNPMessageBlock (sizeClass, n*sizeof (T))); };
+		void deallocate (T * p, size_t n) { ReleaseDNNPMessageBlock (sizeClass, p, n*sizeof (T)); };
+	};
+
+	template<typename T, typename U, int sizeClass>
+	bool operator==(const DNNPMessageAllocator<T, sizeClass>&, const DNNPMessageAllocator<U, sizeClass>&) { return true; }
+	template<typename T, typename U, int sizeClass>
+	bool operator!=(const DNNPMessageAllocator<T, sizeClass>&, const DNNPMessageAllocator<U, sizeClass>&) { return false; }
+
+	DNNPMessagePoolStats GetDNNPMessagePoolStats ()
+	{
+		DNNPMessagePoolStats stats;
+		stats.hits = g_DNNPMessagePoolHits;
+		stats.misses = g_DNNPMessagePoolMisses;
+		stats.bytesHeld = g_DNNPMessagePoolBytesHeld;
+		return stats;
+	}
+
 	std::shared_ptr<DNNPMessage> NewDNNPMessage ()
 	{
-		return std::make_shared<DNNPMessageBuffer<DNNP_MAX_MESSAGE_SIZE> >();
+		return std::allocate_shared<DNNPMessageBuffer<DNNP_MAX_MESSAGE_SIZE> >(
+			DNNPMessageAllocator<DNNPMessageBuffer<DNNP_MAX_MESSAGE_SIZE>, eDNNPMessageSizeClassFull>());
 	}
 
 	std::shared_ptr<DNNPMessage> NewDNNPShortMessage ()
 	{
-		return std::make_shared<DNNPMessageBuffer<DNNP_MAX_SHORT_MESSAGE_SIZE> >();
+		return std::allocate_shared<DNNPMessageBuffer<DNNP_MAX_SHORT_MESSAGE_SIZE> >(
+			DNNPMessageAllocator<DNNPMessageBuffer<DNNP_MAX_SHORT_MESSAGE_SIZE>, eDNNPMessageSizeClassShort>());
 	}
 
 	std::shared_ptr<DNNPMessage> NewDNNPTunnelMessage ()
 	{
-		auto msg = new DNNPMessageBuffer<dotnet::tunnel::TUNNEL_DATA_MSG_SIZE + DNNP_HEADER_SIZE + 34>(); // reserved for alignment and NTCP 16 + 6 + 12
+		auto msg = std::allocate_shared<DNNPMessageBuffer<DNNP_TUNNEL_MESSAGE_SIZE> >(
+			DNNPMessageAllocator<DNNPMessageBuffer<DNNP_TUNNEL_MESSAGE_SIZE>, eDNNPMessageSizeClassTunnel>());
 		msg->Align (12);
-		return std::shared_ptr<DNNPMessage>(msg);
+		return msg;
 	}
 
 	std::shared_ptr<DNNPMessage> NewDNNPMessage (size_t len)
@@ -318,53 +511,82 @@ namespace dotnet
 		}
 	}
 
-	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText)
+	static int DecryptBuildRequestRecords (int num, const uint8_t * records, uint8_t * clearText, BN_CTX * ctx) // index of our record or -1
 	{
 		for (int i = 0; i < num; i++)
 		{
-			uint8_t * record = records + i*TUNNEL_BUILD_RECORD_SIZE;
+			const uint8_t * record = records + i*TUNNEL_BUILD_RECORD_SIZE;
 			if (!memcmp (record + BUILD_REQUEST_RECORD_TO_PEER_OFFSET, (const uint8_t *)dotnet::context.GetRouterInfo ().GetIdentHash (), 16))
 			{
 				LogPrint (eLogDebug, "DNNP: Build request record ", i, " is ours");
-				BN_CTX * ctx = BN_CTX_new ();
 				dotnet::context.DecryptTunnelBuildRecord (record + BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText, ctx);
-				BN_CTX_free (ctx);
-				// replace record to reply
-				if (dotnet::context.AcceptsTunnels () &&
-					dotnet::tunnel::tunnels.GetTransitTunnels ().size () <= g_MaxNumTransitTunnels &&
-					!dotnet::transport::transports.IsBandwidthExceeded () &&
-					!dotnet::transport::transports.IsTransitBandwidthExceeded ())
-				{
-					auto transitTunnel = dotnet::tunnel::CreateTransitTunnel (
-							bufbe32toh (clearText + BUILD_REQUEST_RECORD_RECEIVE_TUNNEL_OFFSET),
-							clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						    bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
-							clearText + BUILD_REQUEST_RECORD_LAYER_KEY_OFFSET,
-						    clearText + BUILD_REQUEST_RECORD_IV_KEY_OFFSET,
-							clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x80,
-						    clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET ] & 0x40);
-					dotnet::tunnel::tunnels.AddTransitTunnel (transitTunnel);
-					record[BUILD_RESPONSE_RECORD_RET_OFFSET] = 0;
-				}
-				else
-					record[BUILD_RESPONSE_RECORD_RET_OFFSET] = 30; // always reject with bandwidth reason (30)
-
-				//TODO: fill filler
-				SHA256 (record + BUILD_RESPONSE_RECORD_PADDING_OFFSET, BUILD_RESPONSE_RECORD_PADDING_SIZE + 1, // + 1 byte of ret
-					record + BUILD_RESPONSE_RECORD_HASH_OFFSET);
-				// encrypt reply
-				dotnet::crypto::CBCEncryption encryption;
-				for (int j = 0; j < num; j++)
-				{
-					encryption.SetKey (clearText + BUILD_REQUEST_RECORD_REPLY_KEY_OFFSET);
-					encryption.SetIV (clearText + BUILD_REQUEST_RECORD_REPLY_IV_OFFSET);
-					uint8_t * reply = records + j*TUNNEL_BUILD_RECORD_SIZE;
-					encryption.Encrypt(reply, TUNNEL_BUILD_RECORD_SIZE, reply);
-				}
-				return true;
+				return i;
 			}
 		}
-		return false;
+		return -1;
+	}
+
+	static void HandleBuildRequestRecord (int num, uint8_t * records, int index, const uint8_t * clearText)
+	{
+		uint8_t * record = records + index*TUNNEL_BUILD_RECORD_SIZE;
+		// replace record to reply
+		if (dotnet::context.AcceptsTunnels () &&
+			dotnet::tunnel::tunnels.GetTransitTunnels ().size () <= g_MaxNumTransitTunnels &&
+			!dotnet::transport::transports.IsBandwidthExceeded () &&
+			!dotnet::transport::transports.IsTransitBandwidthExceeded ())
+		{
+			auto transitTunnel = dotnet::tunnel::CreateTransitTunnel (
+					bufbe32toh (clearText + BUILD_REQUEST_RECORD_RECEIVE_TUNNEL_OFFSET),
+					clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
+				    bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
+					clearText + BUILD_REQUEST_RECORD_LAYER_KEY_OFFSET,
+				    clearText + BUILD_REQUEST_RECORD_IV_KEY_OFFSET,
+					clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x80,
+				    clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET ] & 0x40);
+			dotnet::tunnel::tunnels.AddTransitTunnel (transitTunnel);
+			record[BUILD_RESPONSE_RECORD_RET_OFFSET] = 0;
+		}
+		else
+			record[BUILD_RESPONSE_RECORD_RET_OFFSET] = 30; // always reject with bandwidth reason (30)
+
+		//TODO: fill filler
+		SHA256 (record + BUILD_RESPONSE_RECORD_PADDING_OFFSET, BUILD_RESPONSE_RECORD_PADDING_SIZE + 1, // + 1 byte of ret
+			record + BUILD_RESPONSE_RECORD_HASH_OFFSET);
+		// encrypt reply
+		dotnet::crypto::CBCEncryption encryption;
+		for (int j = 0; j < num; j++)
+		{
+			encryption.SetKey (clearText + BUILD_REQUEST_RECORD_REPLY_KEY_OFFSET);
+			encryption.SetIV (clearText + BUILD_REQUEST_RECORD_REPLY_IV_OFFSET);
+			uint8_t * reply = records + j*TUNNEL_BUILD_RECORD_SIZE;
+			encryption.Encrypt(reply, TUNNEL_BUILD_RECORD_SIZE, reply);
+		}
+	}
+
+	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText)
+	{
+		BN_CTX * ctx = BN_CTX_new ();
+		int index = DecryptBuildRequestRecords (num, records, clearText, ctx);
+		BN_CTX_free (ctx);
+		if (index < 0) return false;
+		HandleBuildRequestRecord (num, records, index, clearText);
+		return true;
+	}
+
+	static void ForwardTunnelBuildMsg (bool isVariable, const uint8_t * buf, size_t len, const uint8_t * clearText)
+	{
+		if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outbound tunnel
+		{
+			// so we send it to reply tunnel
+			transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
+				CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
+					isVariable ? eDNNPVariableTunnelBuildReply : eDNNPTunnelBuildReply, buf, len,
+				    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
+		}
+		else
+			transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
+				CreateDNNPMessage (isVariable ? eDNNPVariableTunnelBuild : eDNNPTunnelBuild, buf, len,
+					bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
 	}
 
 	void HandleVariableTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
@@ -398,20 +620,7 @@ namespace dotnet
 		{
 			uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
 			if (HandleBuildRequestRecords (num, buf + 1, clearText))
-			{
-				if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outboud tunnel
-				{
-					// so we send it to reply tunnel
-					transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
-							eDNNPVariableTunnelBuildReply, buf, len,
-						    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
-				}
-				else
-					transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						CreateDNNPMessage (eDNNPVariableTunnelBuild, buf, len,
-							bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
-			}
+				ForwardTunnelBuildMsg (true, buf, len, clearText);
 		}
 	}
 
@@ -424,20 +633,51 @@ namespace dotnet
 		}
 		uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
 		if (HandleBuildRequestRecords (NUM_TUNNEL_BUILD_RECORDS, buf, clearText))
+			ForwardTunnelBuildMsg (false, buf, len, clearText);
+	}
+
+	static bool GetTunnelBuildRecords (std::shared_ptr<DNNPMessage> msg, int& num, uint8_t *& records, size_t& len)
+	{
+		len = msg->GetPayloadLength ();
+		if (msg->GetSize () < len) len = msg->GetSize ();
+		records = msg->GetPayload ();
+		if (msg->GetTypeID () == eDNNPVariableTunnelBuild)
 		{
-			if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outbound tunnel
+			if (!len) return false;
+			num = records[0];
+			records++;
+			if (len < num*TUNNEL_BUILD_RECORD_SIZE + 1)
 			{
-				// so we send it to reply tunnel
-				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-					CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
-						eDNNPTunnelBuildReply, buf, len,
-					    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
+				LogPrint (eLogError, "VaribleTunnelBuild message of ", num, " records is too short ", len);
+				return false;
+			}
+		}
+		else
+		{
+			num = NUM_TUNNEL_BUILD_RECORDS;
+			if (len < NUM_TUNNEL_BUILD_RECORDS*TUNNEL_BUILD_RECORD_SIZE)
+			{
+				LogPrint (eLogError, "TunnelBuild message is too short ", len);
+				return false;
 			}
-			else
-				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-					CreateDNNPMessage (eDNNPTunnelBuild, buf, len,
-						bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
 		}
+		return true;
+	}
+
+	void DecryptTunnelBuildRequest (TunnelBuildRequest& request, BN_CTX * ctx)
+	{
+		request.record = -1;
+		int num; uint8_t * records; size_t len;
+		if (request.msg && GetTunnelBuildRecords (request.msg, num, records, len))
+			request.record = DecryptBuildRequestRecords (num, records, request.clearText, ctx);
+	}
+
+	void HandleTunnelBuildRequest (TunnelBuildRequest& request)
+	{
+		int num; uint8_t * records; size_t len;
+		if (request.record < 0 || !GetTunnelBuildRecords (request.msg, num, records, len)) return;
+		HandleBuildRequestRecord (num, records, request.record, request.clearText);
+		ForwardTunnelBuildMsg (request.msg->GetTypeID () == eDNNPVariableTunnelBuild, request.msg->GetPayload (), len, request.clearText);
 	}
 
 	void HandleVariableTunnelBuildReplyMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
@@ -229,6 +229,16 @@ namespace tunnel
 		uint8_t m_Buffer[sz + 32]; // 16 alignment + 16 padding
 	};
 
+	// message buffers pool
+	const size_t DNNP_MESSAGE_POOL_THREAD_CACHE_SIZE = 64; // buffers per size class per thread
+	const size_t DNNP_MESSAGE_POOL_MAX_BYTES = 16*1024*1024; // per size class in shared pool
+	struct DNNPMessagePoolStats
+	{
+		uint64_t hits, misses;
+		size_t bytesHeld; // in shared pool and threads' caches
+	};
+	DNNPMessagePoolStats GetDNNPMessagePoolStats ();
+
 	std::shared_ptr<DNNPMessage> NewDNNPMessage ();
 	std::shared_ptr<DNNPMessage> NewDNNPShortMessage ();
 	std::shared_ptr<DNNPMessage> NewDNNPTunnelMessage ();
@@ -256,6 +266,16 @@ namespace tunnel
 	void HandleVariableTunnelBuildReplyMsg (uint32_t replyMsgID, uint8_t * buf, size_t len);
 	void HandleTunnelBuildMsg (uint8_t * buf, size_t len);
 
+	struct TunnelBuildRequest // TunnelBuild or VariableTunnelBuild with our record decrypted
+	{
+		std::shared_ptr<DNNPMessage> msg;
+		int record; // index of our record, -1 if not found
+		uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
+		uint64_t postTime; // microseconds, steady clock
+	};
+	void DecryptTunnelBuildRequest (TunnelBuildRequest& request, BN_CTX * ctx); // ElGamal, any thread
+	void HandleTunnelBuildRequest (TunnelBuildRequest& request); // accept or reject and forward, tunnels thread
+
 	std::shared_ptr<DNNPMessage> CreateTunnelDataMsg (const uint8_t * buf);
 	std::shared_ptr<DNNPMessage> CreateTunnelDataMsg (uint32_t tunnelID, const uint8_t * payload);
 	std::shared_ptr<DNNPMessage> CreateEmptyTunnelDataMsg ();
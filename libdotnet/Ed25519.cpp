@@ -1,130 +1,590 @@
+#include <string.h>
+#include <vector>
 #include <openssl/sha.h>
 #include "Log.h"
 #include "Crypto.h"
+#include "DotNetEndian.h"
 #include "Ed25519.h"
 
 namespace dotnet
 {
 namespace crypto
 {
+#if defined(__SIZEOF_INT128__)
+	__extension__ typedef unsigned __int128 uint128_t;
+
+	static inline uint128_t Mul64 (uint64_t a, uint64_t b)
+	{
+		return (uint128_t)a * b;
+	}
+#else
+	// 32-bit platforms
+	struct uint128_t
+	{
+		uint64_t lo, hi;
+
+		uint128_t (uint64_t l = 0): lo (l), hi (0) {}
+		uint128_t& operator+= (const uint128_t& other) { lo += other.lo; hi += other.hi + (lo < other.lo); return *this; }
+		uint128_t operator+ (const uint128_t& other) const { uint128_t r = *this; r += other; return r; }
+		uint128_t operator>> (int n) const
+		{
+			uint128_t r;
+			if (!n) r = *this;
+			else if (n < 64) { r.lo = (lo >> n) | (hi << (64 - n)); r.hi = hi >> n; }
+			else r.lo = hi >> (n - 64);
+			return r;
+		}
+		explicit operator uint64_t () const { return lo; }
+	};
+
+	static inline uint128_t Mul64 (uint64_t a, uint64_t b)
+	{
+		uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+		uint64_t p00 = a0*b0, p01 = a0*b1, p10 = a1*b0, p11 = a1*b1;
+		uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+		uint128_t r;
+		r.lo = (mid << 32) | (uint32_t)p00;
+		r.hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+		return r;
+	}
+#endif
+
+	// GF(2^255-19) arithmetic, limbs of all elements are kept below 2^52
+	static const uint64_t MASK51 = (1ULL << 51) - 1;
+
+	static inline void FeCopy (Field25519 r, const Field25519 a)
+	{
+		memcpy (r, a, sizeof (Field25519));
+	}
+
+	static inline void FeZero (Field25519 r)
+	{
+		memset (r, 0, sizeof (Field25519));
+	}
+
+	static inline void FeOne (Field25519 r)
+	{
+		FeZero (r); r[0] = 1;
+	}
+
+	static inline void FeCarry (Field25519 h)
+	{
+		uint64_t c;
+		c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+		c = h[1] >> 51; h[1] &= MASK51; h[2] += c;
+		c = h[2] >> 51; h[2] &= MASK51; h[3] += c;
+		c = h[3] >> 51; h[3] &= MASK51; h[4] += c;
+		c = h[4] >> 51; h[4] &= MASK51; h[0] += c*19;
+	}
+
+	static inline void FeAdd (Field25519 r, const Field25519 a, const Field25519 b)
+	{
+		for (int i = 0; i < 5; i++) r[i] = a[i] + b[i];
+		FeCarry (r);
+	}
+
+	static inline void FeSub (Field25519 r, const Field25519 a, const Field25519 b)
+	{
+		// a + 4*q - b
+		r[0] = a[0] + 0x1FFFFFFFFFFFB4ULL - b[0];
+		for (int i = 1; i < 5; i++) r[i] = a[i] + 0x1FFFFFFFFFFFFCULL - b[i];
+		FeCarry (r);
+	}
+
+	static inline void FeNeg (Field25519 r, const Field25519 a)
+	{
+		Field25519 zero = {0};
+		FeSub (r, zero, a);
+	}
+
+	static inline void FeReduce (Field25519 h, uint128_t r0, uint128_t r1, uint128_t r2, uint128_t r3, uint128_t r4)
+	{
+		r1 += r0 >> 51; h[0] = (uint64_t)r0 & MASK51;
+		r2 += r1 >> 51; h[1] = (uint64_t)r1 & MASK51;
+		r3 += r2 >> 51; h[2] = (uint64_t)r2 & MASK51;
+		r4 += r3 >> 51; h[3] = (uint64_t)r3 & MASK51;
+		h[0] += (uint64_t)(r4 >> 51) * 19; h[4] = (uint64_t)r4 & MASK51;
+		h[1] += h[0] >> 51; h[0] &= MASK51;
+	}
+
+	static void FeMul (Field25519 r, const Field25519 a, const Field25519 b)
+	{
+		uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+		uint64_t b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3], b4 = b[4];
+		uint64_t b1_19 = b1*19, b2_19 = b2*19, b3_19 = b3*19, b4_19 = b4*19;
+		FeReduce (r,
+			Mul64 (a0, b0) + Mul64 (a1, b4_19) + Mul64 (a2, b3_19) + Mul64 (a3, b2_19) + Mul64 (a4, b1_19),
+			Mul64 (a0, b1) + Mul64 (a1, b0) + Mul64 (a2, b4_19) + Mul64 (a3, b3_19) + Mul64 (a4, b2_19),
+			Mul64 (a0, b2) + Mul64 (a1, b1) + Mul64 (a2, b0) + Mul64 (a3, b4_19) + Mul64 (a4, b3_19),
+			Mul64 (a0, b3) + Mul64 (a1, b2) + Mul64 (a2, b1) + Mul64 (a3, b0) + Mul64 (a4, b4_19),
+			Mul64 (a0, b4) + Mul64 (a1, b3) + Mul64 (a2, b2) + Mul64 (a3, b1) + Mul64 (a4, b0));
+	}
+
+	static void FeSqr (Field25519 r, const Field25519 a)
+	{
+		uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+		uint64_t d0 = a0*2, d1 = a1*2, d2 = a2*2, d3 = a3*2;
+		uint64_t a3_19 = a3*19, a4_19 = a4*19;
+		FeReduce (r,
+			Mul64 (a0, a0) + Mul64 (d1, a4_19) + Mul64 (d2, a3_19),
+			Mul64 (d0, a1) + Mul64 (d2, a4_19) + Mul64 (a3, a3_19),
+			Mul64 (d0, a2) + Mul64 (a1, a1) + Mul64 (d3, a4_19),
+			Mul64 (d0, a3) + Mul64 (d1, a2) + Mul64 (a4, a4_19),
+			Mul64 (d0, a4) + Mul64 (d1, a3) + Mul64 (a2, a2));
+	}
+
+	static void FeSqrN (Field25519 r, const Field25519 a, int n)
+	{
+		FeSqr (r, a);
+		for (int i = 1; i < n; i++) FeSqr (r, r);
+	}
+
+	static void FePow2250 (Field25519 r, Field25519 z11, const Field25519 z) // r = z^(2^250-1), z11 = z^11
+	{
+		Field25519 t0, t1, t2;
+		FeSqr (t0, z); // z^2
+		FeSqrN (t1, t0, 2); // z^8
+		FeMul (t1, z, t1); // z^9
+		FeMul (z11, t0, t1); // z^11
+		FeSqr (t0, z11); // z^22
+		FeMul (t1, t1, t0); // z^(2^5-1)
+		FeSqrN (t0, t1, 5); FeMul (t1, t0, t1); // z^(2^10-1)
+		FeSqrN (t0, t1, 10); FeMul (t0, t0, t1); // z^(2^20-1)
+		FeSqrN (t2, t0, 20); FeMul (t0, t2, t0); // z^(2^40-1)
+		FeSqrN (t0, t0, 10); FeMul (t1, t0, t1); // z^(2^50-1)
+		FeSqrN (t0, t1, 50); FeMul (t0, t0, t1); // z^(2^100-1)
+		FeSqrN (t2, t0, 100); FeMul (t0, t2, t0); // z^(2^200-1)
+		FeSqrN (t0, t0, 50); FeMul (r, t0, t1); // z^(2^250-1)
+	}
+
+	static void FeInvert (Field25519 r, const Field25519 z) // z^(q-2)
+	{
+		Field25519 t, z11;
+		FePow2250 (t, z11, z);
+		FeSqrN (t, t, 5); // z^(2^255-32)
+		FeMul (r, t, z11); // z^(2^255-21)
+	}
+
+	static void FePow22523 (Field25519 r, const Field25519 z) // z^((q-5)/8)
+	{
+		Field25519 t, z11;
+		FePow2250 (t, z11, z);
+		FeSqrN (t, t, 2); // z^(2^252-4)
+		FeMul (r, t, z); // z^(2^252-3)
+	}
+
+	static void FeFromBytes (Field25519 h, const uint8_t * s) // 32 bytes Little Endian, highest bit ignored
+	{
+		uint64_t w0 = le64toh (buf64toh (s)), w1 = le64toh (buf64toh (s + 8)),
+			w2 = le64toh (buf64toh (s + 16)), w3 = le64toh (buf64toh (s + 24));
+		h[0] = w0 & MASK51;
+		h[1] = ((w0 >> 51) | (w1 << 13)) & MASK51;
+		h[2] = ((w1 >> 38) | (w2 << 26)) & MASK51;
+		h[3] = ((w2 >> 25) | (w3 << 39)) & MASK51;
+		h[4] = (w3 >> 12) & MASK51;
+	}
+
+	static void FeToBytes (uint8_t * s, const Field25519 h) // canonical
+	{
+		Field25519 t;
+		FeCopy (t, h);
+		FeCarry (t); FeCarry (t); // t < 2^255
+		// subtract q if t >= q, i.e. t + 19 >= 2^255
+		uint64_t c = (t[0] + 19) >> 51;
+		c = (t[1] + c) >> 51; c = (t[2] + c) >> 51; c = (t[3] + c) >> 51; c = (t[4] + c) >> 51;
+		t[0] += 19*c;
+		c = t[0] >> 51; t[0] &= MASK51; t[1] += c;
+		c = t[1] >> 51; t[1] &= MASK51; t[2] += c;
+		c = t[2] >> 51; t[2] &= MASK51; t[3] += c;
+		c = t[3] >> 51; t[3] &= MASK51; t[4] += c;
+		t[4] &= MASK51;
+		htole64buf (s, t[0] | (t[1] << 51));
+		htole64buf (s + 8, (t[1] >> 13) | (t[2] << 38));
+		htole64buf (s + 16, (t[2] >> 26) | (t[3] << 25));
+		htole64buf (s + 24, (t[3] >> 39) | (t[4] << 12));
+	}
+
+	static bool FeIsZero (const Field25519 a)
+	{
+		uint8_t s[32], r = 0;
+		FeToBytes (s, a);
+		for (int i = 0; i < 32; i++) r |= s[i];
+		return !r;
+	}
+
+	static int FeIsNegative (const Field25519 a)
+	{
+		uint8_t s[32];
+		FeToBytes (s, a);
+		return s[0] & 1;
+	}
+
+	static inline void FeCMove (Field25519 r, const Field25519 a, uint64_t mask) // r = a if mask is all ones
+	{
+		for (int i = 0; i < 5; i++) r[i] ^= (r[i] ^ a[i]) & mask;
+	}
+
+	static inline void FeCSwap (Field25519 a, Field25519 b, uint64_t mask)
+	{
+		for (int i = 0; i < 5; i++)
+		{
+			uint64_t x = (a[i] ^ b[i]) & mask;
+			a[i] ^= x; b[i] ^= x;
+		}
+	}
+
+	// arithmetic modulo l = 2^252 + 27742317777372353535851937790883648493, Barrett reduction
+	static const uint64_t L[4] = { 0x5812631A5CF5D3EDULL, 0x14DEF9DEA2F79CD6ULL, 0, 0x1000000000000000ULL };
+	static const uint64_t MU[5] = { 0xED9CE5A30A2C131BULL, 0x2106215D086329A7ULL, 0xFFFFFFFFFFFFFFEBULL,
+		0xFFFFFFFFFFFFFFFFULL, 0xF }; // 2^512/l
+
+	static void ScMul (uint64_t * r, const uint64_t * a, int na, const uint64_t * b, int nb) // r is na + nb limbs
+	{
+		memset (r, 0, (na + nb)*sizeof (uint64_t));
+		for (int i = 0; i < na; i++)
+		{
+			uint64_t carry = 0;
+			for (int j = 0; j < nb; j++)
+			{
+				uint128_t t = Mul64 (a[i], b[j]) + r[i + j] + carry;
+				r[i + j] = (uint64_t)t;
+				carry = (uint64_t)(t >> 64);
+			}
+			r[i + nb] = carry;
+		}
+	}
+
+	static uint64_t ScSub (uint64_t * r, const uint64_t * a, const uint64_t * b, int n) // returns borrow
+	{
+		uint64_t borrow = 0;
+		for (int i = 0; i < n; i++)
+		{
+			uint64_t d = a[i] - b[i];
+			uint64_t b1 = a[i] < b[i], b2 = d < borrow;
+			r[i] = d - borrow;
+			borrow = b1 | b2;
+		}
+		return borrow;
+	}
+
+	static void ScReduce (uint64_t * r, const uint64_t * x) // x is 8 limbs, r is 4 limbs
+	{
+		uint64_t q[10], t[9], l[5] = { L[0], L[1], L[2], L[3], 0 }, rr[5], s[5];
+		ScMul (q, x + 3, 5, MU, 5); // (x/2^192)*mu
+		ScMul (t, q + 5, 5, L, 4); // (x/2^192)*mu/2^320*l
+		ScSub (rr, x, t, 5); // mod 2^320, below 3*l
+		for (int i = 0; i < 2; i++)
+		{
+			uint64_t mask = ScSub (s, rr, l, 5) - 1; // all ones if rr >= l
+			for (int j = 0; j < 5; j++) rr[j] ^= (rr[j] ^ s[j]) & mask;
+		}
+		memcpy (r, rr, 32);
+	}
+
+	static void ScLoad (uint64_t * r, const uint8_t * buf, int n)
+	{
+		for (int i = 0; i < n; i++)
+			r[i] = le64toh (buf64toh (buf + 8*i));
+	}
+
+	static void ScStore (uint8_t * buf, const uint64_t * a)
+	{
+		for (int i = 0; i < 4; i++)
+			htole64buf (buf + 8*i, a[i]);
+	}
+
+	static void ScReduce64 (uint8_t * r, const uint8_t * buf) // buf is 64 bytes Little Endian, r = buf % l
+	{
+		uint64_t x[8], res[4];
+		ScLoad (x, buf, 8);
+		ScReduce (res, x);
+		ScStore (r, res);
+	}
+
+	static void ScMulAdd (uint8_t * r, const uint8_t * a, const uint8_t * b, const uint8_t * c) // r = (a*b + c) % l
+	{
+		uint64_t a1[4], b1[4], c1[4], x[8], res[4];
+		ScLoad (a1, a, 4); ScLoad (b1, b, 4); ScLoad (c1, c, 4);
+		ScMul (x, a1, 4, b1, 4);
+		uint64_t carry = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			uint128_t t = uint128_t (x[i]) + (i < 4 ? c1[i] : 0) + carry;
+			x[i] = (uint64_t)t;
+			carry = (uint64_t)(t >> 64);
+		}
+		ScReduce (res, x);
+		ScStore (r, res);
+	}
+
+	static bool ScIsReduced (const uint8_t * s) // s < l
+	{
+		uint64_t s1[4], t[4];
+		ScLoad (s1, s, 4);
+		return ScSub (t, s1, L, 4);
+	}
+
+	static void Slide (int8_t * r, const uint8_t * a) // a as 256 odd digits from -15 to 15 or zero, mostly zero
+	{
+		for (int i = 0; i < 256; i++)
+			r[i] = 1 & (a[i >> 3] >> (i & 7));
+		for (int i = 0; i < 256; i++)
+		{
+			if (!r[i]) continue;
+			for (int b = 1; b <= 6 && i + b < 256; b++)
+			{
+				if (!r[i + b]) continue;
+				if (r[i] + (r[i + b] << b) <= 15)
+				{
+					r[i] += r[i + b] << b;
+					r[i + b] = 0;
+				}
+				else if (r[i] - (r[i + b] << b) >= -15)
+				{
+					r[i] -= r[i + b] << b;
+					for (int k = i + b; k < 256; k++)
+					{
+						if (!r[k])
+						{
+							r[k] = 1;
+							break;
+						}
+						r[k] = 0;
+					}
+				}
+				else
+					break;
+			}
+		}
+	}
+
+	static void SetIdentity (EDDSAPoint& p)
+	{
+		FeZero (p.x); FeOne (p.y); FeOne (p.z); FeZero (p.t);
+	}
+
+	static void SetIdentity (EDDSAPointPrecomputed& p)
+	{
+		FeOne (p.yPlusX); FeOne (p.yMinusX); FeOne (p.z); FeZero (p.t2d);
+	}
+
+	static void Negate (EDDSAPointPrecomputed& r, const EDDSAPointPrecomputed& p)
+	{
+		FeCopy (r.yPlusX, p.yMinusX); FeCopy (r.yMinusX, p.yPlusX);
+		FeCopy (r.z, p.z); FeNeg (r.t2d, p.t2d);
+	}
+
+	static void AddPrecomputed (EDDSAPoint& r, const EDDSAPoint& p, const EDDSAPointPrecomputed& q)
+	{
+		Field25519 A, B, C, D, E, F, G, H;
+		FeSub (A, p.y, p.x);
+		FeMul (A, A, q.yMinusX); // A = (y1-x1)*(y2-x2)
+		FeAdd (B, p.y, p.x);
+		FeMul (B, B, q.yPlusX); // B = (y1+x1)*(y2+x2)
+		FeMul (C, p.t, q.t2d); // C = 2*d*t1*t2
+		FeMul (D, p.z, q.z);
+		FeAdd (D, D, D); // D = 2*z1*z2
+		FeSub (E, B, A);
+		FeSub (F, D, C);
+		FeAdd (G, D, C);
+		FeAdd (H, B, A);
+		FeMul (r.x, E, F);
+		FeMul (r.y, G, H);
+		FeMul (r.t, E, H);
+		FeMul (r.z, F, G);
+	}
+
 	Ed25519::Ed25519 ()
 	{
-		BN_CTX * ctx = BN_CTX_new ();
-		BIGNUM * tmp = BN_new ();
-
-		q = BN_new ();
-		// 2^255-19
-		BN_set_bit (q, 255); // 2^255
-		BN_sub_word (q, 19);
-
-		l = BN_new ();
-		// 2^252 + 27742317777372353535851937790883648493
-		BN_set_bit (l, 252);
-		two_252_2 = BN_dup (l);
-		BN_dec2bn (&tmp, "27742317777372353535851937790883648493");
-		BN_add (l, l, tmp);
-		BN_sub_word (two_252_2, 2); // 2^252 - 2
-
-		 // -121665*inv(121666)
-		d = BN_new ();
-		BN_set_word (tmp, 121666);
-		BN_mod_inverse (tmp, tmp, q, ctx);
-		BN_set_word (d, 121665);
-		BN_set_negative (d, 1);
-		BN_mul (d, d, tmp, ctx);
-
-		// 2^((q-1)/4)
-		I = BN_new ();
-		BN_free (tmp);
-		tmp = BN_dup (q);
-		BN_sub_word (tmp, 1);
-		BN_div_word (tmp, 4);
-		BN_set_word (I, 2);
-		BN_mod_exp (I, I, tmp, q, ctx);
-		BN_free (tmp);
+		// -121665*inv(121666)
+		Field25519 tmp = {121666}, c121665 = {121665};
+		FeInvert (tmp, tmp);
+		FeMul (d, c121665, tmp);
+		FeNeg (d, d);
+		FeAdd (d2, d, d);
+
+		// 2^((q-1)/4) = 2^((q-5)/8)^2*2
+		Field25519 two = {2};
+		FePow22523 (I, two);
+		FeSqr (I, I);
+		FeMul (I, I, two);
 
 		// 4*inv(5)
-		BIGNUM * By = BN_new ();
-		BN_set_word (By, 5);
-		BN_mod_inverse (By, By, q, ctx);
-		BN_mul_word (By, 4);
-		BIGNUM * Bx = RecoverX (By, ctx);
-		BN_mod (Bx, Bx, q, ctx); // % q
-		BN_mod (By, By, q, ctx); // % q
+		Field25519 four = {4}, five = {5};
+		FeInvert (B.y, five);
+		FeMul (B.y, B.y, four);
+		RecoverX (B.x, B.y);
+		if (FeIsNegative (B.x)) FeNeg (B.x, B.x);
+		FeOne (B.z);
+		FeMul (B.t, B.x, B.y);
 
 		// precalculate Bi256 table
-		Bi256Carry = { Bx, By };  // B
+		EDDSAPoint P = B; // 256^i*B
 		for (int i = 0; i < 32; i++)
 		{
-			Bi256[i][0] = Bi256Carry; // first point
-			for (int j = 1; j < 128; j++)
-				Bi256[i][j] = Sum (Bi256[i][j-1], Bi256[i][0], ctx); // (256+j+1)^i*B
-			Bi256Carry = Bi256[i][127];
-			for (int j = 0; j < 128; j++) // add first point 128 more times
-				Bi256Carry = Sum (Bi256Carry, Bi256[i][0], ctx);
+			EDDSAPoint Q = P;
+			Precompute (Bi256[i][0], P);
+			for (int j = 1; j < 8; j++)
+			{
+				AddPrecomputed (Q, Q, Bi256[i][0]);
+				Precompute (Bi256[i][j], Q); // (j+1)*256^i*B
+			}
+			for (int j = 0; j < 8; j++) Double (P);
 		}
 
-		BN_CTX_free (ctx);
+		// odd multiples of B
+		EDDSAPoint Q = B, B2 = B;
+		Double (B2);
+		EDDSAPointPrecomputed B2p;
+		Precompute (B2p, B2);
+		Precompute (Bodd[0], Q);
+		for (int i = 1; i < 8; i++)
+		{
+			AddPrecomputed (Q, Q, B2p);
+			Precompute (Bodd[i], Q);
+		}
 	}
 
-	Ed25519::Ed25519 (const Ed25519& other): q (BN_dup (other.q)), l (BN_dup (other.l)),
-		d (BN_dup (other.d)), I (BN_dup (other.I)), two_252_2 (BN_dup (other.two_252_2)),
-		Bi256Carry (other.Bi256Carry)
-	{
-		for (int i = 0; i < 32; i++)
-			for (int j = 0; j < 128; j++)
-				Bi256[i][j] = other.Bi256[i][j];
-	}
+	Ed25519::Ed25519 (const Ed25519& other) = default;
 
 	Ed25519::~Ed25519 ()
 	{
-		BN_free (q);
-		BN_free (l);
-		BN_free (d);
-		BN_free (I);
-		BN_free (two_252_2);
 	}
 
 
 	EDDSAPoint Ed25519::GeneratePublicKey (const uint8_t * expandedPrivateKey, BN_CTX * ctx) const
 	{
-		return MulB (expandedPrivateKey, ctx); // left half of expanded key, considered as Little Endian
+		return MulB (expandedPrivateKey); // left half of expanded key, considered as Little Endian
 	}
 
 	EDDSAPoint Ed25519::DecodePublicKey (const uint8_t * buf, BN_CTX * ctx) const
 	{
-		return DecodePoint (buf, ctx);
+		return DecodePoint (buf);
 	}
 
 	void Ed25519::EncodePublicKey (const EDDSAPoint& publicKey, uint8_t * buf, BN_CTX * ctx) const
 	{
-		EncodePoint (Normalize (publicKey, ctx), buf);
+		EncodePoint (publicKey, buf);
 	}
 
 	bool Ed25519::Verify (const EDDSAPoint& publicKey, const uint8_t * digest, const uint8_t * signature) const
 	{
-		BN_CTX * ctx = BN_CTX_new ();
-		BIGNUM * h = DecodeBN<64> (digest);
 		// signature 0..31 - R, 32..63 - S
+		if (!ScIsReduced (signature + EDDSA25519_SIGNATURE_LENGTH/2))
+		{
+			LogPrint (eLogError, "25519 signature S is not reduced");
+			return false;
+		}
+		uint8_t h[32];
+		ScReduce64 (h, digest); // public key is multiple of B, but B%l = 0
 		// B*S = R + PK*h => R = B*S - PK*h
 		// we don't decode R, but encode (B*S - PK*h)
-		auto Bs = MulB (signature + EDDSA25519_SIGNATURE_LENGTH/2, ctx); // B*S;
-		BN_mod (h, h, l, ctx); // public key is multiple of B, but B%l = 0
-		auto PKh = Mul (publicKey, h, ctx); // PK*h
+		EDDSAPoint minusPK = publicKey;
+		FeNeg (minusPK.x, minusPK.x);
+		FeNeg (minusPK.t, minusPK.t);
 		uint8_t diff[32];
-		EncodePoint (Normalize (Sum (Bs, -PKh, ctx), ctx), diff); // Bs - PKh encoded
+		auto P = DoubleMulVartime (minusPK, h, signature + EDDSA25519_SIGNATURE_LENGTH/2); // Bs - PKh
+		EncodePoint (P, diff);
 		bool passed = !memcmp (signature, diff, 32); // R
-		BN_free (h);
-		BN_CTX_free (ctx);
+		if (!passed)
+		{
+			// cofactored equation 8*(B*S - PK*h - R) = 0, the same as VerifyBatch
+			// differs only if R or public key has small order component
+			EDDSAPoint R;
+			if (DecodePoint (signature, R, true))
+			{
+				FeNeg (R.x, R.x); FeNeg (R.t, R.t);
+				passed = IsSmallOrder (Sum (P, R));
+			}
+		}
 		if (!passed)
 			LogPrint (eLogError, "25519 signature verification failed");
 		return passed;
 	}
 
-	void Ed25519::Sign (const uint8_t * expandedPrivateKey, const uint8_t * publicKeyEncoded, 
+	bool Ed25519::IsSmallOrder (EDDSAPoint p) const
+	{
+		// 8*p is identity (0, z, z, 0)
+		for (int i = 0; i < 3; i++) Double (p);
+		Field25519 t;
+		FeSub (t, p.y, p.z);
+		return FeIsZero (p.x) && FeIsZero (t);
+	}
+
+	bool Ed25519::VerifyBatch (const uint8_t * const * publicKeys, const uint8_t * const * digests,
+		const uint8_t * const * signatures, size_t num) const
+	{
+		// 8*(sum(z_i*S_i)*B - sum(z_i*R_i) - sum(z_i*h_i*A_i)) = 0 for random 128 bits z_i
+		// cofactored, otherwise small order components of R_i and A_i would be accepted or not depending on z_i
+		// Verify uses the same equation if R doesn't match exactly
+		if (!num) return true;
+		size_t numPoints = 2*num; // R_i and A_i
+		std::vector<EDDSAPointPrecomputed> tables (numPoints*8); // odd multiples of points
+		std::vector<int8_t> slides (numPoints*256);
+		uint8_t sB[32] = {0}, z[32] = {0}, zero[32] = {0}, h[32], zh[32];
+		EDDSAPoint P, P2, Q;
+		EDDSAPointPrecomputed p2;
+		for (size_t i = 0; i < num; i++)
+		{
+			const uint8_t * S = signatures[i] + EDDSA25519_SIGNATURE_LENGTH/2;
+			if (!ScIsReduced (S)) return false;
+			RAND_bytes (z, 16);
+			ScMulAdd (sB, z, S, sB); // sB += z_i*S_i
+			ScReduce64 (h, digests[i]);
+			ScMulAdd (zh, z, h, zero);
+			Slide (slides.data () + 2*i*256, z);
+			Slide (slides.data () + (2*i + 1)*256, zh);
+			// we don't accept R if can't be encoded back the same way
+			for (int j = 0; j < 2; j++)
+			{
+				if (!DecodePoint (j ? publicKeys[i] : signatures[i], P, !j)) return false;
+				FeNeg (P.x, P.x); FeNeg (P.t, P.t); // -R_i, -A_i
+				auto table = tables.data () + (2*i + j)*8;
+				Q = P2 = P;
+				Double (P2);
+				Precompute (p2, P2);
+				Precompute (table[0], Q);
+				for (int k = 1; k < 8; k++)
+				{
+					AddPrecomputed (Q, Q, p2);
+					Precompute (table[k], Q);
+				}
+			}
+		}
+		int8_t bslide[256];
+		Slide (bslide, sB);
+
+		EDDSAPoint res;
+		SetIdentity (res);
+		EDDSAPointPrecomputed minus;
+		for (int i = 255; i >= 0; i--)
+		{
+			Double (res);
+			for (size_t j = 0; j < numPoints; j++)
+			{
+				int8_t d = slides[j*256 + i];
+				if (d > 0)
+					AddPrecomputed (res, res, tables[j*8 + d/2]);
+				else if (d < 0)
+				{
+					Negate (minus, tables[j*8 + (-d)/2]);
+					AddPrecomputed (res, res, minus);
+				}
+			}
+			if (bslide[i] > 0)
+				AddPrecomputed (res, res, Bodd[bslide[i]/2]);
+			else if (bslide[i] < 0)
+			{
+				Negate (minus, Bodd[(-bslide[i])/2]);
+				AddPrecomputed (res, res, minus);
+			}
+		}
+		return IsSmallOrder (res);
+	}
+
+	void Ed25519::Sign (const uint8_t * expandedPrivateKey, const uint8_t * publicKeyEncoded,
 		const uint8_t * buf, size_t len, uint8_t * signature) const
 	{
-		BN_CTX * bnCtx = BN_CTX_new ();
 		// calculate r
 		SHA512_CTX ctx;
 		SHA512_Init (&ctx);
@@ -132,31 +592,27 @@ namespace crypto
 		SHA512_Update (&ctx, buf, len); // data
 		uint8_t digest[64];
 		SHA512_Final (digest, &ctx);
-		BIGNUM * r = DecodeBN<32> (digest); // DecodeBN<64> (digest); // for test vectors
+		uint8_t r[32];
+		ScReduce64 (r, digest); // % l
 		// calculate R
 		uint8_t R[EDDSA25519_SIGNATURE_LENGTH/2]; // we must use separate buffer because signature might be inside buf
-		EncodePoint (Normalize (MulB (digest, bnCtx), bnCtx), R); // EncodePoint (Mul (B, r, bnCtx), R); // for test vectors
+		EncodePoint (MulB (r), R);
 		// calculate S
 		SHA512_Init (&ctx);
 		SHA512_Update (&ctx, R, EDDSA25519_SIGNATURE_LENGTH/2); // R
 		SHA512_Update (&ctx, publicKeyEncoded, EDDSA25519_PUBLIC_KEY_LENGTH); // public key
 		SHA512_Update (&ctx, buf, len); // data
 		SHA512_Final (digest, &ctx);
-		BIGNUM * h = DecodeBN<64> (digest);
+		uint8_t h[32];
+		ScReduce64 (h, digest); // % l
 		// S = (r + h*a) % l
-		BIGNUM * a = DecodeBN<EDDSA25519_PRIVATE_KEY_LENGTH> (expandedPrivateKey); // left half of expanded key
-		BN_mod_mul (h, h, a, l, bnCtx); // %l
-		BN_mod_add (h, h, r, l, bnCtx); // %l
 		memcpy (signature, R, EDDSA25519_SIGNATURE_LENGTH/2);
-		EncodeBN (h, signature + EDDSA25519_SIGNATURE_LENGTH/2, EDDSA25519_SIGNATURE_LENGTH/2); // S
-		BN_free (r); BN_free (h); BN_free (a);
-		BN_CTX_free (bnCtx);
+		ScMulAdd (signature + EDDSA25519_SIGNATURE_LENGTH/2, h, expandedPrivateKey, r); // S, a is left half of expanded key
 	}
 
-	void Ed25519::SignRedDSA (const uint8_t * privateKey, const uint8_t * publicKeyEncoded, 
+	void Ed25519::SignRedDSA (const uint8_t * privateKey, const uint8_t * publicKeyEncoded,
 		const uint8_t * buf, size_t len, uint8_t * signature) const
 	{
-		BN_CTX * bnCtx = BN_CTX_new ();
 		// T = 80 random bytes
 		uint8_t T[80];
 		RAND_bytes (T, 80);
@@ -164,402 +620,329 @@ namespace crypto
 		SHA512_CTX ctx;
 		SHA512_Init (&ctx);
 		SHA512_Update (&ctx, T, 80);
-		SHA512_Update (&ctx, publicKeyEncoded, 32); 
+		SHA512_Update (&ctx, publicKeyEncoded, 32);
 		SHA512_Update (&ctx, buf, len); // data
 		uint8_t digest[64];
 		SHA512_Final (digest, &ctx);
-		BIGNUM * r = DecodeBN<64> (digest); 
-		BN_mod (r, r, l, bnCtx); // % l	
-		EncodeBN (r, digest, 32);
+		uint8_t r[32];
+		ScReduce64 (r, digest); // % l
 		// calculate R
 		uint8_t R[EDDSA25519_SIGNATURE_LENGTH/2]; // we must use separate buffer because signature might be inside buf
-		EncodePoint (Normalize (MulB (digest, bnCtx), bnCtx), R); 
+		EncodePoint (MulB (r), R);
 		// calculate S
 		SHA512_Init (&ctx);
 		SHA512_Update (&ctx, R, EDDSA25519_SIGNATURE_LENGTH/2); // R
 		SHA512_Update (&ctx, publicKeyEncoded, EDDSA25519_PUBLIC_KEY_LENGTH); // public key
 		SHA512_Update (&ctx, buf, len); // data
 		SHA512_Final (digest, &ctx);
-		BIGNUM * h = DecodeBN<64> (digest);
+		uint8_t h[32];
+		ScReduce64 (h, digest); // % l
 		// S = (r + h*a) % l
-		BIGNUM * a = DecodeBN<EDDSA25519_PRIVATE_KEY_LENGTH> (privateKey); 
-		BN_mod_mul (h, h, a, l, bnCtx); // %l
-		BN_mod_add (h, h, r, l, bnCtx); // %l
 		memcpy (signature, R, EDDSA25519_SIGNATURE_LENGTH/2);
-		EncodeBN (h, signature + EDDSA25519_SIGNATURE_LENGTH/2, EDDSA25519_SIGNATURE_LENGTH/2); // S
-		BN_free (r); BN_free (h); BN_free (a);
-		BN_CTX_free (bnCtx);
-	}
-	
-	EDDSAPoint Ed25519::Sum (const EDDSAPoint& p1, const EDDSAPoint& p2, BN_CTX * ctx) const
-	{
-		// x3 = (x1*y2+y1*x2)*(z1*z2-d*t1*t2)
-		// y3 = (y1*y2+x1*x2)*(z1*z2+d*t1*t2)
-		// z3 = (z1*z2-d*t1*t2)*(z1*z2+d*t1*t2)
-		// t3 = (y1*y2+x1*x2)*(x1*y2+y1*x2)
-		BIGNUM * x3 = BN_new (), * y3 = BN_new (), * z3 = BN_new (), * t3 = BN_new ();
-
-		BN_mul (x3, p1.x, p2.x, ctx); // A = x1*x2
-		BN_mul (y3, p1.y, p2.y, ctx); // B = y1*y2
-
-		BN_CTX_start (ctx);
-		BIGNUM * t1 = p1.t, * t2 = p2.t;
-		if (!t1) { t1 = BN_CTX_get (ctx); BN_mul (t1, p1.x, p1.y, ctx); }
-		if (!t2) { t2 = BN_CTX_get (ctx); BN_mul (t2, p2.x, p2.y, ctx); }
-		BN_mul (t3, t1, t2, ctx);
-		BN_mul (t3, t3, d, ctx);  // C = d*t1*t2
-
-		if (p1.z)
-		{
-			if (p2.z)
-				BN_mul (z3, p1.z, p2.z, ctx); // D = z1*z2
-			else
-				BN_copy (z3, p1.z); // D = z1
-		}
-		else
-		{
-			if (p2.z)
-				BN_copy (z3, p2.z); // D = z2
-			else
-				BN_one (z3); // D = 1
-		}
+		ScMulAdd (signature + EDDSA25519_SIGNATURE_LENGTH/2, h, privateKey, r); // S
+	}
 
-		BIGNUM * E = BN_CTX_get (ctx), * F = BN_CTX_get (ctx), * G = BN_CTX_get (ctx), * H = BN_CTX_get (ctx);
-		BN_add (E, p1.x, p1.y);
-		BN_add (F, p2.x, p2.y);
-		BN_mul (E, E, F, ctx); // (x1 + y1)*(x2 + y2)
-		BN_sub (E, E, x3);
-		BN_sub (E, E, y3); // E = (x1 + y1)*(x2 + y2) - A - B
-		BN_sub (F, z3, t3); // F = D - C
-		BN_add (G, z3, t3); // G = D + C
-		BN_add (H, y3, x3); // H = B + A
+	EDDSAPoint Ed25519::Sum (const EDDSAPoint& p1, const EDDSAPoint& p2) const
+	{
+		EDDSAPointPrecomputed p;
+		Precompute (p, p2);
+		EDDSAPoint res;
+		AddPrecomputed (res, p1, p);
+		return res;
+	}
 
-		BN_mod_mul (x3, E, F, q, ctx); // x3 = E*F
-		BN_mod_mul (y3, G, H, q, ctx); // y3 = G*H
-		BN_mod_mul (z3, F, G, q, ctx); // z3 = F*G
-		BN_mod_mul (t3, E, H, q, ctx); // t3 = E*H
+	void Ed25519::Double (EDDSAPoint& p) const
+	{
+		Field25519 A, B, C, E, F, G, H;
+		FeSqr (A, p.x); // A = x^2
+		FeSqr (B, p.y); // B = y^2
+		FeSqr (C, p.z);
+		FeAdd (C, C, C); // C = 2*z^2
+		FeAdd (H, A, B); // H = A + B
+		FeAdd (E, p.x, p.y);
+		FeSqr (E, E);
+		FeSub (E, H, E); // E = A + B - (x+y)^2 = -2*x*y
+		FeSub (G, A, B); // G = A - B
+		FeAdd (F, C, G); // F = C + G
+		FeMul (p.x, E, F);
+		FeMul (p.y, G, H);
+		FeMul (p.t, E, H);
+		FeMul (p.z, F, G);
+	}
 
-		BN_CTX_end (ctx);
+	void Ed25519::Precompute (EDDSAPointPrecomputed& r, const EDDSAPoint& p) const
+	{
+		FeAdd (r.yPlusX, p.y, p.x);
+		FeSub (r.yMinusX, p.y, p.x);
+		FeCopy (r.z, p.z);
+		FeMul (r.t2d, p.t, d2);
+	}
 
-		return EDDSAPoint {x3, y3, z3, t3};
+	void Ed25519::SelectB (EDDSAPointPrecomputed& r, int pos, int8_t b) const
+	{
+		uint8_t negative = (uint8_t)b >> 7;
+		uint8_t babs = b - ((-negative & b) * 2);
+		SetIdentity (r);
+		for (int i = 0; i < 8; i++)
+		{
+			uint32_t eq = babs ^ (i + 1);
+			uint64_t mask = -(uint64_t)((eq - 1) >> 31); // all ones if babs == i + 1
+			FeCMove (r.yPlusX, Bi256[pos][i].yPlusX, mask);
+			FeCMove (r.yMinusX, Bi256[pos][i].yMinusX, mask);
+			FeCMove (r.z, Bi256[pos][i].z, mask);
+			FeCMove (r.t2d, Bi256[pos][i].t2d, mask);
+		}
+		EDDSAPointPrecomputed minus;
+		Negate (minus, r);
+		uint64_t mask = -(uint64_t)negative;
+		FeCMove (r.yPlusX, minus.yPlusX, mask);
+		FeCMove (r.yMinusX, minus.yMinusX, mask);
+		FeCMove (r.t2d, minus.t2d, mask);
 	}
 
-	void Ed25519::Double (EDDSAPoint& p, BN_CTX * ctx) const
+	EDDSAPoint Ed25519::MulB (const uint8_t * e) const // B*e, e is 32 bytes Little Endian
 	{
-		BN_CTX_start (ctx);
-		BIGNUM * x2 = BN_CTX_get (ctx), * y2 = BN_CTX_get (ctx), * z2 = BN_CTX_get (ctx), * t2 = BN_CTX_get (ctx);
+		// 64 signed digits from -8 to 8
+		int8_t digits[64];
+		for (int i = 0; i < 32; i++)
+		{
+			digits[2*i] = e[i] & 0x0F;
+			digits[2*i + 1] = e[i] >> 4;
+		}
+		int8_t carry = 0;
+		for (int i = 0; i < 63; i++)
+		{
+			digits[i] += carry;
+			carry = (digits[i] + 8) >> 4;
+			digits[i] -= carry*16;
+		}
+		digits[63] += carry;
 
-		BN_sqr (x2, p.x, ctx); // x2 = A = x^2
-		BN_sqr (y2, p.y, ctx); // y2 = B = y^2
-		if (p.t)
-			BN_sqr (t2, p.t, ctx); // t2 = t^2
-		else
+		EDDSAPoint res;
+		SetIdentity (res);
+		EDDSAPointPrecomputed p;
+		for (int i = 1; i < 64; i += 2)
 		{
-			BN_mul (t2, p.x, p.y, ctx); // t = x*y
-			BN_sqr (t2, t2, ctx);  // t2 = t^2
+			SelectB (p, i/2, digits[i]);
+			AddPrecomputed (res, res, p);
 		}
-		BN_mul (t2, t2, d, ctx);  // t2 = C = d*t^2
-		if (p.z)
-			BN_sqr (z2, p.z, ctx); // z2 = D = z^2
-		else
-			BN_one (z2); // z2 = 1
-
-		BIGNUM * E = BN_CTX_get (ctx), * F = BN_CTX_get (ctx), * G = BN_CTX_get (ctx), * H = BN_CTX_get (ctx);
-		// E = (x+y)*(x+y)-A-B = x^2+y^2+2xy-A-B = 2xy
-		BN_mul (E, p.x, p.y, ctx);
-		BN_lshift1 (E, E);	// E =2*x*y
-		BN_sub (F, z2, t2); // F = D - C
-		BN_add (G, z2, t2); // G = D + C
-		BN_add (H, y2, x2); // H = B + A
-
-		BN_mod_mul (p.x, E, F, q, ctx); // x2 = E*F
-		BN_mod_mul (p.y, G, H, q, ctx); // y2 = G*H
-		if (!p.z) p.z = BN_new ();
-		BN_mod_mul (p.z, F, G, q, ctx); // z2 = F*G
-		if (!p.t) p.t = BN_new ();
-		BN_mod_mul (p.t, E, H, q, ctx); // t2 = E*H
-
-		BN_CTX_end (ctx);
-	}
-
-	EDDSAPoint Ed25519::Mul (const EDDSAPoint& p, const BIGNUM * e, BN_CTX * ctx) const
-	{
-		BIGNUM * zero = BN_new (), * one = BN_new ();
-		BN_zero (zero); BN_one (one);
-		EDDSAPoint res {zero, one};
-		if (!BN_is_zero (e))
+		for (int i = 0; i < 4; i++) Double (res);
+		for (int i = 0; i < 64; i += 2)
 		{
-			int bitCount = BN_num_bits (e);
-			for (int i = bitCount - 1; i >= 0; i--)
-			{
-				Double (res, ctx);
-				if (BN_is_bit_set (e, i)) res = Sum (res, p, ctx);
-			}
+			SelectB (p, i/2, digits[i]);
+			AddPrecomputed (res, res, p);
 		}
 		return res;
 	}
 
-	EDDSAPoint Ed25519::MulB (const uint8_t * e, BN_CTX * ctx) const // B*e, e is 32 bytes Little Endian
+	EDDSAPoint Ed25519::DoubleMulVartime (const EDDSAPoint& p, const uint8_t * a, const uint8_t * b) const
 	{
-		BIGNUM * zero = BN_new (), * one = BN_new ();
-		BN_zero (zero); BN_one (one);
-		EDDSAPoint res {zero, one};
-		bool carry = false;
-		for (int i = 0; i < 32; i++)
+		int8_t aslide[256], bslide[256];
+		Slide (aslide, a);
+		Slide (bslide, b);
+		// odd multiples of p
+		EDDSAPointPrecomputed Pi[8], p2;
+		EDDSAPoint Q = p, P2 = p;
+		Double (P2);
+		Precompute (p2, P2);
+		Precompute (Pi[0], Q);
+		for (int i = 1; i < 8; i++)
+		{
+			AddPrecomputed (Q, Q, p2);
+			Precompute (Pi[i], Q);
+		}
+
+		EDDSAPoint res;
+		SetIdentity (res);
+		int i = 255;
+		while (i >= 0 && !aslide[i] && !bslide[i]) i--;
+		EDDSAPointPrecomputed minus;
+		for (; i >= 0; i--)
 		{
-			uint8_t x = e[i];
-			if (carry)
+			Double (res);
+			if (aslide[i] > 0)
+				AddPrecomputed (res, res, Pi[aslide[i]/2]);
+			else if (aslide[i] < 0)
 			{
-				if (x < 255)
-				{
-					x++;
-					carry = false;
-				}
-				else
-					x = 0;
+				Negate (minus, Pi[(-aslide[i])/2]);
+				AddPrecomputed (res, res, minus);
 			}
-			if (x > 0)
+			if (bslide[i] > 0)
+				AddPrecomputed (res, res, Bodd[bslide[i]/2]);
+			else if (bslide[i] < 0)
 			{
-				if (x <= 128)
-					res = Sum (res, Bi256[i][x-1], ctx);
-				else
-				{
-					res = Sum (res, -Bi256[i][255-x], ctx); // -Bi[256-x]
-					carry = true;
-				}
+				Negate (minus, Bodd[(-bslide[i])/2]);
+				AddPrecomputed (res, res, minus);
 			}
 		}
-		if (carry) res = Sum (res, Bi256Carry, ctx);
 		return res;
 	}
 
-	EDDSAPoint Ed25519::Normalize (const EDDSAPoint& p, BN_CTX * ctx) const
+	bool Ed25519::IsOnCurve (const EDDSAPoint& p) const
 	{
-		if (p.z)
-		{
-			BIGNUM * x = BN_new (), * y = BN_new ();
-			BN_mod_inverse (y, p.z, q, ctx);
-			BN_mod_mul (x, p.x, y, q, ctx); // x = x/z
-			BN_mod_mul (y, p.y, y, q, ctx); // y = y/z
-			return  EDDSAPoint{x, y};
-		}
-		else
-			return EDDSAPoint{BN_dup (p.x), BN_dup (p.y)};
-	}
-
-	bool Ed25519::IsOnCurve (const EDDSAPoint& p, BN_CTX * ctx) const
-	{
-		BN_CTX_start (ctx);
-		BIGNUM * x2 = BN_CTX_get (ctx), * y2 = BN_CTX_get (ctx), * tmp = BN_CTX_get (ctx);
-		BN_sqr (x2, p.x, ctx); // x^2
-		BN_sqr (y2, p.y, ctx); // y^2
-		// y^2 - x^2 - 1 - d*x^2*y^2
-		BN_mul (tmp, d, x2, ctx);
-		BN_mul (tmp, tmp, y2, ctx);
-		BN_sub (tmp, y2, tmp);
-		BN_sub (tmp, tmp, x2);
-		BN_sub_word (tmp, 1);
-		BN_mod (tmp, tmp, q, ctx); // % q
-		bool ret = BN_is_zero (tmp);
-		BN_CTX_end (ctx);
-		return ret;
-	}
-
-	BIGNUM * Ed25519::RecoverX (const BIGNUM * y, BN_CTX * ctx) const
-	{
-		BN_CTX_start (ctx);
-		BIGNUM * y2 = BN_CTX_get (ctx), * xx = BN_CTX_get (ctx);
-		BN_sqr (y2, y, ctx); // y^2
-		// xx = (y^2 -1)*inv(d*y^2 +1)
-		BN_mul (xx, d, y2, ctx);
-		BN_add_word (xx, 1);
-		BN_mod_inverse (xx, xx, q, ctx);
-		BN_sub_word (y2, 1);
-		BN_mul (xx, y2, xx, ctx);
-		// x = srqt(xx) = xx^(2^252-2)
-		BIGNUM * x = BN_new ();
-		BN_mod_exp (x, xx, two_252_2, q, ctx);
-		// check (x^2 -xx) % q
-		BN_sqr (y2, x, ctx);
-		BN_mod_sub (y2, y2, xx, q, ctx);
-		if (!BN_is_zero (y2))
-			BN_mod_mul (x, x, I, q, ctx);
-		if (BN_is_odd (x))
-			BN_sub (x, q, x);
-		BN_CTX_end (ctx);
-		return x;
-	}
-
-	EDDSAPoint Ed25519::DecodePoint (const uint8_t * buf, BN_CTX * ctx) const
-	{
-		// buf is 32 bytes Little Endian, convert it to Big Endian
-		uint8_t buf1[EDDSA25519_PUBLIC_KEY_LENGTH];
-		for (size_t i = 0; i < EDDSA25519_PUBLIC_KEY_LENGTH/2; i++) // invert bytes
-		{
-			buf1[i] = buf[EDDSA25519_PUBLIC_KEY_LENGTH -1 - i];
-			buf1[EDDSA25519_PUBLIC_KEY_LENGTH -1 - i] = buf[i];
-		}
-		bool isHighestBitSet = buf1[0] & 0x80;
-		if (isHighestBitSet)
-			buf1[0] &= 0x7f; // clear highest bit
-		BIGNUM * y = BN_new ();
-		BN_bin2bn (buf1, EDDSA25519_PUBLIC_KEY_LENGTH, y);
-		BIGNUM * x = RecoverX (y, ctx);
-		if (BN_is_bit_set (x, 0) != isHighestBitSet)
-			BN_sub (x, q, x); // x = q - x
-		BIGNUM * z = BN_new (), * t = BN_new ();
-		BN_one (z); BN_mod_mul (t, x, y, q, ctx); // pre-calculate t
-		EDDSAPoint p {x, y, z, t};
-		if (!IsOnCurve (p, ctx))
-			LogPrint (eLogError, "Decoded point is not on 25519");
-		return p;
+		// (y^2 - x^2)*z^2 = z^4 + d*x^2*y^2
+		Field25519 x2, y2, z2, l, r;
+		FeSqr (x2, p.x);
+		FeSqr (y2, p.y);
+		FeSqr (z2, p.z);
+		FeSub (l, y2, x2);
+		FeMul (l, l, z2);
+		FeMul (r, x2, y2);
+		FeMul (r, r, d);
+		FeSqr (z2, z2);
+		FeAdd (r, r, z2);
+		FeSub (l, l, r);
+		return FeIsZero (l);
 	}
 
-	void Ed25519::EncodePoint (const EDDSAPoint& p, uint8_t * buf) const
+	void Ed25519::RecoverX (Field25519 x, const Field25519 y) const
 	{
-		EncodeBN (p.y, buf,EDDSA25519_PUBLIC_KEY_LENGTH);
-		if (BN_is_bit_set (p.x, 0)) // highest bit
-			buf[EDDSA25519_PUBLIC_KEY_LENGTH - 1] |= 0x80; // set highest bit
+		// xx = (y^2 -1)*inv(d*y^2 +1) = u/v
+		Field25519 u, v, v3, t, one = {1};
+		FeSqr (u, y);
+		FeMul (v, u, d);
+		FeSub (u, u, one);
+		FeAdd (v, v, one);
+		// x = sqrt(u/v) = u*v^3*(u*v^7)^((q-5)/8)
+		FeSqr (v3, v);
+		FeMul (v3, v3, v); // v^3
+		FeSqr (x, v3);
+		FeMul (x, x, v);
+		FeMul (x, x, u); // u*v^7
+		FePow22523 (x, x);
+		FeMul (x, x, v3);
+		FeMul (x, x, u);
+		// check (v*x^2 - u) % q
+		FeSqr (t, x);
+		FeMul (t, t, v);
+		FeSub (t, t, u);
+		if (!FeIsZero (t))
+			FeMul (x, x, I);
 	}
 
-	template<int len>
-	BIGNUM * Ed25519::DecodeBN (const uint8_t * buf) const
+	EDDSAPoint Ed25519::DecodePoint (const uint8_t * buf) const
 	{
-		// buf is Little Endian convert it to Big Endian
-		uint8_t buf1[len];
-		for (size_t i = 0; i < len/2; i++) // invert bytes
-		{
-			buf1[i] = buf[len -1 - i];
-			buf1[len -1 - i] = buf[i];
-		}
-		BIGNUM * res = BN_new ();
-		BN_bin2bn (buf1, len, res);
-		return res;
+		EDDSAPoint p;
+		if (!DecodePoint (buf, p, false))
+			LogPrint (eLogError, "Decoded point is not on 25519");
+		return p;
 	}
 
-	void Ed25519::EncodeBN (const BIGNUM * bn, uint8_t * buf, size_t len) const
+	bool Ed25519::DecodePoint (const uint8_t * buf, EDDSAPoint& p, bool canonicalOnly) const
 	{
-		bn2buf (bn, buf, len);
-		// To Little Endian
-		for (size_t i = 0; i < len/2; i++) // invert bytes
+		// buf is 32 bytes Little Endian, highest bit is sign of x
+		int sign = buf[EDDSA25519_PUBLIC_KEY_LENGTH - 1] >> 7;
+		FeFromBytes (p.y, buf);
+		if (canonicalOnly)
+		{
+			uint8_t y[32];
+			FeToBytes (y, p.y);
+			y[EDDSA25519_PUBLIC_KEY_LENGTH - 1] |= sign << 7;
+			if (memcmp (y, buf, EDDSA25519_PUBLIC_KEY_LENGTH)) return false; // y >= q
+		}
+		RecoverX (p.x, p.y);
+		if (FeIsNegative (p.x) != sign)
 		{
-			uint8_t tmp = buf[i];
-			buf[i] = buf[len -1 - i];
-			buf[len -1 - i] = tmp;
+			if (canonicalOnly && FeIsZero (p.x)) return false; // -0
+			FeNeg (p.x, p.x); // x = q - x
 		}
+		FeOne (p.z);
+		FeMul (p.t, p.x, p.y); // pre-calculate t
+		return IsOnCurve (p);
+	}
+
+	void Ed25519::EncodePoint (const EDDSAPoint& p, uint8_t * buf) const
+	{
+		Field25519 x, y, z;
+		FeInvert (z, p.z);
+		FeMul (x, p.x, z); // x = x/z
+		FeMul (y, p.y, z); // y = y/z
+		FeToBytes (buf, y);
+		if (FeIsNegative (x)) // highest bit
+			buf[EDDSA25519_PUBLIC_KEY_LENGTH - 1] |= 0x80; // set highest bit
 	}
 
 #if !OPENSSL_X25519
-	BIGNUM * Ed25519::ScalarMul (const BIGNUM * u, const BIGNUM * k, BN_CTX * ctx) const
-	{
-		BN_CTX_start (ctx);
-		auto x1 = BN_CTX_get (ctx); BN_copy (x1, u);
-		auto x2 = BN_CTX_get (ctx); BN_one (x2);
-		auto z2 = BN_CTX_get (ctx); BN_zero (z2);
-		auto x3 = BN_CTX_get (ctx); BN_copy (x3, u);
-		auto z3 = BN_CTX_get (ctx); BN_one (z3);
-		auto c121666 = BN_CTX_get (ctx); BN_set_word (c121666, 121666);
-		auto tmp0 = BN_CTX_get (ctx); auto tmp1 = BN_CTX_get (ctx);
-		unsigned int swap = 0;
-		auto bits = BN_num_bits (k);
-		while(bits)
+	void Ed25519::ScalarMul (Field25519 res, const Field25519 u, const uint8_t * k) const
+	{
+		// Montgomery ladder, RFC 7748
+		Field25519 x2, z2, x3, z3, A, AA, B, BB, E, C, D, DA, CB, c121665 = {121665};
+		FeOne (x2); FeZero (z2);
+		FeCopy (x3, u); FeOne (z3);
+		uint64_t swap = 0;
+		for (int i = 254; i >= 0; i--)
 		{
-			--bits;
-			auto k_t = BN_is_bit_set(k, bits) ? 1 : 0;
+			uint64_t k_t = (k[i >> 3] >> (i & 7)) & 1;
 			swap ^= k_t;
-			if (swap) 
-			{
-				std::swap (x2, x3);
-				std::swap (z2, z3);
-			}
+			FeCSwap (x2, x3, -swap);
+			FeCSwap (z2, z3, -swap);
 			swap = k_t;
-			BN_mod_sub(tmp0, x3, z3, q, ctx);
-			BN_mod_sub(tmp1, x2, z2, q, ctx);
-			BN_mod_add(x2, x2, z2, q, ctx);
-			BN_mod_add(z2, x3, z3, q, ctx);
-			BN_mod_mul(z3, tmp0, x2, q, ctx);
-			BN_mod_mul(z2, z2, tmp1, q, ctx);
-			BN_mod_sqr(tmp0, tmp1, q, ctx);
-			BN_mod_sqr(tmp1, x2, q, ctx);
-			BN_mod_add(x3, z3, z2, q, ctx);
-			BN_mod_sub(z2, z3, z2, q, ctx);
-			BN_mod_mul(x2, tmp1, tmp0, q, ctx);
-			BN_mod_sub(tmp1, tmp1, tmp0, q, ctx);
-			BN_mod_sqr(z2, z2, q, ctx);
-			BN_mod_mul(z3, tmp1, c121666, q, ctx);
-			BN_mod_sqr(x3, x3, q, ctx);
-			BN_mod_add(tmp0, tmp0, z3, q, ctx);
-			BN_mod_mul(z3, x1, z2, q, ctx);
-			BN_mod_mul(z2, tmp1, tmp0, q, ctx);
-		}
-		if (swap) 
-		{
-			std::swap (x2, x3);
-			std::swap (z2, z3);
+			FeAdd (A, x2, z2);
+			FeSqr (AA, A);
+			FeSub (B, x2, z2);
+			FeSqr (BB, B);
+			FeSub (E, AA, BB);
+			FeAdd (C, x3, z3);
+			FeSub (D, x3, z3);
+			FeMul (DA, D, A);
+			FeMul (CB, C, B);
+			FeAdd (x3, DA, CB);
+			FeSqr (x3, x3);
+			FeSub (z3, DA, CB);
+			FeSqr (z3, z3);
+			FeMul (z3, z3, u);
+			FeMul (x2, AA, BB);
+			FeMul (z2, c121665, E);
+			FeAdd (z2, z2, AA);
+			FeMul (z2, z2, E);
 		}
-		BN_mod_inverse (z2, z2, q, ctx);
-		BIGNUM * res =  BN_new (); // not from ctx
-		BN_mod_mul(res, x2, z2, q, ctx);
-		BN_CTX_end (ctx);
-		return res;
+		FeCSwap (x2, x3, -swap);
+		FeCSwap (z2, z3, -swap);
+		FeInvert (z2, z2);
+		FeMul (res, x2, z2);
 	}
 
 	void Ed25519::ScalarMul (const uint8_t * p, const  uint8_t * e, uint8_t * buf, BN_CTX * ctx) const
 	{
-		BIGNUM * p1 = DecodeBN<32> (p);
+		Field25519 u, res;
+		FeFromBytes (u, p);
 		uint8_t k[32];
 		memcpy (k, e, 32);
 		k[0] &= 248; k[31] &= 127; k[31] |= 64;
-		BIGNUM * n = DecodeBN<32> (k);
-		BIGNUM * q1 = ScalarMul (p1, n, ctx);
-		EncodeBN (q1, buf, 32);
-		BN_free (p1); BN_free (n); BN_free (q1);
+		ScalarMul (res, u, k);
+		FeToBytes (buf, res);
 	}
 
 	void Ed25519::ScalarMulB (const  uint8_t * e, uint8_t * buf, BN_CTX * ctx) const
 	{
-		BIGNUM *p1 = BN_new (); BN_set_word (p1, 9);
+		Field25519 u = {9}, res;
 		uint8_t k[32];
 		memcpy (k, e, 32);
 		k[0] &= 248; k[31] &= 127; k[31] |= 64;
-		BIGNUM * n = DecodeBN<32> (k);
-		BIGNUM * q1 = ScalarMul (p1, n, ctx);
-		EncodeBN (q1, buf, 32);
-		BN_free (p1); BN_free (n); BN_free (q1);
+		ScalarMul (res, u, k);
+		FeToBytes (buf, res);
 	}
 #endif
 
 	void Ed25519::BlindPublicKey (const uint8_t * pub, const uint8_t * seed, uint8_t * blinded)
 	{
-		BN_CTX * ctx = BN_CTX_new ();
 		// calculate alpha = seed mod l
-		BIGNUM * alpha = DecodeBN<64> (seed); // seed is in Little Endian 
-		BN_mod (alpha, alpha, l, ctx); // % l
-		uint8_t priv[32];	
-		EncodeBN (alpha, priv, 32); // back to Little Endian
-		BN_free (alpha);
+		uint8_t priv[32];
+		ScReduce64 (priv, seed); // seed is in Little Endian
 		// A' = BLIND_PUBKEY(A, alpha) = A + DERIVE_PUBLIC(alpha)
-		auto A1 = Sum (DecodePublicKey (pub, ctx), MulB (priv, ctx), ctx); // pub + B*alpha
-		EncodePublicKey (A1, blinded, ctx);
-		BN_CTX_free (ctx);
+		auto A1 = Sum (DecodePoint (pub), MulB (priv)); // pub + B*alpha
+		EncodePoint (A1, blinded);
 	}
 
 	void Ed25519::BlindPrivateKey (const uint8_t * priv, const uint8_t * seed, uint8_t * blindedPriv, uint8_t * blindedPub)
 	{
-		BN_CTX * ctx = BN_CTX_new ();
 		// calculate alpha = seed mod l
-		BIGNUM * alpha = DecodeBN<64> (seed); // seed is in Little Endian 
-		BN_mod (alpha, alpha, l, ctx); // % l
-		BIGNUM * p = DecodeBN<32> (priv); // priv is in Little Endian 
-		BN_add (alpha, alpha, p); // alpha = alpha + priv
-		// a' = BLIND_PRIVKEY(a, alpha) = (a + alpha) mod L	
-		BN_mod (alpha, alpha, l, ctx); // % l
-		EncodeBN (alpha, blindedPriv, 32);
-		// A' = DERIVE_PUBLIC(a') 	
-		auto A1 = MulB (blindedPriv, ctx);
-		EncodePublicKey (A1, blindedPub, ctx); 
-		BN_free (alpha); BN_free (p);
-		BN_CTX_free (ctx);
+		uint8_t alpha[32], one[32] = {1};
+		ScReduce64 (alpha, seed); // seed is in Little Endian
+		// a' = BLIND_PRIVKEY(a, alpha) = (a + alpha) mod L
+		ScMulAdd (blindedPriv, priv, one, alpha);
+		// A' = DERIVE_PUBLIC(a')
+		EncodePoint (MulB (blindedPriv), blindedPub);
 	}
 
 	void Ed25519::ExpandPrivateKey (const uint8_t * key, uint8_t * expandedKey)
@@ -572,16 +955,12 @@ namespace crypto
 
 	void Ed25519::CreateRedDSAPrivateKey (uint8_t * priv)
 	{
-		uint8_t seed[32];
+		uint8_t seed[64];
 		RAND_bytes (seed, 32);
-		BIGNUM * p = DecodeBN<32> (seed); 	
-		BN_CTX * ctx = BN_CTX_new ();
-		BN_mod (p, p, l, ctx); // % l
-		EncodeBN (p, priv, 32); 
-		BN_CTX_free (ctx);
-		BN_free (p);
-	}	
-	
+		memset (seed + 32, 0, 32);
+		ScReduce64 (priv, seed); // % l
+	}
+
 	static std::unique_ptr<Ed25519> g_Ed25519;
 	std::unique_ptr<Ed25519>& GetEd25519 ()
 	{
@@ -597,4 +976,3 @@ namespace crypto
 	}
 }
 }
-
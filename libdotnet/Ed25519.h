@@ -1,6 +1,7 @@
 #ifndef ED25519_H__
 #define ED25519_H__
 
+#include <inttypes.h>
 #include <memory>
 #include <openssl/bn.h>
 #include "Crypto.h"
@@ -9,57 +10,16 @@ namespace dotnet
 {
 namespace crypto
 {
+	typedef uint64_t Field25519[5]; // GF(2^255-19) element, 5 limbs of 51 bits
+
 	struct EDDSAPoint
 	{
-		BIGNUM * x {nullptr};
-		BIGNUM * y {nullptr};
-		BIGNUM * z {nullptr};
-		BIGNUM * t {nullptr}; // projective coordinates
-
-		EDDSAPoint () {}
-		EDDSAPoint (const EDDSAPoint& other)   { *this = other; }
-		EDDSAPoint (EDDSAPoint&& other)        { *this = std::move (other); }
-		EDDSAPoint (BIGNUM * x1, BIGNUM * y1, BIGNUM * z1 = nullptr, BIGNUM * t1 = nullptr)
-			: x(x1)
-			, y(y1)
-			, z(z1)
-			, t(t1)
-		{}
-		~EDDSAPoint () { BN_free (x); BN_free (y); BN_free(z); BN_free(t); }
-
-		EDDSAPoint& operator=(EDDSAPoint&& other)
-		{
-			if (this != &other)
-			{
-				BN_free (x); x = other.x; other.x = nullptr;
-				BN_free (y); y = other.y; other.y = nullptr;
-				BN_free (z); z = other.z; other.z = nullptr;
-				BN_free (t); t = other.t; other.t = nullptr;
-			}
-			return *this;
-		}
-
-		EDDSAPoint& operator=(const EDDSAPoint& other)
-		{
-			if (this != &other)
-			{
-				BN_free (x); x = other.x ? BN_dup (other.x) : nullptr;
-				BN_free (y); y = other.y ? BN_dup (other.y) : nullptr;
-				BN_free (z); z = other.z ? BN_dup (other.z) : nullptr;
-				BN_free (t); t = other.t ? BN_dup (other.t) : nullptr;
-			}
-			return *this;
-		}
-
-		EDDSAPoint operator-() const
-		{
-			BIGNUM * x1 = NULL, * y1 = NULL, * z1 = NULL, * t1 = NULL;
-			if (x) { x1 = BN_dup (x); BN_set_negative (x1, !BN_is_negative (x)); };
-			if (y) y1 = BN_dup (y);
-			if (z) z1 = BN_dup (z);
-			if (t) { t1 = BN_dup (t); BN_set_negative (t1, !BN_is_negative (t)); };
-			return EDDSAPoint {x1, y1, z1, t1};
-		}
+		Field25519 x, y, z, t; // extended coordinates, x/z, y/z, t = x*y/z
+	};
+
+	struct EDDSAPointPrecomputed
+	{
+		Field25519 yPlusX, yMinusX, z, t2d; // (y+x, y-x, z, 2*d*t), ready for addition
 	};
 
 	const size_t EDDSA25519_PUBLIC_KEY_LENGTH = 32;
@@ -83,7 +43,9 @@ namespace crypto
 			void BlindPublicKey (const uint8_t * pub, const uint8_t * seed, uint8_t * blinded); // for encrypted LeaseSet2, pub - 32, seed - 64, blinded - 32
 			void BlindPrivateKey (const uint8_t * priv, const uint8_t * seed, uint8_t * blindedPriv, uint8_t * blindedPub); // for encrypted LeaseSet2, pub - 32, seed - 64, blinded - 32
 
-			bool Verify (const EDDSAPoint& publicKey, const uint8_t * digest, const uint8_t * signature) const;
+			bool Verify (const EDDSAPoint& publicKey, const uint8_t * digest, const uint8_t * signature) const; // cofactored
+			bool VerifyBatch (const uint8_t * const * publicKeys, const uint8_t * const * digests,
+				const uint8_t * const * signatures, size_t num) const; // true if all num signatures are valid, digest is H(R || A || M)
 			void Sign (const uint8_t * expandedPrivateKey, const uint8_t * publicKeyEncoded, const uint8_t * buf, size_t len, uint8_t * signature) const;
 			void SignRedDSA (const uint8_t * privateKey, const uint8_t * publicKeyEncoded, const uint8_t * buf, size_t len, uint8_t * signature) const;
 			
@@ -92,36 +54,32 @@ namespace crypto
 			
 		private:
 
-			EDDSAPoint Sum (const EDDSAPoint& p1, const EDDSAPoint& p2, BN_CTX * ctx) const;
-			void Double (EDDSAPoint& p, BN_CTX * ctx) const;
-			EDDSAPoint Mul (const EDDSAPoint& p, const BIGNUM * e, BN_CTX * ctx) const;
-			EDDSAPoint MulB (const uint8_t * e, BN_CTX * ctx) const; // B*e, e is 32 bytes Little Endian
-			EDDSAPoint Normalize (const EDDSAPoint& p, BN_CTX * ctx) const;
-			
-			bool IsOnCurve (const EDDSAPoint& p, BN_CTX * ctx) const;	
-			BIGNUM * RecoverX (const BIGNUM * y, BN_CTX * ctx) const;
-			EDDSAPoint DecodePoint (const uint8_t * buf, BN_CTX * ctx) const;
+			EDDSAPoint Sum (const EDDSAPoint& p1, const EDDSAPoint& p2) const;
+			void Double (EDDSAPoint& p) const;
+			EDDSAPoint MulB (const uint8_t * e) const; // B*e, e is 32 bytes Little Endian, e < 2^255, constant time
+			EDDSAPoint DoubleMulVartime (const EDDSAPoint& p, const uint8_t * a, const uint8_t * b) const; // p*a + B*b, a and b < l
+			void SelectB (EDDSAPointPrecomputed& r, int pos, int8_t b) const; // B*b*256^pos, -8 <= b <= 8, constant time
+			void Precompute (EDDSAPointPrecomputed& r, const EDDSAPoint& p) const;
+
+			bool IsOnCurve (const EDDSAPoint& p) const;
+			bool IsSmallOrder (EDDSAPoint p) const; // 8*p = 0
+			void RecoverX (Field25519 x, const Field25519 y) const;
+			EDDSAPoint DecodePoint (const uint8_t * buf) const;
+			bool DecodePoint (const uint8_t * buf, EDDSAPoint& p, bool canonicalOnly) const; // false if not on curve
 			void EncodePoint (const EDDSAPoint& p, uint8_t * buf) const;
 
-			template<int len>
-			BIGNUM * DecodeBN (const uint8_t * buf) const;
-			void EncodeBN (const BIGNUM * bn, uint8_t * buf, size_t len) const;
-
 #if !OPENSSL_X25519
 			// for x25519
-			BIGNUM * ScalarMul (const BIGNUM * p, const BIGNUM * e, BN_CTX * ctx) const; 
+			void ScalarMul (Field25519 res, const Field25519 u, const uint8_t * k) const; // k is clamped
 #endif
 
 		private:
 
-			BIGNUM * q, * l, * d, * I;
-			// transient values
-			BIGNUM * two_252_2; // 2^252-2
-			EDDSAPoint Bi256[32][128]; // per byte, Bi256[i][j] = (256+j+1)^i*B, we don't store zeroes
-			// if j > 128 we use 256 - j and carry 1 to next byte
-			// Bi256[0][0] = B, base point
-			EDDSAPoint Bi256Carry; // Bi256[32][0]
-	};		
+			Field25519 d, d2, I; // d, 2*d, sqrt(-1)
+			EDDSAPoint B; // base point
+			EDDSAPointPrecomputed Bi256[32][8]; // Bi256[i][j] = (j+1)*256^i*B
+			EDDSAPointPrecomputed Bodd[8]; // Bodd[i] = (2*i+1)*B, for variable time multiplication
+	};
 
 	std::unique_ptr<Ed25519>& GetEd25519 ();
 
@@ -3,6 +3,7 @@
 #include <map>
 #include <string>
 #include "Crypto.h"
+#include "SHA256.h"
 #include "RouterContext.h"
 #include "DNNPProtocol.h"
 #include "Tunnel.h"
@@ -413,7 +414,20 @@ namespace garlic
 		if (key)
 		{
 			uint32_t ts = dotnet::util::GetSecondsSinceEpoch ();
-			m_Tags[SessionTag(tag, ts)] = std::make_shared<AESDecryption>(key);
+			AddSessionTags (tag, 1, std::make_shared<AESDecryption>(key), ts);
+		}
+	}
+
+	void GarlicDestination::AddSessionTags (const uint8_t * tags, int num, std::shared_ptr<AESDecryption> decryption, uint32_t ts)
+	{
+		// tags come in bunches, derive their IVs at once
+		std::vector<uint8_t> ivs (num*32);
+		dotnet::crypto::SHA256Batch (tags, 32, ivs.data (), num);
+		for (int i = 0; i < num; i++)
+		{
+			auto& t = m_Tags[SessionTag(tags + i*32, ts)];
+			t.decryption = decryption;
+			memcpy (t.iv, ivs.data () + i*32, 16);
 		}
 	}
 
@@ -437,13 +451,11 @@ namespace garlic
 		if (it != m_Tags.end ())
 		{
 			// tag found. Use AES
-			auto decryption = it->second;
+			auto decryption = it->second.decryption;
+			decryption->SetIV (it->second.iv);
 			m_Tags.erase (it); // tag might be used only once
 			if (length >= 32)
 			{
-				uint8_t iv[32]; // IV is first 16 bytes
-				SHA256(buf, 32, iv);
-				decryption->SetIV (iv);
 				decryption->Decrypt (buf + 32, length - 32, buf + 32);
 				HandleAESBlock (buf + 32, length - 32, decryption, msg->from);
 			}
@@ -480,9 +492,7 @@ namespace garlic
 				LogPrint (eLogError, "Garlic: Tag count ", tagCount, " exceeds length ", len);
 				return ;
 			}
-			uint32_t ts = dotnet::util::GetSecondsSinceEpoch ();
-			for (int i = 0; i < tagCount; i++)
-				m_Tags[SessionTag(buf + i*32, ts)] = decryption;
+			AddSessionTags (buf, tagCount, decryption, dotnet::util::GetSecondsSinceEpoch ());
 		}
 		buf += tagCount*32;
 		len -= tagCount*32;
@@ -765,7 +775,7 @@ namespace garlic
 			{
 				f.write ((char *)&it.first.creationTime, 4);
 				f.write ((char *)it.first.data (), 32);
-				f.write ((char *)it.second->GetKey ().data (), 32);
+				f.write ((char *)it.second.decryption->GetKey ().data (), 32);
 			}
 		}
 	}
@@ -803,7 +813,7 @@ namespace garlic
 						decryption = it->second;
 					else
 						decryption = std::make_shared<AESDecryption>(key);
-					m_Tags.insert (std::make_pair (SessionTag (tag, ts), decryption));
+					AddSessionTags (tag, 1, decryption, ts);
 				}
 				if (!m_Tags.empty ())
 					LogPrint (eLogInfo, m_Tags.size (), " loaded for ", ident);
@@ -75,6 +75,12 @@ namespace garlic
 			dotnet::crypto::AESKey m_Key;
 	};
 
+	struct IncomingSessionTag
+	{
+		std::shared_ptr<AESDecryption> decryption;
+		uint8_t iv[16]; // first 16 bytes of SHA256 (tag), calculated on arrival with other tags
+	};
+
 	struct GarlicRoutingPath
 	{
 		std::shared_ptr<dotnet::tunnel::OutboundTunnel> outboundTunnel;
@@ -202,6 +208,7 @@ namespace garlic
 
 		private:
 
+			void AddSessionTags (const uint8_t * tags, int num, std::shared_ptr<AESDecryption> decryption, uint32_t ts);
 			void HandleAESBlock (uint8_t * buf, size_t len, std::shared_ptr<AESDecryption> decryption,
 				std::shared_ptr<dotnet::tunnel::InboundTunnel> from);
 			void HandleGarlicPayload (uint8_t * buf, size_t len, std::shared_ptr<dotnet::tunnel::InboundTunnel> from);
@@ -214,7 +221,7 @@ namespace garlic
 			std::mutex m_SessionsMutex;
 			std::map<dotnet::data::IdentHash, GarlicRoutingSessionPtr> m_Sessions;
 			// incoming
-			std::map<SessionTag, std::shared_ptr<AESDecryption> > m_Tags;
+			std::map<SessionTag, IncomingSessionTag> m_Tags;
 			// DeliveryStatus
 			std::mutex m_DeliveryStatusSessionsMutex;
 			std::map<uint32_t, GarlicRoutingSessionPtr> m_DeliveryStatusSessions; // msgID -> session
@@ -1,4 +1,5 @@
 #include "Crypto.h"
+#include "SHA256.h"
 #include "DotNetEndian.h"
 #include "Log.h"
 #include "Timestamp.h"
@@ -796,10 +797,26 @@ namespace data
 		return key;
 	}
 
+	void CreateRoutingKeys (const IdentHash * idents, IdentHash * keys, size_t num)
+	{
+		char date[9];
+		dotnet::util::GetCurrentDate (date);
+		std::vector<uint8_t> buf (num*40); // ident + yyyymmdd
+		for (size_t i = 0; i < num; i++)
+		{
+			memcpy (buf.data () + i*40, (const uint8_t *)idents[i], 32);
+			memcpy (buf.data () + i*40 + 32, date, 8);
+		}
+		std::vector<uint8_t> digests (num*32);
+		dotnet::crypto::SHA256Batch (buf.data (), 40, digests.data (), num);
+		for (size_t i = 0; i < num; i++)
+			keys[i] = IdentHash (digests.data () + i*32);
+	}
+
 	XORMetric operator^(const IdentHash& key1, const IdentHash& key2)
 	{
 		XORMetric m;
-#ifdef __AVX__
+#ifdef X86_DISPATCH
 		if(dotnet::cpu::avx)
 		{
 			__asm__
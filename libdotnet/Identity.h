@@ -200,6 +200,7 @@ namespace data
 	};
 
 	IdentHash CreateRoutingKey (const IdentHash& ident);
+	void CreateRoutingKeys (const IdentHash * idents, IdentHash * keys, size_t num); // same date for all
 	XORMetric operator^(const IdentHash& key1, const IdentHash& key2);
 
 	// destination for delivery instuctions
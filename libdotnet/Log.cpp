@@ -182,9 +182,10 @@ namespace log {
 		Reopen ();
 		while (m_IsRunning)
 		{
-			std::shared_ptr<LogMsg> msg;
-			while ((msg = m_Queue.Get ()))
-				Process (msg);
+			std::vector<std::shared_ptr<LogMsg> > msgs;
+			if (m_Queue.GetBatch (msgs))
+				for (auto& it: msgs)
+					Process (it);
 			if (m_LogStream) m_LogStream->flush();
 			if (m_IsRunning)
 				m_Queue.Wait ();
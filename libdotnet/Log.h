@@ -57,7 +57,7 @@ namespace log {
 			std::string m_Logfile;
 			std::time_t m_LastTimestamp;
 			char m_LastDateTime[64];
-			dotnet::util::Queue<std::shared_ptr<LogMsg> > m_Queue;
+			dotnet::util::MPSCQueue<std::shared_ptr<LogMsg> > m_Queue;
 			bool m_HasColors;
 			std::string m_TimeFormat;
 			volatile bool m_IsRunning;
@@ -14,6 +14,7 @@
 #include <openssl/hmac.h>
 #include <stdlib.h>
 #include <vector>
+#include <algorithm>
 #include "Log.h"
 #include "DotNetEndian.h"
 #include "Crypto.h"
@@ -45,7 +46,7 @@ namespace transport
 		uint8_t tempKey[32]; unsigned int len;
 		HMAC(EVP_sha256(), m_CK, 32, inputKeyMaterial, 32, tempKey, &len); 	
 		// ck = HMAC-SHA256(temp_key, byte(0x01)) 
-		static uint8_t one[1] =  { 1 };
+		static const uint8_t one[1] =  { 1 };
 		HMAC(EVP_sha256(), tempKey, 32, one, 1, m_CK, &len); 	
 		// derived = HMAC-SHA256(temp_key, ck || byte(0x02))
 		m_CK[32] = 2;
@@ -354,15 +355,16 @@ namespace transport
 
 	NTCP2Session::NTCP2Session (NTCP2Server& server, std::shared_ptr<const dotnet::data::RouterInfo> in_RemoteRouter):
 		TransportSession (in_RemoteRouter, NTCP2_ESTABLISH_TIMEOUT), 
-		m_Server (server), m_Socket (m_Server.GetService ()), 
+		m_Server (server), m_Service (server.GetNextSessionService ()), m_Socket (m_Service), 
 		m_IsEstablished (false), m_IsTerminated (false),
 		m_Establisher (new NTCP2Establisher),
 		m_SendSipKey (nullptr), m_ReceiveSipKey (nullptr),
 #if OPENSSL_SIPHASH
 		m_SendMDCtx(nullptr), m_ReceiveMDCtx (nullptr),
 #endif
-		m_NextReceivedLen (0), m_NextReceivedBuffer (nullptr), m_NextSendBuffer (nullptr),
-		m_ReceiveSequenceNumber (0), m_SendSequenceNumber (0), m_IsSending (false)
+		m_NextReceivedLen (0), m_ReceiveBufferOffset (0), m_ReceiveBufferLen (0), m_LastReceivedBytes (0), m_NumSmallReads (0), m_NextSendBuffer (nullptr),
+		m_ReceiveSequenceNumber (0), m_SendSequenceNumber (0), m_IsSending (false), m_IsSendingFrames (false),
+		m_NumSmallWrites (0), m_NumSentFrames (0), m_NumWrites (0)
 	{
 		if (in_RemoteRouter) // Alice
 		{
@@ -380,7 +382,6 @@ namespace transport
 
 	NTCP2Session::~NTCP2Session ()
 	{
-		delete[] m_NextReceivedBuffer;
 		delete[] m_NextSendBuffer;
 #if OPENSSL_SIPHASH
 		if (m_SendSipKey) EVP_PKEY_free (m_SendSipKey);
@@ -411,7 +412,7 @@ namespace transport
 
 	void NTCP2Session::Done ()
 	{
-		m_Server.GetService ().post (std::bind (&NTCP2Session::Terminate, shared_from_this ()));
+		m_Service.post (std::bind (&NTCP2Session::Terminate, shared_from_this ()));
 	}
 
 	void NTCP2Session::Established ()
@@ -433,11 +434,12 @@ namespace transport
 	{
 		uint8_t tempKey[32]; unsigned int len;
 		HMAC(EVP_sha256(), m_Establisher->GetCK (), 32, nullptr, 0, tempKey, &len); // temp_key = HMAC-SHA256(ck, zerolen)
-		static uint8_t one[1] =  { 1 };
+		static const uint8_t one[1] =  { 1 };
 		HMAC(EVP_sha256(), tempKey, 32, one, 1, m_Kab, &len);  // k_ab = HMAC-SHA256(temp_key, byte(0x01)).
 		m_Kab[32] = 2;
 		HMAC(EVP_sha256(), tempKey, 32, m_Kab, 33, m_Kba, &len);  // k_ba = HMAC-SHA256(temp_key, k_ab || byte(0x02))
-		static uint8_t ask[4] = { 'a', 's', 'k', 1 }, master[32];
+		static const uint8_t ask[4] = { 'a', 's', 'k', 1 };
+		uint8_t master[32]; // per session, NTCP2 threads derive keys concurrently
 		HMAC(EVP_sha256(), tempKey, 32, ask, 4, master, &len); // ask_master = HMAC-SHA256(temp_key, "ask" || byte(0x01))
 		uint8_t h[39];
 		memcpy (h, m_Establisher->GetH (), 32);
@@ -601,7 +603,7 @@ namespace transport
 		memcpy (m_ReceiveIV.buf, m_Sipkeysba + 16, 8);
 		memcpy (m_SendIV.buf, m_Sipkeysab + 16, 8);
 		Established ();
-		ReceiveLength ();
+		Receive ();
 
 		// TODO: remove
 		// m_SendQueue.push_back (CreateDeliveryStatusMsg (1));
@@ -700,9 +702,11 @@ namespace transport
 					// ready to communicate	
 					auto existing = dotnet::data::netdb.FindRouter (ri.GetRouterIdentity ()->GetIdentHash ()); // check if exists already
 					SetRemoteIdentity (existing ? existing->GetRouterIdentity () : ri.GetRouterIdentity ());
-					m_Server.AddNTCP2Session (shared_from_this ());
-					Established ();
-					ReceiveLength ();
+					if (m_Server.AddNTCP2Session (shared_from_this ()))
+					{
+						Established ();
+						Receive ();
+					}
 				}
 				else
 					Terminate ();
@@ -747,61 +751,65 @@ namespace transport
 				std::placeholders::_1, std::placeholders::_2));
 	}
 
-	void NTCP2Session::ReceiveLength ()
+	uint16_t NTCP2Session::GetNextReceivedFrameLength (const uint8_t * lengthBuf)
 	{
-		if (IsTerminated ()) return;
-		boost::asio::async_read (m_Socket, boost::asio::buffer(&m_NextReceivedLen, 2), boost::asio::transfer_all (),
-			std::bind(&NTCP2Session::HandleReceivedLength, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+#if OPENSSL_SIPHASH
+		EVP_DigestSignInit (m_ReceiveMDCtx, nullptr, nullptr, nullptr, nullptr);
+		EVP_DigestSignUpdate (m_ReceiveMDCtx, m_ReceiveIV.buf, 8); 
+		size_t l = 8;    
+		EVP_DigestSignFinal (m_ReceiveMDCtx, m_ReceiveIV.buf, &l);   
+#else
+		dotnet::crypto::Siphash<8> (m_ReceiveIV.buf, m_ReceiveIV.buf, 8, m_ReceiveSipKey);
+#endif
+		// length comes from the network in BigEndian
+		uint16_t len = bufbe16toh (lengthBuf) ^ le16toh (m_ReceiveIV.key);
+		LogPrint (eLogDebug, "NTCP2: received length ", len);
+		return len;
 	}
 
-	void NTCP2Session::HandleReceivedLength (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	void NTCP2Session::Receive ()
 	{
-		if (ecode)
+		if (IsTerminated ()) return;
+		size_t size = m_ReceiveBuffer.size ();
+		bool isFull = size && m_ReceiveBufferLen == size; // last read filled all free space, checked before compaction
+		if (m_ReceiveBufferOffset == m_ReceiveBufferLen)
+			m_ReceiveBufferOffset = m_ReceiveBufferLen = 0;
+		else if (m_ReceiveBufferOffset)
 		{
-			if (ecode != boost::asio::error::operation_aborted)
-				LogPrint (eLogWarning, "NTCP2: receive length read error: ", ecode.message ());
-			Terminate ();
+			// move incomplete frame to the beginning, frames must be contiguous for decryption
+			m_ReceiveBufferLen -= m_ReceiveBufferOffset;
+			memmove (m_ReceiveBuffer.data (), m_ReceiveBuffer.data () + m_ReceiveBufferOffset, m_ReceiveBufferLen);
+			m_ReceiveBufferOffset = 0;
 		}
-		else
+		// grow if last read filled the buffer or next frame doesn't fit, shrink if it stays mostly empty
+		if (size < NTCP2_RECEIVE_BUFFER_MIN_SIZE) size = NTCP2_RECEIVE_BUFFER_MIN_SIZE;
+		if (isFull)
 		{
-#if OPENSSL_SIPHASH
-			EVP_DigestSignInit (m_ReceiveMDCtx, nullptr, nullptr, nullptr, nullptr);
-			EVP_DigestSignUpdate (m_ReceiveMDCtx, m_ReceiveIV.buf, 8); 
-			size_t l = 8;    
-			EVP_DigestSignFinal (m_ReceiveMDCtx, m_ReceiveIV.buf, &l);   
-#else
-			dotnet::crypto::Siphash<8> (m_ReceiveIV.buf, m_ReceiveIV.buf, 8, m_ReceiveSipKey);
-#endif
-			// m_NextReceivedLen comes from the network in BigEndian
-			m_NextReceivedLen = be16toh (m_NextReceivedLen) ^ le16toh (m_ReceiveIV.key);
-			LogPrint (eLogDebug, "NTCP2: received length ", m_NextReceivedLen);
-			if (m_NextReceivedLen >= 16)
-			{	
-				if (m_NextReceivedBuffer) delete[] m_NextReceivedBuffer;
-				m_NextReceivedBuffer = new uint8_t[m_NextReceivedLen];
-				boost::system::error_code ec;
-				size_t moreBytes = m_Socket.available(ec);
-				if (!ec && moreBytes >= m_NextReceivedLen)
-				{
-					// read and process message immediately if available
-					moreBytes = boost::asio::read (m_Socket, boost::asio::buffer(m_NextReceivedBuffer, m_NextReceivedLen), boost::asio::transfer_all (), ec);
-					HandleReceived (ec, moreBytes);
-				}
-				else
-					Receive ();
-			}
-			else
+			size <<= 1;
+			m_NumSmallReads = 0;
+		}
+		else if (size > NTCP2_RECEIVE_BUFFER_MIN_SIZE && m_LastReceivedBytes < size/4 && m_ReceiveBufferLen < size/4)
+		{
+			// not on single short read, otherwise bursty peers make it grow and shrink all the time
+			if (++m_NumSmallReads >= NTCP2_RECEIVE_BUFFER_SHRINK_READS)
 			{
-				LogPrint (eLogError, "NTCP2: received length ", m_NextReceivedLen, " is too short");
-				Terminate ();
-			}	
+				size >>= 1;
+				m_NumSmallReads = 0;
+			}
+		}
+		else
+			m_NumSmallReads = 0;
+		if (m_NextReceivedLen && size < m_NextReceivedLen) size = m_NextReceivedLen;
+		if (size > NTCP2_RECEIVE_BUFFER_MAX_SIZE) size = NTCP2_RECEIVE_BUFFER_MAX_SIZE;
+		if (size > m_ReceiveBuffer.size ())
+			m_ReceiveBuffer.resize (size);
+		else if (size < m_ReceiveBuffer.size ())
+		{
+			m_ReceiveBuffer.resize (size);
+			m_ReceiveBuffer.shrink_to_fit ();
 		}
-	}
 
-	void NTCP2Session::Receive ()
-	{
-		if (IsTerminated ()) return;
-		boost::asio::async_read (m_Socket, boost::asio::buffer(m_NextReceivedBuffer, m_NextReceivedLen), boost::asio::transfer_all (),
+		m_Socket.async_read_some (boost::asio::buffer (m_ReceiveBuffer.data () + m_ReceiveBufferLen, m_ReceiveBuffer.size () - m_ReceiveBufferLen),
 			std::bind(&NTCP2Session::HandleReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
 	}
 
@@ -812,27 +820,46 @@ namespace transport
 			if (ecode != boost::asio::error::operation_aborted)
 				LogPrint (eLogWarning, "NTCP2: receive read error: ", ecode.message ());
 			Terminate ();
+			return;
 		}
-		else
+		m_LastActivityTimestamp = dotnet::util::GetSecondsSinceEpoch ();
+		m_NumReceivedBytes += bytes_transferred;
+		dotnet::transport::transports.UpdateReceivedBytes (bytes_transferred);
+		m_ReceiveBufferLen += bytes_transferred;
+		m_LastReceivedBytes = bytes_transferred;
+		// process every complete frame we have
+		for (;;)
 		{
-			m_LastActivityTimestamp = dotnet::util::GetSecondsSinceEpoch ();
-			m_NumReceivedBytes += bytes_transferred + 2; // + length
-			dotnet::transport::transports.UpdateReceivedBytes (bytes_transferred);
+			uint8_t * buf = m_ReceiveBuffer.data () + m_ReceiveBufferOffset;
+			size_t len = m_ReceiveBufferLen - m_ReceiveBufferOffset;
+			if (!m_NextReceivedLen) // length of next frame is not known yet
+			{
+				if (len < 2) break;
+				m_NextReceivedLen = GetNextReceivedFrameLength (buf);
+				if (m_NextReceivedLen < 16)
+				{
+					LogPrint (eLogError, "NTCP2: received length ", m_NextReceivedLen, " is too short");
+					Terminate ();
+					return;
+				}
+				m_ReceiveBufferOffset += 2; buf += 2; len -= 2;
+			}
+			if (len < m_NextReceivedLen) break;
 			uint8_t nonce[12];
 			CreateNonce (m_ReceiveSequenceNumber, nonce); m_ReceiveSequenceNumber++;
-			if (dotnet::crypto::AEADChaCha20Poly1305 (m_NextReceivedBuffer, m_NextReceivedLen-16, nullptr, 0, m_ReceiveKey, nonce, m_NextReceivedBuffer, m_NextReceivedLen, false))
-			{	
-				LogPrint (eLogDebug, "NTCP2: received message decrypted");
-				ProcessNextFrame (m_NextReceivedBuffer, m_NextReceivedLen-16);
-				delete[] m_NextReceivedBuffer; m_NextReceivedBuffer = nullptr; // we don't need received buffer anymore
-				ReceiveLength ();
-			}
-			else
+			if (!dotnet::crypto::AEADChaCha20Poly1305 (buf, m_NextReceivedLen-16, nullptr, 0, m_ReceiveKey, nonce, buf, m_NextReceivedLen, false))
 			{
 				LogPrint (eLogWarning, "NTCP2: Received AEAD verification failed ");
 				SendTerminationAndTerminate (eNTCP2DataPhaseAEADFailure);
-			}	
+				return;
+			}
+			LogPrint (eLogDebug, "NTCP2: received message decrypted");
+			ProcessNextFrame (buf, m_NextReceivedLen-16);
+			m_ReceiveBufferOffset += m_NextReceivedLen;
+			m_NextReceivedLen = 0;
+			if (IsTerminated ()) return;
 		}
+		Receive ();
 	}
 
 	void NTCP2Session::ProcessNextFrame (const uint8_t * frame, size_t len)
@@ -915,82 +942,6 @@ namespace transport
 		LogPrint (eLogDebug, "NTCP2: sent length ", frameLen);
 	}	
 
-	void NTCP2Session::SendDNNPMsgs (std::vector<std::shared_ptr<DNNPMessage> >& msgs)
-	{
-		if (msgs.empty () || IsTerminated ()) return;
-		
-		size_t totalLen = 0;
-		std::vector<std::pair<uint8_t *, size_t> > encryptBufs;
-		std::vector<boost::asio::const_buffer> bufs; 
-		std::shared_ptr<DNNPMessage> first;
-		uint8_t * macBuf = nullptr;
-		for (auto& it: msgs) 
-		{	
-			it->ToNTCP2 ();
-			auto buf = it->GetNTCP2Header ();
-			auto len = it->GetNTCP2Length ();
-			// block header
-			buf -= 3; 
-			buf[0] = eNTCP2BlkDNNPMessage; // blk
-			htobe16buf (buf + 1, len); // size
-			len += 3; 	
-			totalLen += len;		
-			encryptBufs.push_back ( {buf, len} );
-			if (&it == &msgs.front ()) // first message
-			{
-				// allocate two bytes for length
-				buf -= 2; len += 2;
-				first = it;
-			}	
-			if (&it == &msgs.back () && it->len + 16 < it->maxLen) // last message
-			{	
-				// if it's long enough we add padding and MAC to it
-				// create padding block
-				auto paddingLen = CreatePaddingBlock (totalLen, buf + len, it->maxLen - it->len - 16);
-				if (paddingLen)
-				{
-					encryptBufs.push_back ( {buf + len, paddingLen} );
-					len += paddingLen;
-					totalLen += paddingLen;
-				}
-				macBuf = buf + len;
-				// allocate 16 bytes for MAC
-				len += 16;
-			}	
-				
-			bufs.push_back (boost::asio::buffer (buf, len));
-		}
-
-		if (!macBuf) // last block was not enough for MAC
-		{
-			// allocate send buffer
-			m_NextSendBuffer = new uint8_t[287]; // can be any size > 16, we just allocate 287 frequently
-			// crate padding block
-			auto paddingLen = CreatePaddingBlock (totalLen, m_NextSendBuffer, 287 - 16);
-			// and padding block to encrypt and send
-			if (paddingLen)
-				encryptBufs.push_back ( {m_NextSendBuffer, paddingLen} );			
-			bufs.push_back (boost::asio::buffer (m_NextSendBuffer, paddingLen + 16));
-			macBuf = m_NextSendBuffer + paddingLen;
-			totalLen += paddingLen;		
-		}
-		uint8_t nonce[12];
-		CreateNonce (m_SendSequenceNumber, nonce); m_SendSequenceNumber++;
-		dotnet::crypto::AEADChaCha20Poly1305Encrypt (encryptBufs, m_SendKey, nonce, macBuf); // encrypt buffers
-		SetNextSentFrameLength (totalLen + 16, first->GetNTCP2Header () - 5); // frame length right before first block
-			
-		// send buffers
-		m_IsSending = true;	
-		boost::asio::async_write (m_Socket, bufs, boost::asio::transfer_all (),
-			std::bind(&NTCP2Session::HandleDNNPMsgsSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, msgs));
-	}	
-
-	void NTCP2Session::HandleDNNPMsgsSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<DNNPMessage> > msgs)
-	{
-		HandleNextFrameSent (ecode, bytes_transferred);
-		// msgs get destroyed here
-	}
-	
 	void NTCP2Session::EncryptAndSendNextBuffer (size_t payloadLen)
 	{
 		if (IsTerminated ()) 
@@ -1030,30 +981,89 @@ namespace transport
 	
 	void NTCP2Session::SendQueue ()
 	{
-		if (!m_SendQueue.empty ())
+		if (m_SendQueue.empty () || IsTerminated () || m_IsSendingFrames) return; // arena is busy until written
+		// pack queued messages into frames placed one after another in the arena
+		size_t len = 0, numFrames = 0;
+		while (!m_SendQueue.empty () && numFrames < NTCP2_MAX_FRAMES_PER_WRITE)
+		{
+			auto l = CreateNextFrame (len);
+			if (l == len) break; // everything left was dropped
+			len = l; numFrames++;
+		}
+		if (!numFrames) return;
+		// send all frames at once
+		m_IsSending = true; m_IsSendingFrames = true;
+		boost::asio::async_write (m_Socket, boost::asio::buffer (m_SendArena.data (), len), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleFramesSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, numFrames));
+	}
+
+	size_t NTCP2Session::CreateNextFrame (size_t offset)
+	{
+		// 2 bytes length, DNNP blocks, padding block, 16 bytes MAC
+		size_t payloadLen = 0;
+		while (!m_SendQueue.empty ())
 		{
-			std::vector<std::shared_ptr<DNNPMessage> > msgs;
-			size_t s = 0;
-			while (!m_SendQueue.empty ())
+			auto& msg = m_SendQueue.front ();
+			size_t len = msg->GetNTCP2Length ();
+			if (len + 3 > NTCP2_UNENCRYPTED_FRAME_MAX_SIZE) // 3 bytes block header
 			{
-				auto msg = m_SendQueue.front ();
-				size_t len = msg->GetNTCP2Length (); 
-				if (s + len + 3 <= NTCP2_UNENCRYPTED_FRAME_MAX_SIZE) // 3 bytes block header
-				{
-					msgs.push_back (msg);
-					s += (len + 3);
-					m_SendQueue.pop_front ();
-				}
-				else if (len + 3 > NTCP2_UNENCRYPTED_FRAME_MAX_SIZE)
-				{
-					LogPrint (eLogError, "NTCP2: DNNP message of size ", len, " can't be sent. Dropped");
-					m_SendQueue.pop_front ();
-				}
-				else
-					break;
+				LogPrint (eLogError, "NTCP2: DNNP message of size ", len, " can't be sent. Dropped");
+				m_SendQueue.pop_front ();
+				continue;
 			}
-			SendDNNPMsgs (msgs);
-		} 
+			if (payloadLen + len + 3 > NTCP2_UNENCRYPTED_FRAME_MAX_SIZE) break; // next frame
+			ReserveSendArena (offset + 2 + payloadLen + len + 3);
+			uint8_t * buf = m_SendArena.data () + offset + 2 + payloadLen;
+			msg->ToNTCP2 ();
+			buf[0] = eNTCP2BlkDNNPMessage; // blk
+			htobe16buf (buf + 1, len); // size
+			memcpy (buf + 3, msg->GetNTCP2Header (), len);
+			payloadLen += len + 3;
+			m_SendQueue.pop_front ();
+		}
+		if (!payloadLen) return offset;
+		// padding block can't exceed NTCP2_MAX_PADDING_RATIO of payload
+		size_t paddingLen = (std::max (payloadLen, (size_t)256)*NTCP2_MAX_PADDING_RATIO)/100 + 3;
+		if (payloadLen + paddingLen > NTCP2_UNENCRYPTED_FRAME_MAX_SIZE) paddingLen = NTCP2_UNENCRYPTED_FRAME_MAX_SIZE - payloadLen;
+		ReserveSendArena (offset + 2 + payloadLen + paddingLen + 16);
+		uint8_t * frame = m_SendArena.data () + offset;
+		payloadLen += CreatePaddingBlock (payloadLen, frame + 2 + payloadLen, paddingLen);
+		// encrypt in place
+		uint8_t nonce[12];
+		CreateNonce (m_SendSequenceNumber, nonce); m_SendSequenceNumber++;
+		dotnet::crypto::AEADChaCha20Poly1305 (frame + 2, payloadLen, nullptr, 0, m_SendKey, nonce, frame + 2, payloadLen + 16, true);
+		SetNextSentFrameLength (payloadLen + 16, frame);
+		return offset + 2 + payloadLen + 16;
+	}
+
+	void NTCP2Session::ReserveSendArena (size_t len)
+	{
+		// grows only, so no zeroing or reallocation for every write, released by HandleFramesSent
+		if (m_SendArena.size () < len) m_SendArena.resize (len);
+	}
+
+	void NTCP2Session::HandleFramesSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, size_t numFrames)
+	{
+		m_IsSending = false; m_IsSendingFrames = false;
+		if (ecode)
+		{
+			LogPrint (eLogWarning, "NTCP2: Couldn't send frames ", ecode.message ());
+			return;
+		}
+		m_LastActivityTimestamp = dotnet::util::GetSecondsSinceEpoch ();
+		m_NumSentBytes += bytes_transferred;
+		m_NumSentFrames += numFrames; m_NumWrites++;
+		dotnet::transport::transports.UpdateSentBytes (bytes_transferred);
+		LogPrint (eLogDebug, "NTCP2: ", numFrames, " frames sent ", bytes_transferred);
+		if (bytes_transferred > NTCP2_SEND_ARENA_KEEP_SIZE)
+			m_NumSmallWrites = 0;
+		else if (m_SendArena.size () > NTCP2_SEND_ARENA_KEEP_SIZE && ++m_NumSmallWrites >= NTCP2_SEND_ARENA_SHRINK_WRITES)
+		{
+			// burst is over, keep arena of regular writes only
+			std::vector<uint8_t>().swap (m_SendArena);
+			m_NumSmallWrites = 0;
+		}
+		SendQueue ();
 	}
 
 	size_t NTCP2Session::CreatePaddingBlock (size_t msgLen, uint8_t * buf, size_t len)
@@ -1106,12 +1116,12 @@ namespace transport
 	void NTCP2Session::SendTerminationAndTerminate (NTCP2TerminationReason reason)
 	{
 		SendTermination (reason);
-		m_Server.GetService ().post (std::bind (&NTCP2Session::Terminate, shared_from_this ())); // let termination message go
+		m_Service.post (std::bind (&NTCP2Session::Terminate, shared_from_this ())); // let termination message go
 	}
 
 	void NTCP2Session::SendDNNPMessages (const std::vector<std::shared_ptr<DNNPMessage> >& msgs)
 	{
-		m_Server.GetService ().post (std::bind (&NTCP2Session::PostDNNPMessages, shared_from_this (), msgs));
+		m_Service.post (std::bind (&NTCP2Session::PostDNNPMessages, shared_from_this (), msgs));
 	}
 
 	void NTCP2Session::PostDNNPMessages (std::vector<std::shared_ptr<DNNPMessage> > msgs)
@@ -1131,13 +1141,18 @@ namespace transport
 	void NTCP2Session::SendLocalRouterInfo ()
 	{
 		if (!IsOutgoing ()) // we send it in SessionConfirmed
-			m_Server.GetService ().post (std::bind (&NTCP2Session::SendRouterInfo, shared_from_this ()));
+			m_Service.post (std::bind (&NTCP2Session::SendRouterInfo, shared_from_this ()));
 	}
 
-	NTCP2Server::NTCP2Server ():
+	NTCP2Server::NTCP2Server (int numThreads):
 		m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service),
-		m_TerminationTimer (m_Service)
+		m_TerminationTimer (m_Service), m_NextShard (0)
 	{
+		if (!numThreads)
+			numThreads = std::thread::hardware_concurrency ();
+		if (numThreads > 1) // otherwise sessions share m_Service with acceptors
+			for (int i = 0; i < numThreads; i++)
+				m_Shards.emplace_back (new Shard);
 	}
 
 	NTCP2Server::~NTCP2Server ()
@@ -1150,7 +1165,11 @@ namespace transport
 		if (!m_IsRunning)
 		{
 			m_IsRunning = true;
-			m_Thread = new std::thread (std::bind (&NTCP2Server::Run, this));
+			m_Thread = new std::thread (std::bind (&NTCP2Server::Run, this, &m_Service));
+			for (auto& it: m_Shards)
+				it->thread = new std::thread (std::bind (&NTCP2Server::Run, this, &it->service));
+			if (!m_Shards.empty ())
+				LogPrint (eLogInfo, "NTCP2: sessions run in ", m_Shards.size (), " threads");
 			auto& addresses = context.GetRouterInfo ().GetAddresses ();
 			for (const auto& address: addresses)
 			{
@@ -1200,37 +1219,53 @@ namespace transport
 
 	void NTCP2Server::Stop ()
 	{
-		{
-			// we have to copy it because Terminate changes m_NTCP2Sessions
-			auto ntcpSessions = m_NTCP2Sessions;
-			for (auto& it: ntcpSessions)
-				it.second->Terminate ();
-			for (auto& it: m_PendingIncomingSessions)
-				it->Terminate ();
-		}
-		m_NTCP2Sessions.clear ();
-
 		if (m_IsRunning)
 		{
 			m_IsRunning = false;
 			m_TerminationTimer.cancel ();
 			m_Service.stop ();
+			for (auto& it: m_Shards)
+				it->service.stop ();
 			if (m_Thread)
 			{
 				m_Thread->join ();
 				delete m_Thread;
 				m_Thread = nullptr;
 			}
+			for (auto& it: m_Shards)
+				if (it->thread)
+				{
+					it->thread->join ();
+					delete it->thread;
+					it->thread = nullptr;
+				}
 		}
+		// no session threads anymore, safe to terminate from here
+		{
+			// we have to copy it because Terminate changes m_NTCP2Sessions
+			auto ntcpSessions = GetNTCP2Sessions ();
+			for (auto& it: ntcpSessions)
+				it.second->Terminate ();
+			for (auto& it: m_PendingIncomingSessions)
+				it->Terminate ();
+		}
+		std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+		m_NTCP2Sessions.clear ();
+	}
+
+	boost::asio::io_service& NTCP2Server::GetNextSessionService ()
+	{
+		if (m_Shards.empty ()) return m_Service;
+		return m_Shards[m_NextShard++ % m_Shards.size ()]->service;
 	}
 
-	void NTCP2Server::Run ()
+	void NTCP2Server::Run (boost::asio::io_service * service)
 	{
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				service->run ();
 			}
 			catch (std::exception& ex)
 			{
@@ -1243,25 +1278,34 @@ namespace transport
 	{
 		if (!session || !session->GetRemoteIdentity ()) return false;
 		auto& ident = session->GetRemoteIdentity ()->GetIdentHash ();
-		auto it = m_NTCP2Sessions.find (ident);
-		if (it != m_NTCP2Sessions.end ())
+		bool inserted;
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			inserted = m_NTCP2Sessions.insert (std::make_pair (ident, session)).second;
+		}
+		if (!inserted)
 		{
 			LogPrint (eLogWarning, "NTCP2: session to ", ident.ToBase64 (), " already exists");
-			session->Terminate();
+			session->Terminate(); // doesn't remove existing one
 			return false;
 		}
-		m_NTCP2Sessions.insert (std::make_pair (ident, session));
 		return true;
 	}
 
 	void NTCP2Server::RemoveNTCP2Session (std::shared_ptr<NTCP2Session> session)
 	{
 		if (session && session->GetRemoteIdentity ())
-			m_NTCP2Sessions.erase (session->GetRemoteIdentity ()->GetIdentHash ());
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			auto it = m_NTCP2Sessions.find (session->GetRemoteIdentity ()->GetIdentHash ());
+			if (it != m_NTCP2Sessions.end () && it->second == session)
+				m_NTCP2Sessions.erase (it);
+		}
 	}
 
 	std::shared_ptr<NTCP2Session> NTCP2Server::FindNTCP2Session (const dotnet::data::IdentHash& ident)
 	{
+		std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
 		auto it = m_NTCP2Sessions.find (ident);
 		if (it != m_NTCP2Sessions.end ())
 			return it->second;
@@ -1271,11 +1315,11 @@ namespace transport
 	void NTCP2Server::Connect(const boost::asio::ip::address & address, uint16_t port, std::shared_ptr<NTCP2Session> conn)
 	{
 		LogPrint (eLogDebug, "NTCP2: Connecting to ", address ,":",  port);
-		m_Service.post([this, address, port, conn]() 
+		conn->GetService ().post([this, address, port, conn]() 
 			{
 				if (this->AddNTCP2Session (conn))
 				{
-					auto timer = std::make_shared<boost::asio::deadline_timer>(m_Service);
+					auto timer = std::make_shared<boost::asio::deadline_timer>(conn->GetService ());
 					auto timeout = NTCP2_CONNECT_TIMEOUT * 5;
 					conn->SetTerminationTimeout(timeout * 2);
 					timer->expires_from_now (boost::posix_time::seconds(timeout));
@@ -1321,7 +1365,7 @@ namespace transport
 				LogPrint (eLogDebug, "NTCP2: Connected from ", ep);
 				if (conn)
 				{
-					conn->ServerLogin ();
+					conn->GetService ().post (std::bind (&NTCP2Session::ServerLogin, conn));
 					m_PendingIncomingSessions.push_back (conn);
 				}
 			}
@@ -1348,7 +1392,7 @@ namespace transport
 				LogPrint (eLogDebug, "NTCP2: Connected from ", ep);
 				if (conn)
 				{
-					conn->ServerLogin ();
+					conn->GetService ().post (std::bind (&NTCP2Session::ServerLogin, conn));
 					m_PendingIncomingSessions.push_back (conn);
 				}
 			}
@@ -1376,26 +1420,34 @@ namespace transport
 		if (ecode != boost::asio::error::operation_aborted)
 		{
 			auto ts = dotnet::util::GetSecondsSinceEpoch ();
-			// established
-			for (auto& it: m_NTCP2Sessions)
-				if (it.second->IsTerminationTimeoutExpired (ts))
-				{
-					auto session = it.second;
-					LogPrint (eLogDebug, "NTCP2: No activity for ", session->GetTerminationTimeout (), " seconds");
-					session->TerminateByTimeout (); // it doesn't change m_NTCP2Session right a way
-				}
-			// pending
+			// established, checked in session's thread
+			for (auto& it: GetNTCP2Sessions ())
+			{
+				auto session = it.second;
+				session->GetService ().post ([session, ts]()
+					{
+						if (session->IsTerminationTimeoutExpired (ts))
+						{
+							LogPrint (eLogDebug, "NTCP2: No activity for ", session->GetTerminationTimeout (), " seconds");
+							session->TerminateByTimeout (); // it doesn't change m_NTCP2Session right a way
+						}
+					});
+			}
+			// pending, removed at next check after termination
 			for (auto it = m_PendingIncomingSessions.begin (); it != m_PendingIncomingSessions.end ();)
 			{
 				if ((*it)->IsEstablished () || (*it)->IsTerminated ())
 					it = m_PendingIncomingSessions.erase (it); // established or terminated
-				else if ((*it)->IsTerminationTimeoutExpired (ts))
-				{
-					(*it)->Terminate ();
-					it = m_PendingIncomingSessions.erase (it); // expired
-				}
 				else
+				{
+					auto session = *it;
+					session->GetService ().post ([session, ts]()
+						{
+							if (!session->IsEstablished () && session->IsTerminationTimeoutExpired (ts))
+								session->Terminate (); // expired
+						});
 					it++;
+				}
 			}
 
 			ScheduleTermination ();
@@ -14,6 +14,9 @@
 #include <inttypes.h>
 #include <memory>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
 #include <list>
 #include <map>
 #include <array>
@@ -32,6 +35,12 @@ namespace transport
 
 	const size_t NTCP2_UNENCRYPTED_FRAME_MAX_SIZE = 65519;	
 	const int NTCP2_MAX_PADDING_RATIO = 6; // in %
+	const size_t NTCP2_MAX_FRAMES_PER_WRITE = 4;
+	const size_t NTCP2_SEND_ARENA_KEEP_SIZE = 16384; // larger send arena is released after number of smaller writes
+	const int NTCP2_SEND_ARENA_SHRINK_WRITES = 64; // consecutive writes up to keep size
+	const size_t NTCP2_RECEIVE_BUFFER_MIN_SIZE = 16384; // grows up to max while reads fill it, shrinks back while they don't
+	const size_t NTCP2_RECEIVE_BUFFER_MAX_SIZE = 131072; // fits any frame with room for next ones
+	const int NTCP2_RECEIVE_BUFFER_SHRINK_READS = 16; // consecutive reads using less than quarter of buffer
 
 	const int NTCP2_CONNECT_TIMEOUT = 5; // 5 seconds
 	const int NTCP2_ESTABLISH_TIMEOUT = 10; // 10 seconds
@@ -135,6 +144,10 @@ namespace transport
 			void Done ();
 
 			boost::asio::ip::tcp::socket& GetSocket () { return m_Socket; };
+			boost::asio::io_service& GetService () { return m_Service; }; // of server's shard session is pinned to
+
+			size_t GetNumSentFrames () const { return m_NumSentFrames; };
+			size_t GetNumWrites () const { return m_NumWrites; };
 
 			bool IsEstablished () const { return m_IsEstablished; };
 			bool IsTerminated () const { return m_IsTerminated; };
@@ -168,19 +181,19 @@ namespace transport
 			void HandleSessionConfirmedReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 
 			// data
-			void ReceiveLength ();
-			void HandleReceivedLength (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			uint16_t GetNextReceivedFrameLength (const uint8_t * lengthBuf);
 			void Receive ();
 			void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 			void ProcessNextFrame (const uint8_t * frame, size_t len);
 
 			void SetNextSentFrameLength (size_t frameLen, uint8_t * lengthBuf);
-			void SendDNNPMsgs (std::vector<std::shared_ptr<DNNPMessage> >& msgs);
-			void HandleDNNPMsgsSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<DNNPMessage> > msgs);
 			void EncryptAndSendNextBuffer (size_t payloadLen);
 			void HandleNextFrameSent (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 			size_t CreatePaddingBlock (size_t msgLen, uint8_t * buf, size_t len);
 			void SendQueue ();
+			size_t CreateNextFrame (size_t offset); // from m_SendQueue to m_SendArena at offset, returns end of frame
+			void ReserveSendArena (size_t len);
+			void HandleFramesSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, size_t numFrames);
 			void SendRouterInfo ();
 			void SendTermination (NTCP2TerminationReason reason);
 			void SendTerminationAndTerminate (NTCP2TerminationReason reason);
@@ -189,8 +202,9 @@ namespace transport
 		private:
 
 			NTCP2Server& m_Server;
+			boost::asio::io_service& m_Service;
 			boost::asio::ip::tcp::socket m_Socket;
-			bool m_IsEstablished, m_IsTerminated;
+			std::atomic<bool> m_IsEstablished, m_IsTerminated; // read by server's thread
 
 			std::unique_ptr<NTCP2Establisher> m_Establisher;
 			// data phase
@@ -202,8 +216,12 @@ namespace transport
 #else
 			const uint8_t * m_SendSipKey, * m_ReceiveSipKey;
 #endif
-			uint16_t m_NextReceivedLen; 
-			uint8_t * m_NextReceivedBuffer, * m_NextSendBuffer;
+			uint16_t m_NextReceivedLen; // 0 if length of next frame is not received yet
+			std::vector<uint8_t> m_ReceiveBuffer; // frames as they come from socket, decrypted in place
+			size_t m_ReceiveBufferOffset, m_ReceiveBufferLen; // first unprocessed byte, end of data
+			size_t m_LastReceivedBytes; // by last read
+			int m_NumSmallReads; // in a row, buffer is halved when it reaches NTCP2_RECEIVE_BUFFER_SHRINK_READS
+			uint8_t * m_NextSendBuffer;
 			union
 			{
 				uint8_t buf[8];
@@ -213,31 +231,36 @@ namespace transport
 
 			dotnet::DNNPMessagesHandler m_Handler;
 
-			bool m_IsSending;
+			bool m_IsSending, m_IsSendingFrames;
 			std::list<std::shared_ptr<DNNPMessage> > m_SendQueue;
+			std::vector<uint8_t> m_SendArena; // frames of current write, encrypted in place
+			int m_NumSmallWrites; // in a row, since last write larger than NTCP2_SEND_ARENA_KEEP_SIZE
+			size_t m_NumSentFrames, m_NumWrites;
 	};
 
 	class NTCP2Server
 	{
 		public:
 
-			NTCP2Server ();
+			NTCP2Server (int numThreads = 1); // 0 - thread per core
 			~NTCP2Server ();
 
 			void Start ();
 			void Stop ();
 
-			bool AddNTCP2Session (std::shared_ptr<NTCP2Session> session);
+			bool AddNTCP2Session (std::shared_ptr<NTCP2Session> session); // from session's thread
 			void RemoveNTCP2Session (std::shared_ptr<NTCP2Session> session);
 			std::shared_ptr<NTCP2Session> FindNTCP2Session (const dotnet::data::IdentHash& ident);
 
-			boost::asio::io_service& GetService () { return m_Service; };
+			boost::asio::io_service& GetService () { return m_Service; }; // acceptors and timers
+			boost::asio::io_service& GetNextSessionService (); // shards in round robin, m_Service if single thread
+			int GetNumThreads () const { return m_Shards.empty () ? 1 : m_Shards.size (); };
 		
 			void Connect(const boost::asio::ip::address & address, uint16_t port, std::shared_ptr<NTCP2Session> conn);
 
 		private:
 
-			void Run ();
+			void Run (boost::asio::io_service * service);
 			void HandleAccept (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error);
 			void HandleAcceptV6 (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error);
 
@@ -249,19 +272,35 @@ namespace transport
 
 		private:
 
+			struct Shard
+			{
+				Shard (): work (service), thread (nullptr) {};
+
+				boost::asio::io_service service;
+				boost::asio::io_service::work work;
+				std::thread * thread;
+			};
+
 			bool m_IsRunning;
 			std::thread * m_Thread;
 			boost::asio::io_service m_Service;
 			boost::asio::io_service::work m_Work;
 			boost::asio::deadline_timer m_TerminationTimer;
 			std::unique_ptr<boost::asio::ip::tcp::acceptor> m_NTCP2Acceptor, m_NTCP2V6Acceptor;
+			std::vector<std::unique_ptr<Shard> > m_Shards; // empty if sessions run on m_Service
+			std::atomic<unsigned int> m_NextShard;
+			mutable std::mutex m_NTCP2SessionsMutex;
 			std::map<dotnet::data::IdentHash, std::shared_ptr<NTCP2Session> > m_NTCP2Sessions; 
-			std::list<std::shared_ptr<NTCP2Session> > m_PendingIncomingSessions;
+			std::list<std::shared_ptr<NTCP2Session> > m_PendingIncomingSessions; // m_Service only
 
 		public:
 
 			// for HTTP/DotNetControl
-			const decltype(m_NTCP2Sessions)& GetNTCP2Sessions () const { return m_NTCP2Sessions; };
+			decltype(m_NTCP2Sessions) GetNTCP2Sessions () const
+			{
+				std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+				return m_NTCP2Sessions;
+			};
 	};
 }
 }
@@ -775,14 +775,13 @@ namespace transport
 	}
 
 //-----------------------------------------
-	NTCPServer::NTCPServer (int workers):
+	NTCPServer::NTCPServer ():
 		m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service),
 		m_TerminationTimer (m_Service), m_NTCPAcceptor (nullptr), m_NTCPV6Acceptor (nullptr),
 		m_ProxyType(eNoProxy), m_Resolver(m_Service), m_ProxyEndpoint(nullptr),
 		m_SoftLimit(0), m_HardLimit(0)
 	{
-		if(workers <= 0) workers = 1;
-		m_CryptoPool = std::make_shared<Pool>(workers);
+		m_CryptoPool = std::make_shared<Pool>();
 	}
 
 	NTCPServer::~NTCPServer ()
@@ -152,7 +152,7 @@ namespace transport
 			};
 
 
-			NTCPServer (int workers=4);
+			NTCPServer ();
 			~NTCPServer ();
 
 			void Start ();
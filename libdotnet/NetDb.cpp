@@ -24,9 +24,99 @@ namespace dotnet
 {
 namespace data
 {
+	void RouterInfosIndex::Add (std::shared_ptr<RouterInfo> r)
+	{
+		if (!r || !m_Positions.emplace (r.get (), m_Routers.size ()).second) return;
+		size_t ind = m_Routers.size ();
+		m_Routers.push_back (r);
+		m_Transports.push_back (0);
+		if (!(ind & 0x3F)) // new word
+			for (auto& it: m_Caps) it.push_back (0);
+		SetCaps (ind, *r);
+	}
+
+	void RouterInfosIndex::Update (std::shared_ptr<RouterInfo> r)
+	{
+		auto it = m_Positions.find (r.get ());
+		if (it != m_Positions.end ())
+			SetCaps (it->second, *r);
+	}
+
+	void RouterInfosIndex::Remove (std::shared_ptr<RouterInfo> r)
+	{
+		auto it = m_Positions.find (r.get ());
+		if (it == m_Positions.end ()) return;
+		size_t ind = it->second, last = m_Routers.size () - 1;
+		m_Positions.erase (it);
+		if (ind != last)
+		{
+			// move last to the removed place
+			m_Routers[ind] = m_Routers[last];
+			m_Transports[ind] = m_Transports[last];
+			for (int c = 0; c < NUM_INDEXED_CAPS; c++)
+				SetBit (c, ind, GetBit (c, last));
+			m_Positions[m_Routers[ind].get ()] = ind;
+		}
+		m_Routers.pop_back ();
+		m_Transports.pop_back ();
+		for (int c = 0; c < NUM_INDEXED_CAPS; c++)
+			SetBit (c, last, false);
+		if (!(last & 0x3F)) // last word is empty now
+			for (auto& it: m_Caps) it.pop_back ();
+	}
+
+	void RouterInfosIndex::Clear ()
+	{
+		m_Routers.clear ();
+		m_Transports.clear ();
+		for (auto& it: m_Caps) it.clear ();
+		m_Positions.clear ();
+	}
+
+	void RouterInfosIndex::SetCaps (size_t ind, const RouterInfo& r)
+	{
+		auto transports = r.GetSupportedTransports ();
+		m_Transports[ind] = transports;
+		SetBit (0, ind, r.IsFloodfill ());
+		SetBit (1, ind, r.IsHighBandwidth ());
+		SetBit (2, ind, r.IsReachable ());
+		SetBit (3, ind, transports & (RouterInfo::eSSUV4 | RouterInfo::eSSUV6));
+		SetBit (4, ind, transports & (RouterInfo::eNTCP2V4 | RouterInfo::eNTCP2V6));
+	}
+
+	bool RouterInfosIndex::Matches (size_t ind, uint8_t caps, uint8_t transports) const
+	{
+		if (transports && !(m_Transports[ind] & transports)) return false;
+		for (int c = 0; c < NUM_INDEXED_CAPS; c++)
+			if ((caps & (1 << c)) && !GetBit (c, ind)) return false;
+		return true;
+	}
+
+	std::vector<std::shared_ptr<RouterInfo> >::const_iterator FloodfillsIndex::Find (const IdentHash& ident) const
+	{
+		return std::lower_bound (m_Floodfills.begin (), m_Floodfills.end (), ident,
+			[](const std::shared_ptr<RouterInfo>& r, const IdentHash& h) { return r->GetIdentHash () < h; });
+	}
+
+	void FloodfillsIndex::Insert (std::shared_ptr<RouterInfo> r)
+	{
+		auto it = Find (r->GetIdentHash ());
+		if (it != m_Floodfills.end () && (*it)->GetIdentHash () == r->GetIdentHash ())
+			m_Floodfills[it - m_Floodfills.begin ()] = r;
+		else
+			m_Floodfills.insert (it, r);
+	}
+
+	void FloodfillsIndex::Remove (std::shared_ptr<RouterInfo> r)
+	{
+		auto it = Find (r->GetIdentHash ());
+		if (it != m_Floodfills.end () && *it == r)
+			m_Floodfills.erase (it);
+	}
+
 	NetDb netdb;
 
-	NetDb::NetDb (): m_IsRunning (false), m_Thread (nullptr), m_Reseeder (nullptr), m_Storage("netDb", "r", "routerInfo-", "dat"), m_PersistProfiles (true), m_HiddenMode(false)
+	NetDb::NetDb (): m_RoutingKeysDay (0), m_IsRunning (false), m_Thread (nullptr), m_Reseeder (nullptr), m_Storage("netDb", "r", "routerInfo-", "dat"), m_PersistProfiles (true), m_HiddenMode(false)
 	{
 	}
 
@@ -40,6 +130,22 @@ namespace data
 	{
 		m_Storage.SetPlace(dotnet::fs::GetDataDir());
 		m_Storage.Init(dotnet::data::GetBase64SubstitutionTable(), 64);
+		std::string netDbStore; dotnet::config::GetOption("persist.netdbstore", netDbStore);
+		if (netDbStore == "single")
+		{
+			m_Store.reset (new NetDbStore (dotnet::fs::DataDirPath (NETDB_STORE_FILENAME)));
+			if (!m_Store->Open ())
+			{
+				LogPrint (eLogError, "NetDb: can't open ", m_Store->GetPath (), ", store RouterInfos in files");
+				m_Store.reset (nullptr);
+			}
+		}
+		else
+		{
+			if (netDbStore != "files")
+				LogPrint (eLogWarning, "NetDb: unknown netDb store '", netDbStore, "', store RouterInfos in files");
+			MigrateStoreToFiles ();
+		}
 		InitProfilesStorage ();
 		m_Families.LoadCertificates ();
 		Load ();
@@ -62,8 +168,8 @@ namespace data
 				for (auto& it: m_RouterInfos)
 					it.second->SaveProfile ();
 			DeleteObsoleteProfiles ();
-			m_RouterInfos.clear ();
-			m_Floodfills.clear ();
+			ClearRouterInfos ();
+			m_Floodfills.Clear ();
 			if (m_Thread)
 			{
 				m_IsRunning = false;
@@ -72,6 +178,7 @@ namespace data
 				delete m_Thread;
 				m_Thread = 0;
 			}
+			m_Store.reset (nullptr);
 			m_LeaseSets.clear();
 			m_Requests.Stop ();
 		}
@@ -84,11 +191,10 @@ namespace data
 		{
 			try
 			{
-				auto msg = m_Queue.GetNextWithTimeout (15000); // 15 sec
-				if (msg)
+				std::vector<std::shared_ptr<const DNNPMessage> > msgs;
+				if (m_Queue.GetBatchWithTimeout (msgs, 15000)) // 15 sec
 				{
-					int numMsgs = 0;
-					while (msg)
+					for (auto& msg: msgs)
 					{
 						LogPrint(eLogDebug, "NetDb: got request with type ", (int) msg->GetTypeID ());
 						switch (msg->GetTypeID ())
@@ -110,9 +216,6 @@ namespace data
 								LogPrint (eLogError, "NetDb: unexpected message type ", (int) msg->GetTypeID ());
 								//dotnet::HandleDNNPMessage (msg);
 						}
-						if (numMsgs > 100) break;
-						msg = m_Queue.Get ();
-						numMsgs++;
 					}
 				}
 				if (!m_IsRunning) break;
@@ -128,6 +231,7 @@ namespace data
 					if (lastSave)
 					{
 						SaveUpdated ();
+						SaveProfiles ();
 						ManageLeaseSets ();
 					}
 					lastSave = ts;
@@ -192,6 +296,37 @@ namespace data
 		return nullptr;
 	}
 
+	void NetDb::AddRouterInfos (const std::vector<std::vector<uint8_t> >& routerInfos)
+	{
+		std::vector<IdentityEx> identities (routerInfos.size ());
+		std::vector<size_t> identityLens (routerInfos.size ());
+		std::vector<size_t> batched; // indices of RouterInfos in batch
+		dotnet::crypto::EDDSA25519BatchVerifier batch;
+		for (size_t i = 0; i < routerInfos.size (); i++)
+		{
+			const auto& buf = routerInfos[i];
+			identityLens[i] = identities[i].FromBuffer (buf.data (), buf.size ());
+			if (identityLens[i] && identities[i].GetSigningKeyType () == SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519 &&
+				buf.size () > identityLens[i] + dotnet::crypto::EDDSA25519_SIGNATURE_LENGTH)
+			{
+				size_t l = buf.size () - dotnet::crypto::EDDSA25519_SIGNATURE_LENGTH;
+				batch.Add (identities[i].GetSigningPublicKeyBuffer (), buf.data (), l, buf.data () + l);
+				batched.push_back (i);
+			}
+		}
+		std::vector<bool> verified;
+		batch.Verify (verified);
+		std::vector<bool> verifySignature (routerInfos.size (), true);
+		for (size_t i = 0; i < batched.size (); i++)
+			if (verified[i]) verifySignature[batched[i]] = false;
+		LogPrint (eLogDebug, "NetDb: ", std::count (verified.begin (), verified.end (), true), " of ", routerInfos.size (), " RouterInfo signatures verified in batch");
+
+		bool updated;
+		for (size_t i = 0; i < routerInfos.size (); i++)
+			if (identityLens[i])
+				AddRouterInfo (identities[i].GetIdentHash (), routerInfos[i].data (), routerInfos[i].size (), updated, verifySignature[i]);
+	}
+
 	bool NetDb::AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len)
 	{
 		bool updated;
@@ -199,7 +334,8 @@ namespace data
 		return updated;
 	}
 
-	std::shared_ptr<const RouterInfo> NetDb::AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated)
+	std::shared_ptr<const RouterInfo> NetDb::AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated,
+		bool verifySignature)
 	{
 		updated = true;
 		auto r = FindRouter (ident);
@@ -208,16 +344,20 @@ namespace data
 			if (r->IsNewer (buf, len))
 			{
 				bool wasFloodfill = r->IsFloodfill ();
-				r->Update (buf, len);
+				r->Update (buf, len, verifySignature);
 				LogPrint (eLogInfo, "NetDb: RouterInfo updated: ", ident.ToBase64());
+				{
+					std::unique_lock<std::mutex> l(m_RouterInfosMutex);
+					m_RouterInfosIndex.Update (r);
+				}
 				if (wasFloodfill != r->IsFloodfill ()) // if floodfill status updated
 				{
 					LogPrint (eLogDebug, "NetDb: RouterInfo floodfill status updated: ", ident.ToBase64());
 					std::unique_lock<std::mutex> l(m_FloodfillsMutex);
 					if (wasFloodfill)
-						m_Floodfills.remove (r);	
-					else	
-						m_Floodfills.push_back (r);
+						m_Floodfills.Remove (r);
+					else
+						m_Floodfills.Insert (r);
 				}	
 			}
 			else
@@ -228,13 +368,14 @@ namespace data
 		}
 		else
 		{
-			r = std::make_shared<RouterInfo> (buf, len);
+			r = std::make_shared<RouterInfo> (buf, len, verifySignature);
 			if (!r->IsUnreachable () && r->HasValidAddresses ())
 			{
 				bool inserted = false;
 				{
 					std::unique_lock<std::mutex> l(m_RouterInfosMutex);
 					inserted = m_RouterInfos.insert ({r->GetIdentHash (), r}).second;
+					if (inserted) m_RouterInfosIndex.Add (r);
 				}
 				if (inserted)
 				{
@@ -242,7 +383,7 @@ namespace data
 					if (r->IsFloodfill () && r->IsReachable ()) // floodfill must be reachable
 					{
 						std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-						m_Floodfills.push_back (r);
+						m_Floodfills.Insert (r);
 					}
 				}
 				else
@@ -413,24 +554,63 @@ namespace data
 		dotnet::transport::transports.SendMessages(ih, requests);
 	}
 
-	bool NetDb::LoadRouterInfo (const std::string & path)
+	bool NetDb::IsLoadable (std::shared_ptr<const RouterInfo> r) const
+	{
+		return r->GetRouterIdentity () && !r->IsUnreachable () &&
+			(!r->UsesIntroducer () || m_LastLoad < r->GetTimestamp () + NETDB_INTRODUCEE_EXPIRATION_TIMEOUT*1000LL); // 1 hour
+	}
+
+	std::shared_ptr<RouterInfo> NetDb::LoadRouterInfo (const std::string & path, bool keepBuffer) const
 	{
 		auto r = std::make_shared<RouterInfo>(path);
-		if (r->GetRouterIdentity () && !r->IsUnreachable () &&
-				(!r->UsesIntroducer () || m_LastLoad < r->GetTimestamp () + NETDB_INTRODUCEE_EXPIRATION_TIMEOUT*1000LL)) // 1 hour
+		if (IsLoadable (r))
 		{
-			r->DeleteBuffer ();
+			if (!keepBuffer) r->DeleteBuffer ();
 			r->ClearProperties (); // properties are not used for regular routers
-			m_RouterInfos[r->GetIdentHash ()] = r;
-			if (r->IsFloodfill () && r->IsReachable ()) // floodfill must be reachable
-				m_Floodfills.push_back (r);
+			return r;
 		}
-		else
+		LogPrint(eLogWarning, "NetDb: RI from ", path, " is invalid. Delete");
+		dotnet::fs::Remove(path);
+		return nullptr;
+	}
+
+	std::shared_ptr<RouterInfo> NetDb::LoadRouterInfo (const IdentHash& ident, const uint8_t * buf, size_t len) const
+	{
+		if (len >= 40 && len <= MAX_RI_BUFFER_SIZE)
 		{
-			LogPrint(eLogWarning, "NetDb: RI from ", path, " is invalid. Delete");
-			dotnet::fs::Remove(path);
+			auto r = std::make_shared<RouterInfo>(buf, len, false);
+			if (IsLoadable (r) && r->GetIdentHash () == ident)
+			{
+				r->SetUpdated (false);
+				r->DeleteBuffer ();
+				r->ClearProperties (); // properties are not used for regular routers
+				return r;
+			}
 		}
-		return true;
+		LogPrint(eLogWarning, "NetDb: RI ", ident.ToBase64 (), " from ", m_Store->GetPath (), " is invalid. Delete");
+		return nullptr;
+	}
+
+	void NetDb::MigrateStoreToFiles ()
+	{
+		auto path = dotnet::fs::DataDirPath (NETDB_STORE_FILENAME);
+		if (!dotnet::fs::Exists (path)) return;
+		NetDbStore store (path);
+		if (!store.Open ()) return;
+		size_t numMigrated = 0;
+		store.Visit ([this, &numMigrated](const IdentHash& ident, const uint8_t * buf, size_t len)
+			{
+				std::ofstream f (m_Storage.Path (ident.ToBase64 ()), std::ofstream::binary | std::ofstream::out);
+				f.write ((const char *)buf, len);
+				if (f) numMigrated++;
+			});
+		bool migrated = numMigrated == store.GetNumRecords ();
+		store.Close ();
+		LogPrint (eLogInfo, "NetDb: ", numMigrated, " routers migrated from ", path, " to ", m_Storage.GetRoot ());
+		if (migrated)
+			dotnet::fs::Remove (path);
+		else
+			LogPrint (eLogError, "NetDb: can't migrate all routers from ", path, ", keep it");
 	}
 
 	void NetDb::VisitLeaseSets(LeaseSetVisitor v)
@@ -442,6 +622,15 @@ namespace data
 
 	void NetDb::VisitStoredRouterInfos(RouterInfoVisitor v)
 	{
+		if (m_Store)
+		{
+			m_Store->Visit ([v] (const IdentHash& ident, const uint8_t * buf, size_t len)
+			{
+				if (len <= MAX_RI_BUFFER_SIZE)
+					v(std::make_shared<dotnet::data::RouterInfo>(buf, len, false));
+			});
+			return;
+		}
 		m_Storage.Iterate([v] (const std::string & filename)
 		{
 			auto ri = std::make_shared<dotnet::data::RouterInfo>(filename);
@@ -459,38 +648,13 @@ namespace data
 	size_t NetDb::VisitRandomRouterInfos(RouterInfoFilter filter, RouterInfoVisitor v, size_t n)
 	{
 		std::vector<std::shared_ptr<const RouterInfo> > found;
-		const size_t max_iters_per_cyle = 3;
-		size_t iters = max_iters_per_cyle;
-		while(n > 0)
 		{
 			std::unique_lock<std::mutex> lock(m_RouterInfosMutex);
-			uint32_t idx = rand () % m_RouterInfos.size ();
-			uint32_t i = 0;
-			for (const auto & it : m_RouterInfos) {
-				if(i >= idx) // are we at the random start point?
-				{
-					// yes, check if we want this one
-					if(filter(it.second))
-					{
-						// we have a match
-						--n;
-						found.push_back(it.second);
-						// reset max iterations per cycle
-						iters = max_iters_per_cyle;
-						break;
-					}
-				}
-				else // not there yet
-					++i;
-			}
-			// we have enough
-			if(n == 0) break;
-			--iters;
-			// have we tried enough this cycle ?
-			if(!iters) {
-				// yes let's try the next cycle
+			while (n > 0)
+			{
+				auto r = m_RouterInfosIndex.GetRandom (filter);
+				if (r) found.push_back (r);
 				--n;
-				iters = max_iters_per_cyle;
 			}
 		}
 		// visit the ones we found
@@ -502,19 +666,116 @@ namespace data
 		return visited;
 	}
 
+	void NetDb::ClearRouterInfos ()
+	{
+		std::unique_lock<std::mutex> l(m_RouterInfosMutex);
+		m_RouterInfos.clear ();
+		m_RouterInfosIndex.Clear ();
+	}
+
 	void NetDb::Load ()
 	{
 		// make sure we cleanup netDb from previous attempts
-		m_RouterInfos.clear ();
-		m_Floodfills.clear ();
+		ClearRouterInfos ();
+		m_Floodfills.Clear ();
 
 		m_LastLoad = dotnet::util::GetSecondsSinceEpoch();
-		std::vector<std::string> files;
+		auto ts = dotnet::util::GetMillisecondsSinceEpoch ();
+		struct StoredRouterInfo
+		{
+			IdentHash ident;
+			const uint8_t * buf;
+			size_t len;
+		};
+		std::vector<StoredRouterInfo> records; // mapped from m_Store
+		if (m_Store)
+			m_Store->Visit ([&records](const IdentHash& ident, const uint8_t * buf, size_t len)
+				{
+					records.push_back ({ ident, buf, len });
+				});
+		std::vector<std::string> files; // must be migrated to m_Store if set
 		m_Storage.Traverse(files);
-		for (const auto& path : files)
-			LoadRouterInfo(path);
+		std::sort (files.begin (), files.end ()); // same order regardless of number of threads
+
+		// read and parse files and records by all cores
+		size_t numRecords = records.size (), numRouters = numRecords + files.size ();
+		std::vector<std::shared_ptr<RouterInfo> > routers (numRouters);
+		size_t numThreads = std::thread::hardware_concurrency ();
+		numThreads = std::max (std::min (numThreads, numRouters/NETDB_MIN_FILES_PER_LOAD_THREAD), (size_t)1);
+		bool migrate = m_Store != nullptr;
+		auto load = [&records, &files, &routers, numRecords, numThreads, migrate, this](size_t first)
+			{
+				for (size_t i = first; i < routers.size (); i += numThreads)
+					routers[i] = i < numRecords ? LoadRouterInfo (records[i].ident, records[i].buf, records[i].len) :
+						LoadRouterInfo (files[i - numRecords], migrate);
+			};
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < numThreads; i++)
+			threads.emplace_back (load, i);
+		load (0);
+		for (auto& it: threads) it.join ();
+
+		// merge, newer RouterInfo wins if the same router is both in the store and a file
+		std::vector<std::shared_ptr<RouterInfo> > floodfills;
+		{
+			std::unique_lock<std::mutex> l(m_RouterInfosMutex);
+			for (auto& r: routers)
+			{
+				if (!r) continue;
+				auto it = m_RouterInfos.find (r->GetIdentHash ());
+				if (it != m_RouterInfos.end ())
+				{
+					if (it->second->GetTimestamp () > r->GetTimestamp ())
+					{
+						r = nullptr;
+						continue;
+					}
+					m_RouterInfosIndex.Remove (it->second);
+					it->second = r;
+				}
+				else
+					m_RouterInfos.emplace (r->GetIdentHash (), r);
+				m_RouterInfosIndex.Add (r);
+			}
+			for (auto& it: m_RouterInfos)
+				if (it.second->IsFloodfill () && it.second->IsReachable ()) // floodfill must be reachable
+					floodfills.push_back (it.second);
+		}
+		{
+			std::unique_lock<std::mutex> l(m_FloodfillsMutex);
+			for (auto& r: floodfills)
+				m_Floodfills.Insert (r);
+		}
 
-		LogPrint (eLogInfo, "NetDb: ", m_RouterInfos.size(), " routers loaded (", m_Floodfills.size (), " floodfils)");
+		if (m_Store)
+		{
+			for (size_t i = 0; i < numRecords; i++)
+				if (!routers[i]) m_Store->Remove (records[i].ident); // invalid
+			size_t numMigrated = 0;
+			for (size_t i = numRecords; i < numRouters; i++)
+			{
+				auto& r = routers[i];
+				if (!r) continue;
+				m_Store->Put (r->GetIdentHash (), r->GetBuffer (), r->GetBufferLen ());
+				r->DeleteBuffer ();
+				numMigrated++;
+			}
+			if (m_Store->Flush ())
+			{
+				if (!files.empty ())
+				{
+					for (auto& it: files)
+						dotnet::fs::Remove (it);
+					LogPrint (eLogInfo, "NetDb: ", numMigrated, " routers migrated from ", m_Storage.GetRoot (), " to ", m_Store->GetPath ());
+				}
+				m_Store->Compact ();
+			}
+		}
+
+		auto duration = dotnet::util::GetMillisecondsSinceEpoch () - ts;
+		LogPrint (eLogInfo, "NetDb: ", m_RouterInfos.size(), " routers loaded (", m_Floodfills.GetSize (), " floodfils) from ",
+			numRecords, " records and ", files.size (), " files in ", duration, " ms, ", duration ? numRouters*1000/duration : numRouters,
+			" RIs/s, ", numThreads, " threads");
 	}
 
 	void NetDb::SaveUpdated ()
@@ -531,11 +792,13 @@ namespace data
 
 		for (auto& it: m_RouterInfos)
 		{
-			std::string ident = it.second->GetIdentHashBase64();
-			std::string path  = m_Storage.Path(ident);
+			std::string ident = m_Store ? "" : it.second->GetIdentHashBase64();
 			if (it.second->IsUpdated ())
 			{
-				it.second->SaveToFile (path);
+				if (m_Store)
+					m_Store->Put (it.first, it.second->GetBuffer (), it.second->GetBufferLen ());
+				else
+					it.second->SaveToFile (m_Storage.Path(ident));
 				it.second->SetUpdated (false);
 				it.second->SetUnreachable (false);
 				it.second->DeleteBuffer ();
@@ -555,12 +818,17 @@ namespace data
 			if (it.second->IsUnreachable ())
 			{
 				// delete RI file
-				m_Storage.Remove(ident);
+				if (m_Store)
+					m_Store->Remove (it.first);
+				else
+					m_Storage.Remove(ident);
 				deletedCount++;
 				if (total - deletedCount < NETDB_MIN_ROUTERS) checkForExpiration = false;
 			}
 		} // m_RouterInfos iteration
 
+		if (m_Store && m_Store->Flush ())
+			m_Store->Compact ();
 		if (updatedCount > 0)
 			LogPrint (eLogInfo, "NetDb: saved ", updatedCount, " new/updated routers");
 		if (deletedCount > 0)
@@ -574,6 +842,7 @@ namespace data
 					if (it->second->IsUnreachable ())
 					{
 						if (m_PersistProfiles) it->second->SaveProfile ();
+						m_RouterInfosIndex.Remove (it->second);
 						it = m_RouterInfos.erase (it);
 						continue;
 					}
@@ -583,11 +852,10 @@ namespace data
 			// clean up expired floodfills or not floodfills anymore
 			{
 				std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-				for (auto it = m_Floodfills.begin (); it != m_Floodfills.end ();)
-					if ((*it)->IsUnreachable () || !(*it)->IsFloodfill ())
-						it = m_Floodfills.erase (it);
-					else
-						++it;
+				m_Floodfills.RemoveIf ([](const std::shared_ptr<RouterInfo>& r)
+					{
+						return r->IsUnreachable () || !r->IsFloodfill ();
+					});
 			}
 		}
 	}
@@ -891,7 +1159,14 @@ namespace data
 				if (router)
 				{
 					LogPrint (eLogDebug, "NetDb: requested RouterInfo ", key, " found");
-					router->LoadBuffer ();
+					if (!m_Store)
+						router->LoadBuffer ();
+					else if (!router->GetBuffer ())
+					{
+						uint8_t buf[MAX_RI_BUFFER_SIZE];
+						auto len = m_Store->Get (ident, buf, MAX_RI_BUFFER_SIZE);
+						if (len) router->SetBuffer (buf, len);
+					}
 					if (router->GetBuffer ())
 						replyMsg = CreateDatabaseStoreMsg (router);
 				}
@@ -1062,9 +1337,8 @@ namespace data
 		return GetRandomRouter (
 			[compatibleWith](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				return !router->IsHidden () && router != compatibleWith &&
-					router->IsCompatible (*compatibleWith);
-			});
+				return !router->IsHidden () && router != compatibleWith;
+			}, 0, compatibleWith->GetSupportedTransports ());
 	}
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomPeerTestRouter (bool v4only) const
@@ -1090,36 +1364,19 @@ namespace data
 		return GetRandomRouter (
 			[compatibleWith](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				return !router->IsHidden () && router != compatibleWith &&
-					router->IsCompatible (*compatibleWith) &&
-					(router->GetCaps () & RouterInfo::eHighBandwidth);
-			});
+				return !router->IsHidden () && router != compatibleWith;
+			}, RouterInfosIndex::eIndexedHighBandwidth, compatibleWith->GetSupportedTransports ());
 	}
 
 	template<typename Filter>
-	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (Filter filter) const
+	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (Filter filter, uint8_t caps, uint8_t transports) const
 	{
-		if (m_RouterInfos.empty())
-			return 0;
-		uint32_t ind = rand () % m_RouterInfos.size ();
-		for (int j = 0; j < 2; j++)
-		{
-			uint32_t i = 0;
-			std::unique_lock<std::mutex> l(m_RouterInfosMutex);
-			for (const auto& it: m_RouterInfos)
+		std::unique_lock<std::mutex> l(m_RouterInfosMutex);
+		return m_RouterInfosIndex.GetRandom (
+			[&filter](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				if (i >= ind)
-				{
-					if (!it.second->IsUnreachable () && filter (it.second))
-						return it.second;
-				}
-				else
-					i++;
-			}
-			// we couldn't find anything, try second pass
-			ind = 0;
-		}
-		return nullptr; // seems we have too few routers
+				return !router->IsUnreachable () && filter (router);
+			}, caps, transports);
 	}
 
 	void NetDb::PostDNNPMsg (std::shared_ptr<const DNNPMessage> msg)
@@ -1127,81 +1384,84 @@ namespace data
 		if (msg) m_Queue.Put (msg);
 	}
 
+	IdentHash NetDb::GetRoutingKey (const IdentHash& ident) const
+	{
+		uint64_t day = dotnet::util::GetSecondsSinceEpoch ()/86400;
+		std::unique_lock<std::mutex> l(m_RoutingKeysMutex);
+		if (day != m_RoutingKeysDay) UpdateRoutingKeys (day);
+		auto it = m_RoutingKeys.find (ident);
+		if (it != m_RoutingKeys.end ())
+		{
+			it->second.used = true;
+			return it->second.key;
+		}
+		auto key = CreateRoutingKey (ident);
+		if (m_RoutingKeys.size () < NETDB_MAX_CACHED_ROUTING_KEYS)
+			m_RoutingKeys.emplace (ident, CachedRoutingKey{ key, true });
+		return key;
+	}
+
+	void NetDb::UpdateRoutingKeys (uint64_t day) const
+	{
+		// keys depend on date, recalculate those used yesterday in one batch and drop the rest
+		std::vector<IdentHash> idents;
+		for (auto it = m_RoutingKeys.begin (); it != m_RoutingKeys.end ();)
+			if (it->second.used)
+			{
+				idents.push_back (it->first);
+				++it;
+			}
+			else
+				it = m_RoutingKeys.erase (it);
+		std::vector<IdentHash> keys (idents.size ());
+		CreateRoutingKeys (idents.data (), keys.data (), idents.size ());
+		for (size_t i = 0; i < idents.size (); i++)
+			m_RoutingKeys[idents[i]] = CachedRoutingKey{ keys[i], false };
+		m_RoutingKeysDay = day;
+		if (!idents.empty ())
+			LogPrint (eLogDebug, "NetDb: ", idents.size (), " routing keys recalculated for new date");
+	}
+
 	std::shared_ptr<const RouterInfo> NetDb::GetClosestFloodfill (const IdentHash& destination,
 		const std::set<IdentHash>& excluded, bool closeThanUsOnly) const
 	{
 		std::shared_ptr<const RouterInfo> r;
 		XORMetric minMetric;
-		IdentHash destKey = CreateRoutingKey (destination);
+		IdentHash destKey = GetRoutingKey (destination);
 		if (closeThanUsOnly)
 			minMetric = destKey ^ dotnet::context.GetIdentHash ();
 		else
 			minMetric.SetMax ();
 		std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-		for (const auto& it: m_Floodfills)
-		{
-			if (!it->IsUnreachable ())
+		m_Floodfills.VisitClosest (destKey, [&](const std::shared_ptr<RouterInfo>& it)->bool
 			{
-				XORMetric m = destKey ^ it->GetIdentHash ();
-				if (m < minMetric && !excluded.count (it->GetIdentHash ()))
-				{
-					minMetric = m;
-					r = it;
-				}
-			}
-		}
+				if (!((destKey ^ it->GetIdentHash ()) < minMetric)) return false; // the rest are not closer
+				if (it->IsUnreachable () || excluded.count (it->GetIdentHash ())) return true;
+				r = it;
+				return false;
+			});
 		return r;
 	}
 
 	std::vector<IdentHash> NetDb::GetClosestFloodfills (const IdentHash& destination, size_t num,
 		std::set<IdentHash>& excluded, bool closeThanUsOnly) const
 	{
-		struct Sorted
-		{
-			std::shared_ptr<const RouterInfo> r;
-			XORMetric metric;
-			bool operator< (const Sorted& other) const { return metric < other.metric; };
-		};
-
-		std::set<Sorted> sorted;
-		IdentHash destKey = CreateRoutingKey (destination);
+		std::vector<IdentHash> res;
+		if (!num) return res;
+		IdentHash destKey = GetRoutingKey (destination);
 		XORMetric ourMetric;
 		if (closeThanUsOnly) ourMetric = destKey ^ dotnet::context.GetIdentHash ();
-		{
-			std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-			for (const auto& it: m_Floodfills)
-			{
-				if (!it->IsUnreachable ())
-				{
-					XORMetric m = destKey ^ it->GetIdentHash ();
-					if (closeThanUsOnly && ourMetric < m) continue;
-					if (sorted.size () < num)
-						sorted.insert ({it, m});
-					else if (m < sorted.rbegin ()->metric)
-					{
-						sorted.insert ({it, m});
-						sorted.erase (std::prev (sorted.end ()));
-					}
-				}
-			}
-		}
-
-		std::vector<IdentHash> res;
 		size_t i = 0;
-		for (const auto& it: sorted)
-		{
-			if (i < num)
+		std::unique_lock<std::mutex> l(m_FloodfillsMutex);
+		m_Floodfills.VisitClosest (destKey, [&](const std::shared_ptr<RouterInfo>& it)->bool
 			{
-				const auto& ident = it.r->GetIdentHash ();
-				if (!excluded.count (ident))
-				{
-					res.push_back (ident);
-					i++;
-				}
-			}
-			else
-				break;
-		}
+				if (closeThanUsOnly && ourMetric < (destKey ^ it->GetIdentHash ())) return false; // the rest are farther
+				if (it->IsUnreachable ()) return true;
+				// excluded floodfills still take their place among num closest
+				const auto& ident = it->GetIdentHash ();
+				if (!excluded.count (ident)) res.push_back (ident);
+				return ++i < num;
+			});
 		return res;
 	}
 
@@ -1218,7 +1478,7 @@ namespace data
 	{
 		std::shared_ptr<const RouterInfo> r;
 		XORMetric minMetric;
-		IdentHash destKey = CreateRoutingKey (destination);
+		IdentHash destKey = GetRoutingKey (destination);
 		minMetric.SetMax ();
 		// must be called from NetDb thread only
 		for (const auto& it: m_RouterInfos)
@@ -4,10 +4,13 @@
 #include <inttypes.h>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <list>
+#include <vector>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <algorithm>
 
 #include "Base.h"
 #include "Gzip.h"
@@ -20,6 +23,7 @@
 #include "TunnelPool.h"
 #include "Reseed.h"
 #include "NetDbRequests.h"
+#include "NetDbStore.h"
 #include "Family.h"
 
 namespace dotnet
@@ -32,6 +36,9 @@ namespace data
 	const int NETDB_MIN_EXPIRATION_TIMEOUT = 90*60; // 1.5 hours
 	const int NETDB_MAX_EXPIRATION_TIMEOUT = 27*60*60; // 27 hours
 	const int NETDB_PUBLISH_INTERVAL = 60*40;
+	const int NETDB_RANDOM_ROUTER_ATTEMPTS = 16; // random picks before scanning capabilities bitsets
+	const int NETDB_MIN_FILES_PER_LOAD_THREAD = 256;
+	const size_t NETDB_MAX_CACHED_ROUTING_KEYS = 4096;
 
 	/** function for visiting a leaseset stored in a floodfill */
 	typedef std::function<void(const IdentHash, std::shared_ptr<LeaseSet>)> LeaseSetVisitor;
@@ -42,6 +49,138 @@ namespace data
 	/** function for visiting a router info and determining if we want to use it */
 	typedef std::function<bool(std::shared_ptr<const dotnet::data::RouterInfo>)> RouterInfoFilter;
 
+	/** dense array of routers with capabilities bitsets for O(1) random selection */
+	class RouterInfosIndex
+	{
+		public:
+
+			enum IndexedCaps
+			{
+				eIndexedFloodfill = 0x01,
+				eIndexedHighBandwidth = 0x02,
+				eIndexedReachable = 0x04,
+				eIndexedSSU = 0x08,
+				eIndexedNTCP2 = 0x10
+			};
+			static const int NUM_INDEXED_CAPS = 5;
+
+			void Add (std::shared_ptr<RouterInfo> r);
+			void Update (std::shared_ptr<RouterInfo> r); // caps or addresses changed
+			void Remove (std::shared_ptr<RouterInfo> r);
+			void Clear ();
+			size_t GetSize () const { return m_Routers.size (); };
+
+			/** random router with all of caps and at least one of transports (if not zero), matching filter */
+			template<typename Filter>
+			std::shared_ptr<RouterInfo> GetRandom (Filter filter, uint8_t caps = 0, uint8_t transports = 0) const;
+
+		private:
+
+			void SetCaps (size_t ind, const RouterInfo& r);
+			bool Matches (size_t ind, uint8_t caps, uint8_t transports) const;
+			bool GetBit (int cap, size_t ind) const { return m_Caps[cap][ind >> 6] & (1ULL << (ind & 0x3F)); };
+			void SetBit (int cap, size_t ind, bool value)
+			{
+				if (value) m_Caps[cap][ind >> 6] |= (1ULL << (ind & 0x3F));
+				else m_Caps[cap][ind >> 6] &= ~(1ULL << (ind & 0x3F));
+			}
+
+		private:
+
+			std::vector<std::shared_ptr<RouterInfo> > m_Routers;
+			std::vector<uint8_t> m_Transports; // supported transports of m_Routers
+			std::vector<uint64_t> m_Caps[NUM_INDEXED_CAPS]; // bitset per capability
+			std::unordered_map<const RouterInfo *, size_t> m_Positions; // in m_Routers
+	};
+
+	template<typename Filter>
+	std::shared_ptr<RouterInfo> RouterInfosIndex::GetRandom (Filter filter, uint8_t caps, uint8_t transports) const
+	{
+		size_t num = m_Routers.size ();
+		if (!num) return nullptr;
+		// most of routers are expected to match, try few random picks first
+		for (int i = 0; i < NETDB_RANDOM_ROUTER_ATTEMPTS; i++)
+		{
+			size_t ind = rand () % num;
+			if (Matches (ind, caps, transports) && filter (m_Routers[ind]))
+				return m_Routers[ind];
+		}
+		// rare capabilities, scan bitsets starting from random word
+		size_t numWords = (num + 63) >> 6, start = rand () % numWords;
+		for (size_t i = 0; i < numWords; i++)
+		{
+			size_t word = (start + i) % numWords;
+			uint64_t bits = ~0ULL;
+			for (int c = 0; c < NUM_INDEXED_CAPS; c++)
+				if (caps & (1 << c)) bits &= m_Caps[c][word];
+			for (int b = 0; bits && b < 64; b++, bits >>= 1)
+			{
+				size_t ind = (word << 6) + b;
+				if (ind >= num) break;
+				if ((bits & 1) && Matches (ind, caps, transports) && filter (m_Routers[ind]))
+					return m_Routers[ind];
+			}
+		}
+		return nullptr;
+	}
+
+	/** floodfills sorted by ident hash, visited in XOR distance order in O(log n) per router */
+	class FloodfillsIndex
+	{
+		public:
+
+			void Insert (std::shared_ptr<RouterInfo> r); // replaces router with same ident
+			void Remove (std::shared_ptr<RouterInfo> r);
+			void Clear () { m_Floodfills.clear (); };
+			size_t GetSize () const { return m_Floodfills.size (); };
+
+			template<typename Predicate>
+			void RemoveIf (Predicate pred)
+			{
+				// keeps sorted order
+				m_Floodfills.erase (std::remove_if (m_Floodfills.begin (), m_Floodfills.end (), pred), m_Floodfills.end ());
+			}
+
+			/** calls visitor from closest to key to farthest until it returns false */
+			template<typename Visitor>
+			void VisitClosest (const IdentHash& key, Visitor visitor) const
+			{
+				VisitRange (0, m_Floodfills.size (), 0, key, visitor);
+			}
+
+		private:
+
+			static bool GetBit (const IdentHash& ident, int bit) { return ident[bit >> 3] & (0x80 >> (bit & 0x07)); };
+			std::vector<std::shared_ptr<RouterInfo> >::const_iterator Find (const IdentHash& ident) const;
+
+			template<typename Visitor>
+			bool VisitRange (size_t from, size_t to, int bit, const IdentHash& key, Visitor& visitor) const;
+
+		private:
+
+			std::vector<std::shared_ptr<RouterInfo> > m_Floodfills; // sorted by ident hash
+	};
+
+	template<typename Visitor>
+	bool FloodfillsIndex::VisitRange (size_t from, size_t to, int bit, const IdentHash& key, Visitor& visitor) const
+	{
+		// all routers in [from, to) have the same first bits, distance is decided by next bit
+		if (from >= to) return true;
+		if (to - from == 1 || bit >= 256)
+		{
+			for (size_t i = from; i < to; i++)
+				if (!visitor (m_Floodfills[i])) return false;
+			return true;
+		}
+		auto begin = m_Floodfills.begin ();
+		size_t mid = std::partition_point (begin + from, begin + to,
+			[bit](const std::shared_ptr<RouterInfo>& r) { return !GetBit (r->GetIdentHash (), bit); }) - begin;
+		if (GetBit (key, bit))
+			return VisitRange (mid, to, bit + 1, key, visitor) && VisitRange (from, mid, bit + 1, key, visitor);
+		else
+			return VisitRange (from, mid, bit + 1, key, visitor) && VisitRange (mid, to, bit + 1, key, visitor);
+	}
+
 	class NetDb
 	{
 		public:
@@ -54,6 +193,7 @@ namespace data
 
 			bool AddRouterInfo (const uint8_t * buf, int len);
 			bool AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len);
+			void AddRouterInfos (const std::vector<std::vector<uint8_t> >& routerInfos); // Ed25519 signatures are verified in batches
 			bool AddLeaseSet (const IdentHash& ident, const uint8_t * buf, int len);
 			bool AddLeaseSet2 (const IdentHash& ident, const uint8_t * buf, int len, uint8_t storeType);
 			std::shared_ptr<RouterInfo> FindRouter (const IdentHash& ident) const;
@@ -90,7 +230,7 @@ namespace data
 
 			// for web interface
 			int GetNumRouters () const { return m_RouterInfos.size (); };
-			int GetNumFloodfills () const { return m_Floodfills.size (); };
+			int GetNumFloodfills () const { return m_Floodfills.GetSize (); };
 			int GetNumLeaseSets () const { return m_LeaseSets.size (); };
 
 			/** visit all lease sets we currently store */
@@ -102,12 +242,15 @@ namespace data
 			/** visit N random router that match using filter, then visit them with a visitor, return number of RouterInfos that were visited */
 			size_t VisitRandomRouterInfos(RouterInfoFilter f, RouterInfoVisitor v, size_t n);
 
-			void ClearRouterInfos () { m_RouterInfos.clear (); };
+			void ClearRouterInfos ();
 
 		private:
 
 			void Load ();
-			bool LoadRouterInfo (const std::string & path);
+			std::shared_ptr<RouterInfo> LoadRouterInfo (const std::string & path, bool keepBuffer = false) const; // nullptr and file deleted if invalid
+			std::shared_ptr<RouterInfo> LoadRouterInfo (const IdentHash& ident, const uint8_t * buf, size_t len) const; // from m_Store, nullptr if invalid
+			bool IsLoadable (std::shared_ptr<const RouterInfo> r) const;
+			void MigrateStoreToFiles ();
 			void SaveUpdated ();
 			void Run (); // exploratory thread
 			void Explore (int numDestinations);
@@ -118,10 +261,14 @@ namespace data
 
 			void ReseedFromFloodfill(const RouterInfo & ri, int numRouters=40, int numFloodfills=20);
 
+			IdentHash GetRoutingKey (const IdentHash& ident) const; // cached CreateRoutingKey
+			void UpdateRoutingKeys (uint64_t day) const; // new date, called with m_RoutingKeysMutex locked
+
 			std::shared_ptr<const RouterInfo> AddRouterInfo (const uint8_t * buf, int len, bool& updated);
-			std::shared_ptr<const RouterInfo> AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated);
+			std::shared_ptr<const RouterInfo> AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated,
+				bool verifySignature = true);
     		template<typename Filter>
-        	std::shared_ptr<const RouterInfo> GetRandomRouter (Filter filter) const;
+        	std::shared_ptr<const RouterInfo> GetRandomRouter (Filter filter, uint8_t caps = 0, uint8_t transports = 0) const;
 
 		private:
 
@@ -129,18 +276,28 @@ namespace data
 			std::map<IdentHash, std::shared_ptr<LeaseSet> > m_LeaseSets;
 			mutable std::mutex m_RouterInfosMutex;
 			std::map<IdentHash, std::shared_ptr<RouterInfo> > m_RouterInfos;
+			RouterInfosIndex m_RouterInfosIndex; // same routers as m_RouterInfos, guarded by m_RouterInfosMutex
 			mutable std::mutex m_FloodfillsMutex;
-			std::list<std::shared_ptr<RouterInfo> > m_Floodfills;
+			FloodfillsIndex m_Floodfills;
+			struct CachedRoutingKey
+			{
+				IdentHash key;
+				bool used; // since last date change
+			};
+			mutable std::mutex m_RoutingKeysMutex;
+			mutable std::map<IdentHash, CachedRoutingKey> m_RoutingKeys; // of idents looked up today
+			mutable uint64_t m_RoutingKeysDay; // days since epoch
 
 			bool m_IsRunning;
 			uint64_t m_LastLoad;
 			std::thread * m_Thread;
-			dotnet::util::Queue<std::shared_ptr<const DNNPMessage> > m_Queue; // of DNNPDatabaseStoreMsg
+			dotnet::util::MPSCQueue<std::shared_ptr<const DNNPMessage> > m_Queue; // of DNNPDatabaseStoreMsg
 
 			GzipInflator m_Inflator;
 			Reseeder * m_Reseeder;
 			Families m_Families;
 			dotnet::fs::HashedStorage m_Storage;
+			std::unique_ptr<NetDbStore> m_Store; // RouterInfos are stored in m_Storage if not set
 
 			friend class NetDbRequests;
 			NetDbRequests m_Requests;
@@ -0,0 +1,257 @@
+#include <string.h>
+#include <zlib.h> // for crc32
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "DotNetEndian.h"
+#include "Log.h"
+#include "NetDbStore.h"
+
+namespace dotnet
+{
+namespace data
+{
+	NetDbStore::NetDbStore (const std::string& path):
+		m_Path (path), m_Mapped (nullptr), m_MappedSize (0), m_FileSize (0), m_GarbageSize (0)
+	{
+	}
+
+	NetDbStore::~NetDbStore ()
+	{
+		Close ();
+	}
+
+	bool NetDbStore::Open ()
+	{
+		Close ();
+		boost::system::error_code ec;
+		m_FileSize = boost::filesystem::exists (m_Path, ec) ? boost::filesystem::file_size (m_Path, ec) : 0;
+		if (!m_FileSize)
+		{
+			std::ofstream f (m_Path, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+			f.write ((const char *)NETDB_STORE_SIGNATURE, sizeof (NETDB_STORE_SIGNATURE));
+			if (!f)
+			{
+				LogPrint (eLogError, "NetDbStore: can't create ", m_Path);
+				return false;
+			}
+			m_FileSize = sizeof (NETDB_STORE_SIGNATURE);
+		}
+		if (!Map ()) return false;
+		if (m_MappedSize < sizeof (NETDB_STORE_SIGNATURE) || memcmp (m_Mapped, NETDB_STORE_SIGNATURE, sizeof (NETDB_STORE_SIGNATURE)))
+		{
+			LogPrint (eLogError, "NetDbStore: ", m_Path, " has unknown format");
+			Unmap ();
+			return false;
+		}
+		if (!Scan ())
+		{
+			Unmap ();
+			boost::filesystem::resize_file (m_Path, m_FileSize, ec);
+			if (ec)
+			{
+				LogPrint (eLogError, "NetDbStore: can't truncate ", m_Path, ": ", ec.message ());
+				return false;
+			}
+			if (!Map ()) return false;
+		}
+		m_File.open (m_Path, std::ofstream::binary | std::ofstream::out | std::ofstream::app);
+		if (!m_File.is_open ())
+		{
+			LogPrint (eLogError, "NetDbStore: can't open ", m_Path, " for writing");
+			Unmap ();
+			return false;
+		}
+		LogPrint (eLogDebug, "NetDbStore: ", m_Index.size (), " records in ", m_Path, ", ", m_GarbageSize, " of ", m_FileSize, " bytes are garbage");
+		return true;
+	}
+
+	void NetDbStore::Close ()
+	{
+		if (m_File.is_open ())
+		{
+			Flush ();
+			m_File.close ();
+		}
+		Unmap ();
+		m_Pending.clear ();
+		m_Index.clear ();
+		m_FileSize = 0; m_GarbageSize = 0;
+	}
+
+	bool NetDbStore::Map ()
+	{
+		Unmap ();
+		try
+		{
+			boost::interprocess::file_mapping file (m_Path.c_str (), boost::interprocess::read_only);
+			m_Region.reset (new boost::interprocess::mapped_region (file, boost::interprocess::read_only, 0, m_FileSize));
+			m_Mapped = (const uint8_t *)m_Region->get_address ();
+			m_MappedSize = m_FileSize;
+		}
+		catch (std::exception& ex)
+		{
+			LogPrint (eLogError, "NetDbStore: can't map ", m_Path, ": ", ex.what ());
+			return false;
+		}
+		return true;
+	}
+
+	void NetDbStore::Unmap ()
+	{
+		m_Region.reset (nullptr);
+		m_Mapped = nullptr;
+		m_MappedSize = 0;
+	}
+
+	bool NetDbStore::Scan ()
+	{
+		uint64_t offset = sizeof (NETDB_STORE_SIGNATURE);
+		while (offset + NETDB_STORE_RECORD_HEADER_SIZE <= m_MappedSize)
+		{
+			const uint8_t * record = m_Mapped + offset;
+			uint16_t len = bufbe16toh (record + 32);
+			if (offset + NETDB_STORE_RECORD_HEADER_SIZE + len > m_MappedSize) break;
+			uint32_t crc = crc32 (0, record, 34);
+			crc = crc32 (crc, record + NETDB_STORE_RECORD_HEADER_SIZE, len);
+			if (crc != bufbe32toh (record + 34)) break;
+			IdentHash ident (record);
+			Drop (ident);
+			if (len)
+				m_Index[ident] = { offset + NETDB_STORE_RECORD_HEADER_SIZE, len };
+			else
+				m_GarbageSize += NETDB_STORE_RECORD_HEADER_SIZE;
+			offset += NETDB_STORE_RECORD_HEADER_SIZE + len;
+		}
+		m_FileSize = offset;
+		if (offset < m_MappedSize)
+		{
+			LogPrint (eLogWarning, "NetDbStore: ", m_MappedSize - offset, " bytes of incomplete or corrupted records at the end of ", m_Path, " dropped");
+			return false;
+		}
+		return true;
+	}
+
+	void NetDbStore::Drop (const IdentHash& ident)
+	{
+		auto it = m_Index.find (ident);
+		if (it != m_Index.end ())
+		{
+			m_GarbageSize += NETDB_STORE_RECORD_HEADER_SIZE + it->second.len;
+			m_Index.erase (it);
+		}
+	}
+
+	void NetDbStore::Append (const IdentHash& ident, const uint8_t * buf, size_t len)
+	{
+		size_t offset = m_Pending.size ();
+		m_Pending.resize (offset + NETDB_STORE_RECORD_HEADER_SIZE + len);
+		uint8_t * record = m_Pending.data () + offset;
+		memcpy (record, ident (), 32);
+		htobe16buf (record + 32, len);
+		if (len) memcpy (record + NETDB_STORE_RECORD_HEADER_SIZE, buf, len);
+		uint32_t crc = crc32 (0, record, 34);
+		crc = crc32 (crc, record + NETDB_STORE_RECORD_HEADER_SIZE, len);
+		htobe32buf (record + 34, crc);
+	}
+
+	void NetDbStore::Visit (Visitor v)
+	{
+		if (!Flush () || (m_MappedSize < m_FileSize && !Map ())) return;
+		std::vector<std::pair<IdentHash, Record> > records (m_Index.begin (), m_Index.end ());
+		std::sort (records.begin (), records.end (),
+			[](const std::pair<IdentHash, Record>& r1, const std::pair<IdentHash, Record>& r2)
+			{
+				return r1.second.offset < r2.second.offset;
+			});
+		for (auto& it: records)
+			v (it.first, m_Mapped + it.second.offset, it.second.len);
+	}
+
+	size_t NetDbStore::Get (const IdentHash& ident, uint8_t * buf, size_t len)
+	{
+		auto it = m_Index.find (ident);
+		if (it == m_Index.end () || it->second.len > len) return 0;
+		if (it->second.offset + it->second.len > m_MappedSize)
+		{
+			// appended after last mapping
+			if (!Flush () || !Map ()) return 0;
+		}
+		memcpy (buf, m_Mapped + it->second.offset, it->second.len);
+		return it->second.len;
+	}
+
+	void NetDbStore::Put (const IdentHash& ident, const uint8_t * buf, size_t len)
+	{
+		if (!buf || !len || len > 0xFFFF) return;
+		Drop (ident);
+		m_Index[ident] = { m_FileSize + m_Pending.size () + NETDB_STORE_RECORD_HEADER_SIZE, (uint16_t)len };
+		Append (ident, buf, len);
+	}
+
+	void NetDbStore::Remove (const IdentHash& ident)
+	{
+		if (!m_Index.count (ident)) return;
+		Drop (ident);
+		Append (ident, nullptr, 0);
+		m_GarbageSize += NETDB_STORE_RECORD_HEADER_SIZE;
+	}
+
+	bool NetDbStore::Flush ()
+	{
+		if (m_Pending.empty ()) return true;
+		m_File.write ((const char *)m_Pending.data (), m_Pending.size ());
+		m_File.flush ();
+		if (!m_File)
+		{
+			LogPrint (eLogError, "NetDbStore: can't write to ", m_Path, ", reopen");
+			m_Pending.clear ();
+			Open (); // index doesn't match the file anymore
+			return false;
+		}
+		m_FileSize += m_Pending.size ();
+		m_Pending.clear ();
+		return true;
+	}
+
+	bool NetDbStore::Compact ()
+	{
+		if (m_GarbageSize < NETDB_STORE_MIN_COMPACT_SIZE || m_GarbageSize*2 < m_FileSize) return false;
+		auto size = m_FileSize;
+		std::string tmp = m_Path + ".tmp";
+		{
+			std::ofstream f (tmp, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+			f.write ((const char *)NETDB_STORE_SIGNATURE, sizeof (NETDB_STORE_SIGNATURE));
+			Visit ([&f](const IdentHash& ident, const uint8_t * buf, size_t len)
+				{
+					// header is followed by RouterInfo, copy both as is
+					f.write ((const char *)buf - NETDB_STORE_RECORD_HEADER_SIZE, NETDB_STORE_RECORD_HEADER_SIZE + len);
+				});
+			f.flush ();
+			if (!f)
+			{
+				LogPrint (eLogError, "NetDbStore: can't write to ", tmp);
+				f.close ();
+				boost::system::error_code ec;
+				boost::filesystem::remove (tmp, ec);
+				return false;
+			}
+		}
+		m_File.close ();
+		Unmap (); // can't replace mapped file on Windows
+		boost::system::error_code ec;
+		boost::filesystem::rename (tmp, m_Path, ec);
+		if (ec)
+		{
+			LogPrint (eLogError, "NetDbStore: can't replace ", m_Path, ": ", ec.message ());
+			boost::filesystem::remove (tmp, ec);
+			Open (); // continue with old one
+			return false;
+		}
+		if (!Open ()) return false;
+		LogPrint (eLogInfo, "NetDbStore: ", m_Path, " compacted from ", size, " to ", m_FileSize, " bytes");
+		return true;
+	}
+}
+}
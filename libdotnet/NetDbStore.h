@@ -0,0 +1,81 @@
+#ifndef NETDB_STORE_H__
+#define NETDB_STORE_H__
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <functional>
+#include "Identity.h"
+
+namespace boost { namespace interprocess { class mapped_region; } }
+
+namespace dotnet
+{
+namespace data
+{
+	const char NETDB_STORE_FILENAME[] = "netDb.dat";
+	const uint8_t NETDB_STORE_SIGNATURE[8] = { 'd', 'n', 'n', 'e', 't', 'd', 'b', 0x01 };
+	const size_t NETDB_STORE_RECORD_HEADER_SIZE = 38; // ident(32) + length(2) + crc32(4)
+	const size_t NETDB_STORE_MIN_COMPACT_SIZE = 1024*1024; // don't compact less than 1M of garbage
+
+	/**
+	 * RouterInfos in a single append-only file, memory mapped for reading.
+	 * Every record is ident, length and crc32 followed by RouterInfo, length 0 means removed.
+	 * Latest record wins, garbage is dropped by Compact. Not thread safe, NetDb thread only
+	 */
+	class NetDbStore
+	{
+		public:
+
+			typedef std::function<void (const IdentHash&, const uint8_t *, size_t)> Visitor;
+
+			NetDbStore (const std::string& path);
+			~NetDbStore ();
+
+			bool Open (); // map and index existing file or create new, torn tail is truncated
+			void Close ();
+			bool IsOpen () const { return m_File.is_open (); };
+			const std::string& GetPath () const { return m_Path; };
+
+			size_t GetNumRecords () const { return m_Index.size (); };
+			uint64_t GetFileSize () const { return m_FileSize; };
+			uint64_t GetGarbageSize () const { return m_GarbageSize; };
+
+			void Visit (Visitor v); // live records in file order, pointers are valid until next Flush
+			size_t Get (const IdentHash& ident, uint8_t * buf, size_t len); // returns 0 if not found
+			void Put (const IdentHash& ident, const uint8_t * buf, size_t len);
+			void Remove (const IdentHash& ident);
+			bool Flush (); // append pending records
+			bool Compact (); // rewrite live records if garbage takes more than a half
+
+		private:
+
+			struct Record
+			{
+				uint64_t offset; // of RouterInfo
+				uint16_t len;
+			};
+
+			bool Map ();
+			void Unmap ();
+			void Append (const IdentHash& ident, const uint8_t * buf, size_t len);
+			void Drop (const IdentHash& ident); // count old record as garbage
+			bool Scan (); // build index from mapped file, returns false if tail must be truncated
+
+		private:
+
+			std::string m_Path;
+			std::ofstream m_File; // append only
+			std::unique_ptr<boost::interprocess::mapped_region> m_Region;
+			const uint8_t * m_Mapped;
+			uint64_t m_MappedSize, m_FileSize, m_GarbageSize;
+			std::vector<uint8_t> m_Pending; // appended to the file by Flush
+			std::map<IdentHash, Record> m_Index;
+	};
+}
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "Poly1305.h"
+#include "DotNetEndian.h"
 /**
    This code is licensed under the MCGSI Public License
    Copyright 2018 Jeff Becker
@@ -7,11 +8,373 @@
 
  */
 
-#if !OPENSSL_AEAD_CHACHA20_POLY1305 
+#if defined(POLY1305_LIMBS64) && defined(X86_DISPATCH) && defined(__x86_64__)
+#define POLY1305_AVX2 // 4 blocks at once in 26 bits limbs
+#include <immintrin.h>
+#endif
+
 namespace dotnet
 {
 namespace crypto
 {
+#ifdef POLY1305_LIMBS64
+	__extension__ typedef unsigned __int128 uint128_t;
+	const uint64_t POLY1305_MASK44 = 0xfffffffffff, POLY1305_MASK42 = 0x3ffffffffff;
+
+	static inline void Poly1305Mul (uint64_t * h, const uint64_t * r) // h = h*r mod 2^130-5, partially reduced
+	{
+		uint64_t s1 = r[1]*(5 << 2), s2 = r[2]*(5 << 2);
+		uint128_t d0 = (uint128_t)h[0]*r[0] + (uint128_t)h[1]*s2 + (uint128_t)h[2]*s1;
+		uint128_t d1 = (uint128_t)h[0]*r[1] + (uint128_t)h[1]*r[0] + (uint128_t)h[2]*s2;
+		uint128_t d2 = (uint128_t)h[0]*r[2] + (uint128_t)h[1]*r[1] + (uint128_t)h[2]*r[0];
+		uint64_t c = (uint64_t)(d0 >> 44); h[0] = (uint64_t)d0 & POLY1305_MASK44;
+		d1 += c; c = (uint64_t)(d1 >> 44); h[1] = (uint64_t)d1 & POLY1305_MASK44;
+		d2 += c; c = (uint64_t)(d2 >> 42); h[2] = (uint64_t)d2 & POLY1305_MASK42;
+		h[0] += c*5; c = h[0] >> 44; h[0] &= POLY1305_MASK44;
+		h[1] += c;
+	}
+
+	Poly1305::Poly1305 (const uint64_t * key)
+	{
+		uint64_t t0 = le64toh (key[0]), t1 = le64toh (key[1]);
+		// clamp r
+		m_R[0] = t0 & 0xffc0fffffff;
+		m_R[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+		m_R[2] = (t1 >> 24) & 0x00ffffffc0f;
+		m_H[0] = m_H[1] = m_H[2] = 0;
+		m_Pad[0] = le64toh (key[2]);
+		m_Pad[1] = le64toh (key[3]);
+		memset (m_RPowers, 0, sizeof (m_RPowers));
+		m_Leftover = 0;
+		m_Final = 0;
+	}
+
+	static void Poly1305BlocksScalar (uint64_t * h, const uint64_t * r, const uint8_t * buf, size_t sz, uint64_t hibit)
+	{
+		while (sz >= POLY1305_BLOCK_BYTES)
+		{
+			uint64_t t0 = le64toh (buf64toh (buf)), t1 = le64toh (buf64toh (buf + 8));
+			h[0] += t0 & POLY1305_MASK44;
+			h[1] += ((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44;
+			h[2] += ((t1 >> 24) & POLY1305_MASK42) | hibit;
+			Poly1305Mul (h, r);
+			buf += POLY1305_BLOCK_BYTES;
+			sz -= POLY1305_BLOCK_BYTES;
+		}
+	}
+
+#ifdef POLY1305_AVX2
+	const uint32_t POLY1305_MASK26 = 0x3ffffff;
+	const size_t POLY1305_AVX2_MIN_BYTES = 8*POLY1305_BLOCK_BYTES; // powers of r are not worth it below
+
+	static void Poly1305ToLimbs26 (const uint64_t * h, uint32_t * l)
+	{
+		// h1 might be slightly above 44 bits
+		uint64_t h0 = h[0] & POLY1305_MASK44, h1 = h[1] + (h[0] >> 44), h2 = h[2] + (h1 >> 44);
+		h1 &= POLY1305_MASK44;
+		l[0] = h0 & POLY1305_MASK26;
+		l[1] = ((h0 >> 26) | (h1 << 18)) & POLY1305_MASK26;
+		l[2] = (h1 >> 8) & POLY1305_MASK26;
+		l[3] = ((h1 >> 34) | (h2 << 10)) & POLY1305_MASK26;
+		l[4] = h2 >> 16;
+	}
+
+	static void Poly1305FromLimbs26 (const uint64_t * l, uint64_t * h) // l are up to 32 bits
+	{
+		// carry to 26 bits first
+		uint64_t l0 = l[0], l1 = l[1], l2 = l[2], l3 = l[3], l4 = l[4];
+		l1 += l0 >> 26; l0 &= POLY1305_MASK26;
+		l2 += l1 >> 26; l1 &= POLY1305_MASK26;
+		l3 += l2 >> 26; l2 &= POLY1305_MASK26;
+		l4 += l3 >> 26; l3 &= POLY1305_MASK26;
+		l0 += (l4 >> 26)*5; l4 &= POLY1305_MASK26;
+		l1 += l0 >> 26; l0 &= POLY1305_MASK26;
+		uint64_t v = l0 | (l1 << 26); // 53 bits at most
+		h[0] = v & POLY1305_MASK44;
+		v = (v >> 44) + (l2 << 8) + (l3 << 34);
+		h[1] = v & POLY1305_MASK44;
+		h[2] = (v >> 44) + (l4 << 16);
+	}
+
+	// d = h*r for 4 lanes, s = 5*r
+#define POLY1305_MUL_AVX2(d, h, r, s) \
+	d##0 = _mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_mul_epu32 (h##0, r##0), \
+		_mm256_mul_epu32 (h##1, s##4)), _mm256_mul_epu32 (h##2, s##3)), _mm256_mul_epu32 (h##3, s##2)), _mm256_mul_epu32 (h##4, s##1)); \
+	d##1 = _mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_mul_epu32 (h##0, r##1), \
+		_mm256_mul_epu32 (h##1, r##0)), _mm256_mul_epu32 (h##2, s##4)), _mm256_mul_epu32 (h##3, s##3)), _mm256_mul_epu32 (h##4, s##2)); \
+	d##2 = _mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_mul_epu32 (h##0, r##2), \
+		_mm256_mul_epu32 (h##1, r##1)), _mm256_mul_epu32 (h##2, r##0)), _mm256_mul_epu32 (h##3, s##4)), _mm256_mul_epu32 (h##4, s##3)); \
+	d##3 = _mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_mul_epu32 (h##0, r##3), \
+		_mm256_mul_epu32 (h##1, r##2)), _mm256_mul_epu32 (h##2, r##1)), _mm256_mul_epu32 (h##3, r##0)), _mm256_mul_epu32 (h##4, s##4)); \
+	d##4 = _mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_add_epi64 (_mm256_mul_epu32 (h##0, r##4), \
+		_mm256_mul_epu32 (h##1, r##3)), _mm256_mul_epu32 (h##2, r##2)), _mm256_mul_epu32 (h##3, r##1)), _mm256_mul_epu32 (h##4, r##0));
+
+	// h = d partially reduced to 26 bits limbs
+#define POLY1305_CARRY_AVX2(h, d) \
+	d##1 = _mm256_add_epi64 (d##1, _mm256_srli_epi64 (d##0, 26)); h##0 = _mm256_and_si256 (d##0, mask); \
+	d##2 = _mm256_add_epi64 (d##2, _mm256_srli_epi64 (d##1, 26)); h##1 = _mm256_and_si256 (d##1, mask); \
+	d##3 = _mm256_add_epi64 (d##3, _mm256_srli_epi64 (d##2, 26)); h##2 = _mm256_and_si256 (d##2, mask); \
+	d##4 = _mm256_add_epi64 (d##4, _mm256_srli_epi64 (d##3, 26)); h##3 = _mm256_and_si256 (d##3, mask); \
+	{ \
+		__m256i c = _mm256_srli_epi64 (d##4, 26); h##4 = _mm256_and_si256 (d##4, mask); \
+		h##0 = _mm256_add_epi64 (h##0, _mm256_add_epi64 (c, _mm256_slli_epi64 (c, 2))); \
+		h##1 = _mm256_add_epi64 (h##1, _mm256_srli_epi64 (h##0, 26)); h##0 = _mm256_and_si256 (h##0, mask); \
+	}
+
+	// 4 blocks to lanes of 26 bits limbs m0..m4, with high bit
+#define POLY1305_LOAD_AVX2(m, buf) \
+	{ \
+		__m256i a = _mm256_loadu_si256 ((const __m256i *)(buf)), b = _mm256_loadu_si256 ((const __m256i *)(buf) + 1); \
+		__m256i lo = _mm256_permute4x64_epi64 (_mm256_unpacklo_epi64 (a, b), 0xD8); \
+		__m256i hi = _mm256_permute4x64_epi64 (_mm256_unpackhi_epi64 (a, b), 0xD8); \
+		m##0 = _mm256_and_si256 (lo, mask); \
+		m##1 = _mm256_and_si256 (_mm256_srli_epi64 (lo, 26), mask); \
+		m##2 = _mm256_and_si256 (_mm256_or_si256 (_mm256_srli_epi64 (lo, 52), _mm256_slli_epi64 (hi, 12)), mask); \
+		m##3 = _mm256_and_si256 (_mm256_srli_epi64 (hi, 14), mask); \
+		m##4 = _mm256_or_si256 (_mm256_srli_epi64 (hi, 40), hibit); \
+	}
+
+	__attribute__((target("avx2")))
+	static size_t Poly1305BlocksAVX2 (uint64_t * h, const uint32_t rPowers[4][5], const uint8_t * buf, size_t sz)
+	// returns number of bytes processed, multiple of 64
+	{
+		const __m256i mask = _mm256_set1_epi64x (POLY1305_MASK26), hibit = _mm256_set1_epi64x (1 << 24);
+		// r^4 in all lanes
+		__m256i r0 = _mm256_set1_epi64x (rPowers[0][0]), r1 = _mm256_set1_epi64x (rPowers[0][1]),
+			r2 = _mm256_set1_epi64x (rPowers[0][2]), r3 = _mm256_set1_epi64x (rPowers[0][3]), r4 = _mm256_set1_epi64x (rPowers[0][4]);
+		__m256i s1 = _mm256_mul_epu32 (r1, _mm256_set1_epi64x (5)), s2 = _mm256_mul_epu32 (r2, _mm256_set1_epi64x (5)),
+			s3 = _mm256_mul_epu32 (r3, _mm256_set1_epi64x (5)), s4 = _mm256_mul_epu32 (r4, _mm256_set1_epi64x (5));
+		// lanes accumulate blocks 4k, 4k+1, 4k+2, 4k+3, h goes to first one
+		uint32_t l[5];
+		Poly1305ToLimbs26 (h, l);
+		__m256i h0, h1, h2, h3, h4, d0, d1, d2, d3, d4;
+		POLY1305_LOAD_AVX2 (h, buf)
+		h0 = _mm256_add_epi64 (h0, _mm256_set_epi64x (0, 0, 0, l[0]));
+		h1 = _mm256_add_epi64 (h1, _mm256_set_epi64x (0, 0, 0, l[1]));
+		h2 = _mm256_add_epi64 (h2, _mm256_set_epi64x (0, 0, 0, l[2]));
+		h3 = _mm256_add_epi64 (h3, _mm256_set_epi64x (0, 0, 0, l[3]));
+		h4 = _mm256_add_epi64 (h4, _mm256_set_epi64x (0, 0, 0, l[4]));
+		size_t processed = 4*POLY1305_BLOCK_BYTES;
+		for (; processed + 4*POLY1305_BLOCK_BYTES <= sz; processed += 4*POLY1305_BLOCK_BYTES)
+		{
+			// h = h*r^4 + m
+			__m256i m0, m1, m2, m3, m4;
+			POLY1305_MUL_AVX2 (d, h, r, s)
+			POLY1305_CARRY_AVX2 (h, d)
+			POLY1305_LOAD_AVX2 (m, buf + processed)
+			h0 = _mm256_add_epi64 (h0, m0); h1 = _mm256_add_epi64 (h1, m1); h2 = _mm256_add_epi64 (h2, m2);
+			h3 = _mm256_add_epi64 (h3, m3); h4 = _mm256_add_epi64 (h4, m4);
+		}
+		// multiply lanes by r^4, r^3, r^2, r
+		r0 = _mm256_set_epi64x (rPowers[3][0], rPowers[2][0], rPowers[1][0], rPowers[0][0]);
+		r1 = _mm256_set_epi64x (rPowers[3][1], rPowers[2][1], rPowers[1][1], rPowers[0][1]);
+		r2 = _mm256_set_epi64x (rPowers[3][2], rPowers[2][2], rPowers[1][2], rPowers[0][2]);
+		r3 = _mm256_set_epi64x (rPowers[3][3], rPowers[2][3], rPowers[1][3], rPowers[0][3]);
+		r4 = _mm256_set_epi64x (rPowers[3][4], rPowers[2][4], rPowers[1][4], rPowers[0][4]);
+		s1 = _mm256_mul_epu32 (r1, _mm256_set1_epi64x (5)); s2 = _mm256_mul_epu32 (r2, _mm256_set1_epi64x (5));
+		s3 = _mm256_mul_epu32 (r3, _mm256_set1_epi64x (5)); s4 = _mm256_mul_epu32 (r4, _mm256_set1_epi64x (5));
+		POLY1305_MUL_AVX2 (d, h, r, s)
+		POLY1305_CARRY_AVX2 (h, d)
+		// sum lanes
+		alignas(32) uint64_t t[5][4];
+		_mm256_store_si256 ((__m256i *)t[0], h0); _mm256_store_si256 ((__m256i *)t[1], h1);
+		_mm256_store_si256 ((__m256i *)t[2], h2); _mm256_store_si256 ((__m256i *)t[3], h3);
+		_mm256_store_si256 ((__m256i *)t[4], h4);
+		uint64_t sum[5];
+		for (int i = 0; i < 5; i++)
+			sum[i] = t[i][0] + t[i][1] + t[i][2] + t[i][3];
+		Poly1305FromLimbs26 (sum, h);
+		return processed;
+	}
+#endif
+
+	void Poly1305::Blocks (const uint8_t * buf, size_t sz)
+	{
+		uint64_t hibit = m_Final ? 0 : ((uint64_t)1 << 40);
+#ifdef POLY1305_AVX2
+		if (hibit && sz >= POLY1305_AVX2_MIN_BYTES && dotnet::cpu::avx2)
+		{
+			if (!m_RPowers[3][0] && !m_RPowers[3][1])
+			{
+				uint64_t r[3] = { m_R[0], m_R[1], m_R[2] };
+				Poly1305ToLimbs26 (r, m_RPowers[3]);
+				for (int i = 2; i >= 0; i--)
+				{
+					Poly1305Mul (r, m_R);
+					Poly1305ToLimbs26 (r, m_RPowers[i]);
+				}
+			}
+			size_t processed = Poly1305BlocksAVX2 (m_H, m_RPowers, buf, sz);
+			buf += processed;
+			sz -= processed;
+		}
+#endif
+		Poly1305BlocksScalar (m_H, m_R, buf, sz, hibit);
+	}
+
+	void Poly1305::Finish (uint64_t * out)
+	{
+		if (m_Leftover)
+		{
+			size_t idx = m_Leftover;
+			m_Buffer[idx++] = 1;
+			for (; idx < POLY1305_BLOCK_BYTES; idx++)
+				m_Buffer[idx] = 0;
+			m_Final = 1;
+			Blocks (m_Buffer, POLY1305_BLOCK_BYTES);
+		}
+		// fully carry h
+		uint64_t h0 = m_H[0], h1 = m_H[1], h2 = m_H[2], c;
+		c = h1 >> 44; h1 &= POLY1305_MASK44;
+		h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+		h0 += c*5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+		h1 += c; c = h1 >> 44; h1 &= POLY1305_MASK44;
+		h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+		h0 += c*5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+		h1 += c;
+		// g = h + -p
+		uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= POLY1305_MASK44;
+		uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= POLY1305_MASK44;
+		uint64_t g2 = h2 + c - ((uint64_t)1 << 42);
+		// select h if h < p, or g if h >= p
+		c = (g2 >> 63) - 1;
+		g0 &= c; g1 &= c; g2 &= c;
+		c = ~c;
+		h0 = (h0 & c) | g0; h1 = (h1 & c) | g1; h2 = (h2 & c) | g2;
+		// h = h + pad mod 2^128
+		uint64_t t0 = m_Pad[0], t1 = m_Pad[1];
+		h0 += t0 & POLY1305_MASK44; c = h0 >> 44; h0 &= POLY1305_MASK44;
+		h1 += (((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44) + c; c = h1 >> 44; h1 &= POLY1305_MASK44;
+		h2 += ((t1 >> 24) & POLY1305_MASK42) + c; h2 &= POLY1305_MASK42;
+		out[0] = htole64 (h0 | (h1 << 44));
+		out[1] = htole64 ((h1 >> 20) | (h2 << 24));
+	}
+#else
+	Poly1305::Poly1305 (const uint64_t * key)
+	{
+		const uint8_t * k = (const uint8_t *)key;
+		// clamp r
+		m_R[0] = (le32toh (buf32toh (k + 0))) & 0x3ffffff;
+		m_R[1] = (le32toh (buf32toh (k + 3)) >> 2) & 0x3ffff03;
+		m_R[2] = (le32toh (buf32toh (k + 6)) >> 4) & 0x3ffc0ff;
+		m_R[3] = (le32toh (buf32toh (k + 9)) >> 6) & 0x3f03fff;
+		m_R[4] = (le32toh (buf32toh (k + 12)) >> 8) & 0x00fffff;
+		memset (m_H, 0, sizeof (m_H));
+		for (int i = 0; i < 4; i++)
+			m_Pad[i] = le32toh (buf32toh (k + 16 + i*4));
+		m_Leftover = 0;
+		m_Final = 0;
+	}
+
+	void Poly1305::Blocks (const uint8_t * buf, size_t sz)
+	{
+		const uint32_t hibit = m_Final ? 0 : (1 << 24);
+		uint32_t r0 = m_R[0], r1 = m_R[1], r2 = m_R[2], r3 = m_R[3], r4 = m_R[4];
+		uint32_t s1 = r1*5, s2 = r2*5, s3 = r3*5, s4 = r4*5;
+		uint32_t h0 = m_H[0], h1 = m_H[1], h2 = m_H[2], h3 = m_H[3], h4 = m_H[4];
+		while (sz >= POLY1305_BLOCK_BYTES)
+		{
+			h0 += (le32toh (buf32toh (buf + 0))) & 0x3ffffff;
+			h1 += (le32toh (buf32toh (buf + 3)) >> 2) & 0x3ffffff;
+			h2 += (le32toh (buf32toh (buf + 6)) >> 4) & 0x3ffffff;
+			h3 += (le32toh (buf32toh (buf + 9)) >> 6) & 0x3ffffff;
+			h4 += (le32toh (buf32toh (buf + 12)) >> 8) | hibit;
+			uint64_t d0 = (uint64_t)h0*r0 + (uint64_t)h1*s4 + (uint64_t)h2*s3 + (uint64_t)h3*s2 + (uint64_t)h4*s1;
+			uint64_t d1 = (uint64_t)h0*r1 + (uint64_t)h1*r0 + (uint64_t)h2*s4 + (uint64_t)h3*s3 + (uint64_t)h4*s2;
+			uint64_t d2 = (uint64_t)h0*r2 + (uint64_t)h1*r1 + (uint64_t)h2*r0 + (uint64_t)h3*s4 + (uint64_t)h4*s3;
+			uint64_t d3 = (uint64_t)h0*r3 + (uint64_t)h1*r2 + (uint64_t)h2*r1 + (uint64_t)h3*r0 + (uint64_t)h4*s4;
+			uint64_t d4 = (uint64_t)h0*r4 + (uint64_t)h1*r3 + (uint64_t)h2*r2 + (uint64_t)h3*r1 + (uint64_t)h4*r0;
+			uint32_t c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+			d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+			d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+			d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+			d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+			h0 += c*5; c = h0 >> 26; h0 &= 0x3ffffff;
+			h1 += c;
+			buf += POLY1305_BLOCK_BYTES;
+			sz -= POLY1305_BLOCK_BYTES;
+		}
+		m_H[0] = h0; m_H[1] = h1; m_H[2] = h2; m_H[3] = h3; m_H[4] = h4;
+	}
+
+	void Poly1305::Finish (uint64_t * out)
+	{
+		if (m_Leftover)
+		{
+			size_t idx = m_Leftover;
+			m_Buffer[idx++] = 1;
+			for (; idx < POLY1305_BLOCK_BYTES; idx++)
+				m_Buffer[idx] = 0;
+			m_Final = 1;
+			Blocks (m_Buffer, POLY1305_BLOCK_BYTES);
+		}
+		// fully carry h
+		uint32_t h0 = m_H[0], h1 = m_H[1], h2 = m_H[2], h3 = m_H[3], h4 = m_H[4], c;
+		c = h1 >> 26; h1 &= 0x3ffffff;
+		h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+		h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+		h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+		h0 += c*5; c = h0 >> 26; h0 &= 0x3ffffff;
+		h1 += c;
+		// g = h + -p
+		uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+		uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+		uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+		uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+		uint32_t g4 = h4 + c - (1 << 26);
+		// select h if h < p, or g if h >= p
+		uint32_t mask = (g4 >> 31) - 1;
+		g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+		mask = ~mask;
+		h0 = (h0 & mask) | g0; h1 = (h1 & mask) | g1; h2 = (h2 & mask) | g2;
+		h3 = (h3 & mask) | g3; h4 = (h4 & mask) | g4;
+		// h = h % 2^128
+		h0 = (h0 | (h1 << 26)) & 0xffffffff;
+		h1 = ((h1 >> 6) | (h2 << 20)) & 0xffffffff;
+		h2 = ((h2 >> 12) | (h3 << 14)) & 0xffffffff;
+		h3 = ((h3 >> 18) | (h4 << 8)) & 0xffffffff;
+		// mac = (h + pad) % 2^128
+		uint64_t f;
+		uint32_t mac[4];
+		f = (uint64_t)h0 + m_Pad[0]; mac[0] = (uint32_t)f;
+		f = (uint64_t)h1 + m_Pad[1] + (f >> 32); mac[1] = (uint32_t)f;
+		f = (uint64_t)h2 + m_Pad[2] + (f >> 32); mac[2] = (uint32_t)f;
+		f = (uint64_t)h3 + m_Pad[3] + (f >> 32); mac[3] = (uint32_t)f;
+		for (int i = 0; i < 4; i++)
+			htole32buf ((uint8_t *)out + i*4, mac[i]);
+	}
+#endif
+
+	void Poly1305::Update (const uint8_t * buf, size_t sz)
+	{
+		// process leftover
+		if (m_Leftover)
+		{
+			size_t want = POLY1305_BLOCK_BYTES - m_Leftover;
+			if (want > sz) want = sz;
+			memcpy (m_Buffer + m_Leftover, buf, want);
+			sz -= want;
+			buf += want;
+			m_Leftover += want;
+			if (m_Leftover < POLY1305_BLOCK_BYTES) return;
+			Blocks (m_Buffer, POLY1305_BLOCK_BYTES);
+			m_Leftover = 0;
+		}
+		// process blocks
+		if (sz >= POLY1305_BLOCK_BYTES)
+		{
+			size_t want = (sz & ~(POLY1305_BLOCK_BYTES - 1));
+			Blocks (buf, want);
+			buf += want;
+			sz -= want;
+		}
+		// leftover
+		if (sz)
+		{
+			memcpy (m_Buffer + m_Leftover, buf, sz);
+			m_Leftover += sz;
+		}
+	}
 
 	void Poly1305HMAC(uint64_t * out, const uint64_t * key, const uint8_t * buf, std::size_t sz)
 	{
@@ -19,7 +382,16 @@ namespace crypto
 		p.Update(buf, sz);
 		p.Finish(out);
 	}
+
+	const char * GetPoly1305Implementation ()
+	{
+#if defined(POLY1305_AVX2)
+		return dotnet::cpu::avx2 ? "AVX2, 4 blocks" : "64 bits limbs";
+#elif defined(POLY1305_LIMBS64)
+		return "64 bits limbs";
+#else
+		return "32 bits limbs";
+#endif
+	}
 }
 }
-#endif
-
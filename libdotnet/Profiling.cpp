@@ -1,7 +1,18 @@
-#include <sys/stat.h>
+#include <string.h>
+#include <list>
+#include <map>
+#include <array>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include "Base.h"
+#include "DotNetEndian.h"
 #include "FS.h"
 #include "Log.h"
 #include "Profiling.h"
@@ -10,7 +21,250 @@ namespace dotnet
 {
 namespace data
 {
-	dotnet::fs::HashedStorage m_ProfilesStorage("peerProfiles", "p", "profile-", "txt");
+	ProfilesStorage::ProfilesStorage (size_t cacheSize):
+		m_Mapped (nullptr), m_NumRecords (0), m_CacheSize (cacheSize)
+	{
+	}
+
+	ProfilesStorage::~ProfilesStorage ()
+	{
+		Close ();
+	}
+
+	bool ProfilesStorage::Open (const std::string& path)
+	{
+		Close ();
+		std::unique_lock<std::mutex> l(m_Mutex);
+		m_Path = path;
+		boost::system::error_code ec;
+		auto size = boost::filesystem::exists (m_Path, ec) ? boost::filesystem::file_size (m_Path, ec) : 0;
+		if (size < PEER_PROFILE_RECORD_SIZE)
+		{
+			std::ofstream f (m_Path, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+			uint8_t header[PEER_PROFILE_RECORD_SIZE];
+			memset (header, 0, PEER_PROFILE_RECORD_SIZE);
+			memcpy (header, PEER_PROFILES_SIGNATURE, sizeof (PEER_PROFILES_SIGNATURE));
+			f.write ((const char *)header, PEER_PROFILE_RECORD_SIZE);
+			if (!f)
+			{
+				LogPrint (eLogError, "Profiling: can't create ", m_Path);
+				return false;
+			}
+			size = PEER_PROFILE_RECORD_SIZE;
+		}
+		m_NumRecords = size/PEER_PROFILE_RECORD_SIZE - 1;
+		if (!m_NumRecords)
+		{
+			boost::filesystem::resize_file (m_Path, (PEER_PROFILES_GROW_SIZE + 1)*PEER_PROFILE_RECORD_SIZE, ec);
+			if (ec)
+			{
+				LogPrint (eLogError, "Profiling: can't resize ", m_Path, ": ", ec.message ());
+				return false;
+			}
+			m_NumRecords = PEER_PROFILES_GROW_SIZE;
+		}
+		if (!Map ()) return false;
+		if (memcmp (m_Mapped, PEER_PROFILES_SIGNATURE, sizeof (PEER_PROFILES_SIGNATURE)))
+		{
+			LogPrint (eLogError, "Profiling: ", m_Path, " has unknown format");
+			m_Region.reset (nullptr); m_Mapped = nullptr;
+			return false;
+		}
+		m_Region->advise (boost::interprocess::mapped_region::advice_willneed);
+		for (size_t i = m_NumRecords; i > 0; i--)
+		{
+			IdentHash ident (GetRecord (i - 1));
+			if (ident.IsZero ())
+				m_FreeRecords.push_back (i - 1);
+			else
+				m_Index[ident] = i - 1;
+		}
+		LogPrint (eLogDebug, "Profiling: ", m_Index.size (), " profiles in ", m_Path);
+		return true;
+	}
+
+	void ProfilesStorage::Close ()
+	{
+		Flush ();
+		std::unique_lock<std::mutex> l(m_Mutex);
+		m_Region.reset (nullptr);
+		m_Mapped = nullptr;
+		m_NumRecords = 0;
+		m_Index.clear ();
+		m_FreeRecords.clear ();
+		m_Cache.clear ();
+		m_CacheIndex.clear ();
+		m_Evicted.clear ();
+	}
+
+	bool ProfilesStorage::Map ()
+	{
+		m_Region.reset (nullptr); m_Mapped = nullptr;
+		try
+		{
+			boost::interprocess::file_mapping file (m_Path.c_str (), boost::interprocess::read_write);
+			m_Region.reset (new boost::interprocess::mapped_region (file, boost::interprocess::read_write, 0,
+				(m_NumRecords + 1)*PEER_PROFILE_RECORD_SIZE));
+			m_Mapped = (uint8_t *)m_Region->get_address ();
+		}
+		catch (std::exception& ex)
+		{
+			LogPrint (eLogError, "Profiling: can't map ", m_Path, ": ", ex.what ());
+			return false;
+		}
+		return true;
+	}
+
+	bool ProfilesStorage::Grow ()
+	{
+		m_Region.reset (nullptr); m_Mapped = nullptr; // can't resize mapped file on Windows
+		boost::system::error_code ec;
+		boost::filesystem::resize_file (m_Path, (m_NumRecords + PEER_PROFILES_GROW_SIZE + 1)*PEER_PROFILE_RECORD_SIZE, ec);
+		if (ec)
+		{
+			LogPrint (eLogError, "Profiling: can't resize ", m_Path, ": ", ec.message ());
+			Map ();
+			return false;
+		}
+		for (size_t i = m_NumRecords + PEER_PROFILES_GROW_SIZE; i > m_NumRecords; i--)
+			m_FreeRecords.push_back (i - 1);
+		m_NumRecords += PEER_PROFILES_GROW_SIZE;
+		return Map ();
+	}
+
+	std::shared_ptr<RouterProfile> ProfilesStorage::Get (const IdentHash& ident)
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		auto it = m_CacheIndex.find (ident);
+		if (it != m_CacheIndex.end ())
+		{
+			m_Cache.splice (m_Cache.begin (), m_Cache, it->second);
+			return it->second->second;
+		}
+		std::shared_ptr<RouterProfile> profile;
+		auto evicted = m_Evicted.find (ident);
+		if (evicted != m_Evicted.end ())
+		{
+			// otherwise changes made through the old object would be lost
+			profile = evicted->second.lock ();
+			m_Evicted.erase (evicted);
+		}
+		if (!profile)
+		{
+			profile = std::make_shared<RouterProfile> ();
+			auto pending = m_Pending.find (ident);
+			if (pending != m_Pending.end ())
+				profile->FromBuffer (pending->second.data ());
+			else if (m_Mapped)
+			{
+				auto ind = m_Index.find (ident);
+				if (ind != m_Index.end ())
+					profile->FromBuffer (GetRecord (ind->second) + 32);
+			}
+		}
+		m_Cache.emplace_front (ident, profile);
+		m_CacheIndex[ident] = m_Cache.begin ();
+		if (m_Cache.size () > m_CacheSize)
+		{
+			auto& last = m_Cache.back ();
+			if (last.second.use_count () > 1) // still referenced
+				m_Evicted[last.first] = last.second;
+			m_CacheIndex.erase (last.first);
+			m_Cache.pop_back ();
+		}
+		return profile;
+	}
+
+	void ProfilesStorage::Put (const IdentHash& ident, const RouterProfile& profile)
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		profile.ToBuffer (m_Pending[ident].data ());
+	}
+
+	bool ProfilesStorage::Flush ()
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		return FlushPending ();
+	}
+
+	bool ProfilesStorage::FlushPending ()
+	{
+		if (m_Pending.empty ()) return true;
+		if (!m_Mapped)
+		{
+			LogPrint (eLogError, "Profiling: ", m_Path, " is not opened, ", m_Pending.size (), " profiles not saved");
+			m_Pending.clear ();
+			return false;
+		}
+		size_t numSaved = 0;
+		for (auto& it: m_Pending)
+		{
+			size_t ind;
+			auto found = m_Index.find (it.first);
+			if (found != m_Index.end ())
+				ind = found->second;
+			else
+			{
+				if (m_FreeRecords.empty () && !Grow ()) break;
+				ind = m_FreeRecords.back ();
+				m_FreeRecords.pop_back ();
+				m_Index[it.first] = ind;
+			}
+			auto record = GetRecord (ind);
+			memcpy (record, it.first, 32);
+			memcpy (record + 32, it.second.data (), it.second.size ());
+			numSaved++;
+		}
+		bool ret = m_Region && m_Region->flush (0, 0, true) && numSaved == m_Pending.size (); // async, no region if Grow failed to map
+		if (numSaved < m_Pending.size ())
+			LogPrint (eLogError, "Profiling: can't grow ", m_Path, ", ", m_Pending.size () - numSaved, " profiles not saved");
+		else
+			LogPrint (eLogDebug, "Profiling: ", numSaved, " profiles saved");
+		m_Pending.clear ();
+		return ret;
+	}
+
+	void ProfilesStorage::DeleteObsolete ()
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		FlushPending ();
+		if (!m_Mapped) return;
+		auto ts = boost::posix_time::to_time_t (boost::posix_time::second_clock::local_time ()); // same as profile's time
+		size_t numDeleted = 0;
+		for (auto it = m_Index.begin (); it != m_Index.end ();)
+		{
+			auto record = GetRecord (it->second);
+			if (ts >= (std::time_t)bufbe64toh (record + 32) + PEER_PROFILE_EXPIRATION_TIMEOUT*3600)
+			{
+				memset (record, 0, PEER_PROFILE_RECORD_SIZE);
+				m_FreeRecords.push_back (it->second);
+				auto cached = m_CacheIndex.find (it->first);
+				if (cached != m_CacheIndex.end ())
+				{
+					m_Cache.erase (cached->second);
+					m_CacheIndex.erase (cached);
+				}
+				it = m_Index.erase (it);
+				numDeleted++;
+			}
+			else
+				++it;
+		}
+		for (auto it = m_Evicted.begin (); it != m_Evicted.end ();)
+			if (it->second.expired ())
+				it = m_Evicted.erase (it);
+			else
+				++it;
+		if (numDeleted)
+		{
+			std::sort (m_FreeRecords.begin (), m_FreeRecords.end (), std::greater<size_t>());
+			m_Region->flush (0, 0, true);
+			LogPrint (eLogDebug, "Profiling: ", numDeleted, " expired peer profiles removed");
+		}
+	}
+
+	static ProfilesStorage m_Profiles;
+	dotnet::fs::HashedStorage m_ProfilesStorage("peerProfiles", "p", "profile-", "txt"); // legacy, migrated to m_Profiles
 
 	RouterProfile::RouterProfile ():
 		m_LastUpdateTime (boost::posix_time::second_clock::local_time()),
@@ -29,46 +283,52 @@ namespace data
 		m_LastUpdateTime = GetTime ();
 	}
 
-	void RouterProfile::Save (const IdentHash& identHash)
+	void RouterProfile::Reset ()
 	{
-		// fill sections
-		boost::property_tree::ptree participation;
-		participation.put (PEER_PROFILE_PARTICIPATION_AGREED, m_NumTunnelsAgreed);
-		participation.put (PEER_PROFILE_PARTICIPATION_DECLINED, m_NumTunnelsDeclined);
-		participation.put (PEER_PROFILE_PARTICIPATION_NON_REPLIED, m_NumTunnelsNonReplied);
-		boost::property_tree::ptree usage;
-		usage.put (PEER_PROFILE_USAGE_TAKEN, m_NumTimesTaken);
-		usage.put (PEER_PROFILE_USAGE_REJECTED, m_NumTimesRejected);
-		// fill property tree
-		boost::property_tree::ptree pt;
-		pt.put (PEER_PROFILE_LAST_UPDATE_TIME, boost::posix_time::to_simple_string (m_LastUpdateTime));
-		pt.put_child (PEER_PROFILE_SECTION_PARTICIPATION, participation);
-		pt.put_child (PEER_PROFILE_SECTION_USAGE, usage);
-
-		// save to file
-		std::string ident = identHash.ToBase64 ();
-		std::string path = m_ProfilesStorage.Path(ident);
+		m_LastUpdateTime = GetTime ();
+		m_NumTunnelsAgreed = 0;
+		m_NumTunnelsDeclined = 0;
+		m_NumTunnelsNonReplied = 0;
+		m_NumTimesTaken = 0;
+		m_NumTimesRejected = 0;
+	}
 
-		try {
-			boost::property_tree::write_ini (path, pt);
-		} catch (std::exception& ex) {
-			/* boost exception verbose enough */
-			LogPrint (eLogError, "Profiling: ", ex.what ());
-		}
+	void RouterProfile::Save (const IdentHash& identHash)
+	{
+		m_Profiles.Put (identHash, *this);
 	}
 
-	void RouterProfile::Load (const IdentHash& identHash)
+	void RouterProfile::ToBuffer (uint8_t * buf) const
 	{
-		std::string ident = identHash.ToBase64 ();
-		std::string path = m_ProfilesStorage.Path(ident);
-		boost::property_tree::ptree pt;
+		std::unique_lock<std::mutex> l(m_Mutex);
+		htobe64buf (buf, boost::posix_time::to_time_t (m_LastUpdateTime));
+		htobe32buf (buf + 8, m_NumTunnelsAgreed);
+		htobe32buf (buf + 12, m_NumTunnelsDeclined);
+		htobe32buf (buf + 16, m_NumTunnelsNonReplied);
+		htobe32buf (buf + 20, m_NumTimesTaken);
+		htobe32buf (buf + 24, m_NumTimesRejected);
+		memset (buf + 28, 0, 4); // reserved
+	}
 
-		if (!dotnet::fs::Exists(path))
+	void RouterProfile::FromBuffer (const uint8_t * buf)
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		m_LastUpdateTime = boost::posix_time::from_time_t (bufbe64toh (buf));
+		if ((GetTime () - m_LastUpdateTime).hours () < PEER_PROFILE_EXPIRATION_TIMEOUT)
 		{
-			LogPrint(eLogWarning, "Profiling: no profile yet for ", ident);
-			return;
+			m_NumTunnelsAgreed = bufbe32toh (buf + 8);
+			m_NumTunnelsDeclined = bufbe32toh (buf + 12);
+			m_NumTunnelsNonReplied = bufbe32toh (buf + 16);
+			m_NumTimesTaken = bufbe32toh (buf + 20);
+			m_NumTimesRejected = bufbe32toh (buf + 24);
 		}
+		else
+			Reset ();
+	}
 
+	bool RouterProfile::LoadLegacy (const std::string& path)
+	{
+		boost::property_tree::ptree pt;
 		try
 		{
 			boost::property_tree::read_ini (path, pt);
@@ -76,7 +336,7 @@ namespace data
 		{
 			/* boost exception verbose enough */
 			LogPrint (eLogError, "Profiling: ", ex.what ());
-			return;
+			return false;
 		}
 
 		try
@@ -96,7 +356,7 @@ namespace data
 				}
 				catch (boost::property_tree::ptree_bad_path& ex)
 				{
-					LogPrint (eLogWarning, "Profiling: Missing section ", PEER_PROFILE_SECTION_PARTICIPATION, " in profile for ", ident);
+					LogPrint (eLogWarning, "Profiling: Missing section ", PEER_PROFILE_SECTION_PARTICIPATION, " in profile ", path);
 				}
 				try
 				{
@@ -107,20 +367,23 @@ namespace data
 				}
 				catch (boost::property_tree::ptree_bad_path& ex)
 				{
-					LogPrint (eLogWarning, "Missing section ", PEER_PROFILE_SECTION_USAGE, " in profile for ", ident);
+					LogPrint (eLogWarning, "Missing section ", PEER_PROFILE_SECTION_USAGE, " in profile ", path);
 				}
 			}
 			else
-				*this = RouterProfile ();
+				return false;
 		}
 		catch (std::exception& ex)
 		{
-			LogPrint (eLogError, "Profiling: Can't read profile ", ident, " :", ex.what ());
+			LogPrint (eLogError, "Profiling: Can't read profile ", path, " :", ex.what ());
+			return false;
 		}
+		return true;
 	}
 
 	void RouterProfile::TunnelBuildResponse (uint8_t ret)
 	{
+		std::unique_lock<std::mutex> l(m_Mutex);
 		UpdateTime ();
 		if (ret > 0)
 			m_NumTunnelsDeclined++;
@@ -130,6 +393,7 @@ namespace data
 
 	void RouterProfile::TunnelNonReplied ()
 	{
+		std::unique_lock<std::mutex> l(m_Mutex);
 		m_NumTunnelsNonReplied++;
 		UpdateTime ();
 	}
@@ -147,6 +411,7 @@ namespace data
 
 	bool RouterProfile::IsBad ()
 	{
+		std::unique_lock<std::mutex> l(m_Mutex);
 		auto isBad = IsAlwaysDeclining () || IsLowPartcipationRate () /*|| IsLowReplyRate ()*/;
 		if (isBad && m_NumTimesRejected > 10*(m_NumTimesTaken + 1))
 		{
@@ -162,34 +427,54 @@ namespace data
 
 	std::shared_ptr<RouterProfile> GetRouterProfile (const IdentHash& identHash)
 	{
-		auto profile = std::make_shared<RouterProfile> ();
-		profile->Load (identHash); // if possible
-		return profile;
+		return m_Profiles.Get (identHash);
 	}
 
 	void InitProfilesStorage ()
 	{
+		auto path = dotnet::fs::DataDirPath (PEER_PROFILES_FILENAME);
+		if (!m_Profiles.Open (path))
+		{
+			LogPrint (eLogError, "Profiling: can't open ", path, ", peer profiles are not persisted");
+			return; // keep legacy profiles until they can be migrated
+		}
+		// migrate profiles from INI files
 		m_ProfilesStorage.SetPlace(dotnet::fs::GetDataDir());
-		m_ProfilesStorage.Init(dotnet::data::GetBase64SubstitutionTable(), 64);
-	}
-
-	void DeleteObsoleteProfiles ()
-	{
-		struct stat st;
-		std::time_t now = std::time(nullptr);
-
+		if (!dotnet::fs::Exists (m_ProfilesStorage.GetRoot ())) return;
 		std::vector<std::string> files;
 		m_ProfilesStorage.Traverse(files);
-		for (const auto& path: files) {
-			if (stat(path.c_str(), &st) != 0) {
-				LogPrint(eLogWarning, "Profiling: Can't stat(): ", path);
-				continue;
-			}
-			if (((now - st.st_mtime) / 3600) >= PEER_PROFILE_EXPIRATION_TIMEOUT) {
-				LogPrint(eLogDebug, "Profiling: removing expired peer profile: ", path);
-				dotnet::fs::Remove(path);
+		size_t numMigrated = 0;
+		for (const auto& file: files)
+		{
+			auto name = boost::filesystem::path (file).stem ().string (); // profile-<ident>
+			if (name.length () != 52 || name.compare (0, 8, "profile-")) continue;
+			IdentHash ident;
+			ident.FromBase64 (name.substr (8));
+			RouterProfile profile;
+			if (profile.LoadLegacy (file))
+			{
+				profile.Save (ident);
+				numMigrated++;
 			}
 		}
+		if (!m_Profiles.Flush ())
+		{
+			LogPrint (eLogError, "Profiling: can't save migrated profiles, ", m_ProfilesStorage.GetRoot (), " is kept");
+			return;
+		}
+		boost::system::error_code ec;
+		boost::filesystem::remove_all (m_ProfilesStorage.GetRoot (), ec);
+		LogPrint (eLogInfo, "Profiling: ", numMigrated, " of ", files.size (), " profiles migrated from ", m_ProfilesStorage.GetRoot (), " to ", path);
+	}
+
+	void SaveProfiles ()
+	{
+		m_Profiles.Flush ();
+	}
+
+	void DeleteObsoleteProfiles ()
+	{
+		m_Profiles.DeleteObsolete ();
 	}
 }
 }
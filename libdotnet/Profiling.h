@@ -2,9 +2,17 @@
 #define PROFILING_H__
 
 #include <memory>
+#include <mutex>
+#include <list>
+#include <map>
+#include <array>
+#include <vector>
+#include <string>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "Identity.h"
 
+namespace boost { namespace interprocess { class mapped_region; } }
+
 namespace dotnet
 {
 namespace data
@@ -22,15 +30,22 @@ namespace data
 
 	const int PEER_PROFILE_EXPIRATION_TIMEOUT = 72; // in hours (3 days)
 
-	class RouterProfile
+	const char PEER_PROFILES_FILENAME[] = "peerProfiles.dat";
+	const uint8_t PEER_PROFILES_SIGNATURE[8] = { 'd', 'n', 'p', 'r', 'o', 'f', 0x00, 0x01 };
+	const size_t PEER_PROFILE_RECORD_SIZE = 64; // ident(32) + last update time(8) + 5 counters(20) + reserved(4), header is the same size
+	const size_t PEER_PROFILES_GROW_SIZE = 1024; // records
+	const size_t PEER_PROFILES_CACHE_SIZE = 8192; // most recently used profiles kept in memory
+
+	class RouterProfile // shared by NetDb, tunnels and transports threads
 	{
 		public:
 
 			RouterProfile ();
-			RouterProfile& operator= (const RouterProfile& ) = default;
 
-			void Save (const IdentHash& identHash);
-			void Load (const IdentHash& identHash);
+			void Save (const IdentHash& identHash); // written to disk by SaveProfiles
+			void ToBuffer (uint8_t * buf) const; // record without ident
+			void FromBuffer (const uint8_t * buf);
+			bool LoadLegacy (const std::string& path); // INI file, false if not loaded or expired
 
 			bool IsBad ();
 
@@ -41,6 +56,7 @@ namespace data
 
 			boost::posix_time::ptime GetTime () const;
 			void UpdateTime ();
+			void Reset ();
 
 			bool IsAlwaysDeclining () const { return !m_NumTunnelsAgreed && m_NumTunnelsDeclined >= 5; };
 			bool IsLowPartcipationRate () const;
@@ -48,6 +64,7 @@ namespace data
 
 		private:
 
+			mutable std::mutex m_Mutex;
 			boost::posix_time::ptime m_LastUpdateTime;
 			// participation
 			uint32_t m_NumTunnelsAgreed;
@@ -58,8 +75,47 @@ namespace data
 			uint32_t m_NumTimesRejected;
 	};
 
+	/** profiles in fixed size records of memory mapped file, changes are written by Flush */
+	class ProfilesStorage
+	{
+		public:
+
+			ProfilesStorage (size_t cacheSize = PEER_PROFILES_CACHE_SIZE);
+			~ProfilesStorage ();
+
+			bool Open (const std::string& path);
+			void Close ();
+
+			std::shared_ptr<RouterProfile> Get (const IdentHash& ident); // the same object while referenced
+			void Put (const IdentHash& ident, const RouterProfile& profile);
+			bool Flush (); // false if some profiles were not written
+			void DeleteObsolete ();
+
+		private:
+
+			bool Map ();
+			bool Grow ();
+			uint8_t * GetRecord (size_t ind) const { return m_Mapped + (ind + 1)*PEER_PROFILE_RECORD_SIZE; }; // after header
+			bool FlushPending ();
+
+		private:
+
+			std::mutex m_Mutex;
+			std::string m_Path;
+			std::unique_ptr<boost::interprocess::mapped_region> m_Region;
+			uint8_t * m_Mapped;
+			size_t m_NumRecords, m_CacheSize;
+			std::map<IdentHash, size_t> m_Index; // record number
+			std::vector<size_t> m_FreeRecords; // lowest in the end
+			std::map<IdentHash, std::array<uint8_t, PEER_PROFILE_RECORD_SIZE - 32> > m_Pending; // saved since last Flush
+			std::list<std::pair<IdentHash, std::shared_ptr<RouterProfile> > > m_Cache; // most recently used first
+			std::map<IdentHash, decltype(m_Cache)::iterator> m_CacheIndex;
+			std::map<IdentHash, std::weak_ptr<RouterProfile> > m_Evicted; // from m_Cache, but still held by RouterInfo
+	};
+
 	std::shared_ptr<RouterProfile> GetRouterProfile (const IdentHash& identHash);
 	void InitProfilesStorage ();
+	void SaveProfiles ();
 	void DeleteObsoleteProfiles ();
 }
 }
@@ -2,12 +2,17 @@
 #define QUEUE_H__
 
 #include <queue>
+#include <deque>
 #include <vector>
+#include <atomic>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <functional>
 #include <utility>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
 
 namespace dotnet
 {
@@ -119,6 +124,161 @@ namespace util
 			std::mutex m_QueueMutex;
 			std::condition_variable m_NonEmpty;
 	};
+
+	/**
+	 * Multiple producers, single consumer. Put is lock free, producers push to intrusive stack and
+	 * consumer takes whole stack at once. Mutex is touched by producer only if queue was empty
+	 */
+	template<typename Element>
+	class MPSCQueue
+	{
+		struct Node
+		{
+			Element element;
+			Node * next;
+		};
+
+		public:
+
+			MPSCQueue (): m_Head (nullptr), m_Size (0), m_IsWokenUp (false) {};
+			~MPSCQueue ()
+			{
+				auto node = m_Head.exchange (nullptr);
+				while (node)
+				{
+					auto next = node->next;
+					delete node;
+					node = next;
+				}
+			}
+
+			void Put (Element e)
+			{
+				auto node = new Node{ std::move (e), nullptr };
+				Push (node, node, 1);
+			}
+
+			template<template<typename, typename...>class Container, typename... R>
+			void Put (const Container<Element, R...>& vec)
+			{
+				if (vec.empty ()) return;
+				Node * first = nullptr, * last = nullptr;
+				for (const auto& it: vec)
+				{
+					first = new Node{ it, first }; // stack is reversed by consumer
+					if (!last) last = first;
+				}
+				Push (first, last, vec.size ());
+			}
+
+			// consumer only
+
+			Element Get ()
+			{
+				if (m_Local.empty () && !Take ()) return nullptr;
+				auto el = std::move (m_Local.front ());
+				m_Local.pop_front ();
+				return el;
+			}
+
+			Element GetNextWithTimeout (int usec)
+			{
+				auto el = Get ();
+				if (!el && Wait (0, usec)) el = Get ();
+				return el;
+			}
+
+			bool GetBatch (std::vector<Element>& batch) // appends all in order
+			{
+				Take ();
+				if (m_Local.empty ()) return false;
+				std::move (m_Local.begin (), m_Local.end (), std::back_inserter (batch));
+				m_Local.clear ();
+				return true;
+			}
+
+			bool GetBatchWithTimeout (std::vector<Element>& batch, int usec)
+			{
+				if (GetBatch (batch)) return true;
+				return Wait (0, usec) && GetBatch (batch);
+			}
+
+			void Wait ()
+			{
+				std::unique_lock<std::mutex> l(m_QueueMutex);
+				if (!HasElements () && !m_IsWokenUp) m_NonEmpty.wait (l);
+				m_IsWokenUp = false;
+			}
+
+			bool Wait (int sec, int usec) // false if timeout
+			{
+				std::unique_lock<std::mutex> l(m_QueueMutex);
+				if (HasElements () || m_IsWokenUp)
+				{
+					m_IsWokenUp = false;
+					return true;
+				}
+				auto ret = m_NonEmpty.wait_for (l, std::chrono::seconds (sec) + std::chrono::milliseconds (usec)) != std::cv_status::timeout;
+				m_IsWokenUp = false;
+				return ret;
+			}
+
+			// any thread
+
+			bool IsEmpty () const { return !m_Size; };
+			int GetSize () const { return m_Size; };
+
+			void WakeUp () // isn't lost if consumer doesn't wait yet
+			{
+				std::unique_lock<std::mutex> l(m_QueueMutex);
+				m_IsWokenUp = true;
+				m_NonEmpty.notify_all ();
+			}
+
+		private:
+
+			void Push (Node * first, Node * last, int num)
+			{
+				m_Size += num;
+				auto head = m_Head.load (std::memory_order_relaxed);
+				do
+					last->next = head;
+				while (!m_Head.compare_exchange_weak (head, first, std::memory_order_release, std::memory_order_relaxed));
+				if (!head) // was empty, consumer might wait
+				{
+					std::unique_lock<std::mutex> l(m_QueueMutex);
+					m_NonEmpty.notify_one ();
+				}
+			}
+
+			bool Take ()
+			{
+				auto node = m_Head.exchange (nullptr, std::memory_order_acquire);
+				if (!node) return false;
+				auto first = m_Local.size ();
+				while (node)
+				{
+					m_Local.push_back (std::move (node->element));
+					auto next = node->next;
+					delete node;
+					node = next;
+				}
+				std::reverse (m_Local.begin () + first, m_Local.end ()); // was pushed in reverse order
+				m_Size -= m_Local.size () - first;
+				return true;
+			}
+
+			bool HasElements () const { return !m_Local.empty () || m_Head.load (std::memory_order_relaxed); };
+
+		private:
+
+			std::atomic<Node *> m_Head; // most recent first
+			std::atomic<int> m_Size;
+			std::deque<Element> m_Local; // taken by consumer from m_Head
+			std::mutex m_QueueMutex;
+			std::condition_variable m_NonEmpty;
+			bool m_IsWokenUp; // by WakeUp, guarded by m_QueueMutex
+	};
 }
 }
 
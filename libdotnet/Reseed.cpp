@@ -261,6 +261,7 @@ namespace data
 	int Reseeder::ProcessZIPStream (std::istream& s, uint64_t contentLength)
 	{
 		int numFiles = 0;
+		std::vector<std::vector<uint8_t> > routerInfos; // added together for batch verification
 		size_t contentPos = s.tellg ();
 		while (!s.eof ())
 		{
@@ -292,6 +293,7 @@ namespace data
 				if ( fileNameLength > 255 ) {
 					// too big
 					LogPrint(eLogError, "Reseed: SU3 fileNameLength too large: ", fileNameLength);
+					dotnet::data::netdb.AddRouterInfos (routerInfos); // what we have processed so far
 					return numFiles;
 				}
 				s.read ((char *)&extraFieldLength, 2);
@@ -307,6 +309,7 @@ namespace data
 					if (!FindZipDataDescriptor (s))
 					{
 						LogPrint (eLogError, "Reseed: SU3 archive data descriptor not found");
+						dotnet::data::netdb.AddRouterInfos (routerInfos); // what we have processed so far
 						return numFiles;
 					}
 					s.read ((char *)&crc_32, 4);
@@ -345,7 +348,7 @@ namespace data
 						uncompressedSize -= inflator.avail_out;
 						if (crc32 (0, uncompressed, uncompressedSize) == crc_32)
 						{
-							dotnet::data::netdb.AddRouterInfo (uncompressed, uncompressedSize);
+							routerInfos.emplace_back (uncompressed, uncompressed + uncompressedSize);
 							numFiles++;
 						}
 						else
@@ -358,7 +361,7 @@ namespace data
 				}
 				else // no compression
 				{
-					dotnet::data::netdb.AddRouterInfo (compressed, compressedSize);
+					routerInfos.emplace_back (compressed, compressed + compressedSize);
 					numFiles++;
 				}
 				delete[] compressed;
@@ -375,6 +378,7 @@ namespace data
 			if (end - contentPos >= contentLength)
 				break; // we are beyond contentLength
 		}
+		dotnet::data::netdb.AddRouterInfos (routerInfos);
 		if (numFiles) // check if routers are not outdated
 		{
 			auto ts = dotnet::util::GetMillisecondsSinceEpoch ();
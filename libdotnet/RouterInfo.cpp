@@ -34,14 +34,14 @@ namespace data
 		ReadFromFile ();
 	}
 
-	RouterInfo::RouterInfo (const uint8_t * buf, int len):
+	RouterInfo::RouterInfo (const uint8_t * buf, int len, bool verifySignature):
 		m_IsUpdated (true), m_IsUnreachable (false), m_SupportedTransports (0), m_Caps (0)
 	{
 		m_Addresses = boost::make_shared<Addresses>(); // create empty list
 		m_Buffer = new uint8_t[MAX_RI_BUFFER_SIZE];
 		memcpy (m_Buffer, buf, len);
 		m_BufferLen = len;
-		ReadFromBuffer (true);
+		ReadFromBuffer (verifySignature);
 	}
 
 	RouterInfo::~RouterInfo ()
@@ -49,11 +49,11 @@ namespace data
 		delete[] m_Buffer;
 	}
 
-	void RouterInfo::Update (const uint8_t * buf, int len)
+	void RouterInfo::Update (const uint8_t * buf, int len, bool verifySignature)
 	{
 		// verify signature since we have identity already
 		int l = len - m_RouterIdentity->GetSignatureLen ();
-		if (m_RouterIdentity->Verify (buf, l, buf + l))
+		if (!verifySignature || m_RouterIdentity->Verify (buf, l, buf + l))
 		{
 			// clean up
 			m_IsUpdated = true;
@@ -596,6 +596,15 @@ namespace data
 		return m_Buffer;
 	}
 
+	void RouterInfo::SetBuffer (const uint8_t * buf, int len)
+	{
+		if (len > MAX_RI_BUFFER_SIZE) return;
+		if (!m_Buffer)
+			m_Buffer = new uint8_t[MAX_RI_BUFFER_SIZE];
+		memcpy (m_Buffer, buf, len);
+		m_BufferLen = len;
+	}
+
 	void RouterInfo::CreateBuffer (const PrivateKeys& privateKeys)
 	{
 		m_Timestamp = dotnet::util::GetMillisecondsSinceEpoch (); // refresh timstamp
@@ -0,0 +1,232 @@
+#include <string.h>
+#include <openssl/sha.h>
+#include "CPU.h"
+#include "DotNetEndian.h"
+#include "SHA256.h"
+
+#if defined(X86_DISPATCH) && defined(__x86_64__)
+#define SHA256_SIMD // SHA-NI one message at time, AVX2 8 messages at time
+#include <immintrin.h>
+#endif
+
+namespace dotnet
+{
+namespace crypto
+{
+#ifdef SHA256_SIMD
+	static const uint32_t SHA256_K[64] =
+	{
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	static const uint32_t SHA256_IV[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	const size_t SHA256_BLOCK_SIZE = 64;
+
+	static size_t SHA256Pad (const uint8_t * in, size_t len, uint8_t * tail) // tail is 2 blocks, returns number of tail blocks
+	{
+		size_t rem = len & (SHA256_BLOCK_SIZE - 1);
+		size_t num = rem + 9 > SHA256_BLOCK_SIZE ? 2 : 1;
+		memcpy (tail, in + len - rem, rem);
+		tail[rem] = 0x80;
+		memset (tail + rem + 1, 0, num*SHA256_BLOCK_SIZE - rem - 9);
+		htobe64buf (tail + num*SHA256_BLOCK_SIZE - 8, (uint64_t)len << 3);
+		return num;
+	}
+
+	__attribute__((target("sha,sse4.1")))
+	static void SHA256BlocksSHANI (uint32_t * state, const uint8_t * buf, size_t num)
+	{
+		const __m128i bswap = _mm_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+		// rnds2 wants ABEF and CDGH
+		__m128i t = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *)state), 0xB1); // CDAB
+		__m128i s1 = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *)(state + 4)), 0x1B); // EFGH
+		__m128i s0 = _mm_alignr_epi8 (t, s1, 8); // ABEF
+		s1 = _mm_blend_epi16 (s1, t, 0xF0); // CDGH
+		for (size_t n = 0; n < num; n++, buf += SHA256_BLOCK_SIZE)
+		{
+			__m128i abef = s0, cdgh = s1, w[4];
+			for (int i = 0; i < 4; i++)
+				w[i] = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(buf + 16*i)), bswap);
+			for (int i = 0; i < 16; i++)
+			{
+				__m128i m = _mm_add_epi32 (w[i & 3], _mm_loadu_si128 ((const __m128i *)(SHA256_K + 4*i)));
+				s1 = _mm_sha256rnds2_epu32 (s1, s0, m);
+				s0 = _mm_sha256rnds2_epu32 (s0, s1, _mm_shuffle_epi32 (m, 0x0E));
+				if (i < 12)
+				{
+					// w[i+4] = msg2 (msg1 (w[i], w[i+1]) + (w[i+2]:w[i+3] >> 32), w[i+3])
+					m = _mm_sha256msg1_epu32 (w[i & 3], w[(i + 1) & 3]);
+					m = _mm_add_epi32 (m, _mm_alignr_epi8 (w[(i + 3) & 3], w[(i + 2) & 3], 4));
+					w[i & 3] = _mm_sha256msg2_epu32 (m, w[(i + 3) & 3]);
+				}
+			}
+			s0 = _mm_add_epi32 (s0, abef);
+			s1 = _mm_add_epi32 (s1, cdgh);
+		}
+		t = _mm_shuffle_epi32 (s0, 0x1B); // FEBA
+		s1 = _mm_shuffle_epi32 (s1, 0xB1); // DCHG
+		_mm_storeu_si128 ((__m128i *)state, _mm_blend_epi16 (t, s1, 0xF0)); // DCBA
+		_mm_storeu_si128 ((__m128i *)(state + 4), _mm_alignr_epi8 (s1, t, 8)); // HGFE
+	}
+
+	__attribute__((target("avx")))
+	static void SHA256ZeroUpper ()
+	{
+		// SHA-NI has legacy SSE encoding only, and is very slow if upper halves of ymm are left dirty by someone else
+		_mm256_zeroupper ();
+	}
+
+	static void SHA256SHANI (const uint8_t * in, size_t len, uint8_t * out)
+	{
+		uint32_t state[8];
+		memcpy (state, SHA256_IV, 32);
+		size_t numFull = len/SHA256_BLOCK_SIZE;
+		if (numFull) SHA256BlocksSHANI (state, in, numFull);
+		uint8_t tail[2*SHA256_BLOCK_SIZE];
+		SHA256BlocksSHANI (state, tail, SHA256Pad (in, len, tail));
+		for (int i = 0; i < 8; i++)
+			htobe32buf (out + 4*i, state[i]);
+	}
+
+#define SHA256_ROTR8(x, n) _mm256_or_si256 (_mm256_srli_epi32 (x, n), _mm256_slli_epi32 (x, 32 - n))
+
+	__attribute__((target("avx2")))
+	static inline void SHA256Transpose8 (__m256i * r) // 8x8 of 32 bits
+	{
+		__m256i t0 = _mm256_unpacklo_epi32 (r[0], r[1]), t1 = _mm256_unpackhi_epi32 (r[0], r[1]);
+		__m256i t2 = _mm256_unpacklo_epi32 (r[2], r[3]), t3 = _mm256_unpackhi_epi32 (r[2], r[3]);
+		__m256i t4 = _mm256_unpacklo_epi32 (r[4], r[5]), t5 = _mm256_unpackhi_epi32 (r[4], r[5]);
+		__m256i t6 = _mm256_unpacklo_epi32 (r[6], r[7]), t7 = _mm256_unpackhi_epi32 (r[6], r[7]);
+		__m256i u0 = _mm256_unpacklo_epi64 (t0, t2), u1 = _mm256_unpackhi_epi64 (t0, t2);
+		__m256i u2 = _mm256_unpacklo_epi64 (t1, t3), u3 = _mm256_unpackhi_epi64 (t1, t3);
+		__m256i u4 = _mm256_unpacklo_epi64 (t4, t6), u5 = _mm256_unpackhi_epi64 (t4, t6);
+		__m256i u6 = _mm256_unpacklo_epi64 (t5, t7), u7 = _mm256_unpackhi_epi64 (t5, t7);
+		r[0] = _mm256_permute2x128_si256 (u0, u4, 0x20); r[4] = _mm256_permute2x128_si256 (u0, u4, 0x31);
+		r[1] = _mm256_permute2x128_si256 (u1, u5, 0x20); r[5] = _mm256_permute2x128_si256 (u1, u5, 0x31);
+		r[2] = _mm256_permute2x128_si256 (u2, u6, 0x20); r[6] = _mm256_permute2x128_si256 (u2, u6, 0x31);
+		r[3] = _mm256_permute2x128_si256 (u3, u7, 0x20); r[7] = _mm256_permute2x128_si256 (u3, u7, 0x31);
+	}
+
+	// up to 8 messages of same length, lane i hashes in[i]
+	__attribute__((target("avx2")))
+	static void SHA256x8AVX2 (const uint8_t * const * in, size_t len, uint8_t * const * out, size_t num)
+	{
+		const __m256i bswap = _mm256_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+			0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+		uint8_t tails[SHA256_BATCH_LANES][2*SHA256_BLOCK_SIZE];
+		const uint8_t * lanes[SHA256_BATCH_LANES];
+		size_t numTail = 0;
+		for (size_t i = 0; i < SHA256_BATCH_LANES; i++)
+		{
+			lanes[i] = in[i < num ? i : 0]; // spare lanes repeat first message
+			numTail = SHA256Pad (lanes[i], len, tails[i]);
+		}
+		size_t numFull = len/SHA256_BLOCK_SIZE;
+		__m256i s[8];
+		for (int i = 0; i < 8; i++)
+			s[i] = _mm256_set1_epi32 (SHA256_IV[i]);
+		for (size_t n = 0; n < numFull + numTail; n++)
+		{
+			__m256i w[16];
+			for (int half = 0; half < 2; half++)
+			{
+				for (size_t i = 0; i < SHA256_BATCH_LANES; i++)
+				{
+					const uint8_t * block = n < numFull ? lanes[i] + n*SHA256_BLOCK_SIZE : tails[i] + (n - numFull)*SHA256_BLOCK_SIZE;
+					w[half*8 + i] = _mm256_loadu_si256 ((const __m256i *)(block + 32*half));
+				}
+				SHA256Transpose8 (w + half*8);
+				for (int i = 0; i < 8; i++)
+					w[half*8 + i] = _mm256_shuffle_epi8 (w[half*8 + i], bswap);
+			}
+			__m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+			for (int t = 0; t < 64; t++)
+			{
+				if (t >= 16)
+				{
+					__m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+					__m256i s0 = _mm256_xor_si256 (_mm256_xor_si256 (SHA256_ROTR8 (w15, 7), SHA256_ROTR8 (w15, 18)), _mm256_srli_epi32 (w15, 3));
+					__m256i s1 = _mm256_xor_si256 (_mm256_xor_si256 (SHA256_ROTR8 (w2, 17), SHA256_ROTR8 (w2, 19)), _mm256_srli_epi32 (w2, 10));
+					w[t & 15] = _mm256_add_epi32 (_mm256_add_epi32 (w[t & 15], s0), _mm256_add_epi32 (w[(t - 7) & 15], s1));
+				}
+				__m256i S1 = _mm256_xor_si256 (_mm256_xor_si256 (SHA256_ROTR8 (e, 6), SHA256_ROTR8 (e, 11)), SHA256_ROTR8 (e, 25));
+				__m256i ch = _mm256_xor_si256 (_mm256_and_si256 (e, f), _mm256_andnot_si256 (e, g));
+				__m256i t1 = _mm256_add_epi32 (_mm256_add_epi32 (h, S1), _mm256_add_epi32 (ch,
+					_mm256_add_epi32 (_mm256_set1_epi32 (SHA256_K[t]), w[t & 15])));
+				__m256i S0 = _mm256_xor_si256 (_mm256_xor_si256 (SHA256_ROTR8 (a, 2), SHA256_ROTR8 (a, 13)), SHA256_ROTR8 (a, 22));
+				__m256i maj = _mm256_or_si256 (_mm256_and_si256 (a, b), _mm256_and_si256 (c, _mm256_or_si256 (a, b)));
+				h = g; g = f; f = e; e = _mm256_add_epi32 (d, t1);
+				d = c; c = b; b = a; a = _mm256_add_epi32 (t1, _mm256_add_epi32 (S0, maj));
+			}
+			s[0] = _mm256_add_epi32 (s[0], a); s[1] = _mm256_add_epi32 (s[1], b);
+			s[2] = _mm256_add_epi32 (s[2], c); s[3] = _mm256_add_epi32 (s[3], d);
+			s[4] = _mm256_add_epi32 (s[4], e); s[5] = _mm256_add_epi32 (s[5], f);
+			s[6] = _mm256_add_epi32 (s[6], g); s[7] = _mm256_add_epi32 (s[7], h);
+		}
+		// row i becomes digest of lane i
+		SHA256Transpose8 (s);
+		for (size_t i = 0; i < num; i++)
+			_mm256_storeu_si256 ((__m256i *)out[i], _mm256_shuffle_epi8 (s[i], bswap));
+	}
+#undef SHA256_ROTR8
+#endif
+
+	void SHA256Batch (const uint8_t * const * in, size_t len, uint8_t * const * out, size_t num)
+	{
+#ifdef SHA256_SIMD
+		if (dotnet::cpu::sha)
+		{
+			if (dotnet::cpu::avx) SHA256ZeroUpper ();
+			for (size_t i = 0; i < num; i++)
+				SHA256SHANI (in[i], len, out[i]);
+			return;
+		}
+		if (dotnet::cpu::avx2)
+		{
+			for (size_t i = 0; i < num; i += SHA256_BATCH_LANES)
+				SHA256x8AVX2 (in + i, len, out + i, num - i < SHA256_BATCH_LANES ? num - i : SHA256_BATCH_LANES);
+			return;
+		}
+#endif
+		for (size_t i = 0; i < num; i++)
+			SHA256 (in[i], len, out[i]);
+	}
+
+	void SHA256Batch (const uint8_t * in, size_t len, uint8_t * out, size_t num)
+	{
+		const uint8_t * bufs[SHA256_BATCH_LANES];
+		uint8_t * digests[SHA256_BATCH_LANES];
+		while (num > 0)
+		{
+			size_t n = num < SHA256_BATCH_LANES ? num : SHA256_BATCH_LANES;
+			for (size_t i = 0; i < n; i++)
+			{
+				bufs[i] = in + i*len;
+				digests[i] = out + i*SHA256_DIGEST_SIZE;
+			}
+			SHA256Batch (bufs, len, digests, n);
+			in += n*len; out += n*SHA256_DIGEST_SIZE; num -= n;
+		}
+	}
+
+	const char * GetSHA256BatchImplementation ()
+	{
+#ifdef SHA256_SIMD
+		if (dotnet::cpu::sha) return "SHA-NI";
+		if (dotnet::cpu::avx2) return "AVX2, 8 messages interleaved";
+#endif
+		return "OpenSSL";
+	}
+}
+}
@@ -0,0 +1,23 @@
+#ifndef LIBDOTNET_SHA256_H
+#define LIBDOTNET_SHA256_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace dotnet
+{
+namespace crypto
+{
+	const size_t SHA256_DIGEST_SIZE = 32;
+	const size_t SHA256_BATCH_LANES = 8; // messages hashed at once by AVX2
+
+	// out[i] = SHA256 (in[i], len) for num messages of same length
+	void SHA256Batch (const uint8_t * const * in, size_t len, uint8_t * const * out, size_t num);
+	// same for messages and digests laid out back to back
+	void SHA256Batch (const uint8_t * in, size_t len, uint8_t * out, size_t num);
+
+	const char * GetSHA256BatchImplementation ();
+}
+}
+
+#endif
@@ -1,5 +1,11 @@
 #include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <future>
 #include <boost/bind.hpp>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 #include "Log.h"
 #include "Timestamp.h"
 #include "RouterContext.h"
@@ -12,7 +18,7 @@ namespace transport
 {
 
 	SSUServer::SSUServer (const boost::asio::ip::address & addr, int port):
-		m_OnlyV6(true), m_IsRunning(false),
+		m_OnlyV6(true), m_IsRunning(false), m_IsRecreatingSockets (false),
 		m_Thread (nullptr), m_ThreadV6 (nullptr), m_ReceiversThread (nullptr),
 		m_ReceiversThreadV6 (nullptr), m_Work (m_Service), m_WorkV6 (m_ServiceV6),
 		m_ReceiversWork (m_ReceiversService), m_ReceiversWorkV6 (m_ReceiversServiceV6),
@@ -24,8 +30,8 @@ namespace transport
 		OpenSocketV6 ();
 	}
 
-	SSUServer::SSUServer (int port):
-		m_OnlyV6(false), m_IsRunning(false),
+	SSUServer::SSUServer (int port, int numThreads):
+		m_OnlyV6(false), m_IsRunning(false), m_IsRecreatingSockets (false),
 		m_Thread (nullptr), m_ThreadV6 (nullptr), m_ReceiversThread (nullptr),
 		m_ReceiversThreadV6 (nullptr), 	m_Work (m_Service), m_WorkV6 (m_ServiceV6),
 		m_ReceiversWork (m_ReceiversService), m_ReceiversWorkV6 (m_ReceiversServiceV6),
@@ -34,13 +40,40 @@ namespace transport
 		m_IntroducersUpdateTimer (m_Service), m_PeerTestsCleanupTimer (m_Service),
 		m_TerminationTimer (m_Service), m_TerminationTimerV6 (m_ServiceV6)
 	{
+		if (!numThreads) numThreads = std::thread::hardware_concurrency ();
+		if (numThreads > SSU_MAX_NUM_THREADS) numThreads = SSU_MAX_NUM_THREADS;
+#ifdef SSU_USE_MMSG
+		for (int i = 1; i < numThreads; i++)
+			m_Shards.emplace_back (new Shard ());
+#else
+		if (numThreads > 1)
+			LogPrint (eLogWarning, "SSU: multiple threads are not supported on this platform");
+#endif
 		OpenSocket ();
+#ifdef SSU_USE_MMSG
+		// sockets join reuseport group in order of shards
+		for (auto& it: m_Shards)
+			OpenShardSocket (it.get ());
+		if (!m_Shards.empty ())
+			AttachShardsFilter ();
+#endif
 		if (context.SupportsV6 ())
 			OpenSocketV6 ();
 	}
 
 	SSUServer::~SSUServer ()
 	{
+#ifdef SSU_USE_MMSG
+		std::vector<MMsgBuffers *> mmsgs{ &m_MMsg, &m_MMsgV6 };
+		for (auto& it: m_Shards)
+			mmsgs.push_back (&it->mmsg);
+		for (auto mmsg: mmsgs)
+		{
+			for (auto packet: mmsg->packets)
+				if (packet) m_PacketsPool.ReleaseMt (packet);
+			m_PacketsPool.ReleaseMt (mmsg->sendQueue);
+		}
+#endif
 	}
 
 	void SSUServer::OpenSocket ()
@@ -48,9 +81,110 @@ namespace transport
 		m_Socket.open (boost::asio::ip::udp::v4());
 		m_Socket.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
 		m_Socket.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
+#ifdef SSU_USE_MMSG
+		if (!m_Shards.empty ())
+		{
+			int one = 1;
+			setsockopt (m_Socket.native_handle (), SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one));
+		}
+#endif
 		m_Socket.bind (m_Endpoint);
 	}
 
+#ifdef SSU_USE_MMSG
+	void SSUServer::OpenShardSocket (Shard * shard)
+	{
+		shard->socket.open (boost::asio::ip::udp::v4());
+		shard->socket.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
+		shard->socket.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
+		int one = 1;
+		setsockopt (shard->socket.native_handle (), SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one));
+		shard->socket.bind (m_Endpoint);
+	}
+
+	void SSUServer::AttachShardsFilter ()
+	{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+		// kernel picks socket (source address ^ source port) % number of sockets, same as GetShard
+		// so packets don't have to be passed between threads
+		struct sock_filter code[] =
+		{
+			{ BPF_LDX | BPF_B | BPF_MSH, 0, 0, (uint32_t)SKF_NET_OFF }, // X = IP header length
+			{ BPF_LD | BPF_H | BPF_IND, 0, 0, (uint32_t)SKF_NET_OFF }, // A = source port
+			{ BPF_MISC | BPF_TAX, 0, 0, 0 },
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)SKF_NET_OFF + 12 }, // A = source address
+			{ BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)m_Shards.size () + 1 },
+			{ BPF_RET | BPF_A, 0, 0, 0 }
+		};
+		struct sock_fprog prog = { sizeof (code)/sizeof (code[0]), code };
+		if (setsockopt (m_Socket.native_handle (), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof (prog)) < 0)
+			LogPrint (eLogWarning, "SSU: can't attach reuseport filter: ", strerror (errno));
+#endif
+	}
+
+	void SSUServer::RecreateSockets ()
+	{
+		// filter picks sockets by their order in reuseport group, and reopened socket would join it last,
+		// so all v4 sockets are reopened in original order and filter is attached to new group
+		LogPrint (eLogInfo, "SSU: reopening ", m_Shards.size () + 1, " v4 sockets");
+		boost::system::error_code ec;
+		m_Socket.close (ec);
+		for (auto& it: m_Shards)
+		{
+			auto shard = it.get ();
+			if (!RunInShard (shard, [shard]() { boost::system::error_code ec; shard->socket.close (ec); }))
+			{
+				m_IsRecreatingSockets = false; // stopping
+				return;
+			}
+		}
+		try
+		{
+			OpenSocket ();
+		}
+		catch (std::exception& ex)
+		{
+			LogPrint (eLogError, "SSU: can't reopen socket: ", ex.what ());
+			m_IsRecreatingSockets = false;
+			return;
+		}
+		for (auto& it: m_Shards)
+		{
+			auto shard = it.get ();
+			if (!RunInShard (shard, [this, shard]() { OpenShardSocket (shard); ReceiveShard (shard); }))
+			{
+				m_IsRecreatingSockets = false; // stopping
+				return;
+			}
+		}
+		AttachShardsFilter ();
+		Receive ();
+		m_IsRecreatingSockets = false; // new errors from now on need another pass
+	}
+
+	bool SSUServer::RunInShard (Shard * shard, std::function<void()> f)
+	{
+		auto done = std::make_shared<std::promise<void> > ();
+		auto future = done->get_future ();
+		shard->service.post ([f, done]()
+			{
+				try
+				{
+					f ();
+				}
+				catch (std::exception& ex)
+				{
+					LogPrint (eLogError, "SSU: shard exception: ", ex.what ());
+				}
+				done->set_value ();
+			});
+		while (future.wait_for (std::chrono::milliseconds (100)) != std::future_status::ready)
+			if (!m_IsRunning) return false;
+		return true;
+	}
+#endif
+
 	void SSUServer::OpenSocketV6 ()
 	{
 		m_SocketV6.open (boost::asio::ip::udp::v6());
@@ -69,6 +203,17 @@ namespace transport
 			m_Thread = new std::thread (std::bind (&SSUServer::Run, this));
 			m_ReceiversService.post (std::bind (&SSUServer::Receive, this));
 			ScheduleTermination ();
+#ifdef SSU_USE_MMSG
+			for (auto& it: m_Shards)
+			{
+				auto shard = it.get ();
+				shard->thread = new std::thread (std::bind (&SSUServer::RunShard, this, shard));
+				shard->service.post (std::bind (&SSUServer::ReceiveShard, this, shard));
+				ScheduleShardTermination (shard);
+			}
+			if (!m_Shards.empty ())
+				LogPrint (eLogInfo, "SSU: v4 sessions run in ", m_Shards.size () + 1, " threads");
+#endif
 		}
 		if (context.SupportsV6 ())
 		{
@@ -88,11 +233,14 @@ namespace transport
 		m_TerminationTimer.cancel ();
 		m_TerminationTimerV6.cancel ();
 		m_Service.stop ();
-		m_Socket.close ();
 		m_ServiceV6.stop ();
-		m_SocketV6.close ();
 		m_ReceiversService.stop ();
 		m_ReceiversServiceV6.stop ();
+		for (auto& it: m_Shards)
+		{
+			it->terminationTimer.cancel ();
+			it->service.stop ();
+		}
 		if (m_ReceiversThread)
 		{
 			m_ReceiversThread->join ();
@@ -117,6 +265,24 @@ namespace transport
 			delete m_ThreadV6;
 			m_ThreadV6 = nullptr;
 		}
+		for (auto& it: m_Shards)
+			if (it->thread)
+			{
+				it->thread->join ();
+				delete it->thread;
+				it->thread = nullptr;
+			}
+#ifdef SSU_USE_MMSG
+		// send what is left, SessionDestroyed for example
+		FlushSendQueue (&m_Socket, &m_MMsg);
+		FlushSendQueue (&m_SocketV6, &m_MMsgV6);
+		for (auto& it: m_Shards)
+			FlushSendQueue (&it->socket, &it->mmsg);
+#endif
+		m_Socket.close ();
+		m_SocketV6.close ();
+		for (auto& it: m_Shards)
+			it->socket.close ();
 	}
 
 	void SSUServer::Run ()
@@ -179,18 +345,38 @@ namespace transport
 		}
 	}
 
+#ifdef SSU_USE_MMSG
+	void SSUServer::RunShard (Shard * shard)
+	{
+		while (m_IsRunning)
+		{
+			try
+			{
+				shard->service.run ();
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "SSU: shard runtime exception: ", ex.what ());
+			}
+		}
+	}
+#endif
+
 	void SSUServer::AddRelay (uint32_t tag, std::shared_ptr<SSUSession> relay)
 	{
+		std::lock_guard<std::mutex> l(m_RelaysMutex);
 		m_Relays[tag] = relay;
 	}
 
 	void SSUServer::RemoveRelay (uint32_t tag)
 	{
+		std::lock_guard<std::mutex> l(m_RelaysMutex);
 		m_Relays.erase (tag);
 	}
 
 	std::shared_ptr<SSUSession> SSUServer::FindRelaySession (uint32_t tag)
 	{
+		std::lock_guard<std::mutex> l(m_RelaysMutex);
 		auto it = m_Relays.find (tag);
 		if (it != m_Relays.end ())
 		{
@@ -204,26 +390,230 @@ namespace transport
 
 	void SSUServer::Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to)
 	{
+#ifdef SSU_USE_MMSG
+		if (len > SSU_MTU_V6 + 18)
+		{
+			LogPrint (eLogError, "SSU: packet of ", len, " bytes to ", to, " exceeds MTU, dropped");
+			return;
+		}
+		// queue copy, all packets queued by current handler are sent by one sendmmsg
+		auto packet = m_PacketsPool.AcquireMt ();
+		memcpy (packet->buf, buf, len);
+		packet->len = len;
+		packet->from = to;
+		bool v6 = to.protocol () != boost::asio::ip::udp::v4();
+		auto shard = GetShard (to);
+		auto& socket = v6 ? m_SocketV6 : (shard ? shard->socket : m_Socket);
+		auto& mmsg = v6 ? m_MMsgV6 : (shard ? shard->mmsg : m_MMsg);
+		bool flush;
+		{
+			std::lock_guard<std::mutex> l(mmsg.sendQueueMutex);
+			mmsg.sendQueue.push_back (packet);
+			flush = mmsg.sendQueue.size () == 1;
+		}
+		if (flush) // in thread of session
+			GetSessionService (to).post (std::bind (&SSUServer::FlushSendQueue, this, &socket, &mmsg));
+#else
 		if (to.protocol () == boost::asio::ip::udp::v4())
 			m_Socket.send_to (boost::asio::buffer (buf, len), to);
 		else
 			m_SocketV6.send_to (boost::asio::buffer (buf, len), to);
+#endif
 	}
 
 	void SSUServer::Receive ()
 	{
-		SSUPacket * packet = new SSUPacket ();
+#ifdef SSU_USE_MMSG
+		m_Socket.async_receive (boost::asio::null_buffers (),
+			std::bind (&SSUServer::HandleReceivedBatch, this, std::placeholders::_1, false));
+#else
+		SSUPacket * packet = m_PacketsPool.AcquireMt ();
 		m_Socket.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from,
 			std::bind (&SSUServer::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, packet));
+#endif
 	}
 
 	void SSUServer::ReceiveV6 ()
 	{
-		SSUPacket * packet = new SSUPacket ();
+#ifdef SSU_USE_MMSG
+		m_SocketV6.async_receive (boost::asio::null_buffers (),
+			std::bind (&SSUServer::HandleReceivedBatch, this, std::placeholders::_1, true));
+#else
+		SSUPacket * packet = m_PacketsPool.AcquireMt ();
 		m_SocketV6.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from,
 			std::bind (&SSUServer::HandleReceivedFromV6, this, std::placeholders::_1, std::placeholders::_2, packet));
+#endif
+	}
+
+#ifdef SSU_USE_MMSG
+	void SSUServer::ReceiveBatch (boost::asio::ip::udp::socket& socket, MMsgBuffers& mmsg, size_t mtu, std::vector<SSUPacket *>& packets)
+	{
+		// socket is readable, take as many datagrams as we can at once
+		for (size_t i = 0; i < SSU_MAX_NUM_RECEIVED_PACKETS; i++)
+		{
+			if (!mmsg.packets[i]) mmsg.packets[i] = m_PacketsPool.AcquireMt ();
+			mmsg.iovs[i].iov_base = mmsg.packets[i]->buf;
+			mmsg.iovs[i].iov_len = mtu;
+			auto& hdr = mmsg.msgs[i].msg_hdr;
+			memset (&hdr, 0, sizeof (hdr));
+			hdr.msg_name = mmsg.packets[i]->from.data ();
+			hdr.msg_namelen = mmsg.packets[i]->from.capacity ();
+			hdr.msg_iov = mmsg.iovs + i;
+			hdr.msg_iovlen = 1;
+		}
+		int num = recvmmsg (socket.native_handle (), mmsg.msgs, SSU_MAX_NUM_RECEIVED_PACKETS, MSG_DONTWAIT, nullptr);
+		if (num > 0)
+		{
+			packets.resize (num);
+			for (int i = 0; i < num; i++)
+			{
+				auto packet = mmsg.packets[i];
+				packet->len = mmsg.msgs[i].msg_len;
+				packet->from.resize (mmsg.msgs[i].msg_hdr.msg_namelen);
+				packets[i] = packet;
+				mmsg.packets[i] = nullptr; // released by HandleReceivedPackets
+			}
+		}
+		else if (num < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			LogPrint (eLogError, "SSU: recvmmsg error: ", strerror (errno));
 	}
 
+	void SSUServer::HandleReceivedBatch (const boost::system::error_code& ecode, bool v6)
+	{
+		auto& socket = v6 ? m_SocketV6 : m_Socket;
+		if (ecode)
+		{
+			if (ecode != boost::asio::error::operation_aborted)
+			{
+				LogPrint (eLogError, "SSU: ", v6 ? "v6 " : "", "receive error: ", ecode.message ());
+				socket.close ();
+				if (v6)
+				{
+					OpenSocketV6 ();
+					ReceiveV6 ();
+				}
+				else if (!m_Shards.empty ())
+				{
+					if (!m_IsRecreatingSockets.exchange (true))
+						RecreateSockets ();
+				}
+				else
+				{
+					OpenSocket ();
+					Receive ();
+				}
+			}
+			return;
+		}
+		std::vector<SSUPacket *> packets;
+		ReceiveBatch (socket, v6 ? m_MMsgV6 : m_MMsg, v6 ? SSU_MTU_V6 : SSU_MTU_V4, packets);
+		if (!packets.empty ())
+		{
+			if (v6)
+				m_ServiceV6.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_SessionsV6));
+			else
+				DispatchReceivedPackets (packets, nullptr);
+		}
+		if (v6)
+			ReceiveV6 ();
+		else
+			Receive ();
+	}
+
+	void SSUServer::DispatchReceivedPackets (std::vector<SSUPacket *>& packets, Shard * current)
+	{
+		if (m_Shards.empty ())
+		{
+			m_Service.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_Sessions));
+			return;
+		}
+		// every remote endpoint belongs to one thread, socket it came to doesn't matter
+		std::vector<std::vector<SSUPacket *> > shardPackets (m_Shards.size () + 1);
+		for (auto packet: packets)
+			shardPackets[GetShardIndex (packet->from)].push_back (packet);
+		for (size_t i = 0; i < shardPackets.size (); i++)
+		{
+			if (shardPackets[i].empty ()) continue;
+			auto shard = i ? m_Shards[i - 1].get () : nullptr;
+			if (shard && shard == current) // we are in its thread already
+				HandleReceivedPackets (shardPackets[i], &shard->sessions);
+			else if (shard)
+				shard->service.post (std::bind (&SSUServer::HandleReceivedPackets, this, shardPackets[i], &shard->sessions));
+			else
+				m_Service.post (std::bind (&SSUServer::HandleReceivedPackets, this, shardPackets[i], &m_Sessions));
+		}
+	}
+
+	void SSUServer::ReceiveShard (Shard * shard)
+	{
+		shard->socket.async_receive (boost::asio::null_buffers (),
+			std::bind (&SSUServer::HandleReceivedShardBatch, this, std::placeholders::_1, shard));
+	}
+
+	void SSUServer::HandleReceivedShardBatch (const boost::system::error_code& ecode, Shard * shard)
+	{
+		if (ecode)
+		{
+			if (ecode != boost::asio::error::operation_aborted)
+			{
+				LogPrint (eLogError, "SSU: shard receive error: ", ecode.message ());
+				if (!m_IsRecreatingSockets.exchange (true)) // other shards might fail at the same time
+					m_ReceiversService.post (std::bind (&SSUServer::RecreateSockets, this)); // in thread of main socket
+			}
+			return;
+		}
+		std::vector<SSUPacket *> packets;
+		ReceiveBatch (shard->socket, shard->mmsg, SSU_MTU_V4, packets);
+		if (!packets.empty ())
+			DispatchReceivedPackets (packets, shard);
+		ReceiveShard (shard);
+	}
+
+	void SSUServer::FlushSendQueue (boost::asio::ip::udp::socket * socket, MMsgBuffers * mmsg)
+	{
+		{
+			std::lock_guard<std::mutex> l(mmsg->sendQueueMutex);
+			mmsg->sending.swap (mmsg->sendQueue); // both keep their capacity
+		}
+		auto& packets = mmsg->sending;
+		mmsghdr msgs[SSU_MAX_NUM_SENT_PACKETS];
+		iovec iovs[SSU_MAX_NUM_SENT_PACKETS];
+		size_t offset = 0;
+		while (offset < packets.size () && socket->is_open ())
+		{
+			size_t num = std::min (packets.size () - offset, SSU_MAX_NUM_SENT_PACKETS);
+			for (size_t i = 0; i < num; i++)
+			{
+				auto packet = packets[offset + i];
+				iovs[i].iov_base = packet->buf;
+				iovs[i].iov_len = packet->len;
+				auto& hdr = msgs[i].msg_hdr;
+				memset (&hdr, 0, sizeof (hdr));
+				hdr.msg_name = packet->from.data ();
+				hdr.msg_namelen = packet->from.size ();
+				hdr.msg_iov = iovs + i;
+				hdr.msg_iovlen = 1;
+			}
+			int sent = sendmmsg (socket->native_handle (), msgs, num, 0);
+			if (sent < 0)
+			{
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				{
+					// socket is non-blocking and its buffer is full, the rest would fail the same way
+					LogPrint (eLogDebug, "SSU: send buffer is full, ", packets.size () - offset, " packets dropped");
+					break;
+				}
+				LogPrint (eLogError, "SSU: sendmmsg error: ", strerror (errno));
+				sent = 1; // drop the packet that failed, try the rest
+			}
+			offset += sent;
+		}
+		m_PacketsPool.ReleaseMt (packets);
+		packets.clear ();
+	}
+#endif
+
 	void SSUServer::HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet)
 	{
 		if (!ecode)
@@ -238,7 +628,7 @@ namespace transport
 			{
 				while (moreBytes && packets.size () < 25)
 				{
-					packet = new SSUPacket ();
+					packet = m_PacketsPool.AcquireMt ();
 					packet->len = m_Socket.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from, 0, ec);
 					if (!ec)
 					{
@@ -249,7 +639,7 @@ namespace transport
 					else
 					{
 						LogPrint (eLogError, "SSU: receive_from error: ", ec.message ());
-						delete packet;
+						m_PacketsPool.ReleaseMt (packet);
 						break;
 					}
 				}
@@ -260,7 +650,7 @@ namespace transport
 		}
 		else
 		{
-			delete packet;
+			m_PacketsPool.ReleaseMt (packet);
 			if (ecode != boost::asio::error::operation_aborted)
 			{
 				LogPrint (eLogError, "SSU: receive error: ", ecode.message ());
@@ -285,7 +675,7 @@ namespace transport
 			{
 				while (moreBytes && packets.size () < 25)
 				{
-					packet = new SSUPacket ();
+					packet = m_PacketsPool.AcquireMt ();
 					packet->len = m_SocketV6.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from, 0, ec);
 					if (!ec)
 					{
@@ -296,7 +686,7 @@ namespace transport
 					else
 					{
 						LogPrint (eLogError, "SSU: v6 receive_from error: ", ec.message ());
-						delete packet;
+						m_PacketsPool.ReleaseMt (packet);
 						break;
 					}
 				}
@@ -307,7 +697,7 @@ namespace transport
 		}
 		else
 		{
-			delete packet;
+			m_PacketsPool.ReleaseMt (packet);
 			if (ecode != boost::asio::error::operation_aborted)
 			{
 				LogPrint (eLogError, "SSU: v6 receive error: ", ecode.message ());
@@ -333,14 +723,16 @@ namespace transport
 						session->FlushData (); 
 						session = nullptr; 
 					}
+					std::unique_lock<std::mutex> l(GetSessionsMutex (packet->from));
 					auto it = sessions->find (packet->from);
 					if (it != sessions->end ())
 						session = it->second;
 					if (!session)
 					{
 						session = std::make_shared<SSUSession> (*this, packet->from);
-						session->WaitForConnect ();
 						(*sessions)[packet->from] = session;
+						l.unlock ();
+						session->WaitForConnect ();
 						LogPrint (eLogDebug, "SSU: new session from ", packet->from.address ().to_string (), ":", packet->from.port (), " created");
 					}
 				}
@@ -352,8 +744,8 @@ namespace transport
 				if (session) session->FlushData ();
 				session = nullptr;
 			}
-			delete packet;
 		}
+		m_PacketsPool.ReleaseMt (packets);
 		if (session) session->FlushData ();
 	}
 
@@ -373,7 +765,9 @@ namespace transport
 
 	std::shared_ptr<SSUSession> SSUServer::FindSession (const boost::asio::ip::udp::endpoint& e) const
 	{
-		auto& sessions = e.address ().is_v6 () ?  m_SessionsV6 : m_Sessions;
+		auto shard = GetShard (e);
+		auto& sessions = e.address ().is_v6 () ? m_SessionsV6 : (shard ? shard->sessions : m_Sessions);
+		std::lock_guard<std::mutex> l(GetSessionsMutex (e));
 		auto it = sessions.find (e);
 		if (it != sessions.end ())
 			return it->second;
@@ -381,6 +775,67 @@ namespace transport
 			return nullptr;
 	}
 
+	size_t SSUServer::GetShardIndex (const boost::asio::ip::udp::endpoint& ep) const
+	{
+		if (m_Shards.empty () || !ep.address ().is_v4 ()) return 0;
+		// must match reuseport filter
+		return (ep.address ().to_v4 ().to_ulong () ^ ep.port ()) % (m_Shards.size () + 1);
+	}
+
+	SSUServer::Shard * SSUServer::GetShard (const boost::asio::ip::udp::endpoint& ep) const
+	{
+		auto ind = GetShardIndex (ep);
+		return ind ? m_Shards[ind - 1].get () : nullptr;
+	}
+
+	SSUServer::SessionsMap& SSUServer::GetSessionsMap (const boost::asio::ip::udp::endpoint& ep)
+	{
+		if (ep.address ().is_v6 ()) return m_SessionsV6;
+		auto shard = GetShard (ep);
+		return shard ? shard->sessions : m_Sessions;
+	}
+
+	std::mutex& SSUServer::GetSessionsMutex (const boost::asio::ip::udp::endpoint& ep) const
+	{
+		auto shard = GetShard (ep);
+		return shard ? shard->sessionsMutex : m_SessionsMutex;
+	}
+
+	boost::asio::io_service& SSUServer::GetSessionService (const boost::asio::ip::udp::endpoint& ep)
+	{
+		if (ep.address ().is_v6 ()) return m_ServiceV6;
+		auto shard = GetShard (ep);
+		return shard ? shard->service : m_Service;
+	}
+
+	void SSUServer::AddSession (std::shared_ptr<SSUSession> session)
+	{
+		auto& ep = session->GetRemoteEndpoint ();
+		std::lock_guard<std::mutex> l(GetSessionsMutex (ep));
+		GetSessionsMap (ep)[ep] = session;
+	}
+
+	SSUServer::SessionsMap SSUServer::GetSessions () const
+	{
+		SessionsMap sessions;
+		{
+			std::lock_guard<std::mutex> l(m_SessionsMutex);
+			sessions = m_Sessions;
+		}
+		for (auto& it: m_Shards)
+		{
+			std::lock_guard<std::mutex> l(it->sessionsMutex);
+			sessions.insert (it->sessions.begin (), it->sessions.end ());
+		}
+		return sessions;
+	}
+
+	SSUServer::SessionsMap SSUServer::GetSessionsV6 () const
+	{
+		std::lock_guard<std::mutex> l(m_SessionsMutex);
+		return m_SessionsV6;
+	}
+
 	void SSUServer::CreateSession (std::shared_ptr<const dotnet::data::RouterInfo> router, bool peerTest, bool v4only)
 	{
 		auto address = router->GetSSUAddress (v4only || !context.SupportsV6 ());
@@ -400,27 +855,24 @@ namespace transport
 			else
 			{
 				boost::asio::ip::udp::endpoint remoteEndpoint (addr, port);
-				auto& s = addr.is_v6 () ? m_ServiceV6 : m_Service;
-				s.post (std::bind (&SSUServer::CreateDirectSession, this, router, remoteEndpoint, peerTest));
+				GetSessionService (remoteEndpoint).post (std::bind (&SSUServer::CreateDirectSession, this, router, remoteEndpoint, peerTest));
 			}
 		}
 	}
 
 	void SSUServer::CreateDirectSession (std::shared_ptr<const dotnet::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest)
 	{
-		auto& sessions = remoteEndpoint.address ().is_v6 () ? m_SessionsV6 : m_Sessions;
-		auto it = sessions.find (remoteEndpoint);
-		if (it != sessions.end ())
+		auto session = FindSession (remoteEndpoint);
+		if (session)
 		{
-			auto session = it->second;
 			if (peerTest && session->GetState () == eSessionStateEstablished)
 				session->SendPeerTest ();
 		}
 		else
 		{
 			// otherwise create new session
-			auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-			sessions[remoteEndpoint] = session;
+			session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
+			AddSession (session);
 			// connect
 			LogPrint (eLogDebug, "SSU: Creating new session to [", dotnet::data::GetIdentHashAbbreviation (router->GetIdentHash ()), "] ",
 				remoteEndpoint.address ().to_string (), ":", remoteEndpoint.port ());
@@ -436,13 +888,17 @@ namespace transport
 			if (address)
 			{
 				boost::asio::ip::udp::endpoint remoteEndpoint (address->host, address->port);
-				auto it = m_Sessions.find (remoteEndpoint);
+				auto existing = FindSession (remoteEndpoint);
 				// check if session is presented already
-				if (it != m_Sessions.end ())
+				if (existing)
 				{
-					auto session = it->second;
-					if (peerTest && session->GetState () == eSessionStateEstablished)
-						session->SendPeerTest ();
+					if (peerTest)
+						GetSessionService (remoteEndpoint).post ([existing]()
+							{
+								// state is checked in session's thread
+								if (existing->GetState () == eSessionStateEstablished)
+									existing->SendPeerTest ();
+							});
 					return;
 				}
 				// create new session
@@ -461,12 +917,8 @@ namespace transport
 						if (ep.address ().is_v4 ()) // ipv4 only
 						{
 							if (!introducer) introducer = intr; // we pick first one for now
-							it = m_Sessions.find (ep);
-							if (it != m_Sessions.end ())
-							{
-								introducerSession = it->second;
-								break;
-							}
+							introducerSession = FindSession (ep);
+							if (introducerSession) break;
 						}
 					}
 					if (!introducer)
@@ -482,7 +934,7 @@ namespace transport
 						LogPrint (eLogDebug, "SSU: Creating new session to introducer ", introducer->iHost);
 						boost::asio::ip::udp::endpoint introducerEndpoint (introducer->iHost, introducer->iPort);
 						introducerSession = std::make_shared<SSUSession> (*this, introducerEndpoint, router);
-						m_Sessions[introducerEndpoint] = introducerSession;
+						AddSession (introducerSession);
 					}
 #if BOOST_VERSION >= 104900
 					if (!address->host.is_unspecified () && address->port)
@@ -490,19 +942,19 @@ namespace transport
 					{
 						// create session
 						auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-						m_Sessions[remoteEndpoint] = session;
+						AddSession (session);
 
 						// introduce
 						LogPrint (eLogInfo, "SSU: Introduce new session to [", dotnet::data::GetIdentHashAbbreviation (router->GetIdentHash ()),
 								"] through introducer ", introducer->iHost, ":", introducer->iPort);
-						session->WaitForIntroduction ();
+						GetSessionService (remoteEndpoint).post (std::bind (&SSUSession::WaitForIntroduction, session)); // in session's thread
 						if (dotnet::context.GetRouterInfo ().UsesIntroducer ()) // if we are unreachable
 						{
 							uint8_t buf[1];
 							Send (buf, 0, remoteEndpoint); // send HolePunch
 						}
 					}
-					introducerSession->Introduce (*introducer, router);
+					GetSessionService (introducerSession->GetRemoteEndpoint ()).post (std::bind (&SSUSession::Introduce, introducerSession, *introducer, router));
 				}
 				else
 					LogPrint (eLogWarning, "SSU: Can't connect to unreachable router and no introducers present");
@@ -514,33 +966,45 @@ namespace transport
 
 	void SSUServer::DeleteSession (std::shared_ptr<SSUSession> session)
 	{
-		if (session)
-		{
-			session->Close ();
-			auto& ep = session->GetRemoteEndpoint ();
-			if (ep.address ().is_v6 ())
-				m_SessionsV6.erase (ep);
-			else
-				m_Sessions.erase (ep);
-		}
+		if (!session) return;
+		// inline if called from session's thread, posted from other threads (Transports)
+		GetSessionService (session->GetRemoteEndpoint ()).dispatch ([this, session]()
+			{
+				session->Close ();
+				auto& ep = session->GetRemoteEndpoint ();
+				std::lock_guard<std::mutex> l(GetSessionsMutex (ep));
+				auto& sessions = GetSessionsMap (ep);
+				auto it = sessions.find (ep);
+				if (it != sessions.end () && it->second == session) // might be replaced meanwhile
+					sessions.erase (it);
+			});
 	}
 
 	void SSUServer::DeleteAllSessions ()
 	{
-		for (auto& it: m_Sessions)
+		SessionsMap sessions, sessionsV6;
+		{
+			std::lock_guard<std::mutex> l(m_SessionsMutex);
+			m_Sessions.swap (sessions);
+			m_SessionsV6.swap (sessionsV6);
+		}
+		for (auto& it: m_Shards)
+		{
+			std::lock_guard<std::mutex> l(it->sessionsMutex);
+			sessions.insert (it->sessions.begin (), it->sessions.end ());
+			it->sessions.clear ();
+		}
+		for (auto& it: sessions)
 			it.second->Close ();
-		m_Sessions.clear ();
-
-		for (auto& it: m_SessionsV6)
+		for (auto& it: sessionsV6)
 			it.second->Close ();
-		m_SessionsV6.clear ();
 	}
 
 	template<typename Filter>
 	std::shared_ptr<SSUSession> SSUServer::GetRandomV4Session (Filter filter) // v4 only
 	{
 		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_Sessions)
+		for (const auto& s: GetSessions ()) // from all threads
 			if (filter (s.second)) filteredSessions.push_back (s.second);
 		if (filteredSessions.size () > 0)
 		{
@@ -564,7 +1028,7 @@ namespace transport
 	std::shared_ptr<SSUSession> SSUServer::GetRandomV6Session (Filter filter) // v6 only
 	{
 		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_SessionsV6)
+		for (const auto& s: GetSessionsV6 ())
 			if (filter (s.second)) filteredSessions.push_back (s.second);
 		if (filteredSessions.size () > 0)
 		{
@@ -636,7 +1100,7 @@ namespace transport
 				auto session = FindSession (it);
 				if (session && ts < session->GetCreationTime () + SSU_TO_INTRODUCER_SESSION_DURATION)
 				{
-					session->SendKeepAlive ();
+					GetSessionService (it).post (std::bind (&SSUSession::SendKeepAlive, session)); // in session's thread
 					newList.push_back (it);
 					numIntroducers++;
 				}
@@ -676,11 +1140,13 @@ namespace transport
 
 	void SSUServer::NewPeerTest (uint32_t nonce, PeerTestParticipant role, std::shared_ptr<SSUSession> session)
 	{
+		std::lock_guard<std::mutex> l(m_PeerTestsMutex);
 		m_PeerTests[nonce] = { dotnet::util::GetMillisecondsSinceEpoch (), role, session };
 	}
 
 	PeerTestParticipant SSUServer::GetPeerTestParticipant (uint32_t nonce)
 	{
+		std::lock_guard<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			return it->second.role;
@@ -690,6 +1156,7 @@ namespace transport
 
 	std::shared_ptr<SSUSession> SSUServer::GetPeerTestSession (uint32_t nonce)
 	{
+		std::lock_guard<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			return it->second.session;
@@ -699,6 +1166,7 @@ namespace transport
 
 	void SSUServer::UpdatePeerTest (uint32_t nonce, PeerTestParticipant role)
 	{
+		std::lock_guard<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			it->second.role = role;
@@ -706,6 +1174,7 @@ namespace transport
 
 	void SSUServer::RemovePeerTest (uint32_t nonce)
 	{
+		std::lock_guard<std::mutex> l(m_PeerTestsMutex);
 		m_PeerTests.erase (nonce);
 	}
 
@@ -722,6 +1191,7 @@ namespace transport
 		{
 			int numDeleted = 0;
 			uint64_t ts = dotnet::util::GetMillisecondsSinceEpoch ();
+			std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 			for (auto it = m_PeerTests.begin (); it != m_PeerTests.end ();)
 			{
 				if (ts > it->second.creationTime + SSU_PEER_TEST_TIMEOUT*1000LL)
@@ -732,6 +1202,7 @@ namespace transport
 				else
 					++it;
 			}
+			l.unlock ();
 			if (numDeleted > 0)
 				LogPrint (eLogDebug, "SSU: ", numDeleted, " peer tests have been expired");
 			SchedulePeerTestsCleanupTimer ();
@@ -750,6 +1221,7 @@ namespace transport
 		if (ecode != boost::asio::error::operation_aborted)
 		{
 			auto ts = dotnet::util::GetSecondsSinceEpoch ();
+			std::lock_guard<std::mutex> l(m_SessionsMutex);
 			for (auto& it: m_Sessions)
 				if (it.second->IsTerminationTimeoutExpired (ts))
 				{
@@ -778,6 +1250,7 @@ namespace transport
 		if (ecode != boost::asio::error::operation_aborted)
 		{
 			auto ts = dotnet::util::GetSecondsSinceEpoch ();
+			std::lock_guard<std::mutex> l(m_SessionsMutex);
 			for (auto& it: m_SessionsV6)
 				if (it.second->IsTerminationTimeoutExpired (ts))
 				{
@@ -793,6 +1266,34 @@ namespace transport
 			ScheduleTerminationV6 ();
 		}
 	}
+#ifdef SSU_USE_MMSG
+	void SSUServer::ScheduleShardTermination (Shard * shard)
+	{
+		shard->terminationTimer.expires_from_now (boost::posix_time::seconds(SSU_TERMINATION_CHECK_TIMEOUT));
+		shard->terminationTimer.async_wait (std::bind (&SSUServer::HandleShardTerminationTimer,
+			this, std::placeholders::_1, shard));
+	}
+
+	void SSUServer::HandleShardTerminationTimer (const boost::system::error_code& ecode, Shard * shard)
+	{
+		if (ecode != boost::asio::error::operation_aborted)
+		{
+			auto ts = dotnet::util::GetSecondsSinceEpoch ();
+			std::lock_guard<std::mutex> l(shard->sessionsMutex);
+			for (auto& it: shard->sessions)
+				if (it.second->IsTerminationTimeoutExpired (ts))
+				{
+					auto session = it.second;
+					shard->service.post ([session]
+						{
+							LogPrint (eLogWarning, "SSU: no activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
+							session->Failed ();
+						});
+				}
+			ScheduleShardTermination (shard);
+		}
+	}
+#endif
 }
 }
 
@@ -8,14 +8,24 @@
 #include <set>
 #include <thread>
 #include <mutex>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
 #include <boost/asio.hpp>
 #include "Crypto.h"
+#include "util.h"
 #include "DotNetEndian.h"
 #include "Identity.h"
 #include "RouterInfo.h"
 #include "DNNPProtocol.h"
 #include "SSUSession.h"
 
+#if defined(__linux__) && !defined(ANDROID)
+#include <sys/socket.h>
+#define SSU_USE_MMSG 1 // batch datagrams with recvmmsg/sendmmsg, SO_REUSEPORT shards
+#endif
+
 namespace dotnet
 {
 namespace transport
@@ -27,11 +37,14 @@ namespace transport
 	const size_t SSU_MAX_NUM_INTRODUCERS = 3;
 	const size_t SSU_SOCKET_RECEIVE_BUFFER_SIZE = 0x1FFFF; // 128K
 	const size_t SSU_SOCKET_SEND_BUFFER_SIZE = 0x1FFFF; // 128K
+	const size_t SSU_MAX_NUM_RECEIVED_PACKETS = 64; // per recvmmsg
+	const size_t SSU_MAX_NUM_SENT_PACKETS = 64; // per sendmmsg
+	const int SSU_MAX_NUM_THREADS = 64;
 
 	struct SSUPacket
 	{
 		dotnet::crypto::AESAlignedBuffer<SSU_MTU_V6 + 18> buf; // max MTU + iv + size
-		boost::asio::ip::udp::endpoint from;
+		boost::asio::ip::udp::endpoint from; // or destination of outgoing packet
 		size_t len;
 	};
 
@@ -39,7 +52,9 @@ namespace transport
 	{
 		public:
 
-			SSUServer (int port);
+			typedef std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > SessionsMap;
+
+			SSUServer (int port, int numThreads = 1); // 0 - thread per core, more than one on Linux only
 			SSUServer (const boost::asio::ip::address & addr, int port);			// ipv6 only constructor
 			~SSUServer ();
 			void Start ();
@@ -57,6 +72,8 @@ namespace transport
 
 			boost::asio::io_service& GetService () { return m_Service; };
 			boost::asio::io_service& GetServiceV6 () { return m_ServiceV6; };
+			boost::asio::io_service& GetSessionService (const boost::asio::ip::udp::endpoint& ep); // thread of session with ep
+			int GetNumThreads () const { return m_Shards.size () + 1; }; // v4
 			const boost::asio::ip::udp::endpoint& GetEndpoint () const { return m_Endpoint; };
 			void Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to);
 			void AddRelay (uint32_t tag, std::shared_ptr<SSUSession> relay);
@@ -71,6 +88,8 @@ namespace transport
 
 		private:
 
+			struct Shard;
+
 			void OpenSocket ();
 			void OpenSocketV6 ();
 			void Run ();
@@ -83,6 +102,29 @@ namespace transport
 			void HandleReceivedFromV6 (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet);
 			void HandleReceivedPackets (std::vector<SSUPacket *> packets,
 				std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions);
+			// sessions with v4 endpoints are spread between main thread and shards
+			size_t GetShardIndex (const boost::asio::ip::udp::endpoint& ep) const; // 0 - main thread, i - m_Shards[i-1]
+			Shard * GetShard (const boost::asio::ip::udp::endpoint& ep) const; // nullptr for main thread and v6
+			SessionsMap& GetSessionsMap (const boost::asio::ip::udp::endpoint& ep);
+			std::mutex& GetSessionsMutex (const boost::asio::ip::udp::endpoint& ep) const;
+			void AddSession (std::shared_ptr<SSUSession> session);
+#ifdef SSU_USE_MMSG
+			struct MMsgBuffers;
+			void ReceiveBatch (boost::asio::ip::udp::socket& socket, MMsgBuffers& mmsg, size_t mtu, std::vector<SSUPacket *>& packets);
+			void HandleReceivedBatch (const boost::system::error_code& ecode, bool v6);
+			void DispatchReceivedPackets (std::vector<SSUPacket *>& packets, Shard * current);
+			void FlushSendQueue (boost::asio::ip::udp::socket * socket, MMsgBuffers * mmsg);
+			// shards
+			void OpenShardSocket (Shard * shard);
+			void AttachShardsFilter ();
+			void RecreateSockets (); // whole reuseport group, in receivers thread, once per m_IsRecreatingSockets
+			bool RunInShard (Shard * shard, std::function<void()> f); // waits for completion, false if stopped
+			void RunShard (Shard * shard);
+			void ReceiveShard (Shard * shard);
+			void HandleReceivedShardBatch (const boost::system::error_code& ecode, Shard * shard);
+			void ScheduleShardTermination (Shard * shard);
+			void HandleShardTerminationTimer (const boost::system::error_code& ecode, Shard * shard);
+#endif
 
 			void CreateSessionThroughIntroducer (std::shared_ptr<const dotnet::data::RouterInfo> router, bool peerTest = false);
 			template<typename Filter>
@@ -114,6 +156,7 @@ namespace transport
 
 			bool m_OnlyV6;
 			bool m_IsRunning;
+			std::atomic<bool> m_IsRecreatingSockets; // set by whoever posts RecreateSockets first
 			std::thread * m_Thread, * m_ThreadV6, * m_ReceiversThread, * m_ReceiversThreadV6;
 			boost::asio::io_service m_Service, m_ServiceV6, m_ReceiversService, m_ReceiversServiceV6;
 			boost::asio::io_service::work m_Work, m_WorkV6, m_ReceiversWork, m_ReceiversWorkV6;
@@ -122,14 +165,45 @@ namespace transport
 			boost::asio::deadline_timer m_IntroducersUpdateTimer, m_PeerTestsCleanupTimer,
 				m_TerminationTimer, m_TerminationTimerV6;
 			std::list<boost::asio::ip::udp::endpoint> m_Introducers; // introducers we are connected to
-			std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > m_Sessions, m_SessionsV6;
+			SessionsMap m_Sessions, m_SessionsV6;
+			mutable std::mutex m_SessionsMutex; // of m_Sessions and m_SessionsV6, shards have own
 			std::map<uint32_t, std::shared_ptr<SSUSession> > m_Relays; // we are introducer
 			std::map<uint32_t, PeerTest> m_PeerTests; // nonce -> creation time in milliseconds
+			std::mutex m_RelaysMutex, m_PeerTestsMutex; // used by sessions from all threads
+			dotnet::util::MemoryPoolMt<SSUPacket> m_PacketsPool;
+#ifdef SSU_USE_MMSG
+			struct MMsgBuffers
+			{
+				MMsgBuffers () { memset (packets, 0, sizeof (packets)); };
+
+				mmsghdr msgs[SSU_MAX_NUM_RECEIVED_PACKETS];
+				iovec iovs[SSU_MAX_NUM_RECEIVED_PACKETS];
+				SSUPacket * packets[SSU_MAX_NUM_RECEIVED_PACKETS]; // receive into, refilled from pool
+				std::vector<SSUPacket *> sendQueue, sending;
+				std::mutex sendQueueMutex;
+			} m_MMsg, m_MMsgV6;
+#endif
+			struct Shard // v4 socket bound with SO_REUSEPORT, receives and processes in one thread
+			{
+				Shard (): work (service), socket (service), terminationTimer (service), thread (nullptr) {};
+
+				boost::asio::io_service service;
+				boost::asio::io_service::work work;
+				boost::asio::ip::udp::socket socket;
+				boost::asio::deadline_timer terminationTimer;
+				std::thread * thread;
+				SessionsMap sessions;
+				mutable std::mutex sessionsMutex;
+#ifdef SSU_USE_MMSG
+				MMsgBuffers mmsg;
+#endif
+			};
+			std::vector<std::unique_ptr<Shard> > m_Shards; // empty if single thread
 
 		public:
 			// for HTTP only
-			const decltype(m_Sessions)& GetSessions () const { return m_Sessions; };
-			const decltype(m_SessionsV6)& GetSessionsV6 () const { return m_SessionsV6; };
+			SessionsMap GetSessions () const; // copy of all v4
+			SessionsMap GetSessionsV6 () const;
 	};
 }
 }
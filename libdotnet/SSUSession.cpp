@@ -1,5 +1,8 @@
+#include <array>
+#include <vector>
 #include <boost/bind.hpp>
 #include "Crypto.h"
+#include "CryptoWorker.h"
 #include "Log.h"
 #include "Timestamp.h"
 #include "RouterContext.h"
@@ -41,14 +44,18 @@ namespace transport
 
 	boost::asio::io_service& SSUSession::GetService ()
 	{
-		return IsV6 () ? m_Server.GetServiceV6 () : m_Server.GetService ();
+		return m_Server.GetSessionService (m_RemoteEndpoint);
 	}
 
 	void SSUSession::CreateAESandMacKey (const uint8_t * pubKey)
 	{
 		uint8_t sharedKey[256];
 		m_DHKeysPair->Agree (pubKey, sharedKey);
+		CreateAESandMacKeyFromShared (sharedKey);
+	}
 
+	void SSUSession::CreateAESandMacKeyFromShared (const uint8_t * sharedKey)
+	{
 		uint8_t * sessionKey = m_SessionKey, * macKey = m_MacKey;
 		if (sharedKey[0] & 0x80)
 		{
@@ -64,7 +71,7 @@ namespace transport
 		else
 		{
 			// find first non-zero byte
-			uint8_t * nonZero = sharedKey + 1;
+			const uint8_t * nonZero = sharedKey + 1;
 			while (!*nonZero)
 			{
 				nonZero++;
@@ -217,8 +224,23 @@ namespace transport
 		}
 		if (!m_DHKeysPair)
 			m_DHKeysPair = transports.GetNextDHKeysPair ();
-		CreateAESandMacKey (buf + headerSize);
-		SendSessionCreated (buf + headerSize, sendRelayTag);
+		// DH agreement in crypto executor, keys are set and session created is sent in session's thread
+		auto s = shared_from_this ();
+		auto keys = m_DHKeysPair;
+		auto x = std::make_shared<std::array<uint8_t, 256> > ();
+		memcpy (x->data (), buf + headerSize, 256);
+		auto agree = [s, keys, x, sendRelayTag]()
+			{
+				auto sharedKey = std::make_shared<std::array<uint8_t, 256> > ();
+				keys->Agree (x->data (), sharedKey->data ());
+				s->GetService ().post ([s, keys, x, sharedKey, sendRelayTag]()
+					{
+						if (s->m_State != eSessionStateUnknown || s->m_DHKeysPair != keys) return; // closed or reset meanwhile
+						s->CreateAESandMacKeyFromShared (sharedKey->data ());
+						s->SendSessionCreated (x->data (), sendRelayTag);
+					});
+			};
+		if (!dotnet::worker::cryptoExecutor.Submit (agree)) agree ();
 	}
 
 	void SSUSession::ProcessSessionCreated (uint8_t * buf, size_t len)
@@ -684,7 +706,8 @@ namespace transport
 				LogPrint (eLogInfo, "SSU: RelayReponse connecting to endpoint ", remoteEndpoint);
 				if (dotnet::context.GetRouterInfo ().UsesIntroducer ()) // if we are unreachable
 					m_Server.Send (buf, 0, remoteEndpoint); // send HolePunch
-				m_Server.CreateDirectSession (it->second, remoteEndpoint, false);
+				m_Server.GetSessionService (remoteEndpoint).post (std::bind (&SSUServer::CreateDirectSession,
+					&m_Server, it->second, remoteEndpoint, false)); // in thread of remote endpoint
 			}
 			// delete request
 			m_RelayRequests.erase (it);
@@ -1004,8 +1027,16 @@ namespace transport
 			{
 				LogPrint (eLogDebug, "SSU: peer test from Charlie. We are Bob");
 				auto session = m_Server.GetPeerTestSession (nonce); // session with Alice from PeerTest
-				if (session && session->m_State == eSessionStateEstablished)
-					session->Send (PAYLOAD_TYPE_PEER_TEST, buf, len); // back to Alice
+				if (session)
+				{
+					// back to Alice, in her session's thread, buf is released with packet
+					std::vector<uint8_t> msg (buf, buf + len);
+					session->GetService ().post ([session, msg]()
+						{
+							if (session->m_State == eSessionStateEstablished)
+								session->Send (PAYLOAD_TYPE_PEER_TEST, msg.data (), msg.size ());
+						});
+				}
 				m_Server.RemovePeerTest (nonce); // nonce has been used
 				break;
 			}
@@ -1049,7 +1080,15 @@ namespace transport
 						if (session)
 						{
 							m_Server.NewPeerTest (nonce, ePeerTestParticipantBob, shared_from_this ());
-							session->SendPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey, false); // to Charlie with Alice's actual address
+							// to Charlie with Alice's actual address, in his session's thread
+							std::array<uint8_t, 32> key;
+							memcpy (key.data (), introKey, 32);
+							auto aliceAddress = senderEndpoint.address ();
+							auto alicePort = senderEndpoint.port ();
+							session->GetService ().post ([session, nonce, aliceAddress, alicePort, key]()
+								{
+									session->SendPeerTest (nonce, aliceAddress, alicePort, key.data (), false);
+								});
 						}
 					}
 				}
@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <set>
 #include <memory>
+#include <atomic>
 #include "Crypto.h"
 #include "DNNPProtocol.h"
 #include "TransportSession.h"
@@ -101,6 +102,7 @@ namespace transport
 
 			boost::asio::io_service& GetService ();
 			void CreateAESandMacKey (const uint8_t * pubKey);
+			void CreateAESandMacKeyFromShared (const uint8_t * sharedKey); // 256 bytes of DH agreement
 			size_t GetSSUHeaderSize (const uint8_t * buf) const;
 			void PostDNNPMessages (std::vector<std::shared_ptr<DNNPMessage> > msgs);
 			void ProcessMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint); // call for established session
@@ -143,16 +145,16 @@ namespace transport
 			const boost::asio::ip::udp::endpoint m_RemoteEndpoint;
 			boost::asio::deadline_timer m_ConnectTimer;
 			bool m_IsPeerTest;
-			SessionState m_State;
+			std::atomic<SessionState> m_State; // read by other threads through GetState
 			bool m_IsSessionKey;
-			uint32_t m_RelayTag; // received from peer
+			std::atomic<uint32_t> m_RelayTag; // received from peer, read by FindIntroducers from main thread
 			uint32_t m_SentRelayTag; // sent by us
 			dotnet::crypto::CBCEncryption m_SessionKeyEncryption;
 			dotnet::crypto::CBCDecryption m_SessionKeyDecryption;
 			dotnet::crypto::AESKey m_SessionKey;
 			dotnet::crypto::MACKey m_MacKey;
 			dotnet::data::RouterInfo::IntroKey m_IntroKey;
-			uint32_t m_CreationTime; // seconds since epoch
+			std::atomic<uint32_t> m_CreationTime; // seconds since epoch, read from main thread
 			SSUData m_Data;
 			bool m_IsDataReceived;
 			std::unique_ptr<SignedData> m_SignedData; // we need it for SessionConfirmed only
@@ -1,4 +1,5 @@
 #include <memory>
+#include <algorithm>
 #include "Log.h"
 #include "Signature.h"
 
@@ -6,31 +7,6 @@ namespace dotnet
 {
 namespace crypto
 {
-#if OPENSSL_EDDSA	
-	EDDSA25519Verifier::EDDSA25519Verifier ():
-		m_Pkey (nullptr)
-	{
-		m_MDCtx = EVP_MD_CTX_create ();	
-	}
-
-	EDDSA25519Verifier::~EDDSA25519Verifier ()
-	{
-		EVP_MD_CTX_destroy (m_MDCtx);
-		if (m_Pkey) EVP_PKEY_free (m_Pkey);
-	}
-
-	void EDDSA25519Verifier::SetPublicKey (const uint8_t * signingKey)
-	{
-		m_Pkey = EVP_PKEY_new_raw_public_key (EVP_PKEY_ED25519, NULL, signingKey, 32);
-		EVP_DigestVerifyInit (m_MDCtx, NULL, NULL, NULL, m_Pkey);
-	}	
-	
-	bool EDDSA25519Verifier::Verify (const uint8_t * buf, size_t len, const uint8_t * signature) const
-	{
-		return EVP_DigestVerify (m_MDCtx, signature, 64, buf, len);
-	}
-	
-#else	
 	EDDSA25519Verifier::EDDSA25519Verifier ()
 	{
 	}
@@ -42,13 +18,12 @@ namespace crypto
 	void EDDSA25519Verifier::SetPublicKey (const uint8_t * signingKey)
 	{
 		memcpy (m_PublicKeyEncoded, signingKey, EDDSA25519_PUBLIC_KEY_LENGTH);
-		BN_CTX * ctx = BN_CTX_new ();
-		m_PublicKey = GetEd25519 ()->DecodePublicKey (m_PublicKeyEncoded, ctx);
-		BN_CTX_free (ctx);
+		m_PublicKey = GetEd25519 ()->DecodePublicKey (m_PublicKeyEncoded, nullptr); // doesn't use BN_CTX
 	}	
 	
 	bool EDDSA25519Verifier::Verify (const uint8_t * buf, size_t len, const uint8_t * signature) const
 	{
+		// own cofactored check rather than OpenSSL's cofactorless one, same as EDDSA25519BatchVerifier
 		uint8_t digest[64];
 		SHA512_CTX ctx;
 		SHA512_Init (&ctx);
@@ -59,7 +34,6 @@ namespace crypto
 
 		return GetEd25519 ()->Verify (m_PublicKey, digest, signature);
 	}
-#endif
 
 	EDDSA25519SignerCompat::EDDSA25519SignerCompat (const uint8_t * signingPrivateKey, const uint8_t * signingPublicKey)
 	{
@@ -89,6 +63,50 @@ namespace crypto
 	{
 		GetEd25519 ()->Sign (m_ExpandedPrivateKey, m_PublicKeyEncoded, buf, len, signature);
 	}
+
+	void EDDSA25519BatchVerifier::Add (const uint8_t * signingKey, const uint8_t * buf, size_t len, const uint8_t * signature)
+	{
+		m_Signatures.emplace_back ();
+		auto& s = m_Signatures.back ();
+		memcpy (s.publicKey, signingKey, EDDSA25519_PUBLIC_KEY_LENGTH);
+		memcpy (s.signature, signature, EDDSA25519_SIGNATURE_LENGTH);
+		SHA512_CTX ctx;
+		SHA512_Init (&ctx);
+		SHA512_Update (&ctx, signature, EDDSA25519_SIGNATURE_LENGTH/2); // R
+		SHA512_Update (&ctx, signingKey, EDDSA25519_PUBLIC_KEY_LENGTH); // public key
+		SHA512_Update (&ctx, buf, len); // data
+		SHA512_Final (s.digest, &ctx);
+	}
+
+	void EDDSA25519BatchVerifier::Verify (std::vector<bool>& verified) const
+	{
+		verified.assign (m_Signatures.size (), false);
+		for (size_t i = 0; i < m_Signatures.size (); i += EDDSA25519_MAX_BATCH_SIZE)
+			Verify (i, std::min (i + EDDSA25519_MAX_BATCH_SIZE, m_Signatures.size ()), verified);
+	}
+
+	void EDDSA25519BatchVerifier::Verify (size_t from, size_t to, std::vector<bool>& verified) const
+	{
+		if (to - from < EDDSA25519_MIN_BATCH_SIZE) return;
+		std::vector<const uint8_t *> publicKeys, digests, signatures;
+		for (size_t i = from; i < to; i++)
+		{
+			publicKeys.push_back (m_Signatures[i].publicKey);
+			digests.push_back (m_Signatures[i].digest);
+			signatures.push_back (m_Signatures[i].signature);
+		}
+		if (GetEd25519 ()->VerifyBatch (publicKeys.data (), digests.data (), signatures.data (), to - from))
+		{
+			for (size_t i = from; i < to; i++) verified[i] = true;
+		}
+		else
+		{
+			// find invalid signatures by halves
+			size_t mid = from + (to - from)/2;
+			Verify (from, mid, verified);
+			Verify (mid, to, verified);
+		}
+	}
 	
 #if OPENSSL_EDDSA	
 	EDDSA25519Signer::EDDSA25519Signer (const uint8_t * signingPrivateKey, const uint8_t * signingPublicKey):
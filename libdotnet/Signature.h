@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <string.h>
+#include <vector>
 #include <openssl/dsa.h>
 #include <openssl/ec.h>
 #include <openssl/ecdsa.h>
@@ -295,13 +296,8 @@ namespace crypto
 
 		private:
 
-#if OPENSSL_EDDSA
-			EVP_PKEY * m_Pkey;
-			EVP_MD_CTX * m_MDCtx;
-#else			
-			EDDSAPoint m_PublicKey;
+			EDDSAPoint m_PublicKey; // decoded once by SetPublicKey
 			uint8_t m_PublicKeyEncoded[EDDSA25519_PUBLIC_KEY_LENGTH];
-#endif			
 	};
 
 	class EDDSA25519SignerCompat: public Signer
@@ -342,6 +338,32 @@ namespace crypto
 	typedef EDDSA25519SignerCompat EDDSA25519Signer;
 	
 #endif	
+
+	const size_t EDDSA25519_MAX_BATCH_SIZE = 64; // signatures in one equation
+	const size_t EDDSA25519_MIN_BATCH_SIZE = 4; // smaller failed batches are left to regular verification
+	class EDDSA25519BatchVerifier
+	{
+		public:
+
+			void Add (const uint8_t * signingKey, const uint8_t * buf, size_t len, const uint8_t * signature);
+			size_t GetNumSignatures () const { return m_Signatures.size (); };
+			// verified[i] is false if signature i is invalid or must be checked by regular verifier
+			void Verify (std::vector<bool>& verified) const;
+
+		private:
+
+			void Verify (size_t from, size_t to, std::vector<bool>& verified) const;
+
+		private:
+
+			struct BatchSignature
+			{
+				uint8_t publicKey[EDDSA25519_PUBLIC_KEY_LENGTH];
+				uint8_t digest[64]; // H(R || A || M)
+				uint8_t signature[EDDSA25519_SIGNATURE_LENGTH];
+			};
+			std::vector<BatchSignature> m_Signatures;
+	};
 	
 	inline void CreateEDDSA25519RandomKeys (uint8_t * signingPrivateKey, uint8_t * signingPublicKey)
 	{
@@ -25,19 +25,31 @@ namespace tunnel
 		dotnet::transport::transports.UpdateTotalTransitTransmittedBytes (TUNNEL_DATA_MSG_SIZE);
 	}
 
+	void TransitTunnel::EncryptTunnelMsgs (const std::vector<std::shared_ptr<const DNNPMessage> >& in,
+		const std::vector<std::shared_ptr<DNNPMessage> >& out)
+	{
+		auto num = in.size ();
+		std::vector<const uint8_t *> inBufs (num);
+		std::vector<uint8_t *> outBufs (num);
+		for (size_t i = 0; i < num; i++)
+		{
+			inBufs[i] = in[i]->GetPayload () + 4;
+			outBufs[i] = out[i]->GetPayload () + 4;
+		}
+		m_Encryption.Encrypt (num, inBufs.data (), outBufs.data ());
+		dotnet::transport::transports.UpdateTotalTransitTransmittedBytes (num*TUNNEL_DATA_MSG_SIZE);
+	}
+
 	TransitTunnelParticipant::~TransitTunnelParticipant ()
 	{
 	}
 
 	void TransitTunnelParticipant::HandleTunnelDataMsg (std::shared_ptr<const dotnet::DNNPMessage> tunnelMsg)
 	{
-		auto newMsg = CreateEmptyTunnelDataMsg ();
-		EncryptTunnelMsg (tunnelMsg, newMsg);
-
+		// encrypted all together by FlushTunnelDataMsgs
+		m_ReceivedTunnelDataMsgs.push_back (tunnelMsg);
+		m_TunnelDataMsgs.push_back (CreateEmptyTunnelDataMsg ());
 		m_NumTransmittedBytes += tunnelMsg->GetLength ();
-		htobe32buf (newMsg->GetPayload (), GetNextTunnelID ());
-		newMsg->FillDNNPMessageHeader (eDNNPTunnelData);
-		m_TunnelDataMsgs.push_back (newMsg);
 	}
 
 	void TransitTunnelParticipant::FlushTunnelDataMsgs ()
@@ -47,6 +59,13 @@ namespace tunnel
 			auto num = m_TunnelDataMsgs.size ();
 			if (num > 1)
 				LogPrint (eLogDebug, "TransitTunnel: ", GetTunnelID (), "->", GetNextTunnelID (), " ", num);
+			EncryptTunnelMsgs (m_ReceivedTunnelDataMsgs, m_TunnelDataMsgs);
+			m_ReceivedTunnelDataMsgs.clear ();
+			for (auto& it: m_TunnelDataMsgs)
+			{
+				htobe32buf (it->GetPayload (), GetNextTunnelID ());
+				it->FillDNNPMessageHeader (eDNNPTunnelData); // checksum of encrypted payload
+			}
 			dotnet::transport::transports.SendMessages (GetNextIdentHash (), m_TunnelDataMsgs);
 			m_TunnelDataMsgs.clear ();
 		}
@@ -29,6 +29,8 @@ namespace tunnel
 			void SendTunnelDataMsg (std::shared_ptr<dotnet::DNNPMessage> msg);
 			void HandleTunnelDataMsg (std::shared_ptr<const dotnet::DNNPMessage> tunnelMsg);
 			void EncryptTunnelMsg (std::shared_ptr<const DNNPMessage> in, std::shared_ptr<DNNPMessage> out);
+			void EncryptTunnelMsgs (const std::vector<std::shared_ptr<const DNNPMessage> >& in,
+				const std::vector<std::shared_ptr<DNNPMessage> >& out); // interleaved
 		private:
 
 			dotnet::crypto::TunnelEncryption m_Encryption;
@@ -52,6 +54,7 @@ namespace tunnel
 		private:
 
 			size_t m_NumTransmittedBytes;
+			std::vector<std::shared_ptr<const dotnet::DNNPMessage> > m_ReceivedTunnelDataMsgs; // encrypted by Flush
 			std::vector<std::shared_ptr<dotnet::DNNPMessage> > m_TunnelDataMsgs;
 	};
 
@@ -158,10 +158,9 @@ namespace transport
 		m_Thread = new std::thread (std::bind (&Transports::Run, this));
 		std::string ntcpproxy; dotnet::config::GetOption("ntcpproxy", ntcpproxy);
 		dotnet::http::URL proxyurl;
-		uint16_t softLimit, hardLimit, threads;
+		uint16_t softLimit, hardLimit;
 		dotnet::config::GetOption("limits.ntcpsoft", softLimit);
 		dotnet::config::GetOption("limits.ntcphard", hardLimit);
-		dotnet::config::GetOption("limits.ntcpthreads", threads);
 		if(softLimit > 0 && hardLimit > 0 && softLimit >= hardLimit)
 		{
 			LogPrint(eLogError, "ntcp soft limit must be less than ntcp hard limit");
@@ -173,7 +172,7 @@ namespace transport
 			{
 				if(proxyurl.schema == "socks" || proxyurl.schema == "http")
 				{
-					m_NTCPServer = new NTCPServer(threads);
+					m_NTCPServer = new NTCPServer();
 					m_NTCPServer->SetSessionLimits(softLimit, hardLimit);
 					NTCPServer::ProxyType proxytype = NTCPServer::eSocksProxy;
 
@@ -200,7 +199,8 @@ namespace transport
 		bool ntcp2;  dotnet::config::GetOption("ntcp2.enabled", ntcp2);
 		if (ntcp2)
 		{
-			m_NTCP2Server = new NTCP2Server ();
+			uint16_t ntcp2threads; dotnet::config::GetOption("limits.ntcp2threads", ntcp2threads);
+			m_NTCP2Server = new NTCP2Server (ntcp2threads);
 			m_NTCP2Server->Start ();
 		}	
 
@@ -211,7 +211,7 @@ namespace transport
 			if (!address) continue;
 			if (m_NTCPServer == nullptr && enableNTCP)
 			{
-				m_NTCPServer = new NTCPServer (threads);
+				m_NTCPServer = new NTCPServer ();
 				m_NTCPServer->SetSessionLimits(softLimit, hardLimit);
 				m_NTCPServer->Start ();
 				if (!(m_NTCPServer->IsBoundV6() || m_NTCPServer->IsBoundV4())) {
@@ -228,7 +228,10 @@ namespace transport
 				if (m_SSUServer == nullptr && enableSSU)
 				{
 					if (address->host.is_v4())
-						m_SSUServer = new SSUServer (address->port);
+					{
+						uint16_t ssuthreads; dotnet::config::GetOption("limits.ssuthreads", ssuthreads);
+						m_SSUServer = new SSUServer (address->port, ssuthreads);
+					}
 					else
 						m_SSUServer = new SSUServer (address->host, address->port);
 					LogPrint (eLogInfo, "Transports: Start listening UDP port ", address->port);
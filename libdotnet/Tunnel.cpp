@@ -1,6 +1,7 @@
 #include <string.h>
 #include "DotNetEndian.h"
 #include <thread>
+#include <chrono>
 #include <algorithm>
 #include <vector>
 #include "Crypto.h"
@@ -333,17 +334,79 @@ namespace tunnel
 
 	Tunnels tunnels;
 
-	Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr),
-		m_NumSuccesiveTunnelCreations (0), m_NumFailedTunnelCreations (0)
+	TunnelWorker::TunnelWorker (Tunnels& owner):
+		m_Owner (owner), m_IsRunning (false), m_Thread (nullptr)
+	{
+	}
+
+	TunnelWorker::~TunnelWorker ()
+	{
+		Stop ();
+	}
+
+	void TunnelWorker::Start ()
+	{
+		m_IsRunning = true;
+		m_Thread = new std::thread (std::bind (&TunnelWorker::Run, this));
+	}
+
+	void TunnelWorker::Stop ()
+	{
+		m_IsRunning = false;
+		m_Queue.WakeUp ();
+		if (m_Thread)
+		{
+			m_Thread->join ();
+			delete m_Thread;
+			m_Thread = nullptr;
+		}
+	}
+
+	void TunnelWorker::PostCleanup (std::shared_ptr<TunnelBase> tunnel)
+	{
+		std::unique_lock<std::mutex> l(m_CleanupMutex);
+		m_CleanupTunnels.push_back (tunnel);
+	}
+
+	void TunnelWorker::Run ()
+	{
+		while (m_IsRunning)
+		{
+			try
+			{
+				std::vector<std::shared_ptr<DNNPMessage> > msgs;
+				if (m_Queue.GetBatchWithTimeout (msgs, 1000)) // 1 sec
+					m_Owner.HandleTunnelMsgs (msgs);
+
+				std::vector<std::shared_ptr<TunnelBase> > cleanupTunnels;
+				{
+					std::unique_lock<std::mutex> l(m_CleanupMutex);
+					cleanupTunnels.swap (m_CleanupTunnels);
+				}
+				for (auto& it: cleanupTunnels)
+					it->Cleanup ();
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Tunnel: worker runtime exception: ", ex.what ());
+			}
+		}
+	}
+
+	Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr), m_NumWorkers (0),
+		m_BNCtx (nullptr), m_NumSubmittedBuildRequests (0), m_BuildRequestLatency (0), m_NumSuccesiveTunnelCreations (0), m_NumFailedTunnelCreations (0)
 	{
 	}
 
 	Tunnels::~Tunnels ()
 	{
+		for (auto it: m_Workers)
+			delete it;
 	}
 
 	std::shared_ptr<TunnelBase> Tunnels::GetTunnel (uint32_t tunnelID)
 	{
+		std::unique_lock<std::mutex> l(m_TunnelsMutex);
 		auto it = m_Tunnels.find(tunnelID);
 		if (it != m_Tunnels.end ())
 			return it->second;
@@ -437,7 +500,12 @@ namespace tunnel
 
 	void Tunnels::AddTransitTunnel (std::shared_ptr<TransitTunnel> tunnel)
 	{
-		if (m_Tunnels.emplace (tunnel->GetTunnelID (), tunnel).second)
+		bool inserted;
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			inserted = m_Tunnels.emplace (tunnel->GetTunnelID (), tunnel).second;
+		}
+		if (inserted)
 			m_TransitTunnels.push_back (tunnel);
 		else
 			LogPrint (eLogError, "Tunnel: tunnel with id ", tunnel->GetTunnelID (), " already exists");
@@ -445,6 +513,17 @@ namespace tunnel
 
 	void Tunnels::Start ()
 	{
+		uint16_t numWorkers; dotnet::config::GetOption("limits.tunnelthreads", numWorkers);
+		if (numWorkers > 1 && m_Workers.empty ())
+		{
+			LogPrint (eLogInfo, "Tunnel: starting ", numWorkers, " tunnel workers");
+			for (int i = 0; i < numWorkers; i++)
+				m_Workers.push_back (new TunnelWorker (*this));
+		}
+		for (auto it: m_Workers)
+			it->Start ();
+		m_NumWorkers = m_Workers.size (); // transports may post from now on
+		m_BNCtx = BN_CTX_new ();
 		m_IsRunning = true;
 		m_Thread = new std::thread (std::bind (&Tunnels::Run, this));
 	}
@@ -459,6 +538,16 @@ namespace tunnel
 			delete m_Thread;
 			m_Thread = 0;
 		}
+		// transports are still running, so workers are stopped, but not deleted
+		m_NumWorkers = 0;
+		for (auto it: m_Workers)
+			it->Stop ();
+		m_BuildRequests.clear ();
+		if (m_BNCtx)
+		{
+			BN_CTX_free (m_BNCtx);
+			m_BNCtx = nullptr;
+		}
 	}
 
 	void Tunnels::Run ()
@@ -470,61 +559,10 @@ namespace tunnel
 		{
 			try
 			{
-				auto msg = m_Queue.GetNextWithTimeout (1000); // 1 sec
-				if (msg)
-				{
-					uint32_t prevTunnelID = 0, tunnelID = 0;
-					std::shared_ptr<TunnelBase> prevTunnel;
-					do
-					{
-						std::shared_ptr<TunnelBase> tunnel;
-						uint8_t typeID = msg->GetTypeID ();
-						switch (typeID)
-						{
-							case eDNNPTunnelData:
-							case eDNNPTunnelGateway:
-							{
-								tunnelID = bufbe32toh (msg->GetPayload ());
-								if (tunnelID == prevTunnelID)
-									tunnel = prevTunnel;
-								else if (prevTunnel)
-									prevTunnel->FlushTunnelDataMsgs ();
-
-								if (!tunnel)
-									tunnel = GetTunnel (tunnelID);
-								if (tunnel)
-								{
-									if (typeID == eDNNPTunnelData)
-										tunnel->HandleTunnelDataMsg (msg);
-									else // tunnel gateway assumed
-										HandleTunnelGatewayMsg (tunnel, msg);
-								}
-								else
-									LogPrint (eLogWarning, "Tunnel: tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
-
-								break;
-							}
-							case eDNNPVariableTunnelBuild:
-							case eDNNPVariableTunnelBuildReply:
-							case eDNNPTunnelBuild:
-							case eDNNPTunnelBuildReply:
-								HandleDNNPMessage (msg->GetBuffer (), msg->GetLength ());
-							break;
-							default:
-								LogPrint (eLogWarning, "Tunnel: unexpected message type ", (int) typeID);
-						}
-
-						msg = m_Queue.Get ();
-						if (msg)
-						{
-							prevTunnelID = tunnelID;
-							prevTunnel = tunnel;
-						}
-						else if (tunnel)
-							tunnel->FlushTunnelDataMsgs ();
-					}
-					while (msg);
-				}
+				std::vector<std::shared_ptr<DNNPMessage> > msgs;
+				if (m_Queue.GetBatchWithTimeout (msgs, 1000)) // 1 sec
+					HandleTunnelMsgs (msgs);
+				HandleBuildRequestResults ();
 
 				uint64_t ts = dotnet::util::GetSecondsSinceEpoch ();
 				if (ts - lastTs >= 15) // manage tunnels every 15 seconds
@@ -540,6 +578,127 @@ namespace tunnel
 		}
 	}
 
+	void Tunnels::HandleTunnelMsgs (const std::vector<std::shared_ptr<DNNPMessage> >& msgs)
+	{
+		uint32_t prevTunnelID = 0, tunnelID = 0;
+		std::shared_ptr<TunnelBase> prevTunnel;
+		for (size_t i = 0; i < msgs.size (); i++)
+		{
+			auto& msg = msgs[i];
+			std::shared_ptr<TunnelBase> tunnel;
+			uint8_t typeID = msg->GetTypeID ();
+			switch (typeID)
+			{
+				case eDNNPTunnelData:
+				case eDNNPTunnelGateway:
+				{
+					tunnelID = bufbe32toh (msg->GetPayload ());
+					if (tunnelID == prevTunnelID)
+						tunnel = prevTunnel;
+					else if (prevTunnel)
+						prevTunnel->FlushTunnelDataMsgs ();
+
+					if (!tunnel)
+						tunnel = GetTunnel (tunnelID);
+					if (tunnel)
+					{
+						if (typeID == eDNNPTunnelData)
+							tunnel->HandleTunnelDataMsg (msg);
+						else // tunnel gateway assumed
+							HandleTunnelGatewayMsg (tunnel, msg);
+					}
+					else
+						LogPrint (eLogWarning, "Tunnel: tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
+
+					break;
+				}
+				case eDNNPVariableTunnelBuild:
+				case eDNNPTunnelBuild:
+					HandleTunnelBuildMsg (msg);
+				break;
+				case eDNNPVariableTunnelBuildReply:
+				case eDNNPTunnelBuildReply:
+					HandleDNNPMessage (msg->GetBuffer (), msg->GetLength ());
+				break;
+				default:
+					LogPrint (eLogWarning, "Tunnel: unexpected message type ", (int) typeID);
+			}
+
+			if (i + 1 < msgs.size ())
+			{
+				prevTunnelID = tunnelID;
+				prevTunnel = tunnel;
+			}
+			else if (tunnel)
+				tunnel->FlushTunnelDataMsgs ();
+		}
+		SubmitBuildRequests ();
+	}
+
+	void Tunnels::HandleTunnelBuildMsg (std::shared_ptr<DNNPMessage> msg)
+	{
+		if (msg->GetTypeID () == eDNNPVariableTunnelBuild && m_PendingInboundTunnels.count (msg->GetMsgID ()))
+		{
+			// reply for our inbound tunnel, no ElGamal
+			HandleDNNPMessage (msg->GetBuffer (), msg->GetLength ());
+			return;
+		}
+		auto request = std::make_shared<TunnelBuildRequest> ();
+		request->msg = msg;
+		request->postTime = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+		if (dotnet::worker::cryptoExecutor.IsRunning ())
+		{
+			m_BuildRequests.push_back ([this, request]()
+				{
+					DecryptTunnelBuildRequest (*request, dotnet::worker::CryptoExecutor::GetBNCtx ());
+					PostBuildRequestResult (request);
+				});
+			m_NumSubmittedBuildRequests++;
+		}
+		else
+		{
+			DecryptTunnelBuildRequest (*request, m_BNCtx);
+			HandleBuildRequestResult (request);
+		}
+	}
+
+	void Tunnels::SubmitBuildRequests ()
+	{
+		if (m_BuildRequests.empty ()) return;
+		if (!dotnet::worker::cryptoExecutor.Submit (m_BuildRequests))
+		{
+			// executor has been stopped
+			m_NumSubmittedBuildRequests -= m_BuildRequests.size ();
+			m_BuildRequests.clear ();
+		}
+	}
+
+	void Tunnels::PostBuildRequestResult (std::shared_ptr<TunnelBuildRequest> request)
+	{
+		m_BuildRequestResults.Put (request);
+		m_Queue.WakeUp ();
+	}
+
+	void Tunnels::HandleBuildRequestResults ()
+	{
+		std::vector<std::shared_ptr<TunnelBuildRequest> > results;
+		if (m_BuildRequestResults.GetBatch (results))
+			for (auto& it: results)
+			{
+				m_NumSubmittedBuildRequests--;
+				HandleBuildRequestResult (it);
+			}
+	}
+
+	void Tunnels::HandleBuildRequestResult (std::shared_ptr<TunnelBuildRequest> request)
+	{
+		HandleTunnelBuildRequest (*request);
+		uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now ().time_since_epoch ()).count () - request->postTime;
+		m_BuildRequestLatency = (m_BuildRequestLatency*7 + latency)/8;
+	}
+
 	void Tunnels::HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<DNNPMessage> msg)
 	{
 		if (!tunnel)
@@ -715,7 +874,10 @@ namespace tunnel
 					auto pool = tunnel->GetTunnelPool ();
 					if (pool)
 						pool->TunnelExpired (tunnel);
-					m_Tunnels.erase (tunnel->GetTunnelID ());
+					{
+						std::unique_lock<std::mutex> l(m_TunnelsMutex);
+						m_Tunnels.erase (tunnel->GetTunnelID ());
+					}
 					it = m_InboundTunnels.erase (it);
 				}
 				else
@@ -736,7 +898,7 @@ namespace tunnel
 						if (ts + TUNNEL_EXPIRATION_THRESHOLD > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
 							tunnel->SetState (eTunnelStateExpiring);
 						else // we don't need to cleanup expiring tunnels
-							tunnel->Cleanup ();
+							CleanupTunnel (tunnel);
 					}
 					it++;
 				}
@@ -786,12 +948,15 @@ namespace tunnel
 			if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
 			{
 				LogPrint (eLogDebug, "Tunnel: Transit tunnel with id ", tunnel->GetTunnelID (), " expired");
-				m_Tunnels.erase (tunnel->GetTunnelID ());
+				{
+					std::unique_lock<std::mutex> l(m_TunnelsMutex);
+					m_Tunnels.erase (tunnel->GetTunnelID ());
+				}
 				it = m_TransitTunnels.erase (it);
 			}
 			else
 			{
-				tunnel->Cleanup ();
+				CleanupTunnel (tunnel);
 				it++;
 			}
 		}
@@ -810,14 +975,53 @@ namespace tunnel
 		}
 	}
 
+	void Tunnels::CleanupTunnel (std::shared_ptr<TunnelBase> tunnel)
+	{
+		// endpoint must be cleaned up by the thread handling its messages
+		size_t numWorkers = m_NumWorkers;
+		if (!numWorkers)
+			tunnel->Cleanup ();
+		else
+			GetWorker (tunnel->GetTunnelID (), numWorkers)->PostCleanup (tunnel);
+	}
+
 	void Tunnels::PostTunnelData (std::shared_ptr<DNNPMessage> msg)
 	{
-		if (msg) m_Queue.Put (msg);
+		if (!msg) return;
+		size_t numWorkers = m_NumWorkers;
+		if (numWorkers)
+		{
+			auto typeID = msg->GetTypeID ();
+			if (typeID == eDNNPTunnelData || typeID == eDNNPTunnelGateway)
+			{
+				GetWorker (bufbe32toh (msg->GetPayload ()), numWorkers)->PostTunnelData (msg);
+				return;
+			}
+		}
+		// build messages are always handled by tunnels thread
+		m_Queue.Put (msg);
 	}
 
 	void Tunnels::PostTunnelData (const std::vector<std::shared_ptr<DNNPMessage> >& msgs)
 	{
-		m_Queue.Put (msgs);
+		size_t numWorkers = m_NumWorkers;
+		if (!numWorkers)
+		{
+			m_Queue.Put (msgs);
+			return;
+		}
+		// split by workers, keeping order of messages within the same tunnel
+		std::vector<std::vector<std::shared_ptr<DNNPMessage> > > shards (numWorkers);
+		for (const auto& it: msgs)
+		{
+			auto typeID = it->GetTypeID ();
+			if (typeID == eDNNPTunnelData || typeID == eDNNPTunnelGateway)
+				shards[bufbe32toh (it->GetPayload ()) % numWorkers].push_back (it);
+			else
+				m_Queue.Put (it);
+		}
+		for (size_t i = 0; i < shards.size (); i++)
+			m_Workers[i]->PostTunnelData (shards[i]);
 	}
 
 	template<class TTunnel>
@@ -870,7 +1074,12 @@ namespace tunnel
 
 	void Tunnels::AddInboundTunnel (std::shared_ptr<InboundTunnel> newTunnel)
 	{
-		if (m_Tunnels.emplace (newTunnel->GetTunnelID (), newTunnel).second)
+		bool inserted;
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			inserted = m_Tunnels.emplace (newTunnel->GetTunnelID (), newTunnel).second;
+		}
+		if (inserted)
 		{
 			m_InboundTunnels.push_back (newTunnel);
 			auto pool = newTunnel->GetTunnelPool ();
@@ -899,7 +1108,10 @@ namespace tunnel
 		auto inboundTunnel = std::make_shared<ZeroHopsInboundTunnel> ();
 		inboundTunnel->SetState (eTunnelStateEstablished);
 		m_InboundTunnels.push_back (inboundTunnel);
-		m_Tunnels[inboundTunnel->GetTunnelID ()] = inboundTunnel;
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			m_Tunnels[inboundTunnel->GetTunnelID ()] = inboundTunnel;
+		}
 		return inboundTunnel;
 	}
 
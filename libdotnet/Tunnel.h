@@ -9,6 +9,7 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include "Queue.h"
 #include "Crypto.h"
@@ -20,6 +21,7 @@
 #include "TunnelBase.h"
 #include "DNNPProtocol.h"
 #include "Event.h"
+#include "CryptoWorker.h"
 
 namespace dotnet
 {
@@ -136,7 +138,7 @@ namespace tunnel
 			std::shared_ptr<const TunnelConfig> m_Config;
 			std::vector<std::unique_ptr<TunnelHop> > m_Hops;
 			std::shared_ptr<TunnelPool> m_Pool; // pool, tunnel belongs to, or null
-			TunnelState m_State;
+			std::atomic<TunnelState> m_State; // set by workers, checked by tunnels thread
 			bool m_IsRecreated;
 			uint64_t m_Latency; // in milliseconds
 	};
@@ -212,6 +214,35 @@ namespace tunnel
 			size_t m_NumSentBytes;
 	};
 
+	class Tunnels;
+	class TunnelWorker // handles TunnelData and TunnelGateway messages of tunnels mapped to it by tunnelID
+	{
+		public:
+
+			TunnelWorker (Tunnels& owner);
+			~TunnelWorker ();
+			void Start ();
+			void Stop ();
+
+			void PostTunnelData (std::shared_ptr<DNNPMessage> msg) { m_Queue.Put (msg); };
+			void PostTunnelData (const std::vector<std::shared_ptr<DNNPMessage> >& msgs) { m_Queue.Put (msgs); };
+			void PostCleanup (std::shared_ptr<TunnelBase> tunnel);
+			int GetQueueSize () { return m_Queue.GetSize (); };
+
+		private:
+
+			void Run ();
+
+		private:
+
+			Tunnels& m_Owner;
+			bool m_IsRunning;
+			std::thread * m_Thread;
+			dotnet::util::MPSCQueue<std::shared_ptr<DNNPMessage> > m_Queue;
+			std::mutex m_CleanupMutex;
+			std::vector<std::shared_ptr<TunnelBase> > m_CleanupTunnels;
+	};
+
 	class Tunnels
 	{
 		public:
@@ -251,6 +282,14 @@ namespace tunnel
 			std::shared_ptr<TTunnel> GetPendingTunnel (uint32_t replyMsgID, const std::map<uint32_t, std::shared_ptr<TTunnel> >& pendingTunnels);
 
 			void HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<DNNPMessage> msg);
+			void HandleTunnelMsgs (const std::vector<std::shared_ptr<DNNPMessage> >& msgs); // batch taken from queue
+			void HandleTunnelBuildMsg (std::shared_ptr<DNNPMessage> msg);
+			void SubmitBuildRequests (); // collected from batch to crypto executor
+			void PostBuildRequestResult (std::shared_ptr<TunnelBuildRequest> request); // from crypto executor
+			void HandleBuildRequestResults ();
+			void HandleBuildRequestResult (std::shared_ptr<TunnelBuildRequest> request);
+			TunnelWorker * GetWorker (uint32_t tunnelID, size_t numWorkers) const { return m_Workers[tunnelID % numWorkers]; };
+			void CleanupTunnel (std::shared_ptr<TunnelBase> tunnel);
 
 			void Run ();
 			void ManageTunnels ();
@@ -275,14 +314,24 @@ namespace tunnel
 			std::list<std::shared_ptr<OutboundTunnel> > m_OutboundTunnels;
 			std::list<std::shared_ptr<TransitTunnel> > m_TransitTunnels;
 			std::unordered_map<uint32_t, std::shared_ptr<TunnelBase> > m_Tunnels; // tunnelID->tunnel known by this id
+			std::mutex m_TunnelsMutex; // for m_Tunnels, accessed by workers
 			std::mutex m_PoolsMutex;
 			std::list<std::shared_ptr<TunnelPool>> m_Pools;
 			std::shared_ptr<TunnelPool> m_ExploratoryPool;
-			dotnet::util::Queue<std::shared_ptr<DNNPMessage> > m_Queue;
+			dotnet::util::MPSCQueue<std::shared_ptr<DNNPMessage> > m_Queue;
+			std::vector<TunnelWorker *> m_Workers; // deleted in destructor only, because transports may still post
+			std::atomic<size_t> m_NumWorkers; // published after m_Workers, 0 if TunnelData is handled by tunnels thread itself
+			std::vector<dotnet::worker::CryptoExecutor::Job> m_BuildRequests; // to submit
+			BN_CTX * m_BNCtx; // if build requests are decrypted by tunnels thread
+			dotnet::util::MPSCQueue<std::shared_ptr<TunnelBuildRequest> > m_BuildRequestResults; // decrypted by crypto executor
+			std::atomic<int> m_NumSubmittedBuildRequests;
+			std::atomic<int> m_BuildRequestLatency; // microseconds, moving average
 
 			// some stats
 			int m_NumSuccesiveTunnelCreations, m_NumFailedTunnelCreations;
 
+		friend class TunnelWorker;
+
 		public:
 
 			// for HTTP only
@@ -294,7 +343,14 @@ namespace tunnel
 			size_t CountInboundTunnels() const;
 			size_t CountOutboundTunnels() const;
 
-			int GetQueueSize () { return m_Queue.GetSize (); };
+			int GetQueueSize ()
+			{
+				int size = m_Queue.GetSize ();
+				for (size_t i = 0; i < m_NumWorkers; i++) size += m_Workers[i]->GetQueueSize ();
+				return size;
+			}
+			int GetBuildRequestQueueSize () const { return m_NumSubmittedBuildRequests; };
+			int GetBuildRequestLatency () const { return m_BuildRequestLatency; }; // microseconds
 			int GetTunnelCreationSuccessRate () const // in percents
 			{
 				int totalNum = m_NumSuccesiveTunnelCreations + m_NumFailedTunnelCreations;
@@ -9,6 +9,7 @@
 #include "Identity.h"
 #include "Destination.h"
 #include "Crypto.h"
+#include "CryptoWorker.h"
 #include "FS.h"
 #include "api.h"
 
@@ -29,7 +30,9 @@ namespace api
 		dotnet::fs::Init();
 
 		bool precomputation; dotnet::config::GetOption("precomputation.elgamal", precomputation);
-		dotnet::crypto::InitCrypto (precomputation);
+		std::string chacha20poly1305; dotnet::config::GetOption("crypto.chacha20poly1305", chacha20poly1305);
+
+		dotnet::crypto::InitCrypto (precomputation, chacha20poly1305 == "builtin");
 
         int netID; dotnet::config::GetOption("netid", netID);
         dotnet::context.SetNetID (netID);
@@ -51,6 +54,11 @@ namespace api
 		dotnet::log::Logger().Start ();
 		LogPrint(eLogInfo, "API: starting NetDB");
 		dotnet::data::netdb.Start();
+		bool elgamalpool; dotnet::config::GetOption("precomputation.elgamalpool", elgamalpool);
+		if (elgamalpool)
+			dotnet::crypto::StartElGamalPool ();
+		uint16_t cryptothreads; dotnet::config::GetOption("limits.cryptothreads", cryptothreads);
+		dotnet::worker::cryptoExecutor.Start (cryptothreads);
 		LogPrint(eLogInfo, "API: starting Transports");
 		dotnet::transport::transports.Start();
 		LogPrint(eLogInfo, "API: starting Tunnels");
@@ -62,6 +70,8 @@ namespace api
 		LogPrint(eLogInfo, "API: shutting down");
 		LogPrint(eLogInfo, "API: stopping Tunnels");
 		dotnet::tunnel::tunnels.Stop();
+		dotnet::crypto::StopElGamalPool ();
+		dotnet::worker::cryptoExecutor.Stop (); // runs jobs left, they still might use transports
 		LogPrint(eLogInfo, "API: stopping Transports");
 		dotnet::transport::transports.Stop();
 		LogPrint(eLogInfo, "API: stopping NetDB");
@@ -15,6 +15,7 @@ SOURCES += DaemonQT.cpp mainwindow.cpp \
     ../../libdotnet/CPU.cpp \
     ../../libdotnet/Crypto.cpp \
 	../../libdotnet/CryptoKey.cpp \
+    ../../libdotnet/CryptoWorker.cpp \
     ../../libdotnet/Datagram.cpp \
     ../../libdotnet/Destination.cpp \
     ../../libdotnet/Event.cpp \
@@ -31,6 +32,7 @@ SOURCES += DaemonQT.cpp mainwindow.cpp \
     ../../libdotnet/Log.cpp \
     ../../libdotnet/NetDb.cpp \
     ../../libdotnet/NetDbRequests.cpp \
+    ../../libdotnet/NetDbStore.cpp \
     ../../libdotnet/NTCPSession.cpp \
     ../../libdotnet/Profiling.cpp \
     ../../libdotnet/Reseed.cpp \
@@ -52,6 +54,7 @@ SOURCES += DaemonQT.cpp mainwindow.cpp \
     ../../libdotnet/Ed25519.cpp \
     ../../libdotnet/Chacha20.cpp \
     ../../libdotnet/Poly1305.cpp \    
+    ../../libdotnet/SHA256.cpp \
     ../../libdotnet_client/AddressBook.cpp \
     ../../libdotnet_client/BOB.cpp \
     ../../libdotnet_client/ClientContext.cpp \
@@ -98,6 +101,7 @@ HEADERS  += DaemonQT.h mainwindow.h \
     ../../libdotnet/Config.h \
     ../../libdotnet/Crypto.h \
 	../../libdotnet/CryptoKey.h \
+    ../../libdotnet/CryptoWorker.h \
     ../../libdotnet/Datagram.h \
     ../../libdotnet/Destination.h \
     ../../libdotnet/Event.h \
@@ -115,12 +119,14 @@ HEADERS  += DaemonQT.h mainwindow.h \
     ../../libdotnet/Log.h \
     ../../libdotnet/NetDb.hpp \
     ../../libdotnet/NetDbRequests.h \
+    ../../libdotnet/NetDbStore.h \
     ../../libdotnet/NTCPSession.h \
     ../../libdotnet/Profiling.h \
     ../../libdotnet/Queue.h \
     ../../libdotnet/Reseed.h \
     ../../libdotnet/RouterContext.h \
     ../../libdotnet/RouterInfo.h \
+    ../../libdotnet/SHA256.h \
     ../../libdotnet/Signature.h \
     ../../libdotnet/SSU.h \
     ../../libdotnet/SSUData.h \
@@ -0,0 +1,94 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+
+#include "Poly1305.h"
+#include "CPU.h"
+
+// previous implementation with 8 bits limbs, as baseline
+static void LegacyPoly1305 (uint64_t * out, const uint64_t * key, const uint8_t * buf, size_t sz)
+{
+	const uint8_t * k = (const uint8_t *)key;
+	const uint8_t clamp[16] = { 0xff, 0xff, 0xff, 0x0f, 0xfc, 0xff, 0xff, 0x0f, 0xfc, 0xff, 0xff, 0x0f, 0xfc, 0xff, 0xff, 0x0f };
+	uint8_t r[17], h[17] = {0}, c[17];
+	for (int i = 0; i < 16; i++) r[i] = k[i] & clamp[i];
+	r[16] = 0;
+	while (sz > 0)
+	{
+		size_t n = sz < 16 ? sz : 16;
+		memset (c, 0, 17); memcpy (c, buf, n); c[n] = 1;
+		unsigned int u = 0;
+		for (int i = 0; i < 17; i++) { u += h[i] + c[i]; h[i] = u; u >>= 8; }
+		unsigned long hr[17];
+		for (int i = 0; i < 17; i++)
+		{
+			unsigned long s = 0;
+			for (int j = 0; j <= i; j++) s += (unsigned long)h[j]*r[i - j];
+			for (int j = i + 1; j < 17; j++) s += (unsigned long)h[j]*r[i + 17 - j]*320;
+			hr[i] = s;
+		}
+		unsigned long v = 0;
+		for (int i = 0; i < 16; i++) { v += hr[i]; h[i] = v; v >>= 8; }
+		v += hr[16]; h[16] = v & 3; v = (v >> 2)*5;
+		for (int i = 0; i < 16; i++) { v += h[i]; h[i] = v; v >>= 8; }
+		h[16] += v;
+		buf += n; sz -= n;
+	}
+	// freeze and add pad
+	const uint8_t minusp[17] = { 5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xfc };
+	uint8_t g[17];
+	unsigned int u = 0;
+	for (int i = 0; i < 17; i++) { u += h[i] + minusp[i]; g[i] = u; u >>= 8; }
+	uint8_t neg = -(g[16] >> 7);
+	for (int i = 0; i < 17; i++) h[i] = g[i] ^ (neg & (h[i] ^ g[i]));
+	u = 0;
+	for (int i = 0; i < 16; i++) { u += h[i] + k[16 + i]; h[i] = u; u >>= 8; }
+	memcpy (out, h, 16);
+}
+
+template<typename F>
+static double Measure (F f, size_t len)
+{
+	int num = 0;
+	auto start = std::chrono::steady_clock::now ();
+	std::chrono::duration<double> elapsed;
+	do
+	{
+		for (int i = 0; i < 16; i++) f ();
+		num += 16;
+		elapsed = std::chrono::steady_clock::now () - start;
+	}
+	while (elapsed.count () < 0.5);
+	return len*num/elapsed.count ()/1000000.0; // MB/s
+}
+
+int main ()
+{
+	dotnet::cpu::Detect ();
+	bool avx2 = dotnet::cpu::avx2;
+	uint64_t key[4];
+	for (int i = 0; i < 32; i++) ((uint8_t *)key)[i] = i*37 + 11;
+	for (size_t len: { 1024, 65536 })
+	{
+		std::vector<uint8_t> buf (len);
+		for (size_t i = 0; i < len; i++) buf[i] = i*7 + 3;
+		uint64_t legacy[2], scalar[2], vector[2];
+		LegacyPoly1305 (legacy, key, buf.data (), len);
+		dotnet::cpu::avx2 = false;
+		dotnet::crypto::Poly1305HMAC (scalar, key, buf.data (), len);
+		assert (!memcmp (legacy, scalar, 16));
+		printf ("%6zu bytes: legacy %7.1f MB/s", len, Measure ([&]() { LegacyPoly1305 (legacy, key, buf.data (), len); }, len));
+		printf (", 64 bits limbs %7.1f MB/s", Measure ([&]() { dotnet::crypto::Poly1305HMAC (scalar, key, buf.data (), len); }, len));
+		if (avx2)
+		{
+			dotnet::cpu::avx2 = true;
+			dotnet::crypto::Poly1305HMAC (vector, key, buf.data (), len);
+			assert (!memcmp (legacy, vector, 16));
+			printf (", AVX2 %7.1f MB/s", Measure ([&]() { dotnet::crypto::Poly1305HMAC (vector, key, buf.data (), len); }, len));
+		}
+		printf ("\n");
+	}
+}
@@ -0,0 +1,298 @@
+// Microbenchmarks of crypto and message path primitives, built and run by "make bench"
+// usage: dotnet-bench [--json] [--time=seconds] [--filter=substring]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "version.h"
+#include "Crypto.h"
+#include "SHA256.h"
+#include "Signature.h"
+#include "Ed25519.h"
+#include "Gost.h"
+#include "Base.h"
+#include "Gzip.h"
+
+struct BenchResult
+{
+	std::string name;
+	size_t bytes; // per operation, 0 if not applicable
+	uint64_t numOps;
+	double opsPerSec, nsPerOp, p50, p90, p99; // percentiles of ns/op over samples
+};
+
+static double g_Time = 0.5; // seconds per benchmark
+static std::string g_Filter;
+static std::vector<BenchResult> g_Results;
+
+static double Now () // in nanoseconds
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+static double Percentile (const std::vector<double>& sorted, double p)
+{
+	size_t ind = p*(sorted.size () - 1);
+	return sorted[ind];
+}
+
+// f performs opsPerCall operations
+static void Bench (const std::string& name, size_t bytes, std::function<void()> f, int opsPerCall = 1)
+{
+	if (!g_Filter.empty () && name.find (g_Filter) == std::string::npos) return;
+	f (); // warm up
+	// calls per sample, so that sample takes at least 20 microseconds
+	size_t batch = 1;
+	for (;;)
+	{
+		double start = Now ();
+		for (size_t i = 0; i < batch; i++) f ();
+		if (Now () - start >= 20000 || batch >= (1 << 20)) break;
+		batch <<= 1;
+	}
+	std::vector<double> samples;
+	double total = 0;
+	uint64_t numCalls = 0;
+	while (total < g_Time*1e9)
+	{
+		double start = Now ();
+		for (size_t i = 0; i < batch; i++) f ();
+		double elapsed = Now () - start;
+		samples.push_back (elapsed/(batch*opsPerCall));
+		total += elapsed;
+		numCalls += batch;
+	}
+	std::sort (samples.begin (), samples.end ());
+	BenchResult r;
+	r.name = name;
+	r.bytes = bytes;
+	r.numOps = numCalls*opsPerCall;
+	r.nsPerOp = total/r.numOps;
+	r.opsPerSec = 1e9/r.nsPerOp;
+	r.p50 = Percentile (samples, 0.5);
+	r.p90 = Percentile (samples, 0.9);
+	r.p99 = Percentile (samples, 0.99);
+	g_Results.push_back (r);
+}
+
+static void PrintText ()
+{
+	printf ("%-32s %12s %10s %10s %10s %10s %10s\n", "benchmark", "ops/sec", "ns/op", "p50", "p90", "p99", "MB/s");
+	for (const auto& r: g_Results)
+	{
+		printf ("%-32s %12.0f %10.1f %10.1f %10.1f %10.1f", r.name.c_str (), r.opsPerSec, r.nsPerOp, r.p50, r.p90, r.p99);
+		if (r.bytes)
+			printf (" %10.1f", r.bytes*r.opsPerSec/1e6);
+		printf ("\n");
+	}
+}
+
+static void PrintJSON ()
+{
+	printf ("{\n\t\"version\": \"%s\",\n\t\"time\": %.2f,\n\t\"kernels\": {", VERSION, g_Time);
+	bool first = true;
+	for (const auto& it: dotnet::crypto::GetCryptoKernels ())
+	{
+		printf ("%s\n\t\t\"%s\": \"%s\"", first ? "" : ",", it.first.c_str (), it.second.c_str ());
+		first = false;
+	}
+	printf ("\n\t},\n\t\"results\": [");
+	first = true;
+	for (const auto& r: g_Results)
+	{
+		printf ("%s\n\t\t{ \"name\": \"%s\", \"bytes\": %zu, \"ops\": %llu, \"ops_per_sec\": %.1f, \"ns_per_op\": %.1f, "
+			"\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f }", first ? "" : ",", r.name.c_str (), r.bytes,
+			(unsigned long long)r.numOps, r.opsPerSec, r.nsPerOp, r.p50, r.p90, r.p99);
+		first = false;
+	}
+	printf ("\n\t]\n}\n");
+}
+
+static void BenchTunnelAES ()
+{
+	dotnet::crypto::AESKey layerKey, ivKey;
+	RAND_bytes (layerKey, 32); RAND_bytes (ivKey, 32);
+	uint8_t in[1024], out[1024];
+	RAND_bytes (in, 1024);
+	dotnet::crypto::TunnelEncryption encryption;
+	encryption.SetKeys (layerKey, ivKey);
+	Bench ("tunnel AES encrypt", 1024, [&]() { encryption.Encrypt (in, out); });
+	dotnet::crypto::TunnelDecryption decryption;
+	decryption.SetKeys (layerKey, ivKey);
+	Bench ("tunnel AES decrypt", 1024, [&]() { decryption.Decrypt (in, out); });
+}
+
+static void BenchElGamal ()
+{
+	uint8_t priv[256], pub[256], data[222], encrypted[512];
+	dotnet::crypto::GenerateElGamalKeyPair (priv, pub);
+	RAND_bytes (data, 222);
+	BN_CTX * ctx = BN_CTX_new ();
+	Bench ("ElGamal encrypt", 0, [&]() { dotnet::crypto::ElGamalEncrypt (pub, data, encrypted, ctx); });
+	Bench ("ElGamal decrypt", 0, [&]() { dotnet::crypto::ElGamalDecrypt (priv, encrypted, data, ctx); });
+	BN_CTX_free (ctx);
+}
+
+static void BenchEd25519 ()
+{
+	uint8_t priv[32], pub[32], buf[1024], signature[64];
+	dotnet::crypto::CreateEDDSA25519RandomKeys (priv, pub);
+	RAND_bytes (buf, 1024);
+	dotnet::crypto::EDDSA25519Signer signer (priv, pub);
+	dotnet::crypto::EDDSA25519Verifier verifier;
+	verifier.SetPublicKey (pub);
+#if OPENSSL_EDDSA
+	const std::string impl = " (OpenSSL)"; // signer goes through EVP, verifier is always own
+#else
+	const std::string impl = "";
+#endif
+	Bench ("Ed25519 sign 1K" + impl, 1024, [&]() { signer.Sign (buf, 1024, signature); });
+	Bench ("Ed25519 verify 1K", 1024, [&]() { verifier.Verify (buf, 1024, signature); });
+
+	// own implementation, digest is H(R || A || M) as passed by verifier
+	const size_t num = 64;
+	auto& ed25519 = dotnet::crypto::GetEd25519 ();
+	uint8_t expandedKey[64], keys[num][32], digests[num][64], signatures[num][64];
+	const uint8_t * keysPtrs[num], * digestsPtrs[num], * signaturesPtrs[num];
+	BN_CTX * ctx = BN_CTX_new ();
+	for (size_t i = 0; i < num; i++)
+	{
+		uint8_t key[32];
+		RAND_bytes (key, 32);
+		dotnet::crypto::Ed25519::ExpandPrivateKey (key, expandedKey);
+		ed25519->EncodePublicKey (ed25519->GeneratePublicKey (expandedKey, ctx), keys[i], ctx);
+		ed25519->Sign (expandedKey, keys[i], buf, 1024, signatures[i]);
+		SHA512_CTX sha;
+		SHA512_Init (&sha);
+		SHA512_Update (&sha, signatures[i], 32); // R
+		SHA512_Update (&sha, keys[i], 32); // A
+		SHA512_Update (&sha, buf, 1024); // M
+		SHA512_Final (digests[i], &sha);
+		keysPtrs[i] = keys[i]; digestsPtrs[i] = digests[i]; signaturesPtrs[i] = signatures[i];
+	}
+	auto publicKey = ed25519->DecodePublicKey (keys[0], ctx);
+	BN_CTX_free (ctx);
+	Bench ("Ed25519 sign 1K (dotnet)", 1024, [&]() { ed25519->Sign (expandedKey, keys[num - 1], buf, 1024, signatures[num - 1]); });
+	Bench ("Ed25519 verify digest (dotnet)", 0, [&]() { ed25519->Verify (publicKey, digests[0], signatures[0]); });
+	Bench ("Ed25519 verify batch 64 (dotnet)", 0, [&]() { ed25519->VerifyBatch (keysPtrs, digestsPtrs, signaturesPtrs, num); });
+}
+
+static void BenchX25519 ()
+{
+	dotnet::crypto::X25519Keys keys, remote;
+	keys.GenerateKeys (); remote.GenerateKeys ();
+	uint8_t shared[32];
+	Bench ("X25519 generate keys", 0, [&]() { keys.GenerateKeys (); });
+	Bench ("X25519 agree", 0, [&]() { keys.Agree (remote.GetPublicKey (), shared); });
+}
+
+static void BenchChaCha20Poly1305 ()
+{
+	uint8_t key[32], nonce[12];
+	RAND_bytes (key, 32); RAND_bytes (nonce, 12);
+	for (size_t len: { 64, 1024, 16384 })
+	{
+		std::vector<uint8_t> msg (len), buf (len + 16);
+		RAND_bytes (msg.data (), len);
+		Bench ("ChaCha20-Poly1305 encrypt " + std::to_string (len), len, [&]()
+			{
+				dotnet::crypto::AEADChaCha20Poly1305 (msg.data (), len, nullptr, 0, key, nonce, buf.data (), len + 16, true);
+			});
+		Bench ("ChaCha20-Poly1305 decrypt " + std::to_string (len), len, [&]()
+			{
+				dotnet::crypto::AEADChaCha20Poly1305 (buf.data (), len, nullptr, 0, key, nonce, msg.data (), len, false);
+			});
+	}
+}
+
+static void BenchHashes ()
+{
+	uint8_t buf[1024], digest[32];
+	RAND_bytes (buf, 1024);
+	Bench ("SHA-256 32", 32, [&]() { SHA256 (buf, 32, digest); });
+	Bench ("SHA-256 1K", 1024, [&]() { SHA256 (buf, 1024, digest); });
+	const int num = 64; // routing keys
+	std::vector<uint8_t> in (num*40), out (num*32);
+	RAND_bytes (in.data (), in.size ());
+	Bench ("SHA-256 batch 40", 40, [&]() { dotnet::crypto::SHA256Batch (in.data (), 40, out.data (), num); }, num);
+	Bench ("GOST R 34.11-2012 256 1K", 1024, [&]() { dotnet::crypto::GOSTR3411_2012_256 (buf, 1024, digest); });
+}
+
+static void BenchBase64 ()
+{
+	uint8_t buf[1024];
+	RAND_bytes (buf, 1024);
+	char b64[1400];
+	size_t len = dotnet::data::ByteStreamToBase64 (buf, 1024, b64, sizeof (b64));
+	Bench ("Base64 encode 1K", 1024, [&]() { dotnet::data::ByteStreamToBase64 (buf, 1024, b64, sizeof (b64)); });
+	Bench ("Base64 decode 1K", 1024, [&]() { dotnet::data::Base64ToByteStream (b64, len, buf, sizeof (buf)); });
+}
+
+static void BenchGzip ()
+{
+	// RouterInfo-like payload, text with some random keys in it
+	std::string s;
+	uint8_t key[32];
+	char b64[64];
+	while (s.length () < 2048)
+	{
+		RAND_bytes (key, 32);
+		dotnet::data::ByteStreamToBase64 (key, 32, b64, sizeof (b64));
+		s += "caps=XfR;host=127.0.0.1;port=12345;s=";
+		s.append (b64, 44);
+		s += ";router.version=0.9.38;";
+	}
+	std::vector<uint8_t> compressed (4096), decompressed (4096);
+	dotnet::data::GzipDeflator deflator;
+	dotnet::data::GzipInflator inflator;
+	size_t len = deflator.Deflate ((const uint8_t *)s.c_str (), s.length (), compressed.data (), compressed.size ());
+	Bench ("gzip deflate 2K", s.length (), [&]()
+		{
+			deflator.Deflate ((const uint8_t *)s.c_str (), s.length (), compressed.data (), compressed.size ());
+		});
+	Bench ("gzip inflate 2K", s.length (), [&]()
+		{
+			inflator.Inflate (compressed.data (), len, decompressed.data (), decompressed.size ());
+		});
+}
+
+int main (int argc, char * argv[])
+{
+	bool json = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--json")
+			json = true;
+		else if (!arg.compare (0, 7, "--time="))
+			g_Time = std::stod (arg.substr (7));
+		else if (!arg.compare (0, 9, "--filter="))
+			g_Filter = arg.substr (9);
+		else
+		{
+			fprintf (stderr, "usage: %s [--json] [--time=seconds] [--filter=substring]\n", argv[0]);
+			return 1;
+		}
+	}
+	dotnet::crypto::InitCrypto (true);
+	BenchTunnelAES ();
+	BenchElGamal ();
+	BenchEd25519 ();
+	BenchX25519 ();
+	BenchChaCha20Poly1305 ();
+	BenchHashes ();
+	BenchBase64 ();
+	BenchGzip ();
+	if (json)
+		PrintJSON ();
+	else
+		PrintText ();
+	dotnet::crypto::TerminateCrypto ();
+	return 0;
+}
@@ -21,12 +21,14 @@ int main ()
 	dotnet::crypto::CreateGOSTR3410RandomKeys (dotnet::crypto::eGOSTR3410TC26A512, priv, pub);
 	dotnet::crypto::GOSTR3410_512_Signer signer (dotnet::crypto::eGOSTR3410TC26A512, priv);
 	signer.Sign (example2, 72, signature);
-	dotnet::crypto::GOSTR3410_512_Verifier verifier (dotnet::crypto::eGOSTR3410TC26A512, pub);
+	dotnet::crypto::GOSTR3410_512_Verifier verifier (dotnet::crypto::eGOSTR3410TC26A512);
+	verifier.SetPublicKey (pub);
 	assert (verifier.Verify (example2, 72, signature));
 
 	dotnet::crypto::CreateGOSTR3410RandomKeys (dotnet::crypto::eGOSTR3410CryptoProA, priv, pub);
 	dotnet::crypto::GOSTR3410_256_Signer signer1 (dotnet::crypto::eGOSTR3410CryptoProA, priv);
 	signer1.Sign (example2, 72, signature);
-	dotnet::crypto::GOSTR3410_256_Verifier verifier1 (dotnet::crypto::eGOSTR3410CryptoProA, pub);
+	dotnet::crypto::GOSTR3410_256_Verifier verifier1 (dotnet::crypto::eGOSTR3410CryptoProA);
+	verifier1.SetPublicKey (pub);
 	assert (verifier1.Verify (example2, 72, signature));
 }
@@ -0,0 +1,61 @@
+#include <cassert>
+#include <memory>
+#include <vector>
+#include <thread>
+
+#include "Queue.h"
+
+const int numProducers = 4, numMsgs = 100000;
+
+struct Msg
+{
+	int producer, seq;
+};
+
+int main ()
+{
+	dotnet::util::MPSCQueue<std::shared_ptr<Msg> > queue;
+	assert (!queue.Get ());
+	std::vector<std::thread> producers;
+	for (int i = 0; i < numProducers; i++)
+		producers.emplace_back ([&queue, i]()
+			{
+				for (int j = 0; j < numMsgs; j += 2)
+				{
+					if (j & 2)
+						queue.Put (std::make_shared<Msg> (Msg{ i, j }));
+					else
+					{
+						std::vector<std::shared_ptr<Msg> > batch;
+						batch.push_back (std::make_shared<Msg> (Msg{ i, j }));
+						batch.push_back (std::make_shared<Msg> (Msg{ i, j + 1 }));
+						queue.Put (batch);
+					}
+					if (j & 2) queue.Put (std::make_shared<Msg> (Msg{ i, j + 1 }));
+				}
+			});
+	// messages of every producer come in order
+	std::vector<int> next (numProducers, 0);
+	int received = 0;
+	while (received < numProducers*numMsgs)
+	{
+		std::vector<std::shared_ptr<Msg> > msgs;
+		if (received & 1)
+		{
+			auto msg = queue.GetNextWithTimeout (1000);
+			if (msg) msgs.push_back (msg);
+		}
+		else
+			queue.GetBatchWithTimeout (msgs, 1000);
+		for (auto& it: msgs)
+		{
+			assert (it->seq == next[it->producer]);
+			next[it->producer]++;
+			received++;
+		}
+	}
+	for (auto& it: producers) it.join ();
+	assert (!queue.Get ());
+	assert (queue.IsEmpty ());
+	assert (!queue.Wait (0, 10));
+}
@@ -0,0 +1,96 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+#include <fstream>
+
+#include "NetDbStore.h"
+
+using namespace dotnet::data;
+
+const char path[] = "test-netdbstore.dat";
+const size_t numRecords = 1000, recordLen = 1500;
+
+static IdentHash CreateIdent (int i)
+{
+	uint8_t buf[32];
+	memset (buf, 0, 32);
+	memcpy (buf, &i, sizeof (i));
+	return IdentHash (buf);
+}
+
+static void Fill (uint8_t * buf, int i, int version)
+{
+	for (size_t j = 0; j < recordLen; j++) buf[j] = i + j + version;
+}
+
+int main ()
+{
+	remove (path);
+	uint8_t buf[recordLen], buf1[recordLen];
+	{
+		NetDbStore store (path);
+		assert (store.Open ());
+		for (size_t i = 0; i < numRecords; i++)
+		{
+			Fill (buf, i, 0);
+			store.Put (CreateIdent (i), buf, recordLen);
+		}
+		assert (store.Flush ());
+		store.Remove (CreateIdent (0));
+		Fill (buf, 1, 1);
+		store.Put (CreateIdent (1), buf, recordLen); // still pending
+		assert (store.Get (CreateIdent (1), buf1, recordLen) == recordLen);
+		assert (!memcmp (buf, buf1, recordLen));
+		assert (!store.Get (CreateIdent (0), buf1, recordLen));
+		assert (store.GetNumRecords () == numRecords - 1);
+	}
+	// reopen, latest records win
+	{
+		NetDbStore store (path);
+		assert (store.Open ());
+		assert (store.GetNumRecords () == numRecords - 1);
+		assert (!store.Get (CreateIdent (0), buf1, recordLen));
+		Fill (buf, 1, 1);
+		assert (store.Get (CreateIdent (1), buf1, recordLen) == recordLen);
+		assert (!memcmp (buf, buf1, recordLen));
+		size_t num = 0;
+		store.Visit ([&num](const IdentHash&, const uint8_t *, size_t) { num++; });
+		assert (num == numRecords - 1);
+		assert (!store.Compact ()); // not enough garbage
+		// overwrite all and compact
+		for (size_t i = 0; i < numRecords; i++)
+		{
+			Fill (buf, i, 2);
+			store.Put (CreateIdent (i), buf, recordLen);
+		}
+		assert (store.Flush ());
+		auto size = store.GetFileSize ();
+		assert (store.Compact ());
+		assert (store.GetFileSize () < size/2);
+		assert (store.GetGarbageSize () == 0);
+		assert (store.GetNumRecords () == numRecords);
+		Fill (buf, 5, 2);
+		assert (store.Get (CreateIdent (5), buf1, recordLen) == recordLen);
+		assert (!memcmp (buf, buf1, recordLen));
+	}
+	// torn record at the end is dropped
+	uint64_t size;
+	{
+		NetDbStore store (path);
+		assert (store.Open ());
+		size = store.GetFileSize ();
+	}
+	{
+		std::ofstream f (path, std::ofstream::binary | std::ofstream::app);
+		Fill (buf, 7, 3);
+		f.write ((const char *)buf, 100);
+	}
+	{
+		NetDbStore store (path);
+		assert (store.Open ());
+		assert (store.GetFileSize () == size);
+		assert (store.GetNumRecords () == numRecords);
+	}
+	remove (path);
+}
@@ -0,0 +1,75 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "Profiling.h"
+
+using namespace dotnet::data;
+
+namespace dotnet { namespace garlic { void CleanUpTagsFiles () {} } } // referenced by FS.cpp
+
+const char path[] = "test-profiling.dat";
+const size_t cacheSize = 16;
+
+static IdentHash CreateIdent (int i)
+{
+	uint8_t buf[32];
+	memset (buf, 0, 32);
+	memcpy (buf, &i, sizeof (i));
+	buf[31] = 1; // never zero
+	return IdentHash (buf);
+}
+
+static bool IsSame (const RouterProfile& p1, const RouterProfile& p2)
+{
+	uint8_t buf1[PEER_PROFILE_RECORD_SIZE - 32], buf2[PEER_PROFILE_RECORD_SIZE - 32];
+	p1.ToBuffer (buf1); p2.ToBuffer (buf2);
+	return !memcmp (buf1, buf2, sizeof (buf1));
+}
+
+int main ()
+{
+	remove (path);
+	RouterProfile expected;
+	{
+		ProfilesStorage storage (cacheSize);
+		assert (storage.Open (path));
+		// hit
+		auto held = storage.Get (CreateIdent (0));
+		assert (storage.Get (CreateIdent (0)) == held);
+		held->TunnelBuildResponse (0);
+		// saved and released
+		auto saved = storage.Get (CreateIdent (1));
+		saved->TunnelBuildResponse (0);
+		saved->TunnelBuildResponse (30);
+		storage.Put (CreateIdent (1), *saved);
+		uint8_t buf[PEER_PROFILE_RECORD_SIZE - 32];
+		saved->ToBuffer (buf);
+		expected.FromBuffer (buf);
+		saved = nullptr;
+		// evict both
+		for (size_t i = 2; i < 3*cacheSize; i++)
+			storage.Get (CreateIdent (i));
+		// still referenced, must be the same object
+		assert (storage.Get (CreateIdent (0)) == held);
+		// re-loaded from pending
+		auto reloaded = storage.Get (CreateIdent (1));
+		assert (IsSame (*reloaded, expected));
+		assert (storage.Flush ());
+		for (size_t i = 2; i < 3*cacheSize; i++)
+			storage.Get (CreateIdent (i));
+		// re-loaded from file
+		reloaded = storage.Get (CreateIdent (1));
+		assert (IsSame (*reloaded, expected));
+	}
+	// reopen
+	{
+		ProfilesStorage storage (cacheSize);
+		assert (storage.Open (path));
+		assert (IsSame (*storage.Get (CreateIdent (1)), expected));
+		assert (!IsSame (*storage.Get (CreateIdent (2)), expected));
+	}
+	remove (path);
+	return 0;
+}
@@ -0,0 +1,39 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <openssl/sha.h>
+
+#include "SHA256.h"
+#include "CPU.h"
+
+// compare every implementation available on this CPU with OpenSSL
+static void Check ()
+{
+	for (size_t len = 0; len <= 200; len++)
+		for (size_t num = 1; num <= 19; num += 3)
+		{
+			std::vector<uint8_t> in (len*num + 1), out (32*num);
+			for (size_t i = 0; i < in.size (); i++) in[i] = i*131 + len;
+			dotnet::crypto::SHA256Batch (in.data (), len, out.data (), num);
+			for (size_t i = 0; i < num; i++)
+			{
+				uint8_t digest[32];
+				SHA256 (in.data () + i*len, len, digest);
+				assert (!memcmp (out.data () + i*32, digest, 32));
+			}
+		}
+}
+
+int main ()
+{
+	dotnet::cpu::Detect ();
+	bool sha = dotnet::cpu::sha, avx2 = dotnet::cpu::avx2;
+	Check ();
+	dotnet::cpu::sha = false;
+	Check ();
+	dotnet::cpu::avx2 = false;
+	Check ();
+	dotnet::cpu::sha = sha; dotnet::cpu::avx2 = avx2;
+	return 0;
+}
@@ -2,7 +2,7 @@
 #include <inttypes.h>
 #include <string.h>
 
-#include "Ed25519.h"
+#include "Crypto.h"
 
 const uint8_t k[32] = 
 {
@@ -27,10 +27,10 @@ uint8_t p[32] =
 
 int main ()
 {
+    // through X25519Keys, so both OpenSSL and own ScalarMul (openssl < 1.1.0) are tested
     uint8_t buf[32];
-    BN_CTX * ctx = BN_CTX_new ();
-    dotnet::crypto::GetEd25519 ()->ScalarMul (u, k, buf, ctx);
-    BN_CTX_free (ctx);
+    dotnet::crypto::X25519Keys keys (k, u); // public key is not used by Agree
+    keys.Agree (u, buf);
     assert(memcmp (buf, p, 32) == 0);
 }
 